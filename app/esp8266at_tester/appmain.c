@@ -15,6 +15,10 @@
 
 #include "main.h"
 
+#if (ESP8266AT__ENABLE_CLI != 1)
+#error "esp8266at_tester needs ESP8266AT__ENABLE_CLI"
+#endif
+
 static void rootfunc(void *arg);
 
 static int clihookfunc(char *str, int len, void *arg);
@@ -104,6 +108,7 @@ static int clihookfunc(char *str, int len, void *arg)
             break;
         }
 
+#if (ESP8266AT__ENABLE_SNTP == 1)
         cmd = "rdate";
         cmdlen = strlen(cmd);
         if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
@@ -115,6 +120,7 @@ static int clihookfunc(char *str, int len, void *arg)
             r = 0;
             break;
         }
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
 
         cmd = "echo client ";
         cmdlen = strlen(cmd);
@@ -152,8 +158,10 @@ static void clihelphookfunc()
     printf("at reset                                        : Reset module\n");
     printf("at version                                      : Query version information\n");
     printf("at dns                                          : Query DNS configuration\n");
+#if (ESP8266AT__ENABLE_SNTP == 1)
     printf("at sntp                                         : Query SNTP configuration\n");
     printf("at time                                         : Query SNTP time\n");
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
     printf("\n");
     printf("at c echo <on|off>                              : Config echo\n");
     printf("at c wmode <mode>                               : Config WiFi mode\n");
@@ -172,6 +180,9 @@ static void clihelphookfunc()
     printf("        0 : disable\n");
     printf("        1 : enable\n");
     printf("    example: : at c dns 1 155.230.10.2 169.126.63.1\n");
+    printf("at c dnscache <enable> (<ttl_ms>)               : Connect to cached host addresses (AT+CIPDOMAIN)\n");
+    printf("    <ttl_ms> : lifetime of a cached address (Default: 300000)\n");
+#if (ESP8266AT__ENABLE_SNTP == 1)
     printf("at c sntp <enable> <tz> (<server>)              : Set SNTP configuration\n");
     printf("    <enalbe> : enable\n");
     printf("        0 : disable\n");
@@ -179,26 +190,44 @@ static void clihelphookfunc()
     printf("    <tz> : timezone (-12 to 14)\n");
     printf("    <server> : sntp server address\n");
     printf("    example: : at c sntp 1 9 time.google.com\n");
-#if (ESP8266AT__USE_WIZFI360_API == 1)
-    printf("at c mqtt <client_id> <username> <passwd>       : Set MQTT connection information\n");
-#else
-    printf("at c mqtt <mqtt_scheme> <client_id> <username> <passwd> : Set MQTT connection information\n");
-    printf("    <mqtt_scheme> :\n");
-    printf("        1 : MQTT over TCP\n");
-    // printf("        2 : MQTT over TLS (no certificate verify)\n");
-    // printf("        3 : MQTT over TLS (verify server certificate)\n");
-    // printf("        4 : MQTT over TLS (provide client certificate)\n");
-    // printf("        5 : MQTT over TLS (verify server certificate and provide client certificate)\n");
-    // printf("        6 : MQTT over WebSocket (based on TCP)\n");
-    // printf("        7 : MQTT over WebSocket Secure (based on TLS, no certificate verify)\n");
-    // printf("        8 : MQTT over WebSocket Secure (based on TLS, verify server certificate)\n");
-    // printf("        9 : MQTT over WebSocket Secure (based on TLS, provide client certificate)\n");
-    // printf("        10: MQTT over WebSocket Secure (based on TLS, verify server certificate and provide client certificate)\n");
-#endif /* (ESP8266AT__USE_WIZFI360_API == 1) */
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
+#if (ESP8266AT__ENABLE_MQTT == 1)
+    if (ESP8266AT_IS_WIZFI360(&_g_esp8266at))
+    {
+        printf("at c mqtt <client_id> <username> <passwd>       : Set MQTT connection information\n");
+    }
+    else
+    {
+        printf("at c mqtt <mqtt_scheme> <client_id> <username> <passwd> : Set MQTT connection information\n");
+        printf("    <mqtt_scheme> :\n");
+        printf("        1 : MQTT over TCP\n");
+        printf("        2 : MQTT over TLS (no certificate verify)\n");
+        printf("        3 : MQTT over TLS (verify server certificate)\n");
+        printf("        4 : MQTT over TLS (provide client certificate)\n");
+        printf("        5 : MQTT over TLS (verify server certificate and provide client certificate)\n");
+        printf("        6 : MQTT over WebSocket (based on TCP)\n");
+        printf("        7 : MQTT over WebSocket Secure (based on TLS, no certificate verify)\n");
+        printf("        8 : MQTT over WebSocket Secure (based on TLS, verify server certificate)\n");
+        printf("        9 : MQTT over WebSocket Secure (based on TLS, provide client certificate)\n");
+        printf("        10: MQTT over WebSocket Secure (based on TLS, verify server certificate and provide client certificate)\n");
+    }
+    printf("at c mqttconn <keepalive> <disable_clean_session> (<lwt_topic> <lwt_msg> <lwt_qos> <lwt_retain>)\n");
+    printf("                                                : Set MQTT keepalive, clean session and last will\n");
+    printf("    <keepalive> : keepalive time in seconds (0 to 7200)\n");
+    printf("    <disable_clean_session> :\n");
+    printf("        0 : Clean session\n");
+    printf("        1 : Keep session (not supported on WizFi360)\n");
+    printf("    example: : at c mqttconn 300 0 dev/1/status offline 1 1\n");
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
     printf("\n");
     printf("at ap join                                      : Join to an AP\n");
+    printf("at ap fjoin                                     : Join to an AP using the cached BSSID and IP (full join on failure)\n");
     printf("at ap quit                                      : Quit from the AP\n");
     printf("at ap ip                                        : Query local IP\n");
+    printf("at ap scan                                      : Scan APs\n");
+    printf("at ap scanopt <sort> <mask>                     : Config scan result (AT+CWLAPOPT)\n");
+    printf("    <sort> : 1 : sort by RSSI, 0 : no sort\n");
+    printf("    <mask> : fields to print in hex, bit 0 : ecn, 1 : ssid, 2 : rssi, 3 : mac, 4 : channel, ... (e.g. 1f)\n");
     printf("\n");
     printf("at conn open <type> <ip> <port>     : Open connection\n");
     printf("    <type> : type of transmission (Default: TCP)\n");
@@ -206,39 +235,105 @@ static void clihelphookfunc()
     printf("at conn close                                   : Close connection\n");
     printf("at conn send <data>                             : Send data\n");
     printf("at conn recv <len>                              : Receive data\n");
+    printf("at conn resolve <host>                          : Resolve a host name (cached)\n");
+#if (ESP8266AT__ENABLE_MQTT == 1)
     printf("\n");
-#if (ESP8266AT__USE_WIZFI360_API == 1)
-    printf("at mqtt topic <pub_topic> <sub_topic>( <sub_topic_2>( <sub_topic_3>))  : Set MQTT topics\n");
-    printf("    mqtt message must contain header (+MQTTSUBRECV:0,\"<topic>\",<data_len>,<data>)");
-    printf("at mqtt open <ip> <port>                        : Open MQTT connection\n");
-    printf("at mqtt close                                   : Close MQTT connection\n");
-    printf("at mqtt pub <data>                              : Publish MQTT messages\n");
-#else
-    printf("at mqtt open <ip> <port> <reconnect>            : Open MQTT connection\n");
-    printf("    <reconnect> :\n");
-    printf("        0 : MQTT will not reconnect automatically.\n");
-    printf("        1 : MQTT will reconnect automatically. It takes more resources.\n");
-    printf("at mqtt close                                   : Close MQTT connection\n");
-    printf("at mqtt pub <topic> <data> <qos> <retain>       : Publish MQTT messages in string to a defined topic.\n");
-    printf("    <qos> :\n");
-    printf("        0 : Up to once\n");
-    printf("        1 : At least once\n");
-    printf("        2 : Exactly once\n");
-    printf("    <retain> :\n");
-    printf("        0 : Not retained\n");
-    printf("        1 : Retained\n");
+    printf("at mqtt topic <pub_topic> <sub_topic>( <sub_topic_2>( <sub_topic_3>))  : Set MQTT topics (bound to sub id 0, 1, 2)\n");
+    printf("    mqtt message must contain header (+MQTTSUBRECV:0,\"<topic>\",<data_len>,<data>)\n");
+    if (ESP8266AT_IS_WIZFI360(&_g_esp8266at))
+    {
+        printf("at mqtt open <ip> <port>                        : Open MQTT connection\n");
+        printf("at mqtt close                                   : Close MQTT connection\n");
+        printf("at mqtt pub <data>                              : Publish MQTT messages\n");
+    }
+    else
+    {
+        printf("at mqtt open <ip> <port> <reconnect>            : Open MQTT connection\n");
+        printf("    <reconnect> :\n");
+        printf("        0 : MQTT will not reconnect automatically.\n");
+        printf("        1 : MQTT will reconnect automatically. It takes more resources.\n");
+        printf("at mqtt close                                   : Close MQTT connection\n");
+        printf("at mqtt pub <topic> <data> <qos> <retain>       : Publish MQTT messages in string to a defined topic.\n");
+        printf("    <qos> :\n");
+        printf("        0 : Up to once\n");
+        printf("        1 : At least once\n");
+        printf("        2 : Exactly once\n");
+        printf("    <retain> :\n");
+        printf("        0 : Not retained\n");
+        printf("        1 : Retained\n");
+        printf("at mqtt sublist                                 : List all MQTT topics that have been already subscribed\n");
+    }
     printf("at mqtt sub <id> <topic> <qos>                  : Subscribe to defined MQTT topics with defined QoS.\n");
     printf("    <qos> :\n");
     printf("        0 : Up to once\n");
     printf("        1 : At least once\n");
     printf("        2 : Exactly once\n");
     printf("at mqtt unsub <id>                              : Unsubscribe\n");
-    printf("at mqtt sublist                                 : List all MQTT topics that have been already subscribed\n");
-#endif /* (ESP8266AT__USE_WIZFI360_API == 1) */
     printf("at mqtt subget <id> <max_len>                   : Get subscribed data\n");
+    printf("at mqtt qcfg <policy>                           : Config and start offline publish queue\n");
+    printf("    <policy> : drop policy when the queue is full\n");
+    printf("        0 : Drop oldest\n");
+    printf("        1 : Drop newest\n");
+    printf("        2 : Drop lowest QoS\n");
+    printf("at mqtt qpub <topic> <data> <qos> <retain>      : Publish MQTT messages (queued while disconnected)\n");
+    printf("at mqtt qdrain                                  : Send queued MQTT messages\n");
+    printf("at mqtt qinfo                                   : Query offline publish queue\n");
+    printf("at mqtt stat( reset)                            : Query (or reset) MQTT publish statistics\n");
+    printf("at mqtt bench <topic> <size> <count> <qos> <rate> : Publish to and subscribe to <topic>, and measure rate, round-trip time and loss\n");
+    printf("    <rate> : messages per second, 0 : as fast as possible\n");
+    printf("    the last subscription slot is used, so it must not be subscribed\n");
+    if (ESP8266AT_IS_WIZFI360(&_g_esp8266at))
+    {
+        printf("    the publish topic set by at mqtt topic is replaced by <topic> during the run\n");
+    }
+    printf("    example: : at mqtt bench bench/1 64 500 1 20 (with resource/esp8266at/mqtt_broker.py)\n");
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+    printf("\n");
+    printf("at sv start                                     : Start connection supervisor (automatic recovery)\n");
+    printf("at sv stop                                      : Stop connection supervisor\n");
+    printf("at sv stat( reset)                              : Query (or reset) supervisor statistics\n");
+    printf("\n");
+    printf("at pwr sleep <state>                            : Set sleep mode (AT+SLEEP)\n");
+    printf("    <state> :\n");
+    printf("        0 : Active (sleep disabled)\n");
+    printf("        1 : Modem sleep\n");
+    printf("        2 : Light sleep\n");
+    printf("at pwr gslp <time>                              : Enter deep sleep (AT+GSLP), <time> in ms, 0 : until woken up\n");
+    printf("at pwr wake                                     : Wake up module and restore configuration\n");
+    printf("at pwr stat( reset)                             : Query (or reset) time spent in each power state\n");
+    printf("\n");
+    if (!ESP8266AT_IS_WIZFI360(&_g_esp8266at))
+    {
+        printf("at ssl sni <host>                               : Set TLS server name indication (AT+CIPSSLCSNI)\n");
+    }
+    else
+    {
+        printf("at ssl size <size>                              : Set TLS buffer size (AT+CIPSSLSIZE, 2048 to 4096)\n");
+    }
+    printf("at ssl conf <auth_mode> (<pki> <ca>)            : Set TLS certificate selection (AT+CIPSSLCCONF)\n");
+    printf("    <auth_mode> : bit 0 : provide client certificate, bit 1 : verify server certificate\n");
+    printf("at ssl open <host> <port>                       : Open TLS connection\n");
+    printf("at ssl stat                                     : Query TLS configuration and connect time\n");
+    printf("\n");
+    printf("at stats( reset)                                : Query (or reset) driver statistics (I/O counters, command latency)\n");
+#if (ESP8266AT__ENABLE_TRACE == 1)
+    printf("at trace( on| off| clear| dump)                 : Query, start, stop, clear or dump the uart trace\n");
+    printf("    dump is decoded by resource/esp8266at/trace_replay.py\n");
+#endif /* (ESP8266AT__ENABLE_TRACE == 1) */
+    printf("\n");
+    printf("at bench <mode> <ip> <port> <bytes> <chunk>     : Measure TCP throughput against resource/esp8266at/bench_server.py\n");
+    printf("    <mode> :\n");
+    printf("        tx   : Send <bytes> to the server\n");
+    printf("        rx   : Receive <bytes> from the server\n");
+    printf("        echo : Send <bytes> and receive them back, one <chunk> at a time\n");
+    printf("    example: : at bench tx 192.168.0.2 9011 102400 1024\n");
+    printf("at bench pecho <ip> <port> <count> <size> <window> : Measure echo round-trip time with up to <window> messages in flight\n");
+    printf("    example: : at bench pecho 192.168.0.2 9011 1000 32 4\n");
     printf("\n");
+#if (ESP8266AT__ENABLE_SNTP == 1)
     printf("rdate                                           : sync system time with NSTP time\n");
     printf("\n");
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
     printf("echo client <ssid> <passwd> <ip> <port> <count> : echo client test\n");
     printf("\n");
     printf("echo client2\n");
@@ -8,9 +8,35 @@ set(INCLUDE__ESP8266AT TRUE)
 set(PROJECT_UBINOS_LIBRARIES ${PROJECT_UBINOS_LIBRARIES} esp8266at)
 
 set_cache_default(ESP8266AT__LOGM_CATEGORY "SYS00" STRING "logm category of esp8266at")
+set_cache_default(ESP8266AT__CMD_LOG_LEVEL "DEBUG" STRING "Highest logm level of command path logs compiled in [NONE | ERROR | WARNING | INFO | DEBUG]")
+set_cache_default(ESP8266AT__ENABLE_DEFERRED_LOG FALSE BOOL "Record command path logs in a ring and format them in a lowest priority task")
 
 set_cache_default(ESP8266AT__USE_RESET_PIN FALSE BOOL "Use reset pin")
 set_cache_default(ESP8266AT__USE_CHIPSELECT_PIN TRUE BOOL "Use chip select pin")
 set_cache_default(ESP8266AT__USE_UART_HW_FLOW_CONTROL FALSE BOOL "Use uart hardware flow control")
 
-set_cache_default(ESP8266AT__USE_WIZFI360_API FALSE BOOL "Use WizFi360 API")
+set_cache_default(ESP8266AT__ENABLE_ISR_PROFILE FALSE BOOL "Measure uart rx interrupt handler time in cycles")
+set_cache_default(ESP8266AT__ENABLE_TRACE FALSE BOOL "Record uart traffic and driver events in a ring buffer")
+
+set_cache_default(ESP8266AT__ENABLE_MQTT TRUE BOOL "Include MQTT API, its receive buffers and publish queue")
+set_cache_default(ESP8266AT__ENABLE_SNTP TRUE BOOL "Include SNTP API")
+set_cache_default(ESP8266AT__ENABLE_CLI TRUE BOOL "Include esp8266at_cli shell commands")
+
+set_cache_default(ESP8266AT__IO_READ_BUF_SIZE "2048" STRING "Size of the AT response receive buffer (bytes)")
+set_cache_default(ESP8266AT__IO_WRITE_BUF_SIZE "2048" STRING "Size of the transmit buffer, also the largest AT+CIPSEND payload (bytes)")
+set_cache_default(ESP8266AT__IO_DATA_BUF_SIZE "256" STRING "Size of the +IPD data receive buffer (bytes)")
+set_cache_default(ESP8266AT__IO_MQTT_SUB_BUF_MAX "3" STRING "Number of MQTT subscriptions with a receive buffer [3 or more]")
+set_cache_default(ESP8266AT__IO_MQTT_SUB_BUF_MSG_MAX "5" STRING "Messages queued in each MQTT subscription receive buffer")
+set_cache_default(ESP8266AT__IO_MQTT_SUB_DATA_BUF_SIZE "1024" STRING "Size of each MQTT subscription receive buffer (bytes)")
+set_cache_default(ESP8266AT__TEMP_CMD_BUF_SIZE "256" STRING "Size of the AT command buffer (bytes)")
+set_cache_default(ESP8266AT__TEMP_RESP_BUF_SIZE "256" STRING "Size of the AT response line buffer (bytes)")
+
+set_cache_default(ESP8266AT__ENABLE_DIALECT_ESPAT TRUE BOOL "Include ESP-AT command dialect")
+set_cache_default(ESP8266AT__ENABLE_DIALECT_WIZFI360 TRUE BOOL "Include WizFi360 command dialect")
+
+# Deprecated: same as including only the WizFi360 dialect
+set_cache_default(ESP8266AT__USE_WIZFI360_API FALSE BOOL "Use WizFi360 API only (deprecated)")
+if(ESP8266AT__USE_WIZFI360_API)
+    set_cache(ESP8266AT__ENABLE_DIALECT_ESPAT FALSE BOOL)
+    set_cache(ESP8266AT__ENABLE_DIALECT_WIZFI360 TRUE BOOL)
+endif()
@@ -30,8 +30,29 @@ ubi_st_t esp8266at_deinit(esp8266at_t *esp8266at);
 
 ubi_st_t esp8266at_reset(esp8266at_t *esp8266at);
 
+ubi_st_t esp8266at_set_dialect(esp8266at_t *esp8266at, uint8_t dialect_id);
+
+ubi_st_t esp8266at_shadow_invalidate(esp8266at_t *esp8266at);
+
+ubi_st_t esp8266at_shadow_force(esp8266at_t *esp8266at, uint8_t force);
+
 ubi_st_t esp8266at_cmd_at_interactive(esp8266at_t *esp8266at);
 
+ubi_st_t esp8266at_cmd_at_stream(esp8266at_t *esp8266at, char *cmd, esp8266at_line_handler_t handler, void *arg, uint32_t timeoutms,
+        uint32_t *remain_timeoutms);
+
+ubi_st_t esp8266at_cmd_at_rst(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+ubi_st_t esp8266at_cmd_at_sleep(esp8266at_t *esp8266at, uint8_t power_state, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+ubi_st_t esp8266at_cmd_at_gslp(esp8266at_t *esp8266at, uint32_t sleep_timems, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+ubi_st_t esp8266at_power_wakeup(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+ubi_st_t esp8266at_power_stat_get(esp8266at_t *esp8266at, esp8266at_power_stat_t *stat);
+
+ubi_st_t esp8266at_power_stat_reset(esp8266at_t *esp8266at);
+
 ubi_st_t esp8266at_cmd_at_test(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
 ubi_st_t esp8266at_cmd_at_gmr(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms);
@@ -44,14 +65,30 @@ ubi_st_t esp8266at_cmd_at_cipmux(esp8266at_t *esp8266at, int mode, uint32_t time
 
 ubi_st_t esp8266at_cmd_at_cwjap(esp8266at_t *esp8266at, char * ssid, char * passwd, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
+ubi_st_t esp8266at_fastjoin(esp8266at_t *esp8266at, char *ssid, char *passwd, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
 ubi_st_t esp8266at_cmd_at_cwqap(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
+ubi_st_t esp8266at_cmd_at_cwlapopt(esp8266at_t *esp8266at, uint8_t sort_enable, uint32_t mask, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+ubi_st_t esp8266at_cmd_at_cwlap(esp8266at_t *esp8266at, esp8266at_ap_callback_t callback, void *arg, uint32_t *count, uint32_t timeoutms,
+        uint32_t *remain_timeoutms);
+
 ubi_st_t esp8266at_cmd_at_cifsr(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
 ubi_st_t esp8266at_cmd_at_cipstart(esp8266at_t *esp8266at, char *type, char *ip, uint32_t port, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
 ubi_st_t esp8266at_cmd_at_cipstart_multiple(esp8266at_t *esp8266at, int id, char *type, char *ip, uint32_t port, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
+ubi_st_t esp8266at_cmd_at_cipsslsize(esp8266at_t *esp8266at, uint32_t size, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+ubi_st_t esp8266at_cmd_at_cipsslcconf(esp8266at_t *esp8266at, uint8_t auth_mode, uint8_t pki_number, uint8_t ca_number, uint32_t timeoutms,
+        uint32_t *remain_timeoutms);
+
+ubi_st_t esp8266at_cmd_at_cipsslcsni(esp8266at_t *esp8266at, char *sni, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+ubi_st_t esp8266at_ssl_connect(esp8266at_t *esp8266at, char *host, uint32_t port, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
 ubi_st_t esp8266at_cmd_at_cipclose(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
 ubi_st_t esp8266at_cmd_at_cipsend(esp8266at_t *esp8266at, uint8_t *buffer, uint32_t length, uint32_t timeoutms, uint32_t *remain_timeoutms);
@@ -62,18 +99,36 @@ ubi_st_t esp8266at_cmd_at_cipdns(esp8266at_t *esp8266at, uint8_t enable, char *
 
 ubi_st_t esp8266at_cmd_at_cipdns_q(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
+ubi_st_t esp8266at_resolve(esp8266at_t *esp8266at, char *host, char *ip_addr, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+ubi_st_t esp8266at_dns_cache_config(esp8266at_t *esp8266at, uint8_t enable, uint32_t ttl_ms);
+
+ubi_st_t esp8266at_dns_cache_clear(esp8266at_t *esp8266at);
+
+uint32_t esp8266at_urc_process(esp8266at_t *esp8266at);
+
+#if (ESP8266AT__ENABLE_SNTP == 1)
 ubi_st_t esp8266at_cmd_at_cipsntpcfg(esp8266at_t *esp8266at, uint8_t enable, int8_t timezone, char * sntp_server_addr, char * sntp_server_addr2, char * sntp_server_addr3, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
 ubi_st_t esp8266at_cmd_at_cipsntpcfg_q(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
 ubi_st_t esp8266at_cmd_at_cipsntptime(esp8266at_t *esp8266at, struct tm * tm_ptr, uint32_t timeoutms, uint32_t *remain_timeoutms);
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
 
+#if (ESP8266AT__ENABLE_MQTT == 1)
 ubi_st_t esp8266at_cmd_at_mqttusercfg(esp8266at_t *esp8266at, uint8_t mqtt_scheme, char * mqtt_client_id, char * mqtt_username, char * mqtt_passwd, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
-#if (ESP8266AT__USE_WIZFI360_API == 1)
+ubi_st_t esp8266at_cmd_at_mqttconncfg(esp8266at_t *esp8266at, uint16_t keepalive, uint8_t disable_clean_session, char * lwt_topic, char * lwt_msg, uint8_t lwt_qos, uint8_t lwt_retain, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
 ubi_st_t esp8266at_cmd_at_mqtttopic(esp8266at_t *esp8266at, char *pub_topic, char *sub_topic, char *sub_topic_2, char *sub_topic_3, uint32_t timeoutms, uint32_t *remain_timeoutms);
-#else
-#endif /* (ESP8266AT__USE_WIZFI360_API == 1) */
+
+/*!
+ * 묶인 publish topic만 바꾸고, old_topic이 NULL이 아니면 이전 topic을 복사해 줍니다.
+ *
+ * 명령은 보내지 않습니다. WizFi360에서는 다음 AT+MQTTTOPIC (AT+MQTTSUB, AT+MQTTUNSUB 포함)부터 적용됩니다.
+ * old_topic은 ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX 크기여야 합니다.
+ */
+ubi_st_t esp8266at_mqtt_pub_topic_swap(esp8266at_t *esp8266at, char *topic, char *old_topic, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
 ubi_st_t esp8266at_cmd_at_mqttconn(esp8266at_t *esp8266at, char *ip, uint32_t port, uint32_t reconnect, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
@@ -85,12 +140,71 @@ ubi_st_t esp8266at_cmd_at_mqttpubraw(esp8266at_t *esp8266at, char *topic, char *
 
 ubi_st_t esp8266at_cmd_at_mqttsub(esp8266at_t *esp8266at, uint32_t id, char *topic, uint32_t qos, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
-ubi_st_t esp8266at_cmd_at_mqttsub_q(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms);
+ubi_st_t esp8266at_cmd_at_mqttsub_q(esp8266at_t *esp8266at, esp8266at_line_handler_t handler, void *arg, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
 ubi_st_t esp8266at_cmd_at_mqttunsub(esp8266at_t *esp8266at, uint32_t id, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
 ubi_st_t esp8266at_cmd_at_mqttsubget(esp8266at_t *esp8266at, uint32_t id, uint8_t *buffer, uint32_t max_length, uint32_t *received, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
+ubi_st_t esp8266at_mqtt_pubq_config(esp8266at_t *esp8266at, uint8_t drop_policy, esp8266at_mqtt_pubq_spill_t *spill);
+
+ubi_st_t esp8266at_mqtt_pubq_start(esp8266at_t *esp8266at);
+
+ubi_st_t esp8266at_mqtt_pubq_put(esp8266at_t *esp8266at, char *topic, char *data, uint32_t length, uint32_t qos, uint32_t retain);
+
+uint32_t esp8266at_mqtt_pubq_count(esp8266at_t *esp8266at);
+
+ubi_st_t esp8266at_mqtt_pubq_drain(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+ubi_st_t esp8266at_mqtt_pub(esp8266at_t *esp8266at, char *topic, char *data, uint32_t length, uint32_t qos, uint32_t retain, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+ubi_st_t esp8266at_mqtt_pub_stat_get(esp8266at_t *esp8266at, esp8266at_mqtt_pub_stat_t *stat);
+
+ubi_st_t esp8266at_mqtt_pub_stat_reset(esp8266at_t *esp8266at);
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+ubi_st_t esp8266at_supervisor_start(esp8266at_t *esp8266at);
+
+ubi_st_t esp8266at_supervisor_stop(esp8266at_t *esp8266at);
+
+ubi_st_t esp8266at_supervisor_stat_get(esp8266at_t *esp8266at, esp8266at_supervisor_stat_t *stat);
+
+ubi_st_t esp8266at_supervisor_stat_reset(esp8266at_t *esp8266at);
+
+ubi_st_t esp8266at_stat_get(esp8266at_t *esp8266at, esp8266at_stat_t *stat);
+
+ubi_st_t esp8266at_stat_reset(esp8266at_t *esp8266at);
+
+#if (ESP8266AT__ENABLE_DEFERRED_LOG == 1)
+/*!
+ * 기록해 둔 명령 처리 log를 출력합니다.
+ *
+ * esp8266at_init이 만든 가장 낮은 우선순위의 task가 주기적으로 호출합니다.
+ * ESP8266AT__CMD_LOG_LEVEL이 DEBUG보다 낮으면 기록할 log가 없으므로 task를 만들지 않고, 이 함수는 아무 일도 하지 않습니다.
+ */
+ubi_st_t esp8266at_log_defer_flush(esp8266at_t *esp8266at);
+#endif /* (ESP8266AT__ENABLE_DEFERRED_LOG == 1) */
+
+#if (ESP8266AT__ENABLE_TRACE == 1)
+/*!
+ * UART 송수신 byte와 driver event를 trace ring buffer에 기록할지 설정합니다.
+ *
+ * 버퍼가 가득 차면 가장 오래된 record부터 덮어씁니다.
+ */
+ubi_st_t esp8266at_trace_config(esp8266at_t *esp8266at, uint8_t enable);
+
+ubi_st_t esp8266at_trace_clear(esp8266at_t *esp8266at);
+
+ubi_st_t esp8266at_trace_info(esp8266at_t *esp8266at, uint8_t *enable, uint32_t *length, uint32_t *drop_count);
+
+/*!
+ * 가장 오래된 record부터 offset byte 이후의 trace 내용을 읽습니다.
+ *
+ * 각 record는 type, data 길이, 직전 record와의 시간 차 (ms, 16 bit little endian) 4 byte header와 data로 구성됩니다.
+ */
+ubi_st_t esp8266at_trace_read(esp8266at_t *esp8266at, uint32_t offset, uint8_t *buffer, uint32_t length, uint32_t *read);
+#endif /* (ESP8266AT__ENABLE_TRACE == 1) */
+
 #ifdef __cplusplus
 }
 #endif
@@ -24,27 +24,71 @@ extern "C"
 
 #include <stdint.h>
 
+#if (ESP8266AT__ENABLE_DIALECT_ESPAT != 1) && (ESP8266AT__ENABLE_DIALECT_WIZFI360 != 1)
+    #error "At least one of ESP8266AT__ENABLE_DIALECT_ESPAT and ESP8266AT__ENABLE_DIALECT_WIZFI360 must be enabled"
+#endif
+
 #define ESP8266AT_VERSION_LENGTH_MAX 15
 #define ESP8266AT_IP_ADDR_LENGTH_MAX 31
 #define ESP8266AT_MAC_ADDR_LENGTH_MAX 31
 
 #define ESP8266AT_SSID_LENGTH_MAX 64
 #define ESP8266AT_PASSWD_LENGTH_MAX 64
+#define ESP8266AT_BSSID_LENGTH_MAX 17
+
+#define ESP8266AT_HOST_LENGTH_MAX 128
+#define ESP8266AT_CONN_TYPE_LENGTH_MAX 7
 
 #define ESP8266AT_DNS_SERVER_ADDR_LENGTH_MAX 64
 #define ESP8266AT_DNS_SERVER_MAX 3
 
+#define ESP8266AT_DNS_CACHE_MAX 4
+#define ESP8266AT_DNS_CACHE_TTL_MS 300000 // default lifetime of a resolved address
+#define ESP8266AT_DNS_REFRESH_INTERVAL_MS 10000 // minimum interval of background refreshes
+#define ESP8266AT_DNS_RESOLVE_TIMEOUT_MS 5000
+
 #define ESP8266AT_SNTP_SERVER_ADDR_LENGTH_MAX 64
 #define ESP8266AT_SNTP_SERVER_MAX 3
 
 #define ESP8266AT_MQTT_CLIENT_ID_LENGTH_MAX 64
 #define ESP8266AT_MQTT_USERNAME_LENGTH_MAX 64
 #define ESP8266AT_MQTT_PASSWD_LENGTH_MAX 64
+#define ESP8266AT_MQTT_LWT_TOPIC_LENGTH_MAX 128
+#define ESP8266AT_MQTT_LWT_MSG_LENGTH_MAX 64
+
+#define ESP8266AT_MQTT_KEEPALIVE_DEFAULT 60
+#define ESP8266AT_MQTT_KEEPALIVE_MAX 7200
+
+#define ESP8266AT_TEMP_CMD_BUF_SIZE ESP8266AT__TEMP_CMD_BUF_SIZE
+#define ESP8266AT_TEMP_CMD_BUF_SIZE_MIN (ESP8266AT_HOST_LENGTH_MAX + 32) // AT+CIPSTART with the longest host
+#define ESP8266AT_TEMP_RESP_BUF_SIZE ESP8266AT__TEMP_RESP_BUF_SIZE
+#define ESP8266AT_TEMP_RESP_BUF_SIZE_MIN 128 // a +CWLAP line with the longest SSID
+
+#define ESP8266AT_RESTART_SETUP_TIME_MS 2000 // upper bound of waiting for the "ready" banner
+#define ESP8266AT_RESET_PULSE_TIME_MS 10
+#define ESP8266AT_READY_PROBE_TIMEOUT_MS 100
+#define ESP8266AT_READY_PROBE_SHARE 4 // 1/4 of a wait for the "ready" banner is kept for AT probes
+#define ESP8266AT_WAKEUP_TIMEOUT_MS 1000 // upper bound of waking up from light sleep
+
+#define ESP8266AT_FASTJOIN_TIMEOUT_MS 3000
 
-#define ESP8266AT_TEMP_CMD_BUF_SIZE 256
-#define ESP8266AT_TEMP_RESP_BUF_SIZE 256
+#define ESP8266AT_SSL_BUF_SIZE_MIN 2048
+#define ESP8266AT_SSL_BUF_SIZE_MAX 4096
 
-#define ESP8266AT_RESTART_SETUP_TIME_MS 2000
+#define ESP8266AT_SSL_AUTH__NONE 0x00
+#define ESP8266AT_SSL_AUTH__CLIENT_CERT 0x01 // provide the client certificate
+#define ESP8266AT_SSL_AUTH__SERVER_CA 0x02   // verify the server certificate
+
+#define ESP8266AT_CWLAP_KEY "+CWLAP:("
+
+#define ESP8266AT_CWLAP_FIELD__ECN 0x0001
+#define ESP8266AT_CWLAP_FIELD__SSID 0x0002
+#define ESP8266AT_CWLAP_FIELD__RSSI 0x0004
+#define ESP8266AT_CWLAP_FIELD__MAC 0x0008
+#define ESP8266AT_CWLAP_FIELD__CHANNEL 0x0010
+#define ESP8266AT_CWLAP_FIELD__ALL 0x07FF // module default
+#define ESP8266AT_CWLAP_FIELD__DEFAULT 0x001F // fields of esp8266at_ap_info_t
+#define ESP8266AT_CWLAP_FIELD_MAX 5 // the parsed fields among the leading bits
 
 #define ESP8266AT_IO_OPTION__TIMED 0x0001
 
@@ -53,20 +97,94 @@ extern "C"
 #define ESP8266AT_IO_DATA_LEN_MAX 65536
 
 #define ESP8266AT_IO_TEMP_RX_BUF_SIZE 1
-#define ESP8266AT_IO_DATA_LEN_BUF_SIZE 256
 
-#define ESP8266AT_IO_READ_BUF_SIZE 2048
-#define ESP8266AT_IO_WRITE_BUF_SIZE 2048
+#define ESP8266AT_IO_READ_BUF_SIZE ESP8266AT__IO_READ_BUF_SIZE
+#define ESP8266AT_IO_WRITE_BUF_SIZE ESP8266AT__IO_WRITE_BUF_SIZE // a command or a payload is written at once
 
-#define ESP8266AT_IO_DATA_BUF_SIZE 256
+#define ESP8266AT_IO_DATA_BUF_SIZE ESP8266AT__IO_DATA_BUF_SIZE
 
 #define ESP8266AT_IO_MQTT_KEY "+MQTTSUBRECV:0,"
 #define ESP8266AT_IO_MQTT_KEY_LEN 15
 
 #define ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX 128
-#define ESP8266AT_IO_MQTT_SUB_DATA_BUF_SIZE 1024
-#define ESP8266AT_IO_MQTT_SUB_BUF_MAX 3 // It must be greater or equal 3
-#define ESP8266AT_IO_MQTT_SUB_BUF_MSG_MAX 5
+#define ESP8266AT_IO_MQTT_SUB_DATA_BUF_SIZE ESP8266AT__IO_MQTT_SUB_DATA_BUF_SIZE
+#define ESP8266AT_IO_MQTT_SUB_BUF_MAX ESP8266AT__IO_MQTT_SUB_BUF_MAX // It must be greater or equal 3
+#define ESP8266AT_IO_MQTT_SUB_BUF_MSG_MAX ESP8266AT__IO_MQTT_SUB_BUF_MSG_MAX
+#define ESP8266AT_WIZFI360_MQTT_SUB_TOPIC_MAX 3 // AT+MQTTTOPIC accepts up to 3 subscribe topics
+
+#define ESP8266AT_IO_URC_KEY_MQTT_CONNECTED "+MQTTCONNECTED:"
+#define ESP8266AT_IO_URC_KEY_MQTT_DISCONNECTED "+MQTTDISCONNECTED:"
+#define ESP8266AT_IO_URC_KEY_READY "ready\r\n"
+#define ESP8266AT_IO_URC_KEY_WIFI_GOT_IP "WIFI GOT IP\r\n"
+#define ESP8266AT_IO_URC_KEY_WIFI_DISCONNECT "WIFI DISCONNECT\r\n"
+#define ESP8266AT_IO_URC_KEY_CLOSED "\nCLOSED\r\n" // at a line start, so "<link id>,CLOSED" of multiple connections does not match
+
+#define ESP8266AT_IO_URC__MQTT_CONNECTED 0x0001
+#define ESP8266AT_IO_URC__MQTT_DISCONNECTED 0x0002
+#define ESP8266AT_IO_URC__READY 0x0004
+#define ESP8266AT_IO_URC__WIFI_GOT_IP 0x0008
+#define ESP8266AT_IO_URC__WIFI_DISCONNECT 0x0010
+#define ESP8266AT_IO_URC__CLOSED 0x0020
+
+#define ESP8266AT_IO_RX_KEY_DATA 0
+#if (ESP8266AT__ENABLE_MQTT == 1)
+#define ESP8266AT_IO_RX_KEY_MQTT 1
+#define ESP8266AT_IO_RX_KEY_URC 2 // the URC keys follow in ESP8266AT_IO_URC__ bit order
+#else
+#define ESP8266AT_IO_RX_KEY_URC 1
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+#define ESP8266AT_IO_RX_KEY_MAX (ESP8266AT_IO_RX_KEY_URC + ESP8266AT_IO_URC_MAX)
+
+#define ESP8266AT_IO_URC_MAX 6
+
+#define ESP8266AT_MQTT_PUBQ_MSG_MAX 8
+#define ESP8266AT_MQTT_PUBQ_DATA_LENGTH_MAX 256
+#define ESP8266AT_MQTT_PUBQ_DRAIN_TIMEOUT_MS 10000
+
+#define ESP8266AT_MQTT_QOS_MAX 2
+#define ESP8266AT_MQTT_PUB_LATENCY_BIN_MAX 8 // upper bounds (ms) : 10, 20, 50, 100, 200, 500, 1000, inf
+
+#define ESP8266AT_STAT_LATENCY_BIN_MAX 9 // upper bounds (ms) : 10, 20, 50, 100, 200, 500, 1000, 5000, inf
+
+#define ESP8266AT_LOG_DEFER_MAX 16
+#define ESP8266AT_LOG_DEFER_STR_LEN 40 // longer strings are truncated
+#define ESP8266AT_LOG_DEFER_PERIOD_MS 100
+
+// Only debug level command logs are deferred, so below it there is no buffer and no flush task.
+#if (ESP8266AT__ENABLE_DEFERRED_LOG == 1) && (ESP8266AT__CMD_LOG_LEVEL >= LOGM_LEVEL__DEBUG)
+    #define ESP8266AT_LOG_DEFER 1
+#else
+    #define ESP8266AT_LOG_DEFER 0
+#endif
+
+#define ESP8266AT_TRACE_VERSION 1
+#define ESP8266AT_TRACE_BUF_SIZE 4096
+#define ESP8266AT_TRACE_REC_HEADER_LEN 4 // type, data length, time since the previous record (ms, 16 bit little endian, saturated)
+#define ESP8266AT_TRACE_REC_DATA_LEN_MAX 255
+
+#if (ESP8266AT_IO_READ_BUF_SIZE < 1) || (ESP8266AT_IO_DATA_BUF_SIZE < 1)
+    #error "ESP8266AT__IO_READ_BUF_SIZE and ESP8266AT__IO_DATA_BUF_SIZE must be greater than 0"
+#endif
+#if (ESP8266AT_TEMP_CMD_BUF_SIZE < ESP8266AT_TEMP_CMD_BUF_SIZE_MIN)
+    #error "ESP8266AT__TEMP_CMD_BUF_SIZE is too small for the longest host name"
+#endif
+#if (ESP8266AT_TEMP_RESP_BUF_SIZE < ESP8266AT_TEMP_RESP_BUF_SIZE_MIN)
+    #error "ESP8266AT__TEMP_RESP_BUF_SIZE is too small for a response line"
+#endif
+#if (ESP8266AT_IO_WRITE_BUF_SIZE < ESP8266AT_TEMP_CMD_BUF_SIZE)
+    #error "ESP8266AT__IO_WRITE_BUF_SIZE must hold a whole command (ESP8266AT__TEMP_CMD_BUF_SIZE)"
+#endif
+#if (ESP8266AT__ENABLE_MQTT == 1)
+#if (ESP8266AT_IO_MQTT_SUB_BUF_MAX < 3)
+    #error "ESP8266AT__IO_MQTT_SUB_BUF_MAX must be greater or equal 3"
+#endif
+#if (ESP8266AT_IO_MQTT_SUB_BUF_MSG_MAX < 1) || (ESP8266AT_IO_MQTT_SUB_DATA_BUF_SIZE < 1)
+    #error "ESP8266AT__IO_MQTT_SUB_BUF_MSG_MAX and ESP8266AT__IO_MQTT_SUB_DATA_BUF_SIZE must be greater than 0"
+#endif
+#if (ESP8266AT_IO_WRITE_BUF_SIZE < ESP8266AT_MQTT_PUBQ_DATA_LENGTH_MAX)
+    #error "ESP8266AT__IO_WRITE_BUF_SIZE must hold a whole queued MQTT message"
+#endif
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
 
 typedef enum
 {
@@ -74,19 +192,355 @@ typedef enum
     ESP8266AT_IO_RX_MODE_DATA_LEN,
     ESP8266AT_IO_RX_MODE_DATA,
     ESP8266AT_IO_RX_MODE_MQTT_TOPIC,
+    ESP8266AT_IO_RX_MODE_MAX,
 } esp8266at_io_rx_mode_t;
 
+#define ESP8266AT_DIALECT_DETECT_TIMEOUT_MS 3000
+
+typedef enum
+{
+    ESP8266AT_SHADOW_CWMODE = 0,
+    ESP8266AT_SHADOW_CIPMUX,
+    ESP8266AT_SHADOW_CIPDNS,
+    ESP8266AT_SHADOW_CIPSNTPCFG,
+    ESP8266AT_SHADOW_MQTTUSERCFG,
+    ESP8266AT_SHADOW_MQTTCONNCFG,
+    ESP8266AT_SHADOW_CIPSSLSIZE,
+    ESP8266AT_SHADOW_CIPSSLCCONF,
+    ESP8266AT_SHADOW_CIPSSLCSNI,
+    ESP8266AT_SHADOW_MAX,
+} esp8266at_shadow_id_t;
+
+#define ESP8266AT_SUPERVISOR_POLL_INTERVAL_MS 200
+#define ESP8266AT_SUPERVISOR_PROBE_INTERVAL_MIN_MS 1000
+#define ESP8266AT_SUPERVISOR_PROBE_INTERVAL_MAX_MS 30000
+#define ESP8266AT_SUPERVISOR_PROBE_TIMEOUT_MS 1000
+#define ESP8266AT_SUPERVISOR_PROBE_FAIL_MAX 3
+#define ESP8266AT_SUPERVISOR_BACKOFF_MIN_MS 1000
+#define ESP8266AT_SUPERVISOR_BACKOFF_MAX_MS 60000
+#define ESP8266AT_SUPERVISOR_RECOVERY_TIMEOUT_MS 30000
+
+typedef enum
+{
+    ESP8266AT_RECOVERY_NONE = 0,
+    ESP8266AT_RECOVERY_RECONNECT,   // reopen the TCP / MQTT connection
+    ESP8266AT_RECOVERY_REJOIN,      // join the AP again, then reconnect
+    ESP8266AT_RECOVERY_SOFT_RESET,  // AT+RST, replay the configuration, then rejoin
+    ESP8266AT_RECOVERY_HARD_RESET,  // reset pin, replay the configuration, then rejoin
+    ESP8266AT_RECOVERY_MAX,
+} esp8266at_recovery_level_t;
+
+typedef enum
+{
+    ESP8266AT_POWER_ACTIVE = 0,
+    ESP8266AT_POWER_MODEM_SLEEP,    // AT+SLEEP, RF off between DTIM beacons, UART stays available
+    ESP8266AT_POWER_LIGHT_SLEEP,    // AT+SLEEP, CPU paused too, woken by UART traffic
+    ESP8266AT_POWER_DEEP_SLEEP,     // AT+GSLP, woken by the reset (or chip select) pin, restarts the module
+    ESP8266AT_POWER_STATE_MAX,
+} esp8266at_power_state_t;
+
+/*!
+ * 전원 상태별 누적 시간과 깨우기 횟수
+ */
+typedef struct _esp8266at_power_stat_t
+{
+    uint32_t state_ms[ESP8266AT_POWER_STATE_MAX];
+    uint32_t wakeup_count;
+    uint32_t wakeup_fail_count;
+} esp8266at_power_stat_t;
+
+/*!
+ * 연결 감시 task의 통계
+ *
+ * 장애 발생(감지)부터 복구 완료까지의 시간을 복구 시간으로 집계합니다.
+ */
+typedef struct _esp8266at_supervisor_stat_t
+{
+    uint32_t probe_count;
+    uint32_t probe_fail_count;
+    uint32_t outage_count;
+    uint32_t recovered_count;
+    uint32_t attempt_count[ESP8266AT_RECOVERY_MAX];
+    uint32_t recovery_time_last_ms;
+    uint32_t recovery_time_max_ms;
+    uint32_t recovery_time_sum_ms;
+} esp8266at_supervisor_stat_t;
+
+/*!
+ * 빠른 재접속에 사용할 마지막 접속 정보
+ *
+ * deep sleep 동안 RAM이 유지되지 않으면 응용이 저장했다가 복원합니다.
+ * 주소는 접속하는 동안만 고정 주소로 쓰고, 접속 후에는 DHCP로 다시 받습니다.
+ */
+typedef struct _esp8266at_join_cache_t
+{
+    uint8_t valid;
+    char ssid[ESP8266AT_SSID_LENGTH_MAX];
+    char bssid[ESP8266AT_BSSID_LENGTH_MAX + 1];
+    uint8_t channel;
+    char ip_addr[ESP8266AT_IP_ADDR_LENGTH_MAX + 1];
+    char gateway[ESP8266AT_IP_ADDR_LENGTH_MAX + 1];
+    char netmask[ESP8266AT_IP_ADDR_LENGTH_MAX + 1];
+} esp8266at_join_cache_t;
+
+/*!
+ * 호스트 이름을 풀어 얻은 주소 하나
+ *
+ * host가 빈 문자열이면 사용하지 않는 항목입니다.
+ */
+typedef struct _esp8266at_dns_cache_t
+{
+    char host[ESP8266AT_HOST_LENGTH_MAX + 1];
+    char ip_addr[ESP8266AT_IP_ADDR_LENGTH_MAX + 1];
+    uint32_t resolve_tick; // when ip_addr was resolved, for TTL
+    uint32_t use_tick;     // last lookup, for LRU eviction
+} esp8266at_dns_cache_t;
+
+/*!
+ * AT+CWLAP 응답의 AP 하나
+ *
+ * 문자열은 응답 line 버퍼를 가리키므로 callback 안에서만 유효합니다.
+ * AT+CWLAPOPT로 뺀 항목은 0 또는 빈 문자열입니다.
+ */
+typedef struct _esp8266at_ap_info_t
+{
+    uint8_t ecn;
+    const char *ssid;
+    int8_t rssi;
+    const char *bssid;
+    uint8_t channel;
+} esp8266at_ap_info_t;
+
+typedef void (*esp8266at_ap_callback_t)(void *arg, const esp8266at_ap_info_t *ap_info);
+
+/*!
+ * 응답을 한 줄 받을 때마다 호출되는 함수
+ *
+ * line은 CRLF를 뗀 문자열이며 함수 안에서 고쳐 써도 됩니다. 최종 결과(OK, ERROR, FAIL)와 빈 줄은 전달하지 않습니다.
+ */
+typedef void (*esp8266at_line_handler_t)(void *arg, char *line);
+
+typedef struct _esp8266at_join_time_t
+{
+    uint8_t fast;      // 1 if the cached AP and lease were used
+    uint32_t fast_ms;  // static ip + directed join (0 if not tried)
+    uint32_t full_ms;  // dhcp + full join (0 if not needed)
+    uint32_t cache_ms; // query of bssid, channel and lease after a full join
+    uint32_t total_ms;
+} esp8266at_join_time_t;
+
+typedef enum
+{
+    ESP8266AT_DIALECT_ESPAT = 0,
+    ESP8266AT_DIALECT_WIZFI360,
+} esp8266at_dialect_id_t;
+
+/*!
+ * 펌웨어 계열별 AT 명령 이름과 응답 토큰
+ *
+ * 인자 구성이 다른 명령은 ESP8266AT_IS_WIZFI360으로 분기합니다.
+ */
+typedef struct _esp8266at_dialect_t
+{
+    uint8_t id;
+    const char *name;
+    const char *gmr_signature; // AT+GMR 응답에 이 문자열이 있으면 이 dialect를 선택
+    const char *cwjap;
+    const char *cwdhcp;
+    const char *cipsta;
+    const char *cipdns;
+    const char *cipdns_rsp_key;
+    const char *mqtt_clean_cmd;
+    const char *mqtt_clean_rsp;
+    uint32_t mqtt_clean_urc; // ESP8266AT_IO_URC__ flags that mqtt_clean_rsp looks like
+    const char *quote_escape; // 따옴표 인자에서 백슬래시로 escape 할 문자들
+    const char *mqtt_quote_escape; // AT+MQTT 명령의 따옴표 인자에서 백슬래시로 escape 할 문자들
+    uint8_t sleep_modem; // AT+SLEEP mode numbers
+    uint8_t sleep_light;
+    uint8_t ssl_size;    // 1 if AT+CIPSSLSIZE is supported
+    uint8_t ssl_pki;     // 1 if AT+CIPSSLCCONF takes PKI and CA indexes
+    uint8_t ssl_sni;     // 1 if AT+CIPSSLCSNI is supported
+} esp8266at_dialect_t;
+
 typedef uint32_t esp8266at_mqtt_sub_buf_msg_t;
 typedef struct _esp8266at_mqtt_sub_buf_t
 {
     char topic[ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX];
+    uint32_t qos;
     msgq_pt msgs;
     cbuf_pt data_buf;
     mutex_pt data_mutex;
 } esp8266at_mqtt_sub_buf_t;
 
+typedef enum
+{
+    ESP8266AT_MQTT_PUB_FAIL_TIMEOUT = 0,
+    ESP8266AT_MQTT_PUB_FAIL_ERROR,
+    ESP8266AT_MQTT_PUB_FAIL_IO,
+    ESP8266AT_MQTT_PUB_FAIL_OTHER,
+    ESP8266AT_MQTT_PUB_FAIL_REASON_MAX,
+} esp8266at_mqtt_pub_fail_reason_t;
+
+/*!
+ * MQTT publish 통계
+ *
+ * latency는 publish 명령을 보낸 때부터 명령이 끝난 응답("OK" 등)까지의 명령 왕복 시간입니다.
+ * QoS 1, 2의 PUBACK, PUBCOMP를 받기까지의 시간이 아니며, 명령은 한 번에 하나씩 보냅니다.
+ */
+typedef struct _esp8266at_mqtt_pub_stat_t
+{
+    uint32_t msg_count;
+    uint32_t msg_count_qos[ESP8266AT_MQTT_QOS_MAX + 1];
+    uint32_t byte_count;
+    uint32_t fail_count[ESP8266AT_MQTT_PUB_FAIL_REASON_MAX];
+    uint32_t latency_hist[ESP8266AT_MQTT_PUB_LATENCY_BIN_MAX];
+    uint32_t latency_min_ms;
+    uint32_t latency_max_ms;
+    uint32_t latency_sum_ms;
+    uint32_t begin_tick;
+    uint32_t elapsed_ms; // time since the last reset, filled by esp8266at_mqtt_pub_stat_get
+} esp8266at_mqtt_pub_stat_t;
+
+typedef enum
+{
+    ESP8266AT_RSP_END_NONE = 0, // no terminal token (I/O error or response buffer overflow)
+    ESP8266AT_RSP_END_OK,       // expected response
+    ESP8266AT_RSP_END_ERROR,    // "ERROR"
+    ESP8266AT_RSP_END_FAIL,     // "FAIL", "SEND FAIL"
+    ESP8266AT_RSP_END_TIMEOUT,
+} esp8266at_rsp_end_t;
+
+typedef enum
+{
+    ESP8266AT_STAT_BUF_READ = 0, // io_read_buf (AT responses)
+    ESP8266AT_STAT_BUF_DATA,     // io_data_buf (+IPD payload)
+    ESP8266AT_STAT_BUF_MQTT,     // mqtt_sub_bufs (+MQTTSUBRECV payload)
+    ESP8266AT_STAT_BUF_WRITE,    // io_write_buf
+    ESP8266AT_STAT_BUF_MAX,
+} esp8266at_stat_buf_t;
+
+typedef enum
+{
+    ESP8266AT_STAT_CMD_BASIC = 0, // AT, AT+RST, AT+GMR, AT+SLEEP, ...
+    ESP8266AT_STAT_CMD_WIFI,      // AT+CW...
+    ESP8266AT_STAT_CMD_IP,        // AT+CIP... except AT+CIPSEND
+    ESP8266AT_STAT_CMD_SEND,      // AT+CIPSEND
+    ESP8266AT_STAT_CMD_MQTT,      // AT+MQTT...
+    ESP8266AT_STAT_CMD_MAX,
+} esp8266at_stat_cmd_t;
+
+typedef struct _esp8266at_cmd_stat_t
+{
+    uint32_t count;
+    uint32_t ok_count;
+    uint32_t error_count;
+    uint32_t fail_count;
+    uint32_t timeout_count;
+    uint32_t other_count;
+    uint32_t latency_hist[ESP8266AT_STAT_LATENCY_BIN_MAX]; // send to terminal token (OK, ERROR or FAIL)
+    uint32_t latency_max_ms;
+    uint32_t latency_sum_ms;
+} esp8266at_cmd_stat_t;
+
+typedef enum
+{
+    ESP8266AT_LOG_WAIT_RSP_BEGIN = 0, // s0 : expected response
+    ESP8266AT_LOG_WAIT_RSP_END,       // a0 : status, a1 : size, s0 : response
+    ESP8266AT_LOG_SEND_CMD_BEGIN,     // s0 : command, s1 : expected response
+    ESP8266AT_LOG_SEND_CMD_END,       // a0 : status
+    ESP8266AT_LOG_READ_LINES_BEGIN,   // s0 : command
+    ESP8266AT_LOG_READ_LINES_END,     // a0 : status, a1 : lines
+    ESP8266AT_LOG_SHADOW_SKIP,        // s0 : command
+} esp8266at_log_event_t;
+
+typedef struct _esp8266at_log_rec_t
+{
+    uint32_t tick;
+    uint8_t event;
+    int32_t a0;
+    int32_t a1;
+    char s0[ESP8266AT_LOG_DEFER_STR_LEN + 1];
+    char s1[ESP8266AT_LOG_DEFER_STR_LEN + 1];
+} esp8266at_log_rec_t;
+
+typedef enum
+{
+    ESP8266AT_TRACE_RX = 1,    // bytes received from the module
+    ESP8266AT_TRACE_TX,        // bytes queued for the module
+    ESP8266AT_TRACE_CMD_BEGIN, // esp8266at_stat_cmd_t of the command
+    ESP8266AT_TRACE_CMD_END,   // esp8266at_rsp_end_t, ubi_st_t (int8)
+    ESP8266AT_TRACE_MODE,      // esp8266at_io_rx_mode_t entered
+    ESP8266AT_TRACE_OVERFLOW,  // esp8266at_io_rx_mode_t the received bytes were dropped in
+} esp8266at_trace_type_t;
+
+typedef struct _esp8266at_isr_stat_t
+{
+    uint32_t count;
+    uint32_t cycles_min;
+    uint32_t cycles_max;
+    uint64_t cycles_sum;
+} esp8266at_isr_stat_t;
+
+typedef struct _esp8266at_stat_t
+{
+    uint32_t rx_byte_count;
+    uint32_t rx_irq_count;
+    uint32_t tx_byte_count;
+    uint32_t tx_irq_count;
+    uint32_t ipd_frame_count;
+    uint32_t ipd_byte_count;
+    uint32_t mqtt_frame_count;
+    uint32_t mqtt_byte_count;
+    uint32_t mqtt_discard_count; // +MQTTSUBRECV frames without a matching subscription or with its queue full
+    uint32_t rx_desync_count; // frames abandoned for a malformed or too long length or topic
+    uint32_t drop_count[ESP8266AT_STAT_BUF_MAX]; // bytes lost because the buffer was full
+    uint32_t high_water[ESP8266AT_STAT_BUF_MAX]; // highest fill level (bytes)
+    esp8266at_cmd_stat_t cmd[ESP8266AT_STAT_CMD_MAX];
+    uint32_t uart_error_count; // overrun, framing and noise errors reported by the uart driver
+    esp8266at_isr_stat_t isr[ESP8266AT_IO_RX_MODE_MAX]; // rx interrupt handler time by the io_rx_mode it started in (ESP8266AT__ENABLE_ISR_PROFILE)
+    uint32_t isr_reentry_count; // rx interrupt handler entered while it was still running
+    uint32_t isr_cycles_per_us; // 0 if the profile is disabled, filled by esp8266at_stat_get
+    uint32_t begin_tick;
+    uint32_t elapsed_ms; // time since the last reset, filled by esp8266at_stat_get
+} esp8266at_stat_t;
+
+typedef enum
+{
+    ESP8266AT_MQTT_PUBQ_DROP_OLDEST = 0,
+    ESP8266AT_MQTT_PUBQ_DROP_NEWEST,
+    ESP8266AT_MQTT_PUBQ_DROP_LOWEST_QOS,
+} esp8266at_mqtt_pubq_drop_policy_t;
+
+typedef struct _esp8266at_mqtt_pubq_msg_t
+{
+    char topic[ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX];
+    uint8_t data[ESP8266AT_MQTT_PUBQ_DATA_LENGTH_MAX + 1];
+    uint32_t length;
+    uint8_t qos;
+    uint8_t retain;
+} esp8266at_mqtt_pubq_msg_t;
+
+/*!
+ * RAM 큐가 가득 찼을 때 밀려난 메시지를 저장할 외부 저장소 (예: flash) 연산
+ *
+ * push는 메시지를 저장하고, pop은 가장 오래된 메시지를 꺼냅니다.
+ * pop은 꺼낼 메시지가 없으면 UBI_ST_OK가 아닌 값을 반환해야 합니다.
+ */
+typedef struct _esp8266at_mqtt_pubq_spill_t
+{
+    ubi_st_t (*push)(void *arg, char *topic, uint8_t *data, uint32_t length, uint32_t qos, uint32_t retain);
+    ubi_st_t (*pop)(void *arg, esp8266at_mqtt_pubq_msg_t *msg);
+    void *arg;
+} esp8266at_mqtt_pubq_spill_t;
+
 typedef struct _esp8266at_t
 {
+    const esp8266at_dialect_t *dialect;
+
+    uint32_t shadow_applied; // bit (1 << esp8266at_shadow_id_t) is set if the setting was applied since the last reset
+    uint32_t shadow_hash[ESP8266AT_SHADOW_MAX]; // hash of the last applied command
+    uint8_t shadow_force;
+
     char version[ESP8266AT_VERSION_LENGTH_MAX + 1];
     char ip_addr[ESP8266AT_IP_ADDR_LENGTH_MAX + 1];
     char mac_addr[ESP8266AT_MAC_ADDR_LENGTH_MAX + 1];
@@ -94,10 +548,27 @@ typedef struct _esp8266at_t
     mutex_pt cmd_mutex;
 
     char temp_cmd_buf[ESP8266AT_TEMP_CMD_BUF_SIZE];
+    uint32_t temp_cmd_len;
+    uint8_t temp_cmd_overflow; // set when the command did not fit in temp_cmd_buf
     uint8_t temp_resp_buf[ESP8266AT_TEMP_RESP_BUF_SIZE];
+    uint8_t rsp_end; // esp8266at_rsp_end_t of the last response
 
     uint32_t rx_overflow_count;
     uint8_t tx_busy;
+    uint8_t io_isr_depth;
+
+    esp8266at_stat_t stat;
+
+#if (ESP8266AT__ENABLE_TRACE == 1)
+    uint8_t trace_enable;
+    uint8_t trace_buf[ESP8266AT_TRACE_BUF_SIZE]; // records, oldest first from trace_begin
+    uint32_t trace_begin;
+    uint32_t trace_len;
+    uint32_t trace_last; // index of the newest record, valid if trace_last_valid
+    uint8_t trace_last_valid;
+    uint32_t trace_last_tick;
+    uint32_t trace_drop_count; // records overwritten by newer ones
+#endif /* (ESP8266AT__ENABLE_TRACE == 1) */
 
     mutex_pt io_mutex;
     sem_pt io_read_sem;
@@ -106,13 +577,15 @@ typedef struct _esp8266at_t
     cbuf_pt io_write_buf;
 
     uint8_t io_temp_rx_buf[ESP8266AT_IO_TEMP_RX_BUF_SIZE];
-    uint8_t io_data_len_buf[ESP8266AT_IO_DATA_LEN_BUF_SIZE];
 
     int io_rx_mode;
-    uint32_t io_data_key_i;
+    uint32_t io_rx_key_active; // keys partly matched, a bit per ESP8266AT_IO_RX_KEY_
+    uint8_t io_rx_key_i[ESP8266AT_IO_RX_KEY_MAX]; // matched length of each key
     uint32_t io_data_len;
-    uint32_t io_data_len_i;
+    uint32_t io_data_len_i; // digits of the length field so far
     uint32_t io_data_read;
+    uint32_t io_data_written; // bytes of the current +MQTTSUBRECV message stored in its sub buf
+    uint8_t io_is_mqtt; // the current frame is a +MQTTSUBRECV message
 
     mutex_pt io_data_read_mutex;
     sem_pt io_data_read_sem;
@@ -123,30 +596,128 @@ typedef struct _esp8266at_t
     char ssid[ESP8266AT_SSID_LENGTH_MAX];
     char passwd[ESP8266AT_PASSWD_LENGTH_MAX];
 
+    esp8266at_join_cache_t join_cache;
+    esp8266at_join_time_t join_time;
+
+    uint32_t cwlap_mask; // fields the module prints in +CWLAP lines now
+    uint8_t cwlap_opt_sort; // AT+CWLAPOPT to replay after a restart
+    uint32_t cwlap_opt_mask;
+
+    uint8_t wifi_mode;
     uint8_t mux_mode;
 
+    uint8_t wifi_requested;
+    uint8_t wifi_connected;
+
+    uint8_t tcp_requested;
+    uint8_t tcp_connected;
+    char tcp_type[ESP8266AT_CONN_TYPE_LENGTH_MAX + 1];
+    char tcp_host[ESP8266AT_HOST_LENGTH_MAX + 1];
+    uint32_t tcp_port;
+
     uint8_t dns_enable;
     char dns_server_addr[ESP8266AT_DNS_SERVER_MAX][ESP8266AT_DNS_SERVER_ADDR_LENGTH_MAX];
 
+    uint16_t ssl_buf_size; // 0 : firmware default
+    uint8_t ssl_auth_mode;
+    uint8_t ssl_pki_number;
+    uint8_t ssl_ca_number;
+    char ssl_sni[ESP8266AT_HOST_LENGTH_MAX + 1];
+    uint32_t ssl_connect_count;
+    uint32_t ssl_connect_last_ms; // TCP connect and TLS handshake
+    uint32_t ssl_connect_max_ms;
+
+    uint8_t dns_cache_enable; // cipstart connects to the cached address of a host name
+    uint32_t dns_cache_ttl_ms;
+    uint32_t dns_refresh_tick;
+    esp8266at_dns_cache_t dns_cache[ESP8266AT_DNS_CACHE_MAX];
+
+#if (ESP8266AT__ENABLE_SNTP == 1)
     uint8_t sntp_enable;
     int8_t sntp_timezone;
     char sntp_server_addr[ESP8266AT_SNTP_SERVER_MAX][ESP8266AT_SNTP_SERVER_ADDR_LENGTH_MAX];
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
 
+    volatile uint32_t io_urc_flags;
+    volatile uint32_t io_urc_ignore; // URC flags that are the response of the running command
+    sem_pt io_urc_sem;
+
+#if (ESP8266AT__ENABLE_MQTT == 1)
     uint8_t mqtt_scheme;
     char mqtt_client_id[ESP8266AT_MQTT_CLIENT_ID_LENGTH_MAX];
     char mqtt_username[ESP8266AT_MQTT_USERNAME_LENGTH_MAX];
     char mqtt_passwd[ESP8266AT_MQTT_PASSWD_LENGTH_MAX];
 
+    uint16_t mqtt_keepalive;
+    uint8_t mqtt_disable_clean_session;
+    char mqtt_lwt_topic[ESP8266AT_MQTT_LWT_TOPIC_LENGTH_MAX + 1];
+    char mqtt_lwt_msg[ESP8266AT_MQTT_LWT_MSG_LENGTH_MAX + 1];
+    uint8_t mqtt_lwt_qos;
+    uint8_t mqtt_lwt_retain;
+
     esp8266at_mqtt_sub_buf_t mqtt_sub_bufs[ESP8266AT_IO_MQTT_SUB_BUF_MAX];
 
     uint8_t io_mqtt_topic_buf[ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX];
 
-    uint8_t io_is_mqtt;
     int32_t io_mqtt_sub_buf_id;
-    uint32_t io_mqtt_key_i;
     uint32_t io_mqtt_topic_i;
+
+    uint8_t mqtt_requested;
+    uint8_t mqtt_connected;
+    char mqtt_host[ESP8266AT_HOST_LENGTH_MAX + 1];
+    uint32_t mqtt_port;
+    uint32_t mqtt_reconnect;
+    char mqtt_pub_topic[ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX];
+    esp8266at_mqtt_pub_stat_t mqtt_pub_stat;
+
+    mutex_pt mqtt_pubq_mutex;
+    esp8266at_mqtt_pubq_msg_t mqtt_pubq_msgs[ESP8266AT_MQTT_PUBQ_MSG_MAX];
+    uint8_t mqtt_pubq_order[ESP8266AT_MQTT_PUBQ_MSG_MAX]; // [0, count) : queued slots (oldest first), [count, max) : free slots
+    uint32_t mqtt_pubq_count;
+    uint32_t mqtt_pubq_inflight;
+    uint32_t mqtt_pubq_spill_count;
+    uint32_t mqtt_pubq_drop_count;
+    uint8_t mqtt_pubq_drop_policy;
+    esp8266at_mqtt_pubq_spill_t mqtt_pubq_spill;
+    task_pt mqtt_pubq_task;
+    volatile uint8_t mqtt_pubq_cancel; // asks mqtt_pubq_task to return
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+    uint32_t last_rsp_tick; // tick of the last successful command
+
+    uint8_t power_state;
+    uint32_t power_state_tick;
+    esp8266at_power_stat_t power_stat;
+
+    task_pt supervisor_task;
+    volatile uint8_t supervisor_enable;
+    volatile uint8_t supervisor_busy; // a check or recovery is in progress
+    volatile uint8_t supervisor_cancel; // asks supervisor_task to return
+    uint8_t supervisor_level;
+    uint8_t supervisor_outage;
+    uint32_t supervisor_outage_tick;
+    uint32_t supervisor_backoff_ms;
+    uint32_t supervisor_probe_interval_ms;
+    uint32_t supervisor_probe_fail;
+    esp8266at_supervisor_stat_t supervisor_stat;
+
+#if (ESP8266AT_LOG_DEFER == 1)
+    esp8266at_log_rec_t log_defer[ESP8266AT_LOG_DEFER_MAX];
+    uint32_t log_defer_head; // oldest record
+    uint32_t log_defer_count;
+    uint32_t log_defer_drop_count; // records overwritten before they were formatted
+    task_pt log_defer_task;
+#endif /* (ESP8266AT_LOG_DEFER == 1) */
 } esp8266at_t;
 
+#if (ESP8266AT__ENABLE_DIALECT_ESPAT == 1) && (ESP8266AT__ENABLE_DIALECT_WIZFI360 == 1)
+    #define ESP8266AT_IS_WIZFI360(esp8266at) ((esp8266at)->dialect->id == ESP8266AT_DIALECT_WIZFI360)
+#elif (ESP8266AT__ENABLE_DIALECT_WIZFI360 == 1)
+    #define ESP8266AT_IS_WIZFI360(esp8266at) (1)
+#else
+    #define ESP8266AT_IS_WIZFI360(esp8266at) (0)
+#endif
+
 /* Deprecated */
 #define esp8266at_err_t ubi_st_t
 #define ESP8266AT_ERR_OK                UBI_ST_OK
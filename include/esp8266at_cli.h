@@ -22,6 +22,8 @@ extern "C"
 
 #include <esp8266at/esp8266at_type.h>
 
+#if (ESP8266AT__ENABLE_CLI == 1)
+
 int esp8266at_cli_at(esp8266at_t *esp8266at, char *str, int len, void *arg);
 
 void esp8266at_cli_at_interactive(esp8266at_t *esp8266at);
@@ -30,8 +32,10 @@ void esp8266at_cli_at_test(esp8266at_t *esp8266at);
 void esp8266at_cli_at_reset(esp8266at_t *esp8266at);
 void esp8266at_cli_at_query_version(esp8266at_t *esp8266at);
 void esp8266at_cli_at_query_dns(esp8266at_t *esp8266at);
+#if (ESP8266AT__ENABLE_SNTP == 1)
 void esp8266at_cli_at_query_sntpcfg(esp8266at_t *esp8266at);
 void esp8266at_cli_at_query_sntptime(esp8266at_t *esp8266at);
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
 
 int esp8266at_cli_at_config(esp8266at_t *esp8266at, char *str, int len, void *arg);
 int esp8266at_cli_at_config_echo(esp8266at_t *esp8266at, char *str, int len, void *arg);
@@ -39,11 +43,20 @@ int esp8266at_cli_at_config_wmode(esp8266at_t *esp8266at, char *str, int len, vo
 int esp8266at_cli_at_config_ipmux(esp8266at_t *esp8266at, char *str, int len, void *arg);
 int esp8266at_cli_at_config_ap(esp8266at_t *esp8266at, char *str, int len, void *arg);
 int esp8266at_cli_at_config_dns(esp8266at_t *esp8266at, char *str, int len, void *arg);
+int esp8266at_cli_at_config_dnscache(esp8266at_t *esp8266at, char *str, int len, void *arg);
+#if (ESP8266AT__ENABLE_SNTP == 1)
 int esp8266at_cli_at_config_sntpcfg(esp8266at_t *esp8266at, char *str, int len, void *arg);
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
+#if (ESP8266AT__ENABLE_MQTT == 1)
 int esp8266at_cli_at_config_mqttusercfg(esp8266at_t *esp8266at, char *str, int len, void *arg);
+int esp8266at_cli_at_config_mqttconncfg(esp8266at_t *esp8266at, char *str, int len, void *arg);
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
 
 int esp8266at_cli_at_ap(esp8266at_t *esp8266at, char *str, int len, void *arg);
 int esp8266at_cli_at_ap_join(esp8266at_t *esp8266at, char *str, int len, void *arg);
+int esp8266at_cli_at_ap_fastjoin(esp8266at_t *esp8266at, char *str, int len, void *arg);
+int esp8266at_cli_at_ap_scan(esp8266at_t *esp8266at, char *str, int len, void *arg);
+int esp8266at_cli_at_ap_scanopt(esp8266at_t *esp8266at, char *str, int len, void *arg);
 int esp8266at_cli_at_ap_quit(esp8266at_t *esp8266at, char *str, int len, void *arg);
 int esp8266at_cli_at_ap_query_ip(esp8266at_t *esp8266at, char *str, int len, void *arg);
 
@@ -52,12 +65,11 @@ int esp8266at_cli_at_conn_open(esp8266at_t *esp8266at, char *str, int len, void
 int esp8266at_cli_at_conn_close(esp8266at_t *esp8266at, char *str, int len, void *arg);
 int esp8266at_cli_at_conn_send(esp8266at_t *esp8266at, char *str, int len, void *arg);
 int esp8266at_cli_at_conn_recv(esp8266at_t *esp8266at, char *str, int len, void *arg);
+int esp8266at_cli_at_conn_resolve(esp8266at_t *esp8266at, char *str, int len, void *arg);
 
+#if (ESP8266AT__ENABLE_MQTT == 1)
 int esp8266at_cli_at_mqtt(esp8266at_t *esp8266at, char *str, int len, void *arg);
-#if (ESP8266AT__USE_WIZFI360_API == 1)
 int esp8266at_cli_at_mqtt_topic(esp8266at_t *esp8266at, char *str, int len, void *arg);
-#else
-#endif /* (ESP8266AT__USE_WIZFI360_API == 1) */
 int esp8266at_cli_at_mqtt_open(esp8266at_t *esp8266at, char *str, int len, void *arg);
 int esp8266at_cli_at_mqtt_close(esp8266at_t *esp8266at, char *str, int len, void *arg);
 int esp8266at_cli_at_mqtt_pub(esp8266at_t *esp8266at, char *str, int len, void *arg);
@@ -65,10 +77,37 @@ int esp8266at_cli_at_mqtt_sub(esp8266at_t *esp8266at, char *str, int len, void *
 int esp8266at_cli_at_mqtt_sublist(esp8266at_t *esp8266at, char *str, int len, void *arg);
 int esp8266at_cli_at_mqtt_unsub(esp8266at_t *esp8266at, char *str, int len, void *arg);
 int esp8266at_cli_at_mqtt_subget(esp8266at_t *esp8266at, char *str, int len, void *arg);
+int esp8266at_cli_at_mqtt_qcfg(esp8266at_t *esp8266at, char *str, int len, void *arg);
+int esp8266at_cli_at_mqtt_qpub(esp8266at_t *esp8266at, char *str, int len, void *arg);
+int esp8266at_cli_at_mqtt_qdrain(esp8266at_t *esp8266at, char *str, int len, void *arg);
+int esp8266at_cli_at_mqtt_qinfo(esp8266at_t *esp8266at, char *str, int len, void *arg);
+int esp8266at_cli_at_mqtt_stat(esp8266at_t *esp8266at, char *str, int len, void *arg);
+int esp8266at_cli_at_mqtt_bench(esp8266at_t *esp8266at, char *str, int len, void *arg);
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+int esp8266at_cli_at_sv(esp8266at_t *esp8266at, char *str, int len, void *arg);
+int esp8266at_cli_at_sv_stat(esp8266at_t *esp8266at, char *str, int len, void *arg);
+
+int esp8266at_cli_at_pwr(esp8266at_t *esp8266at, char *str, int len, void *arg);
+int esp8266at_cli_at_pwr_stat(esp8266at_t *esp8266at, char *str, int len, void *arg);
+
+int esp8266at_cli_at_ssl(esp8266at_t *esp8266at, char *str, int len, void *arg);
 
+int esp8266at_cli_at_stats(esp8266at_t *esp8266at, char *str, int len, void *arg);
+#if (ESP8266AT__ENABLE_TRACE == 1)
+int esp8266at_cli_at_trace(esp8266at_t *esp8266at, char *str, int len, void *arg);
+#endif /* (ESP8266AT__ENABLE_TRACE == 1) */
+
+int esp8266at_cli_at_bench(esp8266at_t *esp8266at, char *str, int len, void *arg);
+int esp8266at_cli_at_bench_pecho(esp8266at_t *esp8266at, char *str, int len, void *arg);
+
+#if (ESP8266AT__ENABLE_SNTP == 1)
 int esp8266at_cli_rdate(esp8266at_t *esp8266at, char *str, int len, void *arg);
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
 int esp8266at_cli_echo_client(esp8266at_t *esp8266at, char *str, int len, void *arg);
 
+#endif /* (ESP8266AT__ENABLE_CLI == 1) */
+
 #ifdef __cplusplus
 }
 #endif
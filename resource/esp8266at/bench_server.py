@@ -0,0 +1,92 @@
+#!/usr/bin/python
+
+#
+# Copyright (c) 2020 Sung Ho Park and CSOS
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+
+#
+# Sink/source for "at bench <mode> <ip> <port> <bytes> <chunk>".
+#
+# The device sends a header line "<mode> <bytes> <chunk>\n" and then
+#     tx   : sends <bytes>, which are counted and checked here
+#     rx   : receives <bytes>, sent from here in <chunk> pieces
+#     echo : sends <bytes>, which are echoed back
+#     pecho : sends <bytes> as sequence-numbered messages of <chunk> bytes, which are echoed back
+#
+# Payload byte n of a transfer is (n % 251). A pecho message starts with its
+# sequence number in 8 hex digits instead, so it is echoed without the check.
+#
+
+import socket
+import time
+
+SERVER_ADDR = ''
+SERVER_PORT = 9011
+DATA_SIZE_MAX = 4096
+PATTERN_MOD = 251
+
+def pattern(offset, length):
+    return bytearray([(offset + i) % PATTERN_MOD for i in range(length)])
+
+def read_header(conn):
+    header = b''
+    while not header.endswith(b'\n'):
+        data = conn.recv(1)
+        if not data:
+            return None
+        header += data
+    fields = header.decode('utf-8').split()
+    return fields[0], int(fields[1]), int(fields[2])
+
+def serve(conn):
+    header = read_header(conn)
+    if header is None:
+        return
+    mode, size, chunk = header
+    print("Header   : %s %d bytes, chunk %d" % (mode, size, chunk))
+
+    done = 0
+    mismatch = 0
+    begin = time.time()
+    while done < size:
+        if mode == 'rx':
+            length = min(chunk, size - done)
+            conn.sendall(pattern(done, length))
+            done += length
+            continue
+
+        data = bytearray(conn.recv(min(DATA_SIZE_MAX, size - done)))
+        if not data:
+            break
+        if mode != 'pecho':
+            expected = pattern(done, len(data))
+            mismatch += sum(1 for a, b in zip(data, expected) if a != b)
+        if mode in ('echo', 'pecho'):
+            conn.sendall(data)
+        done += len(data)
+    elapsed = max(time.time() - begin, 0.001)
+
+    print("Result   : %s %d / %d bytes in %.3f s, %.2f KB/s, %d mismatched bytes" %
+        (mode, done, size, elapsed, done / 1024.0 / elapsed, mismatch))
+
+sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+sock.bind((SERVER_ADDR, SERVER_PORT))
+sock.listen(1)
+
+try:
+    while True:
+        conn, addr = sock.accept()
+        print('Connected from %s:%d' % addr)
+        try:
+            serve(conn)
+        finally:
+            conn.close()
+
+except KeyboardInterrupt:
+    print("Exit!")
+finally:
+    sock.close()
+    del sock
@@ -0,0 +1,197 @@
+#!/usr/bin/python
+
+#
+# Copyright (c) 2020 Sung Ho Park and CSOS
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+
+#
+# Minimal MQTT 3.1.1 broker for "at mqtt bench".
+#
+# It accepts any client, keeps subscriptions in memory and forwards each
+# PUBLISH to the matching subscribers with QoS 0, 1 or 2. Retained messages,
+# sessions and wills are not supported.
+#
+
+import socket
+import struct
+import threading
+
+SERVER_ADDR = ''
+SERVER_PORT = 1883
+
+CONNECT = 1
+CONNACK = 2
+PUBLISH = 3
+PUBACK = 4
+PUBREC = 5
+PUBREL = 6
+PUBCOMP = 7
+SUBSCRIBE = 8
+SUBACK = 9
+UNSUBSCRIBE = 10
+UNSUBACK = 11
+PINGREQ = 12
+PINGRESP = 13
+DISCONNECT = 14
+
+clients = []
+clients_lock = threading.Lock()
+
+def topic_match(pattern, topic):
+    p = pattern.split('/')
+    t = topic.split('/')
+    for i, level in enumerate(p):
+        if level == '#':
+            return True
+        if i >= len(t) or (level != '+' and level != t[i]):
+            return False
+    return len(p) == len(t)
+
+def encode_string(s):
+    return struct.pack('!H', len(s)) + s
+
+def decode_string(data, pos):
+    length = struct.unpack('!H', data[pos:pos + 2])[0]
+    return data[pos + 2:pos + 2 + length], pos + 2 + length
+
+class Client:
+    def __init__(self, conn, addr):
+        self.conn = conn
+        self.addr = addr
+        self.subs = {}
+        self.next_id = 1
+        self.lock = threading.Lock()
+        self.pub_count = 0
+        self.fwd_count = 0
+
+    def send(self, ptype, flags, body):
+        length = len(body)
+        header = bytearray([(ptype << 4) | flags])
+        while True:
+            byte = length % 128
+            length //= 128
+            header.append(byte | (0x80 if length > 0 else 0))
+            if length == 0:
+                break
+        with self.lock:
+            self.conn.sendall(bytes(header) + body)
+
+    def recv_exact(self, size):
+        data = b''
+        while len(data) < size:
+            chunk = self.conn.recv(size - len(data))
+            if not chunk:
+                raise EOFError()
+            data += chunk
+        return data
+
+    def recv_packet(self):
+        first = bytearray(self.recv_exact(1))[0]
+        length = 0
+        shift = 0
+        while True:
+            byte = bytearray(self.recv_exact(1))[0]
+            length += (byte & 0x7f) << shift
+            shift += 7
+            if (byte & 0x80) == 0:
+                break
+        return first >> 4, first & 0x0f, self.recv_exact(length)
+
+    def forward(self, topic, payload, qos):
+        body = encode_string(topic)
+        if qos > 0:
+            body += struct.pack('!H', self.next_id)
+            self.next_id = (self.next_id % 0xffff) + 1
+        self.send(PUBLISH, qos << 1, body + payload)
+        self.fwd_count += 1
+
+    def publish(self, flags, body):
+        qos = (flags >> 1) & 0x03
+        topic, pos = decode_string(body, 0)
+        if qos > 0:
+            packet_id = body[pos:pos + 2]
+            pos += 2
+        payload = body[pos:]
+        self.pub_count += 1
+
+        if qos == 1:
+            self.send(PUBACK, 0, packet_id)
+        elif qos == 2:
+            self.send(PUBREC, 0, packet_id)
+
+        with clients_lock:
+            targets = list(clients)
+        for client in targets:
+            for pattern, sub_qos in list(client.subs.items()):
+                if topic_match(pattern.decode('utf-8'), topic.decode('utf-8')):
+                    client.forward(topic, payload, min(qos, sub_qos))
+                    break
+
+    def run(self):
+        while True:
+            ptype, flags, body = self.recv_packet()
+            if ptype == CONNECT:
+                self.send(CONNACK, 0, b'\x00\x00')
+            elif ptype == PUBLISH:
+                self.publish(flags, body)
+            elif ptype == PUBREL:
+                self.send(PUBCOMP, 0, body[0:2])
+            elif ptype == PUBREC:
+                self.send(PUBREL, 0x02, body[0:2])
+            elif ptype == SUBSCRIBE:
+                pos = 2
+                granted = bytearray()
+                while pos < len(body):
+                    pattern, pos = decode_string(body, pos)
+                    qos = min(bytearray(body[pos:pos + 1])[0], 2)
+                    pos += 1
+                    self.subs[pattern] = qos
+                    granted.append(qos)
+                    print("Subscribe: %s:%d %s qos %d" % (self.addr[0], self.addr[1], pattern.decode('utf-8'), qos))
+                self.send(SUBACK, 0, body[0:2] + bytes(granted))
+            elif ptype == UNSUBSCRIBE:
+                pos = 2
+                while pos < len(body):
+                    pattern, pos = decode_string(body, pos)
+                    self.subs.pop(pattern, None)
+                self.send(UNSUBACK, 0, body[0:2])
+            elif ptype == PINGREQ:
+                self.send(PINGRESP, 0, b'')
+            elif ptype == DISCONNECT:
+                break
+            # PUBACK and PUBCOMP from the subscriber need no reply
+
+def serve(conn, addr):
+    client = Client(conn, addr)
+    with clients_lock:
+        clients.append(client)
+    print('Connected from %s:%d' % addr)
+    try:
+        client.run()
+    except (EOFError, socket.error):
+        pass
+    finally:
+        with clients_lock:
+            clients.remove(client)
+        conn.close()
+        print('Closed   : %s:%d, %d published, %d forwarded' % (addr[0], addr[1], client.pub_count, client.fwd_count))
+
+sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+sock.bind((SERVER_ADDR, SERVER_PORT))
+sock.listen(5)
+
+try:
+    while True:
+        conn, addr = sock.accept()
+        thread = threading.Thread(target=serve, args=(conn, addr))
+        thread.daemon = True
+        thread.start()
+
+except KeyboardInterrupt:
+    print("Exit!")
+finally:
+    sock.close()
+    del sock
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2020 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Throughput of esp8266at_io_rx_process on the host.
+ *
+ *     rx_bench [-r <repeat>] [-c <chunk>] [<rx.bin>]
+ *
+ * <rx.bin> is a received byte stream, such as one saved by
+ * "trace_replay.py rx". Without it a synthetic stream of +IPD frames,
+ * +MQTTSUBRECV messages and response lines is used, and the frame and byte
+ * counts are checked against what was generated.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rx_host.h"
+
+#define RX_BENCH_STREAM_MAX (1024 * 1024)
+#define RX_BENCH_IPD_LEN 1460
+#define RX_BENCH_MQTT_LEN 64
+
+static esp8266at_t _esp8266at;
+static uint8_t _stream[RX_BENCH_STREAM_MAX];
+
+typedef struct _rx_bench_expect_t
+{
+    uint32_t ipd_frames;
+    uint64_t ipd_bytes;
+    uint32_t mqtt_frames;
+    uint64_t mqtt_bytes;
+} rx_bench_expect_t;
+
+static size_t _append(size_t size, const void *data, size_t len)
+{
+    memcpy(&_stream[size], data, len);
+    return size + len;
+}
+
+static size_t _synthesize(rx_bench_expect_t *expect)
+{
+    char header[64];
+    size_t size = 0;
+    uint32_t n = 0;
+    int len;
+
+    memset(expect, 0, sizeof(rx_bench_expect_t));
+
+    while (size + RX_BENCH_IPD_LEN + 256 < RX_BENCH_STREAM_MAX)
+    {
+        // Mostly socket data as in a download, with a message and a response line in between.
+        len = snprintf(header, sizeof(header), "\r\n+IPD,%d:", RX_BENCH_IPD_LEN);
+        size = _append(size, header, len);
+        for (int i = 0; i < RX_BENCH_IPD_LEN; i++)
+        {
+            _stream[size++] = (uint8_t) ((n + i) % 251);
+        }
+        expect->ipd_frames++;
+        expect->ipd_bytes += RX_BENCH_IPD_LEN;
+
+        if (n % 4 == 0)
+        {
+            len = snprintf(header, sizeof(header), "+MQTTSUBRECV:0,\"t/%d\",%d,", 1 + (n / 4) % 2, RX_BENCH_MQTT_LEN);
+            size = _append(size, header, len);
+            memset(&_stream[size], 'm', RX_BENCH_MQTT_LEN);
+            size += RX_BENCH_MQTT_LEN;
+            size = _append(size, "\r\n", 2);
+            expect->mqtt_frames++;
+            expect->mqtt_bytes += RX_BENCH_MQTT_LEN;
+        }
+        if (n % 8 == 0)
+        {
+            size = _append(size, "\r\nRecv 1460 bytes\r\n\r\nSEND OK\r\n", 30);
+        }
+        n++;
+    }
+
+    return size;
+}
+
+static double _now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    rx_bench_expect_t expect;
+    rx_host_count_t count;
+    const char *path = NULL;
+    long repeat = 20;
+    uint32_t chunk = 64;
+    size_t size;
+    uint32_t len;
+    double begin, elapsed;
+    FILE *file;
+    int ok = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+        {
+            repeat = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            chunk = (uint32_t) atol(argv[++i]);
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+    if (chunk == 0 || repeat <= 0)
+    {
+        fprintf(stderr, "usage: rx_bench [-r <repeat>] [-c <chunk>] [<rx.bin>]\n");
+        return 1;
+    }
+
+    if (path != NULL)
+    {
+        file = fopen(path, "rb");
+        if (file == NULL)
+        {
+            fprintf(stderr, "can't open %s\n", path);
+            return 1;
+        }
+        size = fread(_stream, 1, RX_BENCH_STREAM_MAX, file);
+        fclose(file);
+    }
+    else
+    {
+        size = _synthesize(&expect);
+    }
+
+    rx_host_init(&_esp8266at);
+    memset(&count, 0, sizeof(count));
+
+    begin = _now();
+    for (long r = 0; r < repeat; r++)
+    {
+        rx_host_reset(&_esp8266at);
+        for (size_t pos = 0; pos < size; pos += len)
+        {
+            len = size - pos < chunk ? (uint32_t) (size - pos) : chunk;
+            esp8266at_io_rx_process(&_esp8266at, &_stream[pos], len);
+            rx_host_drain(&_esp8266at, &count);
+        }
+    }
+    elapsed = _now() - begin;
+
+    printf("%lu bytes x %ld in %.3f s, %.2f MB/s, %.2f ns/byte, chunk %lu\n",
+            (unsigned long) size, repeat, elapsed, size * repeat / elapsed / 1e6, elapsed * 1e9 / (size * repeat), (unsigned long) chunk);
+    printf("ipd %lu frames %lu bytes, mqtt %lu frames %lu bytes, desync %lu, overflow %lu\n",
+            (unsigned long) _esp8266at.stat.ipd_frame_count, (unsigned long) _esp8266at.stat.ipd_byte_count,
+            (unsigned long) _esp8266at.stat.mqtt_frame_count, (unsigned long) _esp8266at.stat.mqtt_byte_count,
+            (unsigned long) _esp8266at.stat.rx_desync_count, (unsigned long) _esp8266at.rx_overflow_count);
+
+    if (path == NULL)
+    {
+        if (_esp8266at.stat.ipd_frame_count != expect.ipd_frames || count.data_bytes != expect.ipd_bytes * repeat
+                || _esp8266at.stat.mqtt_frame_count != expect.mqtt_frames || count.mqtt_bytes != expect.mqtt_bytes * repeat
+                || count.mqtt_msgs != expect.mqtt_frames * (uint64_t) repeat || _esp8266at.stat.rx_desync_count != 0)
+        {
+            ok = 0;
+        }
+        printf("check %s\n", ok ? "ok" : "failed");
+    }
+
+    return ok ? 0 : 1;
+}
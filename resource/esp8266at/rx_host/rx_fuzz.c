@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2020 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Fuzz target for esp8266at_io_rx_process.
+ *
+ * The first input byte picks how the rest is cut into chunks, as the UART
+ * driver would hand them over, and the state is checked after each chunk.
+ *
+ * With RX_FUZZ_MAIN it builds without libFuzzer:
+ *     rx_fuzz <file>...        : runs each file, as AFL does with "rx_fuzz @@"
+ *     rx_fuzz -n <count> <dir> : runs random mutations of the files in <dir>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rx_host.h"
+
+static esp8266at_t _esp8266at;
+static int _initialized = 0;
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    rx_host_count_t count;
+    uint8_t chunk[256];
+    uint32_t chunk_max;
+    size_t pos;
+    uint32_t len;
+
+    if (!_initialized)
+    {
+        rx_host_init(&_esp8266at);
+        _initialized = 1;
+    }
+    rx_host_reset(&_esp8266at);
+    memset(&count, 0, sizeof(count));
+
+    if (size == 0)
+    {
+        return 0;
+    }
+    chunk_max = (data[0] % sizeof(chunk)) + 1;
+
+    for (pos = 1; pos < size; pos += len)
+    {
+        len = size - pos < chunk_max ? size - pos : chunk_max;
+        memcpy(chunk, &data[pos], len);
+        esp8266at_io_rx_process(&_esp8266at, chunk, len);
+        rx_host_check(&_esp8266at);
+
+        // Let the buffers fill up now and then, so the overflow paths run too.
+        if ((pos / chunk_max) % 4 != 3)
+        {
+            rx_host_drain(&_esp8266at, &count);
+        }
+    }
+    rx_host_drain(&_esp8266at, &count);
+
+    return 0;
+}
+
+#if defined(RX_FUZZ_MAIN)
+
+#include <dirent.h>
+
+#define RX_FUZZ_INPUT_MAX (64 * 1024)
+#define RX_FUZZ_SEED_MAX 256
+
+static uint8_t *_read_file(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    uint8_t *data;
+
+    if (file == NULL)
+    {
+        return NULL;
+    }
+    data = malloc(RX_FUZZ_INPUT_MAX);
+    *size = fread(data, 1, RX_FUZZ_INPUT_MAX, file);
+    fclose(file);
+
+    return data;
+}
+
+static size_t _mutate(uint8_t *data, size_t size, size_t max)
+{
+    static const char *tokens[] = { "+IPD,", "+MQTTSUBRECV:", "\"t/1\"", ",", ":", "\r\n", "OK\r\n", "9999", "0", "ready\r\n", "CLOSED\r\n" };
+    int count = 1 + rand() % 8;
+
+    for (int i = 0; i < count; i++)
+    {
+        size_t pos = size > 0 ? (size_t) rand() % size : 0;
+        const char *token;
+        size_t len;
+
+        switch (rand() % 5)
+        {
+        case 0:
+            if (size > 0)
+            {
+                data[pos] = (uint8_t) rand();
+            }
+            break;
+        case 1:
+            if (size > 0)
+            {
+                data[pos] ^= (uint8_t) (1 << (rand() % 8));
+            }
+            break;
+        case 2:
+            if (size > 1)
+            {
+                len = 1 + (size_t) rand() % (size - pos);
+                memmove(&data[pos], &data[pos + len], size - pos - len);
+                size -= len;
+            }
+            break;
+        default:
+            token = tokens[rand() % (sizeof(tokens) / sizeof(tokens[0]))];
+            len = strlen(token);
+            if (size + len <= max)
+            {
+                memmove(&data[pos + len], &data[pos], size - pos);
+                memcpy(&data[pos], token, len);
+                size += len;
+            }
+            break;
+        }
+    }
+
+    return size;
+}
+
+static int _mutate_dir(long iterations, const char *path)
+{
+    static uint8_t *seeds[RX_FUZZ_SEED_MAX];
+    static size_t seed_sizes[RX_FUZZ_SEED_MAX];
+    int seed_count = 0;
+    uint8_t *data = malloc(RX_FUZZ_INPUT_MAX);
+    char file_path[1024];
+    struct dirent *entry;
+    DIR *dir;
+
+    dir = opendir(path);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "can't open %s\n", path);
+        return 1;
+    }
+    while ((entry = readdir(dir)) != NULL && seed_count < RX_FUZZ_SEED_MAX)
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, entry->d_name);
+        seeds[seed_count] = _read_file(file_path, &seed_sizes[seed_count]);
+        if (seeds[seed_count] != NULL)
+        {
+            seed_count++;
+        }
+    }
+    closedir(dir);
+
+    if (seed_count == 0)
+    {
+        fprintf(stderr, "no seed in %s\n", path);
+        return 1;
+    }
+
+    srand(1);
+    for (long i = 0; i < iterations; i++)
+    {
+        int seed = rand() % seed_count;
+        size_t size = seed_sizes[seed];
+
+        memcpy(data, seeds[seed], size);
+        size = _mutate(data, size, RX_FUZZ_INPUT_MAX);
+        LLVMFuzzerTestOneInput(data, size);
+    }
+
+    printf("%ld inputs from %d seeds, %lu desyncs in the last input\n", iterations, seed_count, (unsigned long) _esp8266at.stat.rx_desync_count);
+    free(data);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint8_t *data;
+    size_t size;
+
+    if (argc == 4 && strcmp(argv[1], "-n") == 0)
+    {
+        return _mutate_dir(atol(argv[2]), argv[3]);
+    }
+
+    if (argc < 2)
+    {
+        data = malloc(RX_FUZZ_INPUT_MAX);
+        size = fread(data, 1, RX_FUZZ_INPUT_MAX, stdin);
+        LLVMFuzzerTestOneInput(data, size);
+        free(data);
+        return 0;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        data = _read_file(argv[i], &size);
+        if (data == NULL)
+        {
+            fprintf(stderr, "can't open %s\n", argv[i]);
+            return 1;
+        }
+        LLVMFuzzerTestOneInput(data, size);
+        free(data);
+    }
+
+    return 0;
+}
+
+#endif /* defined(RX_FUZZ_MAIN) */
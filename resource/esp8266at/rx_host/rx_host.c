@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2020 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rx_host.h"
+
+static const char *_keys[ESP8266AT_IO_RX_KEY_MAX] = {
+    ESP8266AT_IO_DATA_KEY,
+    ESP8266AT_IO_MQTT_KEY,
+    ESP8266AT_IO_URC_KEY_MQTT_CONNECTED,
+    ESP8266AT_IO_URC_KEY_MQTT_DISCONNECTED,
+    ESP8266AT_IO_URC_KEY_READY,
+    ESP8266AT_IO_URC_KEY_WIFI_GOT_IP,
+    ESP8266AT_IO_URC_KEY_WIFI_DISCONNECT,
+    ESP8266AT_IO_URC_KEY_CLOSED,
+};
+
+static uint8_t _drain_buf[ESP8266AT_IO_MQTT_SUB_DATA_BUF_SIZE + ESP8266AT_IO_READ_BUF_SIZE];
+
+#define RX_HOST_ASSERT(cond) \
+    do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); abort(); } } while (0)
+
+void rx_host_init(esp8266at_t *esp8266at)
+{
+    static struct _rx_host_sem_t sems[3];
+
+    memset(esp8266at, 0, sizeof(esp8266at_t));
+
+    esp8266at->io_read_sem = &sems[0];
+    esp8266at->io_data_read_sem = &sems[1];
+    esp8266at->io_urc_sem = &sems[2];
+    cbuf_create(&esp8266at->io_read_buf, ESP8266AT_IO_READ_BUF_SIZE);
+    cbuf_create(&esp8266at->io_data_buf, ESP8266AT_IO_DATA_BUF_SIZE);
+    for (int i = 0; i < ESP8266AT_IO_MQTT_SUB_BUF_MAX; i++)
+    {
+        msgq_create(&esp8266at->mqtt_sub_bufs[i].msgs, sizeof(esp8266at_mqtt_sub_buf_msg_t), ESP8266AT_IO_MQTT_SUB_BUF_MSG_MAX);
+        cbuf_create(&esp8266at->mqtt_sub_bufs[i].data_buf, ESP8266AT_IO_MQTT_SUB_DATA_BUF_SIZE);
+    }
+    strcpy(esp8266at->mqtt_sub_bufs[0].topic, "t/1");
+    strcpy(esp8266at->mqtt_sub_bufs[1].topic, "t/2");
+
+    rx_host_reset(esp8266at);
+}
+
+void rx_host_reset(esp8266at_t *esp8266at)
+{
+    esp8266at_io_rx_init(esp8266at);
+    esp8266at->io_urc_flags = 0;
+    memset(&esp8266at->stat, 0, sizeof(esp8266at->stat));
+    esp8266at->rx_overflow_count = 0;
+
+    cbuf_clear(esp8266at->io_read_buf);
+    cbuf_clear(esp8266at->io_data_buf);
+    for (int i = 0; i < ESP8266AT_IO_MQTT_SUB_BUF_MAX; i++)
+    {
+        msgq_clear(esp8266at->mqtt_sub_bufs[i].msgs);
+        cbuf_clear(esp8266at->mqtt_sub_bufs[i].data_buf);
+    }
+}
+
+void rx_host_drain(esp8266at_t *esp8266at, rx_host_count_t *count)
+{
+    uint32_t read;
+    esp8266at_mqtt_sub_buf_msg_t msg;
+
+    cbuf_read(esp8266at->io_read_buf, _drain_buf, ESP8266AT_IO_READ_BUF_SIZE, &read);
+    count->resp_bytes += read;
+    cbuf_read(esp8266at->io_data_buf, _drain_buf, ESP8266AT_IO_DATA_BUF_SIZE, &read);
+    count->data_bytes += read;
+
+    for (int i = 0; i < ESP8266AT_IO_MQTT_SUB_BUF_MAX; i++)
+    {
+        esp8266at_mqtt_sub_buf_t *sub = &esp8266at->mqtt_sub_bufs[i];
+        unsigned int msg_count;
+
+        // Each message must be fully stored, and nothing but the messages.
+        msgq_getcount(sub->msgs, &msg_count);
+        RX_HOST_ASSERT(msg_count <= ESP8266AT_IO_MQTT_SUB_BUF_MSG_MAX);
+        while (msgq_receive(sub->msgs, (unsigned char *) &msg) == 0)
+        {
+            RX_HOST_ASSERT(msg <= cbuf_get_len(sub->data_buf));
+            cbuf_read(sub->data_buf, _drain_buf, msg, &read);
+            count->mqtt_msgs++;
+            count->mqtt_bytes += read;
+        }
+
+        // A message still being received may have stored part of its data.
+        if (!(esp8266at->io_rx_mode == ESP8266AT_IO_RX_MODE_DATA && esp8266at->io_is_mqtt && esp8266at->io_mqtt_sub_buf_id == i))
+        {
+            RX_HOST_ASSERT(cbuf_get_len(sub->data_buf) == 0);
+        }
+    }
+}
+
+void rx_host_check(esp8266at_t *esp8266at)
+{
+    RX_HOST_ASSERT(esp8266at->io_rx_mode >= 0 && esp8266at->io_rx_mode < ESP8266AT_IO_RX_MODE_MAX);
+    for (int i = 0; i < ESP8266AT_IO_RX_KEY_MAX; i++)
+    {
+        RX_HOST_ASSERT(esp8266at->io_rx_key_i[i] == 0 || (esp8266at->io_rx_key_active & (1 << i)) != 0);
+        RX_HOST_ASSERT(esp8266at->io_rx_key_i[i] < strlen(_keys[i]));
+    }
+    if (esp8266at->io_rx_mode != ESP8266AT_IO_RX_MODE_RESP)
+    {
+        RX_HOST_ASSERT(esp8266at->io_rx_key_active == 0);
+    }
+    RX_HOST_ASSERT(esp8266at->io_mqtt_topic_i < ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX);
+    RX_HOST_ASSERT(esp8266at->io_data_len <= ESP8266AT_IO_DATA_LEN_MAX);
+    RX_HOST_ASSERT(esp8266at->io_mqtt_sub_buf_id < ESP8266AT_IO_MQTT_SUB_BUF_MAX);
+    if (esp8266at->io_rx_mode == ESP8266AT_IO_RX_MODE_DATA)
+    {
+        RX_HOST_ASSERT(esp8266at->io_data_read < esp8266at->io_data_len);
+        RX_HOST_ASSERT(esp8266at->io_data_written <= esp8266at->io_data_read);
+    }
+    RX_HOST_ASSERT(cbuf_get_len(esp8266at->io_read_buf) <= ESP8266AT_IO_READ_BUF_SIZE);
+    RX_HOST_ASSERT(cbuf_get_len(esp8266at->io_data_buf) <= ESP8266AT_IO_DATA_BUF_SIZE);
+}
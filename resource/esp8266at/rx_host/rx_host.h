@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2020 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef RX_HOST_H_
+#define RX_HOST_H_
+
+#include <ubinos.h>
+
+#include "esp8266at_io.h"
+
+typedef struct _rx_host_count_t
+{
+    uint64_t resp_bytes;
+    uint64_t data_bytes;
+    uint64_t mqtt_msgs;
+    uint64_t mqtt_bytes;
+} rx_host_count_t;
+
+/* Subscribes slot 0 and 1 to "t/1" and "t/2", slot 2 stays free. */
+void rx_host_init(esp8266at_t *esp8266at);
+void rx_host_reset(esp8266at_t *esp8266at);
+
+/* Empties the buffers as the driver tasks would and checks each message against the stored data. */
+void rx_host_drain(esp8266at_t *esp8266at, rx_host_count_t *count);
+
+/* Aborts if the parser state is out of range. */
+void rx_host_check(esp8266at_t *esp8266at);
+
+#endif /* RX_HOST_H_ */
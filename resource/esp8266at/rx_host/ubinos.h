@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2020 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Host stand-in for the parts of ubinos that esp8266at_io_rx.c uses.
+ * Only cbuf, msgq and sem_give do real work, the rest only has to compile.
+ */
+
+#ifndef RX_HOST_UBINOS_H_
+#define RX_HOST_UBINOS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define INCLUDE__ESP8266AT 1
+#define ESP8266AT__ENABLE_DIALECT_ESPAT 1
+#define ESP8266AT__ENABLE_DIALECT_WIZFI360 1
+#define ESP8266AT__ENABLE_TRACE 0
+#define ESP8266AT__ENABLE_ISR_PROFILE 0
+#define ESP8266AT__ENABLE_DEFERRED_LOG 0
+#define ESP8266AT__ENABLE_MQTT 1
+#define ESP8266AT__ENABLE_SNTP 1
+#define ESP8266AT__ENABLE_CLI 1
+
+#define ESP8266AT__IO_READ_BUF_SIZE 2048
+#define ESP8266AT__IO_WRITE_BUF_SIZE 2048
+#define ESP8266AT__IO_DATA_BUF_SIZE 256
+#define ESP8266AT__IO_MQTT_SUB_BUF_MAX 3
+#define ESP8266AT__IO_MQTT_SUB_BUF_MSG_MAX 5
+#define ESP8266AT__IO_MQTT_SUB_DATA_BUF_SIZE 1024
+#define ESP8266AT__TEMP_CMD_BUF_SIZE 256
+#define ESP8266AT__TEMP_RESP_BUF_SIZE 256
+
+typedef int ubi_st_t;
+typedef int ubi_err_t;
+
+#define UBI_ST_OK 0
+#define UBI_ERR_OK 0
+#define UBI_ERR_ERROR -1
+#define UBI_ERR_BUF_FULL -2
+
+typedef struct _rx_host_mutex_t *mutex_pt;
+typedef struct _rx_host_task_t *task_pt;
+
+typedef struct _rx_host_sem_t
+{
+    uint32_t count;
+} *sem_pt;
+
+typedef struct _rx_host_cbuf_t
+{
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t head;
+    uint32_t len;
+} *cbuf_pt;
+
+typedef struct _rx_host_msgq_t
+{
+    uint8_t *buf;
+    uint32_t msg_size;
+    uint32_t max;
+    uint32_t head;
+    uint32_t count;
+} *msgq_pt;
+
+extern int _bsp_kernel_active;
+
+ubi_err_t cbuf_create(cbuf_pt *cbuf, uint32_t size);
+ubi_err_t cbuf_delete(cbuf_pt *cbuf);
+ubi_err_t cbuf_read(cbuf_pt cbuf, uint8_t *buf, uint32_t len, uint32_t *read);
+ubi_err_t cbuf_write(cbuf_pt cbuf, const uint8_t *buf, uint32_t len, uint32_t *written);
+ubi_err_t cbuf_clear(cbuf_pt cbuf);
+uint32_t cbuf_get_len(cbuf_pt cbuf);
+int cbuf_is_full(cbuf_pt cbuf);
+
+int msgq_create(msgq_pt *msgq, uint32_t msg_size, uint32_t max);
+int msgq_delete(msgq_pt *msgq);
+int msgq_send(msgq_pt msgq, unsigned char *msg);
+int msgq_receive(msgq_pt msgq, unsigned char *msg);
+int msgq_getcount(msgq_pt msgq, unsigned int *count);
+int msgq_clear(msgq_pt msgq);
+
+int sem_give(sem_pt sem);
+
+#endif /* RX_HOST_UBINOS_H_ */
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2020 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ubinos.h>
+#include <stdlib.h>
+#include <string.h>
+
+int _bsp_kernel_active = 1;
+
+ubi_err_t cbuf_create(cbuf_pt *cbuf, uint32_t size)
+{
+    *cbuf = calloc(1, sizeof(**cbuf));
+    (*cbuf)->buf = malloc(size);
+    (*cbuf)->size = size;
+
+    return UBI_ERR_OK;
+}
+
+ubi_err_t cbuf_delete(cbuf_pt *cbuf)
+{
+    free((*cbuf)->buf);
+    free(*cbuf);
+    *cbuf = NULL;
+
+    return UBI_ERR_OK;
+}
+
+ubi_err_t cbuf_read(cbuf_pt cbuf, uint8_t *buf, uint32_t len, uint32_t *read)
+{
+    uint32_t n = len < cbuf->len ? len : cbuf->len;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (buf != NULL)
+        {
+            buf[i] = cbuf->buf[(cbuf->head + i) % cbuf->size];
+        }
+    }
+    cbuf->head = (cbuf->head + n) % cbuf->size;
+    cbuf->len -= n;
+
+    if (read != NULL)
+    {
+        *read = n;
+    }
+
+    return n < len ? UBI_ERR_ERROR : UBI_ERR_OK;
+}
+
+ubi_err_t cbuf_write(cbuf_pt cbuf, const uint8_t *buf, uint32_t len, uint32_t *written)
+{
+    uint32_t n = len < cbuf->size - cbuf->len ? len : cbuf->size - cbuf->len;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        cbuf->buf[(cbuf->head + cbuf->len + i) % cbuf->size] = buf[i];
+    }
+    cbuf->len += n;
+
+    if (written != NULL)
+    {
+        *written = n;
+    }
+
+    return n < len ? UBI_ERR_BUF_FULL : UBI_ERR_OK;
+}
+
+ubi_err_t cbuf_clear(cbuf_pt cbuf)
+{
+    cbuf->head = 0;
+    cbuf->len = 0;
+
+    return UBI_ERR_OK;
+}
+
+uint32_t cbuf_get_len(cbuf_pt cbuf)
+{
+    return cbuf->len;
+}
+
+int cbuf_is_full(cbuf_pt cbuf)
+{
+    return cbuf->len == cbuf->size;
+}
+
+int msgq_create(msgq_pt *msgq, uint32_t msg_size, uint32_t max)
+{
+    *msgq = calloc(1, sizeof(**msgq));
+    (*msgq)->buf = malloc(msg_size * max);
+    (*msgq)->msg_size = msg_size;
+    (*msgq)->max = max;
+
+    return 0;
+}
+
+int msgq_delete(msgq_pt *msgq)
+{
+    free((*msgq)->buf);
+    free(*msgq);
+    *msgq = NULL;
+
+    return 0;
+}
+
+int msgq_send(msgq_pt msgq, unsigned char *msg)
+{
+    if (msgq->count == msgq->max)
+    {
+        return -1;
+    }
+    memcpy(&msgq->buf[((msgq->head + msgq->count) % msgq->max) * msgq->msg_size], msg, msgq->msg_size);
+    msgq->count++;
+
+    return 0;
+}
+
+int msgq_receive(msgq_pt msgq, unsigned char *msg)
+{
+    if (msgq->count == 0)
+    {
+        return -1;
+    }
+    memcpy(msg, &msgq->buf[msgq->head * msgq->msg_size], msgq->msg_size);
+    msgq->head = (msgq->head + 1) % msgq->max;
+    msgq->count--;
+
+    return 0;
+}
+
+int msgq_getcount(msgq_pt msgq, unsigned int *count)
+{
+    *count = msgq->count;
+
+    return 0;
+}
+
+int msgq_clear(msgq_pt msgq)
+{
+    msgq->head = 0;
+    msgq->count = 0;
+
+    return 0;
+}
+
+int sem_give(sem_pt sem)
+{
+    if (sem != NULL)
+    {
+        sem->count++;
+    }
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+#!/usr/bin/python
+
+#
+# Copyright (c) 2020 Sung Ho Park and CSOS
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+
+#
+# Decoder and replayer for "at trace dump" (ESP8266AT__ENABLE_TRACE).
+#
+#     trace_replay.py decode <trace>                    : print the records
+#     trace_replay.py extract <log> <trace.bin>         : save the binary trace from a console log
+#     trace_replay.py rx <trace> <rx.bin>               : save the received byte stream
+#     trace_replay.py play <trace> <tty> [baud] [speed] : stand in for the module and send the received
+#                                                         bytes to the device with the recorded timing
+#
+# <trace> is either a console log holding the dump or a file saved by extract.
+#
+# A record is a 4 byte header (type, data length, ms since the previous record
+# as 16 bit little endian) followed by the data. The delta saturates at 65535 ms.
+#
+
+import os
+import select
+import struct
+import sys
+import termios
+import time
+
+TRACE_VERSION = 1
+HEADER_LEN = 4
+
+RX = 1
+TX = 2
+CMD_BEGIN = 3
+CMD_END = 4
+MODE = 5
+OVERFLOW = 6
+
+TYPE_NAME = {RX: 'rx', TX: 'tx', CMD_BEGIN: 'cmd', CMD_END: 'end', MODE: 'mode', OVERFLOW: 'overflow'}
+CMD_NAME = ['basic', 'wifi', 'ip', 'send', 'mqtt']
+RSP_END_NAME = ['none', 'ok', 'error', 'fail', 'timeout']
+RX_MODE_NAME = ['resp', 'data len', 'data', 'mqtt topic']
+
+BAUD = {9600: termios.B9600, 57600: termios.B57600, 115200: termios.B115200, 230400: termios.B230400,
+    460800: getattr(termios, 'B460800', termios.B230400), 921600: getattr(termios, 'B921600', termios.B230400)}
+
+def load(path):
+    data = open(path, 'rb').read()
+    if b'trace begin' not in data:
+        return bytearray(data)
+
+    trace = bytearray()
+    inside = False
+    for line in data.decode('utf-8', 'replace').splitlines():
+        line = line.strip()
+        if line.startswith('trace begin'):
+            version = int(line.split('version')[1].split(',')[0])
+            if version != TRACE_VERSION:
+                raise ValueError('unsupported trace version %d' % version)
+            inside = True
+            trace = bytearray()
+        elif line.startswith('trace end'):
+            inside = False
+        elif inside and line:
+            trace += bytearray.fromhex(line)
+    return trace
+
+def records(trace):
+    pos = 0
+    time_ms = 0
+    while pos + HEADER_LEN <= len(trace):
+        rtype, length, delta_ms = struct.unpack('<BBH', bytes(trace[pos:pos + HEADER_LEN]))
+        data = trace[pos + HEADER_LEN:pos + HEADER_LEN + length]
+        if len(data) < length:
+            break
+        time_ms += delta_ms
+        yield time_ms, rtype, data
+        pos += HEADER_LEN + length
+
+def name(table, index):
+    return table[index] if index < len(table) else str(index)
+
+def describe(rtype, data):
+    if rtype in (RX, TX):
+        return repr(bytes(data))
+    if rtype == CMD_BEGIN:
+        return name(CMD_NAME, data[0])
+    if rtype == CMD_END:
+        return '%s, status %d' % (name(RSP_END_NAME, data[0]), struct.unpack('b', bytes(data[1:2]))[0])
+    return name(RX_MODE_NAME, data[0])
+
+def decode(trace):
+    counts = {}
+    for time_ms, rtype, data in records(trace):
+        print('%10d ms %-8s %s' % (time_ms, TYPE_NAME.get(rtype, str(rtype)), describe(rtype, data)))
+        counts[rtype] = counts.get(rtype, 0) + len(data)
+    print('rx %d bytes, tx %d bytes' % (counts.get(RX, 0), counts.get(TX, 0)))
+
+def rx_stream(trace):
+    return b''.join(bytes(data) for time_ms, rtype, data in records(trace) if rtype == RX)
+
+def open_tty(path, baud):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    attr = termios.tcgetattr(fd)
+    attr[0] = 0                                      # iflag
+    attr[1] = 0                                      # oflag
+    attr[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attr[3] = 0                                      # lflag
+    attr[4] = attr[5] = BAUD[baud]
+    attr[6][termios.VMIN] = 0
+    attr[6][termios.VTIME] = 0
+    termios.tcsetattr(fd, termios.TCSANOW, attr)
+    termios.tcflush(fd, termios.TCIOFLUSH)
+    return fd
+
+def play(trace, path, baud, speed):
+    fd = open_tty(path, baud)
+    begin = time.time()
+    sent = 0
+    try:
+        for time_ms, rtype, data in records(trace):
+            due = begin + time_ms / 1000.0 / speed
+            while True:
+                wait = due - time.time()
+                if wait <= 0:
+                    break
+                # Print what the device sends meanwhile, to compare with the recorded tx.
+                ready = select.select([fd], [], [], wait)[0]
+                if ready:
+                    print('%10d ms device   %r' % ((time.time() - begin) * 1000 * speed, os.read(fd, 1024)))
+            if rtype == RX:
+                os.write(fd, bytes(data))
+                sent += len(data)
+            elif rtype != TX:
+                print('%10d ms %-8s %s' % (time_ms, TYPE_NAME.get(rtype, str(rtype)), describe(rtype, data)))
+    finally:
+        os.close(fd)
+    print('played %d bytes in %.3f s' % (sent, time.time() - begin))
+
+if len(sys.argv) < 3:
+    print('usage: trace_replay.py decode|extract|rx|play <trace> ...')
+    sys.exit(1)
+
+command = sys.argv[1]
+trace = load(sys.argv[2])
+
+if command == 'decode':
+    decode(trace)
+elif command == 'extract':
+    open(sys.argv[3], 'wb').write(bytes(trace))
+elif command == 'rx':
+    open(sys.argv[3], 'wb').write(rx_stream(trace))
+elif command == 'play':
+    baud = int(sys.argv[4]) if len(sys.argv) > 4 else 115200
+    speed = float(sys.argv[5]) if len(sys.argv) > 5 else 1.0
+    play(trace, sys.argv[3], baud, speed)
+else:
+    print('unknown command: %s' % command)
+    sys.exit(1)
@@ -6,12 +6,32 @@
 #if (INCLUDE__ESP8266AT == 1)
 
 #define ESP8266AT__LOGM_CATEGORY LOGM_CATEGORY__@ESP8266AT__LOGM_CATEGORY@
+#define ESP8266AT__CMD_LOG_LEVEL LOGM_LEVEL__@ESP8266AT__CMD_LOG_LEVEL@
+#cmakedefine01 ESP8266AT__ENABLE_DEFERRED_LOG
 
 #cmakedefine01 ESP8266AT__USE_RESET_PIN
 #cmakedefine01 ESP8266AT__USE_CHIPSELECT_PIN
 #cmakedefine01 ESP8266AT__USE_UART_HW_FLOW_CONTROL
 
+#cmakedefine01 ESP8266AT__ENABLE_ISR_PROFILE
+#cmakedefine01 ESP8266AT__ENABLE_TRACE
+
+#cmakedefine01 ESP8266AT__ENABLE_MQTT
+#cmakedefine01 ESP8266AT__ENABLE_SNTP
+#cmakedefine01 ESP8266AT__ENABLE_CLI
+
+#define ESP8266AT__IO_READ_BUF_SIZE @ESP8266AT__IO_READ_BUF_SIZE@
+#define ESP8266AT__IO_WRITE_BUF_SIZE @ESP8266AT__IO_WRITE_BUF_SIZE@
+#define ESP8266AT__IO_DATA_BUF_SIZE @ESP8266AT__IO_DATA_BUF_SIZE@
+#define ESP8266AT__IO_MQTT_SUB_BUF_MAX @ESP8266AT__IO_MQTT_SUB_BUF_MAX@
+#define ESP8266AT__IO_MQTT_SUB_BUF_MSG_MAX @ESP8266AT__IO_MQTT_SUB_BUF_MSG_MAX@
+#define ESP8266AT__IO_MQTT_SUB_DATA_BUF_SIZE @ESP8266AT__IO_MQTT_SUB_DATA_BUF_SIZE@
+#define ESP8266AT__TEMP_CMD_BUF_SIZE @ESP8266AT__TEMP_CMD_BUF_SIZE@
+#define ESP8266AT__TEMP_RESP_BUF_SIZE @ESP8266AT__TEMP_RESP_BUF_SIZE@
+
 #cmakedefine01 ESP8266AT__USE_WIZFI360_API
+#cmakedefine01 ESP8266AT__ENABLE_DIALECT_ESPAT
+#cmakedefine01 ESP8266AT__ENABLE_DIALECT_WIZFI360
 
 #endif /* (INCLUDE__ESP8266AT == 1) */
 
@@ -26,293 +26,53 @@
 
 #include "nrf_delay.h"
 
-static const char * _data_key = ESP8266AT_IO_DATA_KEY;
-static const char * _mqtt_key = ESP8266AT_IO_MQTT_KEY;
-
 static uint8_t _g_esp8266at_uart_initiated = 0;
 static nrf_drv_uart_t _g_esp8266at_uart = NRF_DRV_UART_INSTANCE(1);
 
 static void esp8266at_io_event_handler(nrf_drv_uart_event_t *p_event, void *p_context)
 {
-    int need_signal = 0;
     uint8_t *buf;
     uint32_t len;
-    uint32_t written;
-    cbuf_pt rbuf;
-    sem_pt rsem;
     cbuf_pt wbuf;
     sem_pt wsem;
-    msgq_pt rmsgq;
-    char len_end;
-    unsigned int msg_count;
-    esp8266at_mqtt_sub_buf_msg_t msg;
+#if (ESP8266AT__ENABLE_ISR_PROFILE == 1)
+    uint32_t profile_rx_mode;
+    uint32_t profile_begin;
+#endif /* (ESP8266AT__ENABLE_ISR_PROFILE == 1) */
 
     switch (p_event->type)
     {
     case NRF_DRV_UART_EVT_RX_DONE:
+#if (ESP8266AT__ENABLE_ISR_PROFILE == 1)
+        profile_rx_mode = _g_esp8266at.io_rx_mode;
+        profile_begin = esp8266at_io_profile_begin(&_g_esp8266at);
+#endif /* (ESP8266AT__ENABLE_ISR_PROFILE == 1) */
+
         len = ESP8266AT_IO_TEMP_RX_BUF_SIZE;
         buf = _g_esp8266at.io_temp_rx_buf;
 
+        _g_esp8266at.stat.rx_irq_count++;
+
         if (p_event->data.rxtx.bytes > 0)
         {
-            switch (_g_esp8266at.io_rx_mode)
-            {
-            case ESP8266AT_IO_RX_MODE_RESP:
-                rbuf = _g_esp8266at.io_read_buf;
-                rsem = _g_esp8266at.io_read_sem;
-
-                if (_data_key[_g_esp8266at.io_data_key_i] == buf[0])
-                {
-                    _g_esp8266at.io_data_key_i++;
-                }
-                else
-                {
-                    _g_esp8266at.io_data_key_i = 0;
-                }
-                if (_g_esp8266at.io_data_key_i == ESP8266AT_IO_DATA_KEY_LEN)
-                {
-                    _g_esp8266at.io_data_len = 0;
-                    _g_esp8266at.io_data_len_i = 0;
-                    _g_esp8266at.io_is_mqtt = 0;
-                    _g_esp8266at.io_rx_mode = ESP8266AT_IO_RX_MODE_DATA_LEN;
-                    break;
-                }
-
-                if (_mqtt_key[_g_esp8266at.io_mqtt_key_i] == buf[0])
-                {
-                    _g_esp8266at.io_mqtt_key_i++;
-                }
-                else
-                {
-                    _g_esp8266at.io_mqtt_key_i = 0;
-                }
-                if (_g_esp8266at.io_mqtt_key_i == ESP8266AT_IO_MQTT_KEY_LEN)
-                {
-                    _g_esp8266at.io_is_mqtt = 1;
-                    _g_esp8266at.io_mqtt_topic_i = 0;
-                    _g_esp8266at.io_mqtt_sub_buf_id = -1;
-                    _g_esp8266at.io_rx_mode = ESP8266AT_IO_RX_MODE_MQTT_TOPIC;
-                    break;
-                }
-
-               if (cbuf_is_full(rbuf))
-                {
-                    _g_esp8266at.rx_overflow_count++;
-                    break;
-                }
-
-                if (cbuf_get_len(rbuf) == 0)
-                {
-                    need_signal = 1;
-                }
-
-                cbuf_write(rbuf, buf, len, NULL);
-
-                if (need_signal && _bsp_kernel_active)
-                {
-                    sem_give(rsem);
-                }
-
-                break;
-
-            case ESP8266AT_IO_RX_MODE_MQTT_TOPIC:
-                rbuf = _g_esp8266at.io_read_buf;
-                rsem = _g_esp8266at.io_read_sem;
-
-                if (',' == buf[0])
-                {
-                    if (_g_esp8266at.io_mqtt_topic_i > 0 && _g_esp8266at.io_mqtt_topic_buf[_g_esp8266at.io_mqtt_topic_i - 1] == '"')
-                    {
-                        // ignore last "
-                        _g_esp8266at.io_mqtt_topic_buf[_g_esp8266at.io_mqtt_topic_i - 1] = 0;
-                    }
-                    else
-                    {
-                        _g_esp8266at.io_mqtt_topic_buf[_g_esp8266at.io_mqtt_topic_i] = 0;
-                    }
-
-                    for (int i = 0; i < ESP8266AT_IO_MQTT_SUB_BUF_MAX; i++)
-                    {
-                        if (strncmp((char *) _g_esp8266at.io_mqtt_topic_buf, _g_esp8266at.mqtt_sub_bufs[i].topic, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX) == 0)
-                        {
-                            msgq_getcount(_g_esp8266at.mqtt_sub_bufs[i].msgs, &msg_count);
-                            if (msg_count < ESP8266AT_IO_MQTT_SUB_BUF_MSG_MAX)
-                            {
-                                _g_esp8266at.io_mqtt_sub_buf_id = i;
-                            }
-                            break;
-                        }
-                    }
-
-                    _g_esp8266at.io_data_len = 0;
-                    _g_esp8266at.io_data_len_i = 0;
-                    _g_esp8266at.io_rx_mode = ESP8266AT_IO_RX_MODE_DATA_LEN;
-                    break;
-                }
-
-                if (_g_esp8266at.io_mqtt_topic_i >= ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX - 1)
-                {
-                    _g_esp8266at.io_data_key_i = 0;
-                    _g_esp8266at.io_mqtt_key_i = 0;
-                    _g_esp8266at.io_rx_mode = ESP8266AT_IO_RX_MODE_RESP;
-                    break;
-                }
-
-                if (_g_esp8266at.io_mqtt_topic_i == 0 && buf[0] == '"')
-                {
-                    // ignore first "
-                }
-                else
-                {
-                    _g_esp8266at.io_mqtt_topic_buf[_g_esp8266at.io_mqtt_topic_i] = buf[0];
-                    _g_esp8266at.io_mqtt_topic_i++;
-                }
-
-                break;
-
-            case ESP8266AT_IO_RX_MODE_DATA_LEN:
-                rbuf = _g_esp8266at.io_read_buf;
-                rsem = _g_esp8266at.io_read_sem;
-
-                if (_g_esp8266at.io_is_mqtt)
-                {
-                    len_end = ',';
-                }
-                else
-                {
-                    len_end = ':';
-                }
-
-                if (len_end == buf[0])
-                {
-                    _g_esp8266at.io_data_len_buf[_g_esp8266at.io_data_len_i] = 0;
-                    _g_esp8266at.io_data_len = atoi((char*) _g_esp8266at.io_data_len_buf);
-                    if (_g_esp8266at.io_data_len > ESP8266AT_IO_DATA_LEN_MAX)
-                    {
-                        _g_esp8266at.io_data_key_i = 0;
-                        _g_esp8266at.io_mqtt_key_i = 0;
-                        _g_esp8266at.io_rx_mode = ESP8266AT_IO_RX_MODE_RESP;
-                        break;
-                    }
-
-                    _g_esp8266at.io_data_read = 0;
-                    _g_esp8266at.io_rx_mode = ESP8266AT_IO_RX_MODE_DATA;
-                    break;
-                }
-
-                if (_g_esp8266at.io_data_len_i >= ESP8266AT_IO_DATA_LEN_BUF_SIZE - 1)
-                {
-                    _g_esp8266at.io_data_key_i = 0;
-                    _g_esp8266at.io_mqtt_key_i = 0;
-                    _g_esp8266at.io_rx_mode = ESP8266AT_IO_RX_MODE_RESP;
-                    break;
-                }
-
-                _g_esp8266at.io_data_len_buf[_g_esp8266at.io_data_len_i] = buf[0];
-                _g_esp8266at.io_data_len_i++;
-
-                break;
-
-            case ESP8266AT_IO_RX_MODE_DATA:
-                if (_g_esp8266at.io_is_mqtt)
-                {
-                    if (_g_esp8266at.io_mqtt_sub_buf_id >= 0)
-                    {
-                        rmsgq = _g_esp8266at.mqtt_sub_bufs[_g_esp8266at.io_mqtt_sub_buf_id].msgs;
-                        rbuf = _g_esp8266at.mqtt_sub_bufs[_g_esp8266at.io_mqtt_sub_buf_id].data_buf;
-                    }
-                    else
-                    {
-                        rmsgq = NULL;
-                        rbuf = NULL;
-                    }
-
-                    _g_esp8266at.io_data_read += len;
-
-                    if (_g_esp8266at.io_mqtt_sub_buf_id >= 0)
-                    {
-                        if (cbuf_is_full(rbuf))
-                        {
-                            _g_esp8266at.rx_overflow_count++;
-
-                            if (_g_esp8266at.io_data_read >= _g_esp8266at.io_data_len)
-                            {
-                                msg = _g_esp8266at.io_data_read - len;
-                                msgq_send(rmsgq, (unsigned char *) &msg);
-
-                                _g_esp8266at.io_data_key_i = 0;
-                                _g_esp8266at.io_mqtt_key_i = 0;
-                                _g_esp8266at.io_rx_mode = ESP8266AT_IO_RX_MODE_RESP;
-                            }
-                            break;
-                        }
-
-                        cbuf_write(rbuf, buf, len, &written);
-                    }
-
-                    if (_g_esp8266at.io_data_read >= _g_esp8266at.io_data_len)
-                    {
-                        if (_g_esp8266at.io_mqtt_sub_buf_id >= 0)
-                        {
-                            msg = _g_esp8266at.io_data_read - len + written;
-                            msgq_send(rmsgq, (unsigned char *) &msg);
-                        }
-                        _g_esp8266at.io_data_key_i = 0;
-                        _g_esp8266at.io_mqtt_key_i = 0;
-                        _g_esp8266at.io_rx_mode = ESP8266AT_IO_RX_MODE_RESP;
-                    }
-                }
-                else
-                {
-                    rbuf = _g_esp8266at.io_data_buf;
-                    rsem = _g_esp8266at.io_data_read_sem;
-
-                    _g_esp8266at.io_data_read += len;
-
-                    if (cbuf_is_full(rbuf))
-                    {
-                        _g_esp8266at.rx_overflow_count++;
-
-                        if (_g_esp8266at.io_data_read >= _g_esp8266at.io_data_len)
-                        {
-                            _g_esp8266at.io_data_key_i = 0;
-                            _g_esp8266at.io_mqtt_key_i = 0;
-                            _g_esp8266at.io_rx_mode = ESP8266AT_IO_RX_MODE_RESP;
-                        }
-                        break;
-                    }
-
-                    if (cbuf_get_len(rbuf) == 0)
-                    {
-                        need_signal = 1;
-                    }
-
-                    cbuf_write(rbuf, buf, len, NULL);
-
-                    if (need_signal && _bsp_kernel_active)
-                    {
-                        sem_give(rsem);
-                    }
-                    if (_g_esp8266at.io_data_read >= _g_esp8266at.io_data_len)
-                    {
-                        _g_esp8266at.io_data_key_i = 0;
-                        _g_esp8266at.io_mqtt_key_i = 0;
-                        _g_esp8266at.io_rx_mode = ESP8266AT_IO_RX_MODE_RESP;
-                    }
-                }
-
-                break;
-            }
+            esp8266at_io_rx_process(&_g_esp8266at, buf, p_event->data.rxtx.bytes);
         }
 
         nrf_drv_uart_rx(&_g_esp8266at_uart, buf, len);
 
+#if (ESP8266AT__ENABLE_ISR_PROFILE == 1)
+        esp8266at_io_profile_end(&_g_esp8266at, profile_rx_mode, profile_begin);
+#endif /* (ESP8266AT__ENABLE_ISR_PROFILE == 1) */
+
         break;
 
     case NRF_DRV_UART_EVT_TX_DONE:
         wbuf = _g_esp8266at.io_write_buf;
         wsem = _g_esp8266at.io_write_sem;
 
+        _g_esp8266at.stat.tx_irq_count++;
+        _g_esp8266at.stat.tx_byte_count += p_event->data.rxtx.bytes;
+
         if (p_event->data.rxtx.bytes > 0)
         {
             cbuf_read(wbuf, NULL, p_event->data.rxtx.bytes, NULL);
@@ -333,6 +93,7 @@ static void esp8266at_io_event_handler(nrf_drv_uart_event_t *p_event, void *p_co
         break;
 
     case NRF_DRV_UART_EVT_ERROR:
+        _g_esp8266at.stat.uart_error_count++;
         break;
 
     default:
@@ -340,6 +101,38 @@ static void esp8266at_io_event_handler(nrf_drv_uart_event_t *p_event, void *p_co
     }
 }
 
+#if (ESP8266AT__ENABLE_ISR_PROFILE == 1)
+
+void esp8266at_io_profile_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t esp8266at_io_profile_cycles(void)
+{
+    return DWT->CYCCNT;
+}
+
+uint32_t esp8266at_io_profile_cycles_per_us(void)
+{
+    return SystemCoreClock / 1000000;
+}
+
+#endif /* (ESP8266AT__ENABLE_ISR_PROFILE == 1) */
+
+static void _delayms(uint32_t ms)
+{
+    if (_bsp_kernel_active)
+    {
+        task_sleepms(ms);
+    }
+    else
+    {
+        nrf_delay_ms(ms);
+    }
+}
+
 ubi_st_t esp8266at_io_module_reset(esp8266at_t *esp8266at)
 {
     ubi_st_t st;
@@ -347,28 +140,52 @@ ubi_st_t esp8266at_io_module_reset(esp8266at_t *esp8266at)
 #if (ESP8266AT__USE_CHIPSELECT_PIN == 1)
     /* Deassert chip select */
     nrf_drv_gpiote_out_clear(ESP8266_CS_Pin);
-    nrf_delay_ms(100);
+    _delayms(ESP8266AT_RESET_PULSE_TIME_MS);
     /* Assert chip select */
     nrf_drv_gpiote_out_set(ESP8266_CS_Pin);
-    nrf_delay_ms(100);
 #endif /* (ESP8266AT__USE_CHIPSELECT_PIN == 1) */
 
 #if (ESP8266AT__USE_RESET_PIN == 1)
     /* Assert reset pin */
     nrf_drv_gpiote_out_clear(ESP8266_NRST_Pin);
-    nrf_delay_ms(500);
+    _delayms(ESP8266AT_RESET_PULSE_TIME_MS);
     /* Deassert reset pin */
     nrf_drv_gpiote_out_set(ESP8266_NRST_Pin);
-    nrf_delay_ms(500);
-#else
-    nrf_delay_ms(1000);
 #endif /* (ESP8266AT__USE_RESET_PIN == 1) */
 
+    /* The caller waits for the "ready" banner */
+
     st = UBI_ST_OK;
 
     return st;
 }
 
+ubi_st_t esp8266at_io_module_wakeup(esp8266at_t *esp8266at)
+{
+    ubi_st_t st;
+
+#if (ESP8266AT__USE_RESET_PIN == 1)
+    /* A reset pulse ends deep sleep */
+    nrf_drv_gpiote_out_clear(ESP8266_NRST_Pin);
+    _delayms(ESP8266AT_RESET_PULSE_TIME_MS);
+    nrf_drv_gpiote_out_set(ESP8266_NRST_Pin);
+
+    st = UBI_ST_OK;
+#elif (ESP8266AT__USE_CHIPSELECT_PIN == 1)
+    /* So does a chip select pulse */
+    nrf_drv_gpiote_out_clear(ESP8266_CS_Pin);
+    _delayms(ESP8266AT_RESET_PULSE_TIME_MS);
+    nrf_drv_gpiote_out_set(ESP8266_CS_Pin);
+
+    st = UBI_ST_OK;
+#else
+    /* Only a timed deep sleep ends by itself */
+    st = UBI_ST_ERR_UNSUP;
+#endif /* (ESP8266AT__USE_RESET_PIN == 1) */
+
+    return st;
+}
+
 ubi_st_t esp8266at_io_uart_reset(esp8266at_t *esp8266at)
 {
     ret_code_t nrf_err;
@@ -438,6 +255,10 @@ ubi_st_t esp8266at_io_init(esp8266at_t *esp8266at)
     APP_ERROR_CHECK(nrf_err);
 #endif /* (ESP8266AT__USE_CHIPSELECT_PIN == 1) */
 
+#if (ESP8266AT__ENABLE_ISR_PROFILE == 1)
+    esp8266at_io_profile_init();
+#endif /* (ESP8266AT__ENABLE_ISR_PROFILE == 1) */
+
     esp8266at_io_module_reset(esp8266at);
     esp8266at_io_uart_reset(esp8266at);
 
@@ -727,12 +548,17 @@ ubi_st_t esp8266at_io_write_advan(esp8266at_t *esp8266at, uint8_t *buffer, uint3
         assert(st == UBI_ERR_OK || st == UBI_ERR_BUF_FULL);
         if (st == UBI_ERR_BUF_FULL)
         {
+            esp8266at->stat.drop_count[ESP8266AT_STAT_BUF_WRITE] += length - written_tmp;
             st = UBI_ST_ERR_IO;
         }
         else
         {
             st = UBI_ST_OK;
         }
+        esp8266at_io_stat_high_water(esp8266at, ESP8266AT_STAT_BUF_WRITE, esp8266at->io_write_buf);
+#if (ESP8266AT__ENABLE_TRACE == 1)
+        esp8266at_trace_put(esp8266at, ESP8266AT_TRACE_TX, buffer, written_tmp);
+#endif /* (ESP8266AT__ENABLE_TRACE == 1) */
 
         if (written_tmp > 0)
         {
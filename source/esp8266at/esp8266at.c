@@ -19,20 +19,166 @@
 #undef LOGM_CATEGORY
 #define LOGM_CATEGORY ESP8266AT__LOGM_CATEGORY
 
-#if (ESP8266AT__USE_WIZFI360_API == 1)
-    #define _CIPDNS_STRING "CIPDNS_CUR"
-    #define _CWJAP_STRING "CWJAP_CUR"
+// Command path debug logs. Below the debug level nothing is copied or formatted.
+#if (ESP8266AT__CMD_LOG_LEVEL >= LOGM_LEVEL__DEBUG)
+    #define ESP8266AT_LOG_CMD(esp8266at, event, s0, s1, a0, a1) _log_cmd(esp8266at, event, s0, s1, a0, a1)
 #else
-    #define _CIPDNS_STRING "CIPDNS"
-    #define _CWJAP_STRING "CWJAP"
-#endif /* (ESP8266AT__USE_WIZFI360_API == 1) */
+    #define ESP8266AT_LOG_CMD(esp8266at, event, s0, s1, a0, a1) do { (void) (a0); (void) (a1); } while (0)
+#endif
+
+// A pin restarts the module at init and reset, so it prints the "ready" banner.
+#if (ESP8266AT__USE_RESET_PIN == 1) || (ESP8266AT__USE_CHIPSELECT_PIN == 1)
+    #define ESP8266AT_RESTART_BANNER 1
+#else
+    #define ESP8266AT_RESTART_BANNER 0
+#endif
+
+#if (ESP8266AT__ENABLE_DIALECT_ESPAT == 1)
+static const esp8266at_dialect_t _dialect_espat =
+{
+    .id = ESP8266AT_DIALECT_ESPAT,
+    .name = "ESP-AT",
+    .gmr_signature = NULL,
+    .cwjap = "CWJAP",
+    .cwdhcp = "CWDHCP",
+    .cipsta = "CIPSTA",
+    .cipdns = "CIPDNS",
+    .cipdns_rsp_key = "+CIPDNS:",
+    .mqtt_clean_cmd = "AT+MQTTCLEAN=0\r\n",
+    .mqtt_clean_rsp = "OK\r\n",
+    .mqtt_clean_urc = 0,
+    .quote_escape = "\",\\",
+    .mqtt_quote_escape = "\",\\",
+    .sleep_modem = 1,
+    .sleep_light = 2,
+    .ssl_size = 0,
+    .ssl_pki = 1,
+    .ssl_sni = 1,
+};
+#endif /* (ESP8266AT__ENABLE_DIALECT_ESPAT == 1) */
+
+#if (ESP8266AT__ENABLE_DIALECT_WIZFI360 == 1)
+static const esp8266at_dialect_t _dialect_wizfi360 =
+{
+    .id = ESP8266AT_DIALECT_WIZFI360,
+    .name = "WizFi360",
+    .gmr_signature = "WizFi360",
+    .cwjap = "CWJAP_CUR",
+    .cwdhcp = "CWDHCP_CUR",
+    .cipsta = "CIPSTA_CUR",
+    .cipdns = "CIPDNS_CUR",
+    .cipdns_rsp_key = "+CIPDNS_CUR:",
+    .mqtt_clean_cmd = "AT+MQTTDIS\r\n",
+    .mqtt_clean_rsp = "CLOSED\r\n",
+    .mqtt_clean_urc = ESP8266AT_IO_URC__CLOSED,
+    .quote_escape = "\",\\",
+    .mqtt_quote_escape = "",
+    .sleep_modem = 2,
+    .sleep_light = 1,
+    .ssl_size = 1,
+    .ssl_pki = 0,
+    .ssl_sni = 0,
+};
+#endif /* (ESP8266AT__ENABLE_DIALECT_WIZFI360 == 1) */
+
+// The first entry is the default dialect.
+static const esp8266at_dialect_t * const _dialects[] =
+{
+#if (ESP8266AT__ENABLE_DIALECT_ESPAT == 1)
+    &_dialect_espat,
+#endif /* (ESP8266AT__ENABLE_DIALECT_ESPAT == 1) */
+#if (ESP8266AT__ENABLE_DIALECT_WIZFI360 == 1)
+    &_dialect_wizfi360,
+#endif /* (ESP8266AT__ENABLE_DIALECT_WIZFI360 == 1) */
+};
+
+static const esp8266at_dialect_t *_match_dialect(char *gmr_line);
+static void _select_dialect(esp8266at_t *esp8266at, const esp8266at_dialect_t *dialect);
 
 static ubi_st_t _wait_rsp(esp8266at_t *esp8266at, char *rsp, uint8_t *buffer, uint32_t length, uint32_t *received, uint32_t timeoutms,
         uint32_t *remain_timeoutms);
+static ubi_st_t _wait_rsp_advan(esp8266at_t *esp8266at, char *rsp, uint8_t watch_error, uint8_t *buffer, uint32_t length, uint32_t *received,
+        uint32_t timeoutms, uint32_t *remain_timeoutms);
+static uint8_t _token_step(const char *token, uint32_t *token_i, uint8_t c);
+static uint8_t _line_token_step(const char *token, uint32_t *token_i, uint8_t *buffer, uint32_t buf_i);
+static uint32_t _stat_cmd_type(const char *cmd);
+static void _stat_cmd_end(esp8266at_t *esp8266at, char *cmd, uint32_t begin_tick);
+static void _trace_cmd_begin(esp8266at_t *esp8266at, char *cmd);
+static void _trace_cmd_end(esp8266at_t *esp8266at, ubi_st_t st);
+#if (ESP8266AT__CMD_LOG_LEVEL >= LOGM_LEVEL__DEBUG)
+static void _log_cmd(esp8266at_t *esp8266at, uint8_t event, const char *s0, const char *s1, int32_t a0, int32_t a1);
+static void _log_cmd_format(uint8_t event, const char *s0, const char *s1, int32_t a0, int32_t a1);
+#endif /* (ESP8266AT__CMD_LOG_LEVEL >= LOGM_LEVEL__DEBUG) */
+#if (ESP8266AT_LOG_DEFER == 1)
+static void _log_defer_taskfunc(void *arg);
+#endif /* (ESP8266AT_LOG_DEFER == 1) */
+static void _cmd_begin(esp8266at_t *esp8266at, const char *str);
+static void _cmd_str(esp8266at_t *esp8266at, const char *str);
+static void _cmd_quoted(esp8266at_t *esp8266at, const char *str);
+#if (ESP8266AT__ENABLE_MQTT == 1)
+static void _cmd_quoted_mqtt(esp8266at_t *esp8266at, const char *str);
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+static void _cmd_quoted_escape(esp8266at_t *esp8266at, const char *str, const char *escape);
+static void _cmd_int(esp8266at_t *esp8266at, int32_t value);
+static void _cmd_uint(esp8266at_t *esp8266at, uint32_t value);
+static void _cmd_end(esp8266at_t *esp8266at);
+static ubi_st_t _send_cmd(esp8266at_t *esp8266at, char *cmd, uint32_t timeoutms, uint32_t *remain_timeoutms);
 static ubi_st_t _send_cmd_and_wait_rsp(esp8266at_t *esp8266at, char *cmd, char *rsp, uint32_t timeoutms, uint32_t *remain_timeoutms);
+static ubi_st_t _read_line(esp8266at_t *esp8266at, char *buffer, uint32_t length, uint32_t *line_len, uint32_t timeoutms, uint32_t *remain_timeoutms);
+static ubi_st_t _send_cmd_and_read_lines(esp8266at_t *esp8266at, char *cmd, esp8266at_line_handler_t handler, void *arg, uint32_t timeoutms,
+        uint32_t *remain_timeoutms);
+static char *_line_value(char *line, const char *key);
+static char *_next_field(char **next);
+static void _copy_field(char *dst, const char *field, uint32_t max_length);
+static ubi_st_t _wait_ready(esp8266at_t *esp8266at, uint8_t banner, uint32_t timeoutms, uint32_t *remain_timeoutms);
+static uint8_t _shadow_skip(esp8266at_t *esp8266at, uint32_t id, char *cmd);
+static void _shadow_update(esp8266at_t *esp8266at, uint32_t id, char *cmd, ubi_st_t st);
+static uint32_t _gettick(void);
+static uint32_t _elapsedms(uint32_t begin_tick);
+static ubi_st_t _join_cache_update(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+static void _cipdns_build(esp8266at_t *esp8266at, uint8_t enable, uint32_t first);
+static uint8_t _is_ip_addr(const char *host);
+static esp8266at_dns_cache_t *_dns_cache_find(esp8266at_t *esp8266at, const char *host);
+static ubi_st_t _resolve(esp8266at_t *esp8266at, char *host, char *ip_addr, uint8_t refresh, uint32_t timeoutms, uint32_t *remain_timeoutms);
+static void _dns_cache_refresh(esp8266at_t *esp8266at);
+static char *_cipstart_addr(esp8266at_t *esp8266at, char *host, char *cached_addr, uint32_t timeoutms, uint32_t *remain_timeoutms);
+static void _cipstart_addr_failed(esp8266at_t *esp8266at, char *host, char *addr, char *cached_addr);
+
+#if (ESP8266AT__ENABLE_MQTT == 1)
+static ubi_st_t _mqtt_pub(esp8266at_t *esp8266at, char *topic, char *data, uint32_t length, uint32_t qos, uint32_t retain, uint32_t timeoutms,
+        uint32_t *remain_timeoutms);
+static void _mqtt_sub_bind(esp8266at_t *esp8266at, uint32_t id, char *topic, uint32_t qos);
+static ubi_st_t _mqtt_sub_emit(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms);
+static ubi_st_t _mqtt_unsub_send(esp8266at_t *esp8266at, char *topic, uint32_t timeoutms, uint32_t *remain_timeoutms);
+static uint8_t _mqtt_topic_in(char *topic, char **topics, uint32_t count);
+static void _mqtt_pub_stat_end(esp8266at_t *esp8266at, uint32_t begin_tick, uint32_t length, uint32_t qos, ubi_st_t st);
+
+static const uint32_t _mqtt_pub_latency_bin_ms[ESP8266AT_MQTT_PUB_LATENCY_BIN_MAX - 1] = {10, 20, 50, 100, 200, 500, 1000};
+
+static void _mqtt_pubq_remove(esp8266at_t *esp8266at, uint32_t index);
+static uint8_t _mqtt_pubq_pending(esp8266at_t *esp8266at, uint8_t *connected);
+static void _mqtt_pubq_taskfunc(void *arg);
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+static const uint32_t _stat_latency_bin_ms[ESP8266AT_STAT_LATENCY_BIN_MAX - 1] = {10, 20, 50, 100, 200, 500, 1000, 5000};
 
 static void _esp8266at_interactive_recvfunc(void *arg);
 
+static ubi_st_t _config_replay(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+static void _urc_clear(esp8266at_t *esp8266at, uint32_t flags);
+static uint32_t _urc_process(esp8266at_t *esp8266at);
+static void _restart_reset(esp8266at_t *esp8266at);
+
+static void _power_state_set(esp8266at_t *esp8266at, uint8_t power_state);
+static ubi_st_t _wakeup(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+static uint32_t _supervisor_check(esp8266at_t *esp8266at);
+static ubi_st_t _supervisor_recover(esp8266at_t *esp8266at, uint32_t level);
+static void _supervisor_sleepms(esp8266at_t *esp8266at, uint32_t ms);
+static void _supervisor_taskfunc(void *arg);
+
 ubi_st_t esp8266at_init(esp8266at_t *esp8266at)
 {
     int r;
@@ -46,6 +192,13 @@ ubi_st_t esp8266at_init(esp8266at_t *esp8266at)
 
     esp8266at->rx_overflow_count = 0;
     esp8266at->tx_busy = 0;
+    esp8266at->io_isr_depth = 0;
+    esp8266at->rsp_end = ESP8266AT_RSP_END_NONE;
+    esp8266at_stat_reset(esp8266at);
+#if (ESP8266AT__ENABLE_TRACE == 1)
+    esp8266at->trace_enable = 0;
+    esp8266at_trace_clear(esp8266at);
+#endif /* (ESP8266AT__ENABLE_TRACE == 1) */
 
     r = mutex_create(&esp8266at->io_mutex);
     assert(r == 0);
@@ -60,11 +213,7 @@ ubi_st_t esp8266at_init(esp8266at_t *esp8266at)
     st = cbuf_create(&esp8266at->io_write_buf, ESP8266AT_IO_WRITE_BUF_SIZE);
     assert(st == UBI_ERR_OK);
 
-    esp8266at->io_rx_mode = ESP8266AT_IO_RX_MODE_RESP;
-    esp8266at->io_data_key_i = 0;
-    esp8266at->io_data_len = 0;
-    esp8266at->io_data_len_i = 0;
-    esp8266at->io_data_read = 0;
+    esp8266at_io_rx_init(esp8266at);
 
     r = mutex_create(&esp8266at->io_data_read_mutex);
     assert(r == 0);
@@ -73,29 +222,78 @@ ubi_st_t esp8266at_init(esp8266at_t *esp8266at)
     st = cbuf_create(&esp8266at->io_data_buf, ESP8266AT_IO_DATA_BUF_SIZE);
     assert(st == UBI_ERR_OK);
 
+    esp8266at->dialect = _dialects[0];
+    esp8266at->shadow_applied = 0;
+    esp8266at->shadow_force = 0;
+
     st = esp8266at_io_init(esp8266at);
     assert(st == UBI_ST_OK);
 
     memset(esp8266at->ssid, 0, ESP8266AT_SSID_LENGTH_MAX);
     memset(esp8266at->passwd, 0, ESP8266AT_PASSWD_LENGTH_MAX);
+    memset(&esp8266at->join_cache, 0, sizeof(esp8266at_join_cache_t));
+    memset(&esp8266at->join_time, 0, sizeof(esp8266at_join_time_t));
+    esp8266at->cwlap_mask = ESP8266AT_CWLAP_FIELD__ALL;
+    esp8266at->cwlap_opt_sort = 0;
+    esp8266at->cwlap_opt_mask = ESP8266AT_CWLAP_FIELD__ALL;
 
+    esp8266at->wifi_mode = 0;
     esp8266at->mux_mode = 0;
 
+    esp8266at->wifi_requested = 0;
+    esp8266at->wifi_connected = 0;
+
+    esp8266at->tcp_requested = 0;
+    esp8266at->tcp_connected = 0;
+    memset(esp8266at->tcp_type, 0, sizeof(esp8266at->tcp_type));
+    memset(esp8266at->tcp_host, 0, sizeof(esp8266at->tcp_host));
+    esp8266at->tcp_port = 0;
+
     esp8266at->dns_enable = 0;
     memset(esp8266at->dns_server_addr, 0, ESP8266AT_DNS_SERVER_MAX * ESP8266AT_DNS_SERVER_ADDR_LENGTH_MAX);
 
+    esp8266at->ssl_buf_size = 0;
+    esp8266at->ssl_auth_mode = ESP8266AT_SSL_AUTH__NONE;
+    esp8266at->ssl_pki_number = 0;
+    esp8266at->ssl_ca_number = 0;
+    memset(esp8266at->ssl_sni, 0, sizeof(esp8266at->ssl_sni));
+    esp8266at->ssl_connect_count = 0;
+    esp8266at->ssl_connect_last_ms = 0;
+    esp8266at->ssl_connect_max_ms = 0;
+
+    esp8266at->dns_cache_enable = 0;
+    esp8266at->dns_cache_ttl_ms = ESP8266AT_DNS_CACHE_TTL_MS;
+    esp8266at->dns_refresh_tick = 0;
+    memset(esp8266at->dns_cache, 0, sizeof(esp8266at->dns_cache));
+
+#if (ESP8266AT__ENABLE_SNTP == 1)
     esp8266at->sntp_enable = 0;
     esp8266at->sntp_timezone = 0;
     memset(esp8266at->sntp_server_addr, 0, ESP8266AT_SNTP_SERVER_MAX * ESP8266AT_SNTP_SERVER_ADDR_LENGTH_MAX);
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
+
+    esp8266at->io_urc_flags = 0;
+    esp8266at->io_urc_ignore = 0;
+    r = semb_create(&esp8266at->io_urc_sem);
+    assert(r == 0);
 
+#if (ESP8266AT__ENABLE_MQTT == 1)
     esp8266at->mqtt_scheme = 1; // MQTT over TCP
     memset(esp8266at->mqtt_client_id, 0, ESP8266AT_MQTT_CLIENT_ID_LENGTH_MAX);
     memset(esp8266at->mqtt_username, 0, ESP8266AT_MQTT_USERNAME_LENGTH_MAX);
     memset(esp8266at->mqtt_passwd, 0, ESP8266AT_MQTT_PASSWD_LENGTH_MAX);
 
+    esp8266at->mqtt_keepalive = ESP8266AT_MQTT_KEEPALIVE_DEFAULT;
+    esp8266at->mqtt_disable_clean_session = 0;
+    memset(esp8266at->mqtt_lwt_topic, 0, ESP8266AT_MQTT_LWT_TOPIC_LENGTH_MAX + 1);
+    memset(esp8266at->mqtt_lwt_msg, 0, ESP8266AT_MQTT_LWT_MSG_LENGTH_MAX + 1);
+    esp8266at->mqtt_lwt_qos = 0;
+    esp8266at->mqtt_lwt_retain = 0;
+
     for (int i = 0; i < ESP8266AT_IO_MQTT_SUB_BUF_MAX; i++)
     {
         memset(esp8266at->mqtt_sub_bufs[i].topic, 0, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX);
+        esp8266at->mqtt_sub_bufs[i].qos = 0;
         st = msgq_create(&esp8266at->mqtt_sub_bufs[i].msgs, sizeof(esp8266at_mqtt_sub_buf_msg_t), ESP8266AT_IO_MQTT_SUB_BUF_MSG_MAX);
         assert(st == UBI_ERR_OK);
         st = cbuf_create(&esp8266at->mqtt_sub_bufs[i].data_buf, ESP8266AT_IO_MQTT_SUB_DATA_BUF_SIZE);
@@ -104,8 +302,62 @@ ubi_st_t esp8266at_init(esp8266at_t *esp8266at)
         assert(st == UBI_ERR_OK);
     }
 
-    esp8266at->io_mqtt_key_i = 0;
-    esp8266at->io_mqtt_topic_i = 0;
+    esp8266at->mqtt_requested = 0;
+    esp8266at->mqtt_connected = 0;
+    memset(esp8266at->mqtt_host, 0, sizeof(esp8266at->mqtt_host));
+    esp8266at->mqtt_port = 0;
+    esp8266at->mqtt_reconnect = 0;
+    esp8266at_mqtt_pub_stat_reset(esp8266at);
+    memset(esp8266at->mqtt_pub_topic, 0, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX);
+
+    r = mutex_create(&esp8266at->mqtt_pubq_mutex);
+    assert(r == 0);
+    for (int i = 0; i < ESP8266AT_MQTT_PUBQ_MSG_MAX; i++)
+    {
+        esp8266at->mqtt_pubq_order[i] = i;
+    }
+    esp8266at->mqtt_pubq_count = 0;
+    esp8266at->mqtt_pubq_inflight = 0;
+    esp8266at->mqtt_pubq_spill_count = 0;
+    esp8266at->mqtt_pubq_drop_count = 0;
+    esp8266at->mqtt_pubq_drop_policy = ESP8266AT_MQTT_PUBQ_DROP_OLDEST;
+    memset(&esp8266at->mqtt_pubq_spill, 0, sizeof(esp8266at_mqtt_pubq_spill_t));
+    esp8266at->mqtt_pubq_task = NULL;
+    esp8266at->mqtt_pubq_cancel = 0;
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+    esp8266at->last_rsp_tick = _gettick();
+
+    esp8266at->power_state = ESP8266AT_POWER_ACTIVE;
+    esp8266at_power_stat_reset(esp8266at);
+
+    esp8266at->supervisor_task = NULL;
+    esp8266at->supervisor_enable = 0;
+    esp8266at->supervisor_busy = 0;
+    esp8266at->supervisor_cancel = 0;
+    esp8266at->supervisor_level = ESP8266AT_RECOVERY_NONE;
+    esp8266at->supervisor_outage = 0;
+    esp8266at->supervisor_outage_tick = 0;
+    esp8266at->supervisor_backoff_ms = ESP8266AT_SUPERVISOR_BACKOFF_MIN_MS;
+    esp8266at->supervisor_probe_interval_ms = ESP8266AT_SUPERVISOR_PROBE_INTERVAL_MIN_MS;
+    esp8266at->supervisor_probe_fail = 0;
+    memset(&esp8266at->supervisor_stat, 0, sizeof(esp8266at_supervisor_stat_t));
+
+#if (ESP8266AT_LOG_DEFER == 1)
+    esp8266at->log_defer_head = 0;
+    esp8266at->log_defer_count = 0;
+    esp8266at->log_defer_drop_count = 0;
+    r = task_create(&esp8266at->log_defer_task, _log_defer_taskfunc, esp8266at, task_getlowestpriority(), 0, "esp8266at_log");
+    assert(r == 0);
+#endif /* (ESP8266AT_LOG_DEFER == 1) */
+
+    _wait_ready(esp8266at, ESP8266AT_RESTART_BANNER, ESP8266AT_RESTART_SETUP_TIME_MS, NULL);
+
+    if (sizeof(_dialects) / sizeof(_dialects[0]) > 1)
+    {
+        // AT+GMR selects the dialect. If the module does not answer yet, the default is kept until the next AT+GMR.
+        esp8266at_cmd_at_gmr(esp8266at, ESP8266AT_DIALECT_DETECT_TIMEOUT_MS, NULL);
+    }
 
     st = UBI_ST_OK;
 
@@ -119,6 +371,23 @@ ubi_st_t esp8266at_deinit(esp8266at_t *esp8266at)
     assert(esp8266at != NULL);
     assert(esp8266at->cmd_mutex != NULL);
 
+    if (esp8266at->supervisor_task != NULL)
+    {
+        esp8266at_supervisor_stop(esp8266at);
+        esp8266at->supervisor_cancel = 1;
+        task_join_and_delete(&esp8266at->supervisor_task, NULL, 1);
+    }
+
+#if (ESP8266AT__ENABLE_MQTT == 1)
+    // The task may be holding cmd_mutex or waiting on io_urc_sem, so it has to return before they are deleted.
+    if (esp8266at->mqtt_pubq_task != NULL)
+    {
+        esp8266at->mqtt_pubq_cancel = 1;
+        sem_give(esp8266at->io_urc_sem);
+        task_join_and_delete(&esp8266at->mqtt_pubq_task, NULL, 1);
+    }
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
     st = esp8266at_io_deinit(esp8266at);
 
     mutex_delete(&esp8266at->io_data_read_mutex);
@@ -135,6 +404,7 @@ ubi_st_t esp8266at_deinit(esp8266at_t *esp8266at)
 
     mutex_delete(&esp8266at->cmd_mutex);
 
+#if (ESP8266AT__ENABLE_MQTT == 1)
     for (int i = 0; i < ESP8266AT_IO_MQTT_SUB_BUF_MAX; i++)
     {
         cbuf_delete(&esp8266at->mqtt_sub_bufs[i].data_buf);
@@ -142,6 +412,16 @@ ubi_st_t esp8266at_deinit(esp8266at_t *esp8266at)
         mutex_delete(&esp8266at->mqtt_sub_bufs[i].data_mutex);
     }
 
+    mutex_delete(&esp8266at->mqtt_pubq_mutex);
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+#if (ESP8266AT_LOG_DEFER == 1)
+    if (esp8266at->log_defer_task != NULL)
+    {
+        task_delete(&esp8266at->log_defer_task);
+    }
+#endif /* (ESP8266AT_LOG_DEFER == 1) */
+    sem_delete(&esp8266at->io_urc_sem);
+
     return st;
 }
 
@@ -149,27 +429,217 @@ ubi_st_t esp8266at_reset(esp8266at_t *esp8266at)
 {
     ubi_st_t st;
 
+    mutex_lock(esp8266at->cmd_mutex);
+
     esp8266at_io_module_reset(esp8266at);
     esp8266at_io_uart_reset(esp8266at);
 
-    st = UBI_ST_OK;
+    esp8266at_shadow_invalidate(esp8266at);
+    _power_state_set(esp8266at, ESP8266AT_POWER_ACTIVE);
+
+    st = _wait_ready(esp8266at, ESP8266AT_RESTART_BANNER, ESP8266AT_RESTART_SETUP_TIME_MS, NULL);
+
+    // The links are gone with the restart, which is already handled here.
+    _restart_reset(esp8266at);
+    _urc_clear(esp8266at, ESP8266AT_IO_URC__READY);
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+static void _urc_clear(esp8266at_t *esp8266at, uint32_t flags)
+{
+    ubik_entercrit();
+    esp8266at->io_urc_flags &= ~flags;
+    ubik_exitcrit();
+}
+
+// After a restart the links are gone and the module options are back to their defaults.
+static void _restart_reset(esp8266at_t *esp8266at)
+{
+    esp8266at->cwlap_mask = ESP8266AT_CWLAP_FIELD__ALL;
+    esp8266at->wifi_connected = 0;
+    esp8266at->tcp_connected = 0;
+#if (ESP8266AT__ENABLE_MQTT == 1)
+    esp8266at->mqtt_connected = 0;
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+}
+
+ubi_st_t esp8266at_shadow_invalidate(esp8266at_t *esp8266at)
+{
+    esp8266at->shadow_applied = 0;
+
+    return UBI_ST_OK;
+}
+
+ubi_st_t esp8266at_shadow_force(esp8266at_t *esp8266at, uint8_t force)
+{
+    esp8266at->shadow_force = force;
+
+    return UBI_ST_OK;
+}
+
+static uint32_t _shadow_hash(char *cmd)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*cmd != 0)
+    {
+        hash = (hash ^ (uint8_t) *cmd) * 16777619u;
+        cmd++;
+    }
+
+    return hash;
+}
+
+static uint8_t _shadow_skip(esp8266at_t *esp8266at, uint32_t id, char *cmd)
+{
+    // Pick up a "ready" banner of an unexpected module restart.
+    if ((esp8266at->io_urc_flags & ESP8266AT_IO_URC__READY) != 0)
+    {
+        _urc_process(esp8266at);
+    }
+
+    if (esp8266at->shadow_force || esp8266at->temp_cmd_overflow || (esp8266at->shadow_applied & (1 << id)) == 0)
+    {
+        return 0;
+    }
+
+    if (esp8266at->shadow_hash[id] != _shadow_hash(cmd))
+    {
+        return 0;
+    }
+
+    ESP8266AT_LOG_CMD(esp8266at, ESP8266AT_LOG_SHADOW_SKIP, cmd, NULL, 0, 0);
+
+    return 1;
+}
+
+static void _shadow_update(esp8266at_t *esp8266at, uint32_t id, char *cmd, ubi_st_t st)
+{
+    if (st == UBI_ST_OK)
+    {
+        esp8266at->shadow_hash[id] = _shadow_hash(cmd);
+        esp8266at->shadow_applied |= (1 << id);
+    }
+    else
+    {
+        esp8266at->shadow_applied &= ~(1 << id);
+    }
+}
+
+static uint32_t _gettick(void)
+{
+    return ubik_gettickcount().low;
+}
+
+static uint32_t _elapsedms(uint32_t begin_tick)
+{
+    return ubik_ticktotimems(_gettick() - begin_tick);
+}
+
+static ubi_st_t _wait_ready(esp8266at_t *esp8266at, uint8_t banner, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    ubi_st_t st;
+    uint32_t banner_timeoutms;
+    uint32_t probe_timeoutms;
+
+    st = UBI_ST_ERR;
+
+    if (banner)
+    {
+        // Boot messages (74880 bps) can fill the buffer before "ready" arrives, so keep reading,
+        // but leave a share of the time for AT probes in case the banner itself was lost.
+        banner_timeoutms = timeoutms - timeoutms / ESP8266AT_READY_PROBE_SHARE;
+        timeoutms -= banner_timeoutms;
+        do
+        {
+            st = _wait_rsp(esp8266at, "ready\r\n", esp8266at->temp_resp_buf, ESP8266AT_TEMP_RESP_BUF_SIZE, NULL, banner_timeoutms,
+                    &banner_timeoutms);
+        } while (st == UBI_ST_ERR && banner_timeoutms > 0);
+        timeoutms += banner_timeoutms;
+    }
+
+    // Without a restart or when the banner was missed, the module is ready once it answers AT.
+    while (st != UBI_ST_OK && timeoutms > 0)
+    {
+        probe_timeoutms = min(timeoutms, ESP8266AT_READY_PROBE_TIMEOUT_MS);
+        timeoutms -= probe_timeoutms;
+        st = _send_cmd_and_wait_rsp(esp8266at, "AT\r\n", "OK\r\n", probe_timeoutms, &probe_timeoutms);
+        timeoutms += probe_timeoutms;
+    }
+
+    logmfd("wait ready : status = %d", st);
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
 
     return st;
 }
 
 static ubi_st_t _wait_rsp(esp8266at_t *esp8266at, char *rsp, uint8_t *buffer, uint32_t length, uint32_t *received, uint32_t timeoutms,
         uint32_t *remain_timeoutms)
+{
+    return _wait_rsp_advan(esp8266at, rsp, 0, buffer, length, received, timeoutms, remain_timeoutms);
+}
+
+static uint8_t _token_step(const char *token, uint32_t *token_i, uint8_t c)
+{
+    if (token[*token_i] == c)
+    {
+        (*token_i)++;
+    }
+    else
+    {
+        *token_i = (token[0] == c) ? 1 : 0;
+    }
+
+    if (token[*token_i] == 0)
+    {
+        *token_i = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Matches the token only as a whole line, so echoed text or a field that ends in the same bytes is not taken for it.
+static uint8_t _line_token_step(const char *token, uint32_t *token_i, uint8_t *buffer, uint32_t buf_i)
+{
+    uint32_t token_len;
+
+    if (!_token_step(token, token_i, buffer[buf_i]))
+    {
+        return 0;
+    }
+
+    token_len = strlen(token);
+    if (buf_i + 1 == token_len || buffer[buf_i - token_len] == '\n')
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+static ubi_st_t _wait_rsp_advan(esp8266at_t *esp8266at, char *rsp, uint8_t watch_error, uint8_t *buffer, uint32_t length, uint32_t *received,
+        uint32_t timeoutms, uint32_t *remain_timeoutms)
 {
     ubi_st_t st;
     uint32_t read;
     uint32_t rsp_len;
     uint32_t rsp_i;
     uint32_t buf_i;
+    uint32_t error_i;
+    uint32_t fail_i;
 
     st = UBI_ST_ERR;
+    esp8266at->rsp_end = ESP8266AT_RSP_END_NONE;
 
-    logmd("wait response : begin");
-    logmfd("wait response : \"%s\"", rsp);
+    ESP8266AT_LOG_CMD(esp8266at, ESP8266AT_LOG_WAIT_RSP_BEGIN, rsp, NULL, 0, 0);
 
     do
     {
@@ -181,11 +651,17 @@ static ubi_st_t _wait_rsp(esp8266at_t *esp8266at, char *rsp, uint8_t *buffer, ui
         rsp_len = strlen(rsp);
         rsp_i = 0;
         buf_i = 0;
+        error_i = 0;
+        fail_i = 0;
         while ((rsp_i < rsp_len) && (buf_i < length - 1))
         {
             st = esp8266at_io_read_timedms(esp8266at, &buffer[buf_i], 1, &read, timeoutms, &timeoutms);
             if (st != UBI_ST_OK)
             {
+                if (st == UBI_ST_TIMEOUT)
+                {
+                    esp8266at->rsp_end = ESP8266AT_RSP_END_TIMEOUT;
+                }
                 break;
             }
             if (read != 1)
@@ -203,7 +679,25 @@ static ubi_st_t _wait_rsp(esp8266at_t *esp8266at, char *rsp, uint8_t *buffer, ui
                 rsp_i = 0;
             }
 
+            // Stop at an ERROR or FAIL line instead of waiting for the timeout.
+            if (watch_error)
+            {
+                if (_line_token_step("ERROR\r\n", &error_i, buffer, buf_i))
+                {
+                    esp8266at->rsp_end = ESP8266AT_RSP_END_ERROR;
+                }
+                if (_line_token_step("FAIL\r\n", &fail_i, buffer, buf_i))
+                {
+                    esp8266at->rsp_end = ESP8266AT_RSP_END_FAIL;
+                }
+            }
+
             buf_i++;
+
+            if (esp8266at->rsp_end != ESP8266AT_RSP_END_NONE)
+            {
+                break;
+            }
         }
         buffer[buf_i] = 0;
 
@@ -218,6 +712,7 @@ static ubi_st_t _wait_rsp(esp8266at_t *esp8266at, char *rsp, uint8_t *buffer, ui
             *received = buf_i;
         }
 
+        esp8266at->rsp_end = ESP8266AT_RSP_END_OK;
         st = UBI_ST_OK;
 
         break;
@@ -228,162 +723,777 @@ static ubi_st_t _wait_rsp(esp8266at_t *esp8266at, char *rsp, uint8_t *buffer, ui
         *remain_timeoutms = timeoutms;
     }
 
-    logmfd("wait response : status = %d, size = %d, data = \"%s\"", st, buf_i, buffer);
-    logmd("wait response : end");
+    ESP8266AT_LOG_CMD(esp8266at, ESP8266AT_LOG_WAIT_RSP_END, (char *) buffer, NULL, st, buf_i);
 
     return st;
 }
 
-static ubi_st_t _send_cmd_and_wait_rsp(esp8266at_t *esp8266at, char *cmd, char *rsp, uint32_t timeoutms, uint32_t *remain_timeoutms)
+static uint32_t _stat_cmd_type(const char *cmd)
 {
-    ubi_st_t st;
+    if (strncmp(cmd, "AT+CIPSEND", 10) == 0)
+    {
+        return ESP8266AT_STAT_CMD_SEND;
+    }
+    if (strncmp(cmd, "AT+CIP", 6) == 0)
+    {
+        return ESP8266AT_STAT_CMD_IP;
+    }
+    if (strncmp(cmd, "AT+CW", 5) == 0)
+    {
+        return ESP8266AT_STAT_CMD_WIFI;
+    }
+    if (strncmp(cmd, "AT+MQTT", 7) == 0)
+    {
+        return ESP8266AT_STAT_CMD_MQTT;
+    }
 
-    st = UBI_ST_ERR;
+    return ESP8266AT_STAT_CMD_BASIC;
+}
+
+static void _stat_cmd_end(esp8266at_t *esp8266at, char *cmd, uint32_t begin_tick)
+{
+    esp8266at_cmd_stat_t *stat = &esp8266at->stat.cmd[_stat_cmd_type(cmd)];
+    uint32_t latency_ms;
+    uint32_t bin;
 
-    logmd("send command : begin");
-    logmfd("send command : command = \"%s\", expected response = \"%s\"", cmd, rsp);
+    stat->count++;
 
-    do
+    switch (esp8266at->rsp_end)
     {
-        st = esp8266at_io_read_buf_clear_timedms(esp8266at, timeoutms, &timeoutms);
-        if (st != UBI_ST_OK)
-        {
-            break;
-        }
+    case ESP8266AT_RSP_END_OK:
+        stat->ok_count++;
+        break;
+    case ESP8266AT_RSP_END_ERROR:
+        stat->error_count++;
+        break;
+    case ESP8266AT_RSP_END_FAIL:
+        stat->fail_count++;
+        break;
+    case ESP8266AT_RSP_END_TIMEOUT:
+        stat->timeout_count++;
+        return;
+    default:
+        stat->other_count++;
+        return;
+    }
 
-        st = esp8266at_io_write_timedms(esp8266at, (uint8_t*) cmd, strlen(cmd), NULL, timeoutms, &timeoutms);
-        if (st != UBI_ST_OK)
-        {
-            break;
-        }
-        st = esp8266at_io_flush_timedms(esp8266at, timeoutms, &timeoutms);
-        if (st != UBI_ST_OK)
-        {
-            break;
-        }
+    latency_ms = _elapsedms(begin_tick);
 
-        st = _wait_rsp(esp8266at, rsp, esp8266at->temp_resp_buf, ESP8266AT_TEMP_RESP_BUF_SIZE, NULL, timeoutms, &timeoutms);
-        if (st != UBI_ST_OK)
+    for (bin = 0; bin < ESP8266AT_STAT_LATENCY_BIN_MAX - 1; bin++)
+    {
+        if (latency_ms < _stat_latency_bin_ms[bin])
         {
             break;
         }
+    }
+    stat->latency_hist[bin]++;
+    if (latency_ms > stat->latency_max_ms)
+    {
+        stat->latency_max_ms = latency_ms;
+    }
+    stat->latency_sum_ms += latency_ms;
+}
 
-        break;
-    } while (1);
+static void _trace_cmd_begin(esp8266at_t *esp8266at, char *cmd)
+{
+#if (ESP8266AT__ENABLE_TRACE == 1)
+    uint8_t data = _stat_cmd_type(cmd);
 
-    if (remain_timeoutms)
+    esp8266at_trace_put(esp8266at, ESP8266AT_TRACE_CMD_BEGIN, &data, 1);
+#endif /* (ESP8266AT__ENABLE_TRACE == 1) */
+}
+
+static void _trace_cmd_end(esp8266at_t *esp8266at, ubi_st_t st)
+{
+#if (ESP8266AT__ENABLE_TRACE == 1)
+    uint8_t data[2];
+
+    data[0] = esp8266at->rsp_end;
+    data[1] = (uint8_t) (int8_t) st;
+    esp8266at_trace_put(esp8266at, ESP8266AT_TRACE_CMD_END, data, 2);
+#endif /* (ESP8266AT__ENABLE_TRACE == 1) */
+}
+
+#if (ESP8266AT__CMD_LOG_LEVEL >= LOGM_LEVEL__DEBUG)
+
+static void _log_cmd_format(uint8_t event, const char *s0, const char *s1, int32_t a0, int32_t a1)
+{
+    switch (event)
     {
-        *remain_timeoutms = timeoutms;
+    case ESP8266AT_LOG_WAIT_RSP_BEGIN:
+        logmd("wait response : begin");
+        logmfd("wait response : \"%s\"", s0);
+        break;
+    case ESP8266AT_LOG_WAIT_RSP_END:
+        logmfd("wait response : status = %d, size = %d, data = \"%s\"", a0, a1, s0);
+        logmd("wait response : end");
+        break;
+    case ESP8266AT_LOG_SEND_CMD_BEGIN:
+        logmd("send command : begin");
+        logmfd("send command : command = \"%s\", expected response = \"%s\"", s0, s1);
+        break;
+    case ESP8266AT_LOG_SEND_CMD_END:
+        logmfd("send command : status = %d", a0);
+        logmd("send command : end");
+        break;
+    case ESP8266AT_LOG_READ_LINES_BEGIN:
+        logmd("send command : begin");
+        logmfd("send command : command = \"%s\", streamed response", s0);
+        break;
+    case ESP8266AT_LOG_READ_LINES_END:
+        logmfd("send command : status = %d, lines = %d", a0, a1);
+        logmd("send command : end");
+        break;
+    case ESP8266AT_LOG_SHADOW_SKIP:
+        logmfd("skip already applied command : \"%s\"", s0);
+        break;
+    default:
+        break;
     }
+}
 
-    logmfd("send command : status = %d", st);
-    logmd("send command : end");
+#if (ESP8266AT_LOG_DEFER == 1)
 
-    return st;
+static void _log_defer_copy(char *dst, const char *src)
+{
+    uint32_t i = 0;
+
+    if (src != NULL)
+    {
+        for (; i < ESP8266AT_LOG_DEFER_STR_LEN && src[i] != 0; i++)
+        {
+            dst[i] = src[i];
+        }
+    }
+    dst[i] = 0;
 }
 
-static void _esp8266at_interactive_recvfunc(void *arg)
+static void _log_cmd(esp8266at_t *esp8266at, uint8_t event, const char *s0, const char *s1, int32_t a0, int32_t a1)
 {
-    esp8266at_t *esp8266at = (esp8266at_t *) arg;
-    uint8_t data;
-    uint32_t read;
+    esp8266at_log_rec_t *rec;
 
-    while (esp8266at->cancel_interactive_mode == 0)
+    // Only a bounded copy is made here, formatting is left to the lowest priority task.
+    ubik_entercrit();
+    if (esp8266at->log_defer_count == ESP8266AT_LOG_DEFER_MAX)
     {
-        esp8266at_io_read_timedms(esp8266at, &data, 1, &read, 1000, NULL);
-        if (read == 1) {
-            dtty_putc(data);
-            dtty_flush();
-        }
+        esp8266at->log_defer_head = (esp8266at->log_defer_head + 1) % ESP8266AT_LOG_DEFER_MAX;
+        esp8266at->log_defer_count--;
+        esp8266at->log_defer_drop_count++;
     }
+    rec = &esp8266at->log_defer[(esp8266at->log_defer_head + esp8266at->log_defer_count) % ESP8266AT_LOG_DEFER_MAX];
+    rec->tick = _gettick();
+    rec->event = event;
+    rec->a0 = a0;
+    rec->a1 = a1;
+    _log_defer_copy(rec->s0, s0);
+    _log_defer_copy(rec->s1, s1);
+    esp8266at->log_defer_count++;
+    ubik_exitcrit();
 }
 
-ubi_st_t esp8266at_cmd_at_interactive(esp8266at_t *esp8266at)
+#else
+
+static void _log_cmd(esp8266at_t *esp8266at, uint8_t event, const char *s0, const char *s1, int32_t a0, int32_t a1)
 {
-    int r;
-    ubi_st_t st;
-    task_pt recv_task;
-    char data[2];
-    int len;
-    int old_echo;
-    uint8_t ignore_lf = 0;
+    (void) esp8266at;
 
-    st = UBI_ST_ERR;
+    _log_cmd_format(event, s0, s1, a0, a1);
+}
 
-    r = mutex_lock(esp8266at->cmd_mutex);
-    if (r != 0)
+#endif /* (ESP8266AT_LOG_DEFER == 1) */
+
+#endif /* (ESP8266AT__CMD_LOG_LEVEL >= LOGM_LEVEL__DEBUG) */
+
+#if (ESP8266AT_LOG_DEFER == 1)
+
+ubi_st_t esp8266at_log_defer_flush(esp8266at_t *esp8266at)
+{
+    esp8266at_log_rec_t rec;
+    uint32_t count;
+    uint32_t drop_count;
+
+    ubik_entercrit();
+    count = esp8266at->log_defer_count;
+    drop_count = esp8266at->log_defer_drop_count;
+    esp8266at->log_defer_drop_count = 0;
+    rec.tick = esp8266at->log_defer[esp8266at->log_defer_head].tick;
+    ubik_exitcrit();
+
+    if (count == 0 && drop_count == 0)
     {
-        return UBI_ST_ERR;
+        return UBI_ST_OK;
     }
 
-    do {
-        esp8266at->cancel_interactive_mode = 0;
-        r = task_create_noautodel(&recv_task, _esp8266at_interactive_recvfunc, esp8266at, task_getmiddlepriority(), 0, "esp8266at_i_recv");
-        if (r != 0)
+    logmfd("deferred log : %d records, oldest %d ms ago, %d dropped", count, _elapsedms(rec.tick), drop_count);
+
+    // Records added while formatting are left for the next flush.
+    for (; count > 0; count--)
+    {
+        ubik_entercrit();
+        memcpy(&rec, &esp8266at->log_defer[esp8266at->log_defer_head], sizeof(esp8266at_log_rec_t));
+        esp8266at->log_defer_head = (esp8266at->log_defer_head + 1) % ESP8266AT_LOG_DEFER_MAX;
+        esp8266at->log_defer_count--;
+        ubik_exitcrit();
+
+        _log_cmd_format(rec.event, rec.s0, rec.s1, rec.a0, rec.a1);
+    }
+
+    return UBI_ST_OK;
+}
+
+static void _log_defer_taskfunc(void *arg)
+{
+    esp8266at_t *esp8266at = (esp8266at_t *) arg;
+
+    for (;;)
+    {
+        esp8266at_log_defer_flush(esp8266at);
+        task_sleepms(ESP8266AT_LOG_DEFER_PERIOD_MS);
+    }
+}
+
+#elif (ESP8266AT__ENABLE_DEFERRED_LOG == 1)
+
+ubi_st_t esp8266at_log_defer_flush(esp8266at_t *esp8266at)
+{
+    (void) esp8266at;
+
+    return UBI_ST_OK;
+}
+
+#endif /* (ESP8266AT_LOG_DEFER == 1) */
+
+static void _cmd_put(esp8266at_t *esp8266at, char c)
+{
+    // Keep one byte for the terminator.
+    if (esp8266at->temp_cmd_len >= ESP8266AT_TEMP_CMD_BUF_SIZE - 1)
+    {
+        esp8266at->temp_cmd_overflow = 1;
+        return;
+    }
+
+    esp8266at->temp_cmd_buf[esp8266at->temp_cmd_len++] = c;
+}
+
+static void _cmd_begin(esp8266at_t *esp8266at, const char *str)
+{
+    esp8266at->temp_cmd_len = 0;
+    esp8266at->temp_cmd_overflow = 0;
+
+    _cmd_str(esp8266at, str);
+}
+
+static void _cmd_str(esp8266at_t *esp8266at, const char *str)
+{
+    while (*str != 0)
+    {
+        _cmd_put(esp8266at, *str++);
+    }
+
+    esp8266at->temp_cmd_buf[esp8266at->temp_cmd_len] = 0;
+}
+
+static void _cmd_quoted(esp8266at_t *esp8266at, const char *str)
+{
+    _cmd_quoted_escape(esp8266at, str, esp8266at->dialect->quote_escape);
+}
+
+#if (ESP8266AT__ENABLE_MQTT == 1)
+// WizFi360 takes a backslash in its MQTT commands literally.
+static void _cmd_quoted_mqtt(esp8266at_t *esp8266at, const char *str)
+{
+    _cmd_quoted_escape(esp8266at, str, esp8266at->dialect->mqtt_quote_escape);
+}
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+static void _cmd_quoted_escape(esp8266at_t *esp8266at, const char *str, const char *escape)
+{
+    _cmd_put(esp8266at, '"');
+    while (*str != 0)
+    {
+        // The AT parser takes these literally only when escaped.
+        if (strchr(escape, *str) != NULL)
         {
-            st = UBI_ST_ERR;
+            _cmd_put(esp8266at, '\\');
+        }
+        _cmd_put(esp8266at, *str++);
+    }
+    _cmd_put(esp8266at, '"');
+
+    esp8266at->temp_cmd_buf[esp8266at->temp_cmd_len] = 0;
+}
+
+static void _cmd_int(esp8266at_t *esp8266at, int32_t value)
+{
+    if (value < 0)
+    {
+        _cmd_put(esp8266at, '-');
+        _cmd_uint(esp8266at, 0 - (uint32_t) value);
+    }
+    else
+    {
+        _cmd_uint(esp8266at, (uint32_t) value);
+    }
+}
+
+static void _cmd_uint(esp8266at_t *esp8266at, uint32_t value)
+{
+    char digits[10];
+    int count = 0;
+
+    do
+    {
+        digits[count++] = '0' + (value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    while (count > 0)
+    {
+        _cmd_put(esp8266at, digits[--count]);
+    }
+
+    esp8266at->temp_cmd_buf[esp8266at->temp_cmd_len] = 0;
+}
+
+static void _cmd_end(esp8266at_t *esp8266at)
+{
+    _cmd_str(esp8266at, "\r\n");
+}
+
+static ubi_st_t _send_cmd(esp8266at_t *esp8266at, char *cmd, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    ubi_st_t st;
+
+    st = UBI_ST_ERR;
+
+    do
+    {
+        // A truncated command must never reach the module.
+        if (cmd == esp8266at->temp_cmd_buf && esp8266at->temp_cmd_overflow)
+        {
+            logmfw("command overflow : \"%s\"", cmd);
+            st = UBI_ST_ERR_OVERFLOW;
             break;
         }
-        old_echo = dtty_getecho();
-        dtty_setecho(0);
 
-        while (1)
+        if (esp8266at->power_state == ESP8266AT_POWER_LIGHT_SLEEP || esp8266at->power_state == ESP8266AT_POWER_DEEP_SLEEP)
         {
-            r = dtty_getc(data);
-            len = 1;
-            if (r != 0)
-            {
-                continue;
-            }
-            if (data[0] == '\033') // ESC
+            st = _wakeup(esp8266at, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
             {
-                st = UBI_ST_OK;
                 break;
             }
-            if (ignore_lf)
+        }
+
+        st = esp8266at_io_read_buf_clear_timedms(esp8266at, timeoutms, &timeoutms);
+        if (st != UBI_ST_OK)
+        {
+            break;
+        }
+
+        st = esp8266at_io_write_timedms(esp8266at, (uint8_t*) cmd, strlen(cmd), NULL, timeoutms, &timeoutms);
+        if (st != UBI_ST_OK)
+        {
+            break;
+        }
+        st = esp8266at_io_flush_timedms(esp8266at, timeoutms, &timeoutms);
+        if (st != UBI_ST_OK)
+        {
+            break;
+        }
+
+        break;
+    } while (1);
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    return st;
+}
+
+static ubi_st_t _send_cmd_and_wait_rsp(esp8266at_t *esp8266at, char *cmd, char *rsp, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    ubi_st_t st;
+    uint32_t begin_tick;
+
+    st = UBI_ST_ERR;
+
+    ESP8266AT_LOG_CMD(esp8266at, ESP8266AT_LOG_SEND_CMD_BEGIN, cmd, rsp, 0, 0);
+
+    begin_tick = _gettick();
+    _trace_cmd_begin(esp8266at, cmd);
+
+    do
+    {
+        st = _send_cmd(esp8266at, cmd, timeoutms, &timeoutms);
+        if (st != UBI_ST_OK)
+        {
+            esp8266at->rsp_end = (st == UBI_ST_TIMEOUT) ? ESP8266AT_RSP_END_TIMEOUT : ESP8266AT_RSP_END_NONE;
+            break;
+        }
+
+        st = _wait_rsp_advan(esp8266at, rsp, 1, esp8266at->temp_resp_buf, ESP8266AT_TEMP_RESP_BUF_SIZE, NULL, timeoutms, &timeoutms);
+        if (st != UBI_ST_OK)
+        {
+            break;
+        }
+
+        esp8266at->last_rsp_tick = _gettick();
+
+        break;
+    } while (1);
+
+    _stat_cmd_end(esp8266at, cmd, begin_tick);
+    _trace_cmd_end(esp8266at, st);
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    ESP8266AT_LOG_CMD(esp8266at, ESP8266AT_LOG_SEND_CMD_END, NULL, NULL, st, 0);
+
+    return st;
+}
+
+static ubi_st_t _read_line(esp8266at_t *esp8266at, char *buffer, uint32_t length, uint32_t *line_len, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    ubi_st_t st;
+    uint32_t read;
+    uint32_t buf_i;
+    uint8_t data;
+
+    st = UBI_ST_ERR;
+    buf_i = 0;
+
+    for (;;)
+    {
+        st = esp8266at_io_read_timedms(esp8266at, &data, 1, &read, timeoutms, &timeoutms);
+        if (st != UBI_ST_OK)
+        {
+            break;
+        }
+        if (read != 1)
+        {
+            st = UBI_ST_ERR;
+            break;
+        }
+
+        if (data == '\n')
+        {
+            break;
+        }
+
+        // The tail of a line longer than the buffer is dropped.
+        if (buf_i < length - 1)
+        {
+            buffer[buf_i] = data;
+            buf_i++;
+        }
+    }
+
+    if (buf_i > 0 && buffer[buf_i - 1] == '\r')
+    {
+        buf_i--;
+    }
+    buffer[buf_i] = 0;
+
+    if (line_len)
+    {
+        *line_len = buf_i;
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    return st;
+}
+
+static ubi_st_t _send_cmd_and_read_lines(esp8266at_t *esp8266at, char *cmd, esp8266at_line_handler_t handler, void *arg, uint32_t timeoutms,
+        uint32_t *remain_timeoutms)
+{
+    ubi_st_t st;
+    char *line = (char *) esp8266at->temp_resp_buf;
+    uint32_t line_count = 0;
+    uint32_t begin_tick;
+
+    st = UBI_ST_ERR;
+    esp8266at->rsp_end = ESP8266AT_RSP_END_NONE;
+
+    ESP8266AT_LOG_CMD(esp8266at, ESP8266AT_LOG_READ_LINES_BEGIN, cmd, NULL, 0, 0);
+
+    begin_tick = _gettick();
+    _trace_cmd_begin(esp8266at, cmd);
+
+    do
+    {
+        st = _send_cmd(esp8266at, cmd, timeoutms, &timeoutms);
+        if (st != UBI_ST_OK)
+        {
+            if (st == UBI_ST_TIMEOUT)
             {
-                ignore_lf = 0;
-                if (data[0] == '\n')
-                {
-                    continue;
-                }
+                esp8266at->rsp_end = ESP8266AT_RSP_END_TIMEOUT;
             }
-            if (data[0] == '\r' || data[0] == '\n')
+            break;
+        }
+
+        // Each line is handled as it arrives, so the response size does not matter.
+        for (;;)
+        {
+            st = _read_line(esp8266at, line, ESP8266AT_TEMP_RESP_BUF_SIZE, NULL, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
             {
-                if (data[0] == '\r')
+                if (st == UBI_ST_TIMEOUT)
                 {
-                    ignore_lf = 1;
+                    esp8266at->rsp_end = ESP8266AT_RSP_END_TIMEOUT;
                 }
-                data[0] = '\r';
-                data[1] = '\n';
-                len = 2;
+                break;
             }
 
-            st = esp8266at_io_write_timedms(esp8266at, (uint8_t*) data, len, NULL, UINT32_MAX, NULL);
-            if (st != UBI_ST_OK)
+            if (strcmp(line, "OK") == 0)
             {
+                esp8266at->rsp_end = ESP8266AT_RSP_END_OK;
+                esp8266at->last_rsp_tick = _gettick();
                 break;
             }
-            st = esp8266at_io_flush_timedms(esp8266at, UINT32_MAX, NULL);
-            if (st != UBI_ST_OK)
+            if (strcmp(line, "ERROR") == 0)
             {
+                esp8266at->rsp_end = ESP8266AT_RSP_END_ERROR;
+                st = UBI_ST_ERR;
+                break;
+            }
+            if (strcmp(line, "FAIL") == 0)
+            {
+                esp8266at->rsp_end = ESP8266AT_RSP_END_FAIL;
+                st = UBI_ST_ERR;
                 break;
             }
-        }
 
-        dtty_setecho(old_echo);
-        esp8266at->cancel_interactive_mode = 1;
-        r = task_join_and_delete(&recv_task, NULL, 1);
-        if (r != 0)
-        {
-            st = UBI_ST_ERR;
-            break;
+            if (line[0] != 0 && handler != NULL)
+            {
+                handler(arg, line);
+            }
+            line_count++;
         }
 
         break;
     } while (1);
 
-    mutex_unlock(esp8266at->cmd_mutex);
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    _stat_cmd_end(esp8266at, cmd, begin_tick);
+    _trace_cmd_end(esp8266at, st);
+
+    ESP8266AT_LOG_CMD(esp8266at, ESP8266AT_LOG_READ_LINES_END, NULL, NULL, st, line_count);
+
+    return st;
+}
+
+static char *_line_value(char *line, const char *key)
+{
+    uint32_t key_len = strlen(key);
+
+    if (strncmp(line, key, key_len) != 0)
+    {
+        return NULL;
+    }
+
+    return line + key_len;
+}
+
+static char *_next_field(char **next)
+{
+    char *ptr;
+    char *field;
+
+    ptr = *next;
+    if (*ptr == 0)
+    {
+        return NULL;
+    }
+
+    if (*ptr == '"')
+    {
+        // A quote belongs to the string (e.g. an SSID) unless the field ends right after it.
+        ptr++;
+        field = ptr;
+        while (*ptr != 0 && !(ptr[0] == '"' && (ptr[1] == ',' || ptr[1] == ')' || ptr[1] == 0)))
+        {
+            ptr++;
+        }
+        if (*ptr == '"')
+        {
+            *ptr = 0;
+            ptr++;
+        }
+    }
+    else
+    {
+        field = ptr;
+        while (*ptr != 0 && *ptr != ',' && *ptr != ')')
+        {
+            ptr++;
+        }
+    }
+
+    if (*ptr == ',' || *ptr == ')')
+    {
+        *ptr = 0;
+        ptr++;
+    }
+
+    *next = ptr;
+
+    return field;
+}
+
+static void _copy_field(char *dst, const char *field, uint32_t max_length)
+{
+    strncpy(dst, field, max_length);
+    dst[max_length] = 0;
+}
+
+static void _esp8266at_interactive_recvfunc(void *arg)
+{
+    esp8266at_t *esp8266at = (esp8266at_t *) arg;
+    uint8_t data;
+    uint32_t read;
+
+    while (esp8266at->cancel_interactive_mode == 0)
+    {
+        esp8266at_io_read_timedms(esp8266at, &data, 1, &read, 1000, NULL);
+        if (read == 1) {
+            dtty_putc(data);
+            dtty_flush();
+        }
+    }
+}
+
+ubi_st_t esp8266at_cmd_at_interactive(esp8266at_t *esp8266at)
+{
+    int r;
+    ubi_st_t st;
+    task_pt recv_task;
+    char data[2];
+    int len;
+    int old_echo;
+    uint8_t ignore_lf = 0;
+
+    st = UBI_ST_ERR;
+
+    r = mutex_lock(esp8266at->cmd_mutex);
+    if (r != 0)
+    {
+        return UBI_ST_ERR;
+    }
+
+    do {
+        esp8266at->cancel_interactive_mode = 0;
+        r = task_create_noautodel(&recv_task, _esp8266at_interactive_recvfunc, esp8266at, task_getmiddlepriority(), 0, "esp8266at_i_recv");
+        if (r != 0)
+        {
+            st = UBI_ST_ERR;
+            break;
+        }
+        old_echo = dtty_getecho();
+        dtty_setecho(0);
+
+        while (1)
+        {
+            r = dtty_getc(data);
+            len = 1;
+            if (r != 0)
+            {
+                continue;
+            }
+            if (data[0] == '\033') // ESC
+            {
+                st = UBI_ST_OK;
+                break;
+            }
+            if (ignore_lf)
+            {
+                ignore_lf = 0;
+                if (data[0] == '\n')
+                {
+                    continue;
+                }
+            }
+            if (data[0] == '\r' || data[0] == '\n')
+            {
+                if (data[0] == '\r')
+                {
+                    ignore_lf = 1;
+                }
+                data[0] = '\r';
+                data[1] = '\n';
+                len = 2;
+            }
+
+            st = esp8266at_io_write_timedms(esp8266at, (uint8_t*) data, len, NULL, UINT32_MAX, NULL);
+            if (st != UBI_ST_OK)
+            {
+                break;
+            }
+            st = esp8266at_io_flush_timedms(esp8266at, UINT32_MAX, NULL);
+            if (st != UBI_ST_OK)
+            {
+                break;
+            }
+        }
+
+        dtty_setecho(old_echo);
+        esp8266at->cancel_interactive_mode = 1;
+        r = task_join_and_delete(&recv_task, NULL, 1);
+        if (r != 0)
+        {
+            st = UBI_ST_ERR;
+            break;
+        }
+
+        break;
+    } while (1);
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_stream(esp8266at_t *esp8266at, char *cmd, esp8266at_line_handler_t handler, void *arg, uint32_t timeoutms,
+        uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    if (cmd == NULL)
+    {
+        return UBI_ST_ERR_PARAM;
+    }
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    _cmd_begin(esp8266at, cmd);
+    _cmd_end(esp8266at);
+    st = _send_cmd_and_read_lines(esp8266at, esp8266at->temp_cmd_buf, handler, arg, timeoutms, &timeoutms);
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
 
     return st;
 }
@@ -400,75 +1510,2622 @@ ubi_st_t esp8266at_cmd_at_test(esp8266at_t *esp8266at, uint32_t timeoutms, uint3
         return UBI_ST_TIMEOUT;
     }
 
-    st = _send_cmd_and_wait_rsp(esp8266at, "AT\r\n", "OK\r\n", timeoutms, &timeoutms);
+    st = _send_cmd_and_wait_rsp(esp8266at, "AT\r\n", "OK\r\n", timeoutms, &timeoutms);
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_rst(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+    uint32_t ready_timeoutms;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    do
+    {
+        st = _send_cmd_and_wait_rsp(esp8266at, "AT+RST\r\n", "OK\r\n", timeoutms, &timeoutms);
+        if (st != UBI_ST_OK)
+        {
+            break;
+        }
+
+        esp8266at_shadow_invalidate(esp8266at);
+
+        // AT+RST answers OK before it restarts, so the AT probes only start after most of the time was given to the banner.
+        ready_timeoutms = min(timeoutms, ESP8266AT_RESTART_SETUP_TIME_MS);
+        timeoutms -= ready_timeoutms;
+        st = _wait_ready(esp8266at, 1, ready_timeoutms, &ready_timeoutms);
+        timeoutms += ready_timeoutms;
+
+        _restart_reset(esp8266at);
+        _power_state_set(esp8266at, ESP8266AT_POWER_ACTIVE);
+        _urc_clear(esp8266at, ESP8266AT_IO_URC__READY);
+
+        break;
+    } while (1);
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+static void _power_state_set(esp8266at_t *esp8266at, uint8_t power_state)
+{
+    ubik_entercrit();
+    esp8266at->power_stat.state_ms[esp8266at->power_state] += _elapsedms(esp8266at->power_state_tick);
+    esp8266at->power_state_tick = _gettick();
+    esp8266at->power_state = power_state;
+    ubik_exitcrit();
+}
+
+static ubi_st_t _wakeup(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    ubi_st_t st;
+    uint8_t power_state;
+    uint32_t wakeup_timeoutms;
+    uint32_t probe_timeoutms;
+
+    power_state = esp8266at->power_state;
+
+    // Mark it active first, since the commands below go through _send_cmd_and_wait_rsp too.
+    _power_state_set(esp8266at, ESP8266AT_POWER_ACTIVE);
+
+    if (power_state == ESP8266AT_POWER_DEEP_SLEEP)
+    {
+        wakeup_timeoutms = min(timeoutms, ESP8266AT_RESTART_SETUP_TIME_MS);
+        timeoutms -= wakeup_timeoutms;
+
+        st = esp8266at_io_module_wakeup(esp8266at);
+        if (st == UBI_ST_OK)
+        {
+            esp8266at_io_uart_reset(esp8266at);
+        }
+        // Deep sleep ends with a restart even without a pin, so the banner comes in any case.
+        st = _wait_ready(esp8266at, 1, wakeup_timeoutms, &wakeup_timeoutms);
+        if (st == UBI_ST_OK)
+        {
+            // Deep sleep ends with a restart.
+            esp8266at_shadow_invalidate(esp8266at);
+            _restart_reset(esp8266at);
+            _urc_clear(esp8266at, ESP8266AT_IO_URC__READY);
+        }
+
+        timeoutms += wakeup_timeoutms;
+    }
+    else
+    {
+        wakeup_timeoutms = min(timeoutms, ESP8266AT_WAKEUP_TIMEOUT_MS);
+        timeoutms -= wakeup_timeoutms;
+
+        // The first bytes wake the module up and may be lost, so repeat AT until it answers.
+        st = UBI_ST_ERR;
+        while (st != UBI_ST_OK && wakeup_timeoutms > 0)
+        {
+            probe_timeoutms = min(wakeup_timeoutms, ESP8266AT_READY_PROBE_TIMEOUT_MS);
+            wakeup_timeoutms -= probe_timeoutms;
+            st = _send_cmd_and_wait_rsp(esp8266at, "AT\r\n", "OK\r\n", probe_timeoutms, &probe_timeoutms);
+            wakeup_timeoutms += probe_timeoutms;
+        }
+        if (st == UBI_ST_OK)
+        {
+            st = _send_cmd_and_wait_rsp(esp8266at, "AT+SLEEP=0\r\n", "OK\r\n", wakeup_timeoutms, &wakeup_timeoutms);
+        }
+
+        timeoutms += wakeup_timeoutms;
+    }
+
+    if (st == UBI_ST_OK)
+    {
+        esp8266at->power_stat.wakeup_count++;
+    }
+    else
+    {
+        esp8266at->power_stat.wakeup_fail_count++;
+        _power_state_set(esp8266at, power_state);
+    }
+
+    logmfd("wakeup : from = %d, status = %d", power_state, st);
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_sleep(esp8266at_t *esp8266at, uint8_t power_state, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+    int mode;
+
+    switch (power_state)
+    {
+    case ESP8266AT_POWER_ACTIVE:
+        mode = 0;
+        break;
+    case ESP8266AT_POWER_MODEM_SLEEP:
+        mode = esp8266at->dialect->sleep_modem;
+        break;
+    case ESP8266AT_POWER_LIGHT_SLEEP:
+        mode = esp8266at->dialect->sleep_light;
+        break;
+    default:
+        return UBI_ST_ERR_PARAM;
+    }
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    _cmd_begin(esp8266at, "AT+SLEEP=");
+    _cmd_int(esp8266at, mode);
+    _cmd_end(esp8266at);
+    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+    if (st == UBI_ST_OK)
+    {
+        _power_state_set(esp8266at, power_state);
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_gslp(esp8266at_t *esp8266at, uint32_t sleep_timems, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    _cmd_begin(esp8266at, "AT+GSLP=");
+    _cmd_uint(esp8266at, sleep_timems);
+    _cmd_end(esp8266at);
+    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+    if (st == UBI_ST_OK)
+    {
+        _restart_reset(esp8266at);
+        _power_state_set(esp8266at, ESP8266AT_POWER_DEEP_SLEEP);
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_power_wakeup(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+    uint8_t restarted;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    restarted = (esp8266at->power_state == ESP8266AT_POWER_DEEP_SLEEP);
+
+    st = UBI_ST_OK;
+    if (esp8266at->power_state == ESP8266AT_POWER_LIGHT_SLEEP || esp8266at->power_state == ESP8266AT_POWER_DEEP_SLEEP)
+    {
+        st = _wakeup(esp8266at, timeoutms, &timeoutms);
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    // Commands wake the module up by themselves, but only this brings back the configuration and the AP after deep sleep.
+    if (st == UBI_ST_OK && restarted)
+    {
+        st = _config_replay(esp8266at, timeoutms, &timeoutms);
+        if (st == UBI_ST_OK && esp8266at->wifi_requested)
+        {
+            st = esp8266at_fastjoin(esp8266at, esp8266at->ssid, esp8266at->passwd, timeoutms, &timeoutms);
+        }
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    return st;
+}
+
+ubi_st_t esp8266at_power_stat_get(esp8266at_t *esp8266at, esp8266at_power_stat_t *stat)
+{
+    assert(stat != NULL);
+
+    ubik_entercrit();
+    memcpy(stat, &esp8266at->power_stat, sizeof(esp8266at_power_stat_t));
+    stat->state_ms[esp8266at->power_state] += _elapsedms(esp8266at->power_state_tick);
+    ubik_exitcrit();
+
+    return UBI_ST_OK;
+}
+
+ubi_st_t esp8266at_power_stat_reset(esp8266at_t *esp8266at)
+{
+    ubik_entercrit();
+    memset(&esp8266at->power_stat, 0, sizeof(esp8266at_power_stat_t));
+    esp8266at->power_state_tick = _gettick();
+    ubik_exitcrit();
+
+    return UBI_ST_OK;
+}
+
+typedef struct _gmr_ctx_t
+{
+    esp8266at_t *esp8266at;
+    const esp8266at_dialect_t *dialect;
+} _gmr_ctx_t;
+
+static void _gmr_line(void *arg, char *line)
+{
+    _gmr_ctx_t *ctx = (_gmr_ctx_t *) arg;
+    char *value;
+    char *ptr;
+
+    // AT version:<version>(<build date>)
+    value = _line_value(line, "AT version:");
+    if (value != NULL)
+    {
+        ptr = strchr(value, '(');
+        if (ptr != NULL)
+        {
+            *ptr = 0;
+        }
+        _copy_field(ctx->esp8266at->version, value, ESP8266AT_VERSION_LENGTH_MAX);
+    }
+
+    if (ctx->dialect == NULL)
+    {
+        ctx->dialect = _match_dialect(line);
+    }
+}
+
+ubi_st_t esp8266at_cmd_at_gmr(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+    _gmr_ctx_t ctx;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    ctx.esp8266at = esp8266at;
+    ctx.dialect = NULL;
+
+    st = _send_cmd_and_read_lines(esp8266at, "AT+GMR\r\n", _gmr_line, &ctx, timeoutms, &timeoutms);
+    if (st == UBI_ST_OK)
+    {
+        _select_dialect(esp8266at, ctx.dialect);
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+static const esp8266at_dialect_t *_match_dialect(char *gmr_line)
+{
+    for (uint32_t i = 0; i < sizeof(_dialects) / sizeof(_dialects[0]); i++)
+    {
+        if (_dialects[i]->gmr_signature != NULL && strstr(gmr_line, _dialects[i]->gmr_signature) != NULL)
+        {
+            return _dialects[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void _select_dialect(esp8266at_t *esp8266at, const esp8266at_dialect_t *dialect)
+{
+    if (dialect == NULL)
+    {
+        dialect = _dialects[0];
+    }
+
+    if (esp8266at->dialect != dialect)
+    {
+        logmfi("AT dialect : %s", dialect->name);
+        esp8266at->dialect = dialect;
+    }
+}
+
+ubi_st_t esp8266at_set_dialect(esp8266at_t *esp8266at, uint8_t dialect_id)
+{
+    for (uint32_t i = 0; i < sizeof(_dialects) / sizeof(_dialects[0]); i++)
+    {
+        if (_dialects[i]->id == dialect_id)
+        {
+            esp8266at->dialect = _dialects[i];
+            return UBI_ST_OK;
+        }
+    }
+
+    return UBI_ST_ERR;
+}
+
+ubi_st_t esp8266at_cmd_at_e(esp8266at_t *esp8266at, int is_on, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    _cmd_begin(esp8266at, "ATE");
+    _cmd_int(esp8266at, is_on);
+    _cmd_end(esp8266at);
+    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+
+    task_sleepms(100);
+    if (timeoutms < 100)
+    {
+        timeoutms = 0;
+    }
+    else
+    {
+        timeoutms -= 100;
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_cwmode(esp8266at_t *esp8266at, int mode, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    _cmd_begin(esp8266at, "AT+CWMODE=");
+    _cmd_int(esp8266at, mode);
+    _cmd_end(esp8266at);
+    if (_shadow_skip(esp8266at, ESP8266AT_SHADOW_CWMODE, esp8266at->temp_cmd_buf))
+    {
+        st = UBI_ST_OK;
+    }
+    else
+    {
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        _shadow_update(esp8266at, ESP8266AT_SHADOW_CWMODE, esp8266at->temp_cmd_buf, st);
+        if (st == UBI_ST_OK)
+        {
+            esp8266at->wifi_mode = mode;
+        }
+
+        task_sleepms(100);
+        if (timeoutms < 100)
+        {
+            timeoutms = 0;
+        }
+        else
+        {
+            timeoutms -= 100;
+        }
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_cipmux(esp8266at_t *esp8266at, int mode, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    _cmd_begin(esp8266at, "AT+CIPMUX=");
+    _cmd_int(esp8266at, mode);
+    _cmd_end(esp8266at);
+    if (_shadow_skip(esp8266at, ESP8266AT_SHADOW_CIPMUX, esp8266at->temp_cmd_buf))
+    {
+        st = UBI_ST_OK;
+    }
+    else
+    {
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        _shadow_update(esp8266at, ESP8266AT_SHADOW_CIPMUX, esp8266at->temp_cmd_buf, st);
+        if (st == UBI_ST_OK)
+        {
+            esp8266at->mux_mode = mode;
+        }
+
+        task_sleepms(100);
+        if (timeoutms < 100)
+        {
+            timeoutms = 0;
+        }
+        else
+        {
+            timeoutms -= 100;
+        }
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_cwjap(esp8266at_t *esp8266at, char *ssid, char *passwd, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    assert(ssid != NULL);
+    assert(passwd != NULL);
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    if (esp8266at->ssid != ssid)
+    {
+        strncpy(esp8266at->ssid, ssid, ESP8266AT_SSID_LENGTH_MAX);
+    }
+    if (esp8266at->passwd != passwd)
+    {
+        strncpy(esp8266at->passwd, passwd, ESP8266AT_PASSWD_LENGTH_MAX);
+    }
+
+    _cmd_begin(esp8266at, "AT+");
+    _cmd_str(esp8266at, esp8266at->dialect->cwjap);
+    _cmd_str(esp8266at, "=");
+    _cmd_quoted(esp8266at, ssid);
+    _cmd_str(esp8266at, ",");
+    _cmd_quoted(esp8266at, passwd);
+    _cmd_end(esp8266at);
+    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+    if (st == UBI_ST_OK)
+    {
+        esp8266at->wifi_requested = 1;
+        esp8266at->wifi_connected = 1;
+        // Rejoining prints "WIFI DISCONNECT" first, which is stale now.
+        _urc_clear(esp8266at, ESP8266AT_IO_URC__WIFI_DISCONNECT);
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+typedef struct _join_cache_ctx_t
+{
+    esp8266at_join_cache_t *cache;
+    char key[24];
+    uint8_t found;
+} _join_cache_ctx_t;
+
+static void _cwjap_q_line(void *arg, char *line)
+{
+    _join_cache_ctx_t *ctx = (_join_cache_ctx_t *) arg;
+    char *next;
+    char *field;
+
+    // +CWJAP:"<ssid>","<bssid>",<channel>,<rssi>
+    next = _line_value(line, ctx->key);
+    if (next == NULL || _next_field(&next) == NULL)
+    {
+        return;
+    }
+
+    field = _next_field(&next);
+    if (field == NULL)
+    {
+        return;
+    }
+    _copy_field(ctx->cache->bssid, field, ESP8266AT_BSSID_LENGTH_MAX);
+
+    field = _next_field(&next);
+    if (field == NULL)
+    {
+        return;
+    }
+    ctx->cache->channel = (uint8_t) strtoul(field, NULL, 10);
+
+    ctx->found = 1;
+}
+
+static void _cipsta_q_line(void *arg, char *line)
+{
+    _join_cache_ctx_t *ctx = (_join_cache_ctx_t *) arg;
+    char *next;
+    char *field;
+    char *value;
+    uint32_t i;
+    static const char * const names[3] = {"ip:", "gateway:", "netmask:"};
+
+    // +CIPSTA:ip:"<ip>", +CIPSTA:gateway:"<gateway>", +CIPSTA:netmask:"<netmask>"
+    next = _line_value(line, ctx->key);
+    if (next == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < 3; i++)
+    {
+        value = _line_value(next, names[i]);
+        if (value != NULL)
+        {
+            break;
+        }
+    }
+    if (value == NULL)
+    {
+        return;
+    }
+
+    field = _next_field(&value);
+    if (field == NULL)
+    {
+        return;
+    }
+
+    switch (i)
+    {
+    case 0:
+        _copy_field(ctx->cache->ip_addr, field, ESP8266AT_IP_ADDR_LENGTH_MAX);
+        break;
+    case 1:
+        _copy_field(ctx->cache->gateway, field, ESP8266AT_IP_ADDR_LENGTH_MAX);
+        break;
+    default:
+        _copy_field(ctx->cache->netmask, field, ESP8266AT_IP_ADDR_LENGTH_MAX);
+        break;
+    }
+    ctx->found |= (1 << i);
+}
+
+static ubi_st_t _join_cache_update(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    ubi_st_t st;
+    esp8266at_join_cache_t *cache = &esp8266at->join_cache;
+    _join_cache_ctx_t ctx;
+
+    cache->valid = 0;
+    ctx.cache = cache;
+
+    do
+    {
+        strcpy(ctx.key, "+");
+        strcat(ctx.key, esp8266at->dialect->cwjap);
+        strcat(ctx.key, ":");
+        ctx.found = 0;
+        _cmd_begin(esp8266at, "AT+");
+        _cmd_str(esp8266at, esp8266at->dialect->cwjap);
+        _cmd_str(esp8266at, "?");
+        _cmd_end(esp8266at);
+        st = _send_cmd_and_read_lines(esp8266at, esp8266at->temp_cmd_buf, _cwjap_q_line, &ctx, timeoutms, &timeoutms);
+        if (st != UBI_ST_OK)
+        {
+            break;
+        }
+        if (ctx.found == 0)
+        {
+            st = UBI_ST_ERR;
+            break;
+        }
+
+        strcpy(ctx.key, "+");
+        strcat(ctx.key, esp8266at->dialect->cipsta);
+        strcat(ctx.key, ":");
+        ctx.found = 0;
+        _cmd_begin(esp8266at, "AT+");
+        _cmd_str(esp8266at, esp8266at->dialect->cipsta);
+        _cmd_str(esp8266at, "?");
+        _cmd_end(esp8266at);
+        st = _send_cmd_and_read_lines(esp8266at, esp8266at->temp_cmd_buf, _cipsta_q_line, &ctx, timeoutms, &timeoutms);
+        if (st != UBI_ST_OK)
+        {
+            break;
+        }
+        if (ctx.found != 0x7)
+        {
+            st = UBI_ST_ERR;
+            break;
+        }
+
+        strncpy(cache->ssid, esp8266at->ssid, ESP8266AT_SSID_LENGTH_MAX);
+        cache->valid = 1;
+
+        break;
+    } while (1);
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    return st;
+}
+
+ubi_st_t esp8266at_fastjoin(esp8266at_t *esp8266at, char *ssid, char *passwd, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+    esp8266at_join_cache_t *cache = &esp8266at->join_cache;
+    esp8266at_join_time_t *join_time = &esp8266at->join_time;
+    uint32_t begin_tick;
+    uint32_t phase_tick;
+    uint32_t fast_timeoutms;
+
+    assert(ssid != NULL);
+    assert(passwd != NULL);
+
+    begin_tick = _gettick();
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    if (esp8266at->ssid != ssid)
+    {
+        strncpy(esp8266at->ssid, ssid, ESP8266AT_SSID_LENGTH_MAX);
+    }
+    if (esp8266at->passwd != passwd)
+    {
+        strncpy(esp8266at->passwd, passwd, ESP8266AT_PASSWD_LENGTH_MAX);
+    }
+
+    memset(join_time, 0, sizeof(esp8266at_join_time_t));
+    st = UBI_ST_ERR;
+
+    if (cache->valid && strncmp(cache->ssid, ssid, ESP8266AT_SSID_LENGTH_MAX) == 0)
+    {
+        phase_tick = _gettick();
+
+        // Reuse the last lease as a static address (no DHCP) and join the known AP only (no full scan).
+        _cmd_begin(esp8266at, "AT+");
+        _cmd_str(esp8266at, esp8266at->dialect->cipsta);
+        _cmd_str(esp8266at, "=");
+        _cmd_quoted(esp8266at, cache->ip_addr);
+        _cmd_str(esp8266at, ",");
+        _cmd_quoted(esp8266at, cache->gateway);
+        _cmd_str(esp8266at, ",");
+        _cmd_quoted(esp8266at, cache->netmask);
+        _cmd_end(esp8266at);
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        if (st == UBI_ST_OK)
+        {
+            fast_timeoutms = min(timeoutms, ESP8266AT_FASTJOIN_TIMEOUT_MS);
+            timeoutms -= fast_timeoutms;
+            _cmd_begin(esp8266at, "AT+");
+            _cmd_str(esp8266at, esp8266at->dialect->cwjap);
+            _cmd_str(esp8266at, "=");
+            _cmd_quoted(esp8266at, ssid);
+            _cmd_str(esp8266at, ",");
+            _cmd_quoted(esp8266at, passwd);
+            _cmd_str(esp8266at, ",");
+            _cmd_quoted(esp8266at, cache->bssid);
+            _cmd_end(esp8266at);
+            st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", fast_timeoutms, &fast_timeoutms);
+            timeoutms += fast_timeoutms;
+        }
+
+        if (st == UBI_ST_OK)
+        {
+            // The lease may have expired, so go back to DHCP rather than keep an address another station may get.
+            _cmd_begin(esp8266at, "AT+");
+            _cmd_str(esp8266at, esp8266at->dialect->cwdhcp);
+            _cmd_str(esp8266at, "=1,1");
+            _cmd_end(esp8266at);
+            if (_send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms) != UBI_ST_OK)
+            {
+                logmw("fast join : enabling DHCP failed");
+            }
+        }
+
+        join_time->fast_ms = _elapsedms(phase_tick);
+
+        if (st == UBI_ST_OK)
+        {
+            join_time->fast = 1;
+        }
+        else
+        {
+            logmfi("fast join failed (st = %d), falling back to full join", st);
+            cache->valid = 0;
+        }
+    }
+
+    if (st != UBI_ST_OK)
+    {
+        phase_tick = _gettick();
+
+        _cmd_begin(esp8266at, "AT+");
+        _cmd_str(esp8266at, esp8266at->dialect->cwdhcp);
+        _cmd_str(esp8266at, "=1,1");
+        _cmd_end(esp8266at);
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        if (st == UBI_ST_OK)
+        {
+            _cmd_begin(esp8266at, "AT+");
+            _cmd_str(esp8266at, esp8266at->dialect->cwjap);
+            _cmd_str(esp8266at, "=");
+            _cmd_quoted(esp8266at, ssid);
+            _cmd_str(esp8266at, ",");
+            _cmd_quoted(esp8266at, passwd);
+            _cmd_end(esp8266at);
+            st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        }
+
+        join_time->full_ms = _elapsedms(phase_tick);
+
+        if (st == UBI_ST_OK)
+        {
+            phase_tick = _gettick();
+
+            if (_join_cache_update(esp8266at, timeoutms, &timeoutms) != UBI_ST_OK)
+            {
+                logmi("join cache update failed");
+            }
+
+            join_time->cache_ms = _elapsedms(phase_tick);
+        }
+    }
+
+    join_time->total_ms = _elapsedms(begin_tick);
+
+    if (st == UBI_ST_OK)
+    {
+        esp8266at->wifi_requested = 1;
+        esp8266at->wifi_connected = 1;
+        // Rejoining prints "WIFI DISCONNECT" first, which is stale now.
+        _urc_clear(esp8266at, ESP8266AT_IO_URC__WIFI_DISCONNECT);
+    }
+
+    logmfd("join : fast = %d, fast_ms = %d, full_ms = %d, cache_ms = %d, total_ms = %d", join_time->fast, join_time->fast_ms,
+            join_time->full_ms, join_time->cache_ms, join_time->total_ms);
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_cwqap(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    task_sleepms(500);
+    if (timeoutms < 500)
+    {
+        timeoutms = 0;
+    }
+    else
+    {
+        timeoutms -= 500;
+    }
+
+    st = _send_cmd_and_wait_rsp(esp8266at, "AT+CWQAP\r\n", "OK\r\n", timeoutms, &timeoutms);
+
+    esp8266at->wifi_requested = 0;
+    esp8266at->wifi_connected = 0;
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_cwlapopt(esp8266at_t *esp8266at, uint8_t sort_enable, uint32_t mask, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    _cmd_begin(esp8266at, "AT+CWLAPOPT=");
+    _cmd_int(esp8266at, sort_enable);
+    _cmd_str(esp8266at, ",");
+    _cmd_uint(esp8266at, mask);
+    _cmd_end(esp8266at);
+    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+    if (st == UBI_ST_OK)
+    {
+        esp8266at->cwlap_mask = mask;
+        esp8266at->cwlap_opt_sort = sort_enable;
+        esp8266at->cwlap_opt_mask = mask;
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+static void _cwlap_parse(esp8266at_t *esp8266at, char *line, esp8266at_ap_info_t *ap_info)
+{
+    char *next;
+    char *field;
+
+    ap_info->ecn = 0;
+    ap_info->ssid = "";
+    ap_info->rssi = 0;
+    ap_info->bssid = "";
+    ap_info->channel = 0;
+
+    // The fields come in bit order, without the ones masked out by AT+CWLAPOPT.
+    next = line + strlen(ESP8266AT_CWLAP_KEY);
+    for (int i = 0; i < ESP8266AT_CWLAP_FIELD_MAX; i++)
+    {
+        if ((esp8266at->cwlap_mask & (1 << i)) == 0)
+        {
+            continue;
+        }
+
+        field = _next_field(&next);
+        if (field == NULL)
+        {
+            break;
+        }
+
+        switch (1 << i)
+        {
+        case ESP8266AT_CWLAP_FIELD__ECN:
+            ap_info->ecn = atoi(field);
+            break;
+        case ESP8266AT_CWLAP_FIELD__SSID:
+            ap_info->ssid = field;
+            break;
+        case ESP8266AT_CWLAP_FIELD__RSSI:
+            ap_info->rssi = atoi(field);
+            break;
+        case ESP8266AT_CWLAP_FIELD__MAC:
+            ap_info->bssid = field;
+            break;
+        case ESP8266AT_CWLAP_FIELD__CHANNEL:
+            ap_info->channel = atoi(field);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+typedef struct _cwlap_ctx_t
+{
+    esp8266at_t *esp8266at;
+    esp8266at_ap_callback_t callback;
+    void *arg;
+    uint32_t count;
+} _cwlap_ctx_t;
+
+static void _cwlap_line(void *arg, char *line)
+{
+    _cwlap_ctx_t *ctx = (_cwlap_ctx_t *) arg;
+    esp8266at_ap_info_t ap_info;
+
+    if (strncmp(line, ESP8266AT_CWLAP_KEY, strlen(ESP8266AT_CWLAP_KEY)) != 0)
+    {
+        return;
+    }
+
+    _cwlap_parse(ctx->esp8266at, line, &ap_info);
+    ctx->count++;
+    if (ctx->callback)
+    {
+        ctx->callback(ctx->arg, &ap_info);
+    }
+}
+
+ubi_st_t esp8266at_cmd_at_cwlap(esp8266at_t *esp8266at, esp8266at_ap_callback_t callback, void *arg, uint32_t *count, uint32_t timeoutms,
+        uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+    _cwlap_ctx_t ctx;
+
+    if (count)
+    {
+        *count = 0;
+    }
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    ctx.esp8266at = esp8266at;
+    ctx.callback = callback;
+    ctx.arg = arg;
+    ctx.count = 0;
+
+    st = _send_cmd_and_read_lines(esp8266at, "AT+CWLAP\r\n", _cwlap_line, &ctx, timeoutms, &timeoutms);
+
+    logmfd("scan : status = %d, count = %d", st, ctx.count);
+
+    if (count)
+    {
+        *count = ctx.count;
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+static void _cifsr_line(void *arg, char *line)
+{
+    esp8266at_t *esp8266at = (esp8266at_t *) arg;
+    char *value;
+    char *field;
+
+    // +CIFSR:STAIP,"<ip>", +CIFSR:STAMAC,"<mac>"
+    value = _line_value(line, "+CIFSR:STAIP,");
+    if (value != NULL)
+    {
+        field = _next_field(&value);
+        if (field != NULL)
+        {
+            _copy_field(esp8266at->ip_addr, field, ESP8266AT_IP_ADDR_LENGTH_MAX);
+        }
+        return;
+    }
+
+    value = _line_value(line, "+CIFSR:STAMAC,");
+    if (value != NULL)
+    {
+        field = _next_field(&value);
+        if (field != NULL)
+        {
+            _copy_field(esp8266at->mac_addr, field, ESP8266AT_MAC_ADDR_LENGTH_MAX);
+        }
+        return;
+    }
+}
+
+ubi_st_t esp8266at_cmd_at_cifsr(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    memset(esp8266at->ip_addr, 0, ESP8266AT_IP_ADDR_LENGTH_MAX);
+    memset(esp8266at->mac_addr, 0, ESP8266AT_MAC_ADDR_LENGTH_MAX);
+
+    st = _send_cmd_and_read_lines(esp8266at, "AT+CIFSR\r\n", _cifsr_line, esp8266at, timeoutms, &timeoutms);
+    if (st == UBI_ST_OK && (esp8266at->ip_addr[0] == 0 || esp8266at->mac_addr[0] == 0))
+    {
+        st = UBI_ST_ERR;
+    }
+
+    if (st != UBI_ST_OK)
+    {
+        memset(esp8266at->ip_addr, 0, ESP8266AT_IP_ADDR_LENGTH_MAX);
+        memset(esp8266at->mac_addr, 0, ESP8266AT_MAC_ADDR_LENGTH_MAX);
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+static char *_cipstart_addr(esp8266at_t *esp8266at, char *host, char *cached_addr, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    char *addr;
+
+    // Without a cached address the module resolves the name itself.
+    addr = host;
+    if (esp8266at->dns_cache_enable && !_is_ip_addr(host) && _resolve(esp8266at, host, cached_addr, 0, timeoutms, &timeoutms) == UBI_ST_OK)
+    {
+        addr = cached_addr;
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    return addr;
+}
+
+static void _cipstart_addr_failed(esp8266at_t *esp8266at, char *host, char *addr, char *cached_addr)
+{
+    esp8266at_dns_cache_t *entry;
+
+    if (addr != cached_addr)
+    {
+        return;
+    }
+
+    // The host may have moved, so look it up again next time.
+    entry = _dns_cache_find(esp8266at, host);
+    if (entry != NULL)
+    {
+        memset(entry, 0, sizeof(esp8266at_dns_cache_t));
+    }
+}
+
+ubi_st_t esp8266at_cmd_at_cipstart(esp8266at_t *esp8266at, char *type, char *ip, uint32_t port, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+    char *addr;
+    char cached_addr[ESP8266AT_IP_ADDR_LENGTH_MAX + 1];
+    uint32_t begin_tick;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    addr = _cipstart_addr(esp8266at, ip, cached_addr, timeoutms, &timeoutms);
+
+    _cmd_begin(esp8266at, "AT+CIPSTART=");
+    _cmd_quoted(esp8266at, type);
+    _cmd_str(esp8266at, ",");
+    _cmd_quoted(esp8266at, addr);
+    _cmd_str(esp8266at, ",");
+    _cmd_uint(esp8266at, port);
+    _cmd_end(esp8266at);
+    begin_tick = _gettick();
+    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+    if (st == UBI_ST_OK && strcmp(type, "SSL") == 0)
+    {
+        esp8266at->ssl_connect_count++;
+        esp8266at->ssl_connect_last_ms = _elapsedms(begin_tick);
+        esp8266at->ssl_connect_max_ms = max(esp8266at->ssl_connect_max_ms, esp8266at->ssl_connect_last_ms);
+        logmfd("ssl connect : %d ms", esp8266at->ssl_connect_last_ms);
+    }
+    if (st != UBI_ST_OK)
+    {
+        _cipstart_addr_failed(esp8266at, ip, addr, cached_addr);
+    }
+    if (st == UBI_ST_OK)
+    {
+        if (esp8266at->tcp_type != type)
+        {
+            strncpy(esp8266at->tcp_type, type, ESP8266AT_CONN_TYPE_LENGTH_MAX);
+        }
+        if (esp8266at->tcp_host != ip)
+        {
+            strncpy(esp8266at->tcp_host, ip, ESP8266AT_HOST_LENGTH_MAX);
+        }
+        esp8266at->tcp_port = port;
+        esp8266at->tcp_requested = 1;
+        esp8266at->tcp_connected = 1;
+        _urc_clear(esp8266at, ESP8266AT_IO_URC__CLOSED);
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_cipstart_multiple(esp8266at_t *esp8266at, int id, char *type, char *ip, uint32_t port, uint32_t timeoutms,
+        uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+    char *addr;
+    char cached_addr[ESP8266AT_IP_ADDR_LENGTH_MAX + 1];
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    addr = _cipstart_addr(esp8266at, ip, cached_addr, timeoutms, &timeoutms);
+
+    _cmd_begin(esp8266at, "AT+CIPSTART=");
+    _cmd_int(esp8266at, id);
+    _cmd_str(esp8266at, ",");
+    _cmd_quoted(esp8266at, type);
+    _cmd_str(esp8266at, ",");
+    _cmd_quoted(esp8266at, addr);
+    _cmd_str(esp8266at, ",");
+    _cmd_uint(esp8266at, port);
+    _cmd_end(esp8266at);
+    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+    if (st != UBI_ST_OK)
+    {
+        _cipstart_addr_failed(esp8266at, ip, addr, cached_addr);
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_cipsslsize(esp8266at_t *esp8266at, uint32_t size, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    if (!esp8266at->dialect->ssl_size)
+    {
+        return UBI_ST_ERR_UNSUP;
+    }
+    if (size < ESP8266AT_SSL_BUF_SIZE_MIN || size > ESP8266AT_SSL_BUF_SIZE_MAX)
+    {
+        return UBI_ST_ERR_PARAM;
+    }
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    _cmd_begin(esp8266at, "AT+CIPSSLSIZE=");
+    _cmd_uint(esp8266at, size);
+    _cmd_end(esp8266at);
+    if (_shadow_skip(esp8266at, ESP8266AT_SHADOW_CIPSSLSIZE, esp8266at->temp_cmd_buf))
+    {
+        st = UBI_ST_OK;
+    }
+    else
+    {
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        _shadow_update(esp8266at, ESP8266AT_SHADOW_CIPSSLSIZE, esp8266at->temp_cmd_buf, st);
+    }
+    if (st == UBI_ST_OK)
+    {
+        esp8266at->ssl_buf_size = size;
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_cipsslcconf(esp8266at_t *esp8266at, uint8_t auth_mode, uint8_t pki_number, uint8_t ca_number, uint32_t timeoutms,
+        uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    if (auth_mode > (ESP8266AT_SSL_AUTH__CLIENT_CERT | ESP8266AT_SSL_AUTH__SERVER_CA))
+    {
+        return UBI_ST_ERR_PARAM;
+    }
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    // Single connection mode only, multiple connection mode takes a link id first.
+    _cmd_begin(esp8266at, "AT+CIPSSLCCONF=");
+    _cmd_uint(esp8266at, auth_mode);
+    if (esp8266at->dialect->ssl_pki && auth_mode != ESP8266AT_SSL_AUTH__NONE)
+    {
+        _cmd_str(esp8266at, ",");
+        _cmd_uint(esp8266at, pki_number);
+        _cmd_str(esp8266at, ",");
+        _cmd_uint(esp8266at, ca_number);
+    }
+    _cmd_end(esp8266at);
+    if (_shadow_skip(esp8266at, ESP8266AT_SHADOW_CIPSSLCCONF, esp8266at->temp_cmd_buf))
+    {
+        st = UBI_ST_OK;
+    }
+    else
+    {
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        _shadow_update(esp8266at, ESP8266AT_SHADOW_CIPSSLCCONF, esp8266at->temp_cmd_buf, st);
+    }
+    if (st == UBI_ST_OK)
+    {
+        esp8266at->ssl_auth_mode = auth_mode;
+        esp8266at->ssl_pki_number = pki_number;
+        esp8266at->ssl_ca_number = ca_number;
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_cipsslcsni(esp8266at_t *esp8266at, char *sni, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    if (!esp8266at->dialect->ssl_sni)
+    {
+        return UBI_ST_ERR_UNSUP;
+    }
+    if (sni == NULL || strlen(sni) == 0 || strlen(sni) > ESP8266AT_HOST_LENGTH_MAX)
+    {
+        return UBI_ST_ERR_PARAM;
+    }
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    _cmd_begin(esp8266at, "AT+CIPSSLCSNI=");
+    _cmd_quoted(esp8266at, sni);
+    _cmd_end(esp8266at);
+    if (_shadow_skip(esp8266at, ESP8266AT_SHADOW_CIPSSLCSNI, esp8266at->temp_cmd_buf))
+    {
+        st = UBI_ST_OK;
+    }
+    else
+    {
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        _shadow_update(esp8266at, ESP8266AT_SHADOW_CIPSSLCSNI, esp8266at->temp_cmd_buf, st);
+    }
+    if (st == UBI_ST_OK && esp8266at->ssl_sni != sni)
+    {
+        _copy_field(esp8266at->ssl_sni, sni, ESP8266AT_HOST_LENGTH_MAX);
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_ssl_connect(esp8266at_t *esp8266at, char *host, uint32_t port, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    ubi_st_t st;
+
+    st = UBI_ST_OK;
+
+    do
+    {
+        // The server picks its certificate by SNI, which also lets cipstart use a cached address.
+        if (esp8266at->dialect->ssl_sni && !_is_ip_addr(host))
+        {
+            st = esp8266at_cmd_at_cipsslcsni(esp8266at, host, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
+            {
+                break;
+            }
+        }
+
+        st = esp8266at_cmd_at_cipstart(esp8266at, "SSL", host, port, timeoutms, &timeoutms);
+
+        break;
+    } while (1);
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_cipclose(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    st = _send_cmd_and_wait_rsp(esp8266at, "AT+CIPCLOSE\r\n", "OK\r\n", timeoutms, &timeoutms);
+
+    esp8266at->tcp_requested = 0;
+    esp8266at->tcp_connected = 0;
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_cipsend(esp8266at_t *esp8266at, uint8_t *buffer, uint32_t length, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    st = UBI_ST_ERR;
+
+    do
+    {
+        _cmd_begin(esp8266at, "AT+CIPSEND=");
+        _cmd_uint(esp8266at, length);
+        _cmd_end(esp8266at);
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, ">", timeoutms, &timeoutms);
+        if (st != UBI_ST_OK)
+        {
+            break;
+        }
+
+        st = esp8266at_io_write_timedms(esp8266at, buffer, length, NULL, timeoutms, &timeoutms);
+        if (st != UBI_ST_OK)
+        {
+            break;
+        }
+        st = esp8266at_io_flush_timedms(esp8266at, timeoutms, &timeoutms);
+        if (st != UBI_ST_OK)
+        {
+            break;
+        }
+
+        st = _wait_rsp(esp8266at, "SEND OK\r\n", esp8266at->temp_resp_buf, ESP8266AT_TEMP_RESP_BUF_SIZE, NULL, timeoutms, &timeoutms);
+        if (st != UBI_ST_OK)
+        {
+            break;
+        }
+
+        break;
+    } while (1);
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_ciprecv(esp8266at_t *esp8266at, uint8_t *buffer, uint32_t length, uint32_t *received, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+    uint32_t read_tmp;
+    uint32_t read_tmp2;
+
+    r = mutex_lock_timedms(esp8266at->io_data_read_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    st = UBI_ST_ERR;
+
+    read_tmp = 0;
+    read_tmp2 = 0;
+
+    for (;;)
+    {
+        st = cbuf_read(esp8266at->io_data_buf, &buffer[read_tmp], length - read_tmp, &read_tmp2);
+        assert(st == UBI_ERR_OK || st == UBI_ERR_BUF_EMPTY);
+        read_tmp += read_tmp2;
+
+        if (read_tmp >= length)
+        {
+            st = UBI_ST_OK;
+            break;
+        }
+        else
+        {
+            if (timeoutms == 0)
+            {
+                st = UBI_ST_TIMEOUT;
+                break;
+            }
+            r = sem_take_timedms(esp8266at->io_data_read_sem, timeoutms);
+            timeoutms = task_getremainingtimeoutms();
+            if (r == UBIK_ERR__TIMEOUT)
+            {
+                st = UBI_ST_TIMEOUT;
+                break;
+            }
+            if (r != 0)
+            {
+                st = UBI_ST_ERR;
+                break;
+            }
+        }
+    }
+
+    if (received)
+    {
+        *received = read_tmp;
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->io_data_read_mutex);
+
+    return st;
+}
+
+static void _cipdns_build(esp8266at_t *esp8266at, uint8_t enable, uint32_t first)
+{
+    _cmd_begin(esp8266at, "AT+");
+    _cmd_str(esp8266at, esp8266at->dialect->cipdns);
+    _cmd_str(esp8266at, "=");
+    _cmd_int(esp8266at, enable);
+    for (uint32_t i = first; i < ESP8266AT_DNS_SERVER_MAX; i++)
+    {
+        if (esp8266at->dns_server_addr[i][0] == 0)
+        {
+            break;
+        }
+        _cmd_str(esp8266at, ",");
+        _cmd_quoted(esp8266at, esp8266at->dns_server_addr[i]);
+    }
+    _cmd_end(esp8266at);
+}
+
+ubi_st_t esp8266at_cmd_at_cipdns(esp8266at_t *esp8266at, uint8_t enable, char * dns_server_addr, char * dns_server_addr2, char * dns_server_addr3, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+    char *addrs[ESP8266AT_DNS_SERVER_MAX];
+    uint32_t i;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    esp8266at->dns_enable = enable;
+
+    addrs[0] = dns_server_addr;
+    addrs[1] = dns_server_addr2;
+    addrs[2] = dns_server_addr3;
+    for (i = 0; i < ESP8266AT_DNS_SERVER_MAX; i++)
+    {
+        if (addrs[i] == NULL || strlen(addrs[i]) == 0)
+        {
+            break;
+        }
+        if (esp8266at->dns_server_addr[i] != addrs[i])
+        {
+            _copy_field(esp8266at->dns_server_addr[i], addrs[i], ESP8266AT_DNS_SERVER_ADDR_LENGTH_MAX - 1);
+        }
+    }
+    for (; i < ESP8266AT_DNS_SERVER_MAX; i++)
+    {
+        esp8266at->dns_server_addr[i][0] = 0;
+    }
+
+    _cipdns_build(esp8266at, enable, 0);
+
+    if (_shadow_skip(esp8266at, ESP8266AT_SHADOW_CIPDNS, esp8266at->temp_cmd_buf))
+    {
+        st = UBI_ST_OK;
+    }
+    else
+    {
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        _shadow_update(esp8266at, ESP8266AT_SHADOW_CIPDNS, esp8266at->temp_cmd_buf, st);
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+static void _cipdns_q_line(void *arg, char *line)
+{
+    esp8266at_t *esp8266at = (esp8266at_t *) arg;
+    char *next;
+    char *field;
+
+    // +CIPDNS:<enable>[,"<server>"[,"<server2>"[,"<server3>"]]]
+    next = _line_value(line, esp8266at->dialect->cipdns_rsp_key);
+    if (next == NULL)
+    {
+        return;
+    }
+
+    field = _next_field(&next);
+    if (field == NULL)
+    {
+        return;
+    }
+    esp8266at->dns_enable = atoi(field);
+
+    memset(esp8266at->dns_server_addr, 0, ESP8266AT_DNS_SERVER_MAX * ESP8266AT_DNS_SERVER_ADDR_LENGTH_MAX);
+    for (int i = 0; i < ESP8266AT_DNS_SERVER_MAX; i++)
+    {
+        field = _next_field(&next);
+        if (field == NULL)
+        {
+            break;
+        }
+        _copy_field(esp8266at->dns_server_addr[i], field, ESP8266AT_DNS_SERVER_ADDR_LENGTH_MAX - 1);
+    }
+}
+
+ubi_st_t esp8266at_cmd_at_cipdns_q(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    _cmd_begin(esp8266at, "AT+");
+    _cmd_str(esp8266at, esp8266at->dialect->cipdns);
+    _cmd_str(esp8266at, "?");
+    _cmd_end(esp8266at);
+    st = _send_cmd_and_read_lines(esp8266at, esp8266at->temp_cmd_buf, _cipdns_q_line, esp8266at, timeoutms, &timeoutms);
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+static uint8_t _is_ip_addr(const char *host)
+{
+    // Dotted IPv4 or IPv6 (has a colon) needs no lookup.
+    if (strchr(host, ':') != NULL)
+    {
+        return 1;
+    }
+
+    for (; *host != 0; host++)
+    {
+        if ((*host < '0' || *host > '9') && *host != '.')
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static esp8266at_dns_cache_t *_dns_cache_find(esp8266at_t *esp8266at, const char *host)
+{
+    for (int i = 0; i < ESP8266AT_DNS_CACHE_MAX; i++)
+    {
+        if (esp8266at->dns_cache[i].host[0] != 0 && strcmp(esp8266at->dns_cache[i].host, host) == 0)
+        {
+            return &esp8266at->dns_cache[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void _dns_cache_store(esp8266at_t *esp8266at, const char *host, const char *ip_addr)
+{
+    esp8266at_dns_cache_t *entry;
+
+    entry = _dns_cache_find(esp8266at, host);
+    if (entry == NULL)
+    {
+        // Take an empty entry, or evict the least recently used one.
+        entry = &esp8266at->dns_cache[0];
+        for (int i = 0; i < ESP8266AT_DNS_CACHE_MAX; i++)
+        {
+            if (esp8266at->dns_cache[i].host[0] == 0)
+            {
+                entry = &esp8266at->dns_cache[i];
+                break;
+            }
+            if (_elapsedms(esp8266at->dns_cache[i].use_tick) > _elapsedms(entry->use_tick))
+            {
+                entry = &esp8266at->dns_cache[i];
+            }
+        }
+        _copy_field(entry->host, host, ESP8266AT_HOST_LENGTH_MAX);
+        entry->use_tick = _gettick();
+    }
+
+    _copy_field(entry->ip_addr, ip_addr, ESP8266AT_IP_ADDR_LENGTH_MAX);
+    entry->resolve_tick = _gettick();
+}
+
+static void _cipdomain_line(void *arg, char *line)
+{
+    char *ip_addr = (char *) arg;
+    char *next;
+    char *field;
+
+    // +CIPDOMAIN:<ip> (quoted on some firmware)
+    next = _line_value(line, "+CIPDOMAIN:");
+    if (next == NULL)
+    {
+        return;
+    }
+
+    field = _next_field(&next);
+    if (field != NULL)
+    {
+        _copy_field(ip_addr, field, ESP8266AT_IP_ADDR_LENGTH_MAX);
+    }
+}
+
+static ubi_st_t _cipdomain(esp8266at_t *esp8266at, char *host, char *ip_addr, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    ubi_st_t st;
+
+    ip_addr[0] = 0;
+
+    _cmd_begin(esp8266at, "AT+CIPDOMAIN=");
+    _cmd_quoted(esp8266at, host);
+    _cmd_end(esp8266at);
+    st = _send_cmd_and_read_lines(esp8266at, esp8266at->temp_cmd_buf, _cipdomain_line, ip_addr, timeoutms, &timeoutms);
+    if (st == UBI_ST_OK && ip_addr[0] == 0)
+    {
+        st = UBI_ST_ERR;
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    return st;
+}
+
+static ubi_st_t _resolve(esp8266at_t *esp8266at, char *host, char *ip_addr, uint8_t refresh, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    ubi_st_t st;
+    ubi_st_t st2;
+    esp8266at_dns_cache_t *entry;
+    uint8_t reordered;
+
+    st = UBI_ST_ERR;
+
+    do
+    {
+        if (_is_ip_addr(host))
+        {
+            _copy_field(ip_addr, host, ESP8266AT_IP_ADDR_LENGTH_MAX);
+            st = UBI_ST_OK;
+            break;
+        }
+
+        // The cache would store a longer name truncated and then match it for other names.
+        if (strlen(host) > ESP8266AT_HOST_LENGTH_MAX)
+        {
+            st = UBI_ST_ERR_PARAM;
+            break;
+        }
+
+        entry = _dns_cache_find(esp8266at, host);
+        if (entry != NULL && !refresh)
+        {
+            entry->use_tick = _gettick();
+            if (_elapsedms(entry->resolve_tick) < esp8266at->dns_cache_ttl_ms)
+            {
+                _copy_field(ip_addr, entry->ip_addr, ESP8266AT_IP_ADDR_LENGTH_MAX);
+                logmfd("resolve : %s = %s (cached)", host, ip_addr);
+                st = UBI_ST_OK;
+                break;
+            }
+        }
+
+        st = _cipdomain(esp8266at, host, ip_addr, timeoutms, &timeoutms);
+
+        // The module asks its primary server only, so try the others in turn. This rewrites the server setting,
+        // which ESP-AT may store in flash, so only a caller waiting for the address does it, not the background refresh.
+        reordered = 0;
+        for (uint32_t i = 1; !refresh && st != UBI_ST_OK && st != UBI_ST_TIMEOUT && i < ESP8266AT_DNS_SERVER_MAX; i++)
+        {
+            if (esp8266at->dns_server_addr[i][0] == 0)
+            {
+                break;
+            }
+
+            logmfi("resolve : %s failed, retry with server[%d] %s", host, i, esp8266at->dns_server_addr[i]);
+            _cipdns_build(esp8266at, 1, i);
+            reordered = 1;
+            st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+            if (st == UBI_ST_OK)
+            {
+                st = _cipdomain(esp8266at, host, ip_addr, timeoutms, &timeoutms);
+            }
+        }
+
+        if (reordered)
+        {
+            // Put the configured server order back, once for all the servers tried.
+            _cipdns_build(esp8266at, esp8266at->dns_enable, 0);
+            st2 = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+            _shadow_update(esp8266at, ESP8266AT_SHADOW_CIPDNS, esp8266at->temp_cmd_buf, st2);
+        }
+
+        if (st == UBI_ST_OK)
+        {
+            _dns_cache_store(esp8266at, host, ip_addr);
+            logmfd("resolve : %s = %s", host, ip_addr);
+            break;
+        }
+
+        // An expired address is still better than none while the DNS servers are unreachable.
+        entry = _dns_cache_find(esp8266at, host);
+        if (entry != NULL)
+        {
+            _copy_field(ip_addr, entry->ip_addr, ESP8266AT_IP_ADDR_LENGTH_MAX);
+            logmfw("resolve : %s failed (st = %d), using stale %s", host, st, ip_addr);
+            st = UBI_ST_OK;
+            break;
+        }
+
+        logmfw("resolve : %s failed (st = %d)", host, st);
+        break;
+    } while (1);
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    return st;
+}
+
+static void _dns_cache_refresh(esp8266at_t *esp8266at)
+{
+    int r;
+    uint32_t ttl_ms;
+    esp8266at_dns_cache_t *entry = NULL;
+    char ip_addr[ESP8266AT_IP_ADDR_LENGTH_MAX + 1];
+
+    if (!esp8266at->wifi_connected || _elapsedms(esp8266at->dns_refresh_tick) < ESP8266AT_DNS_REFRESH_INTERVAL_MS)
+    {
+        return;
+    }
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, ESP8266AT_SUPERVISOR_PROBE_TIMEOUT_MS);
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        // A command is in progress, try again on the next poll.
+        return;
+    }
+
+    // Renew a host in use during the last quarter of its TTL, so that the next connect does not wait for DNS.
+    ttl_ms = esp8266at->dns_cache_ttl_ms;
+    for (int i = 0; esp8266at->dns_cache_enable && i < ESP8266AT_DNS_CACHE_MAX; i++)
+    {
+        if (esp8266at->dns_cache[i].host[0] != 0 && _elapsedms(esp8266at->dns_cache[i].use_tick) < ttl_ms
+                && _elapsedms(esp8266at->dns_cache[i].resolve_tick) >= ttl_ms - ttl_ms / 4)
+        {
+            entry = &esp8266at->dns_cache[i];
+            break;
+        }
+    }
+
+    if (entry != NULL)
+    {
+        esp8266at->dns_refresh_tick = _gettick();
+        _resolve(esp8266at, entry->host, ip_addr, 1, ESP8266AT_DNS_RESOLVE_TIMEOUT_MS, NULL);
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+}
+
+ubi_st_t esp8266at_resolve(esp8266at_t *esp8266at, char *host, char *ip_addr, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    if (host == NULL || ip_addr == NULL || strlen(host) > ESP8266AT_HOST_LENGTH_MAX)
+    {
+        return UBI_ST_ERR_PARAM;
+    }
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    st = _resolve(esp8266at, host, ip_addr, 0, timeoutms, &timeoutms);
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_dns_cache_config(esp8266at_t *esp8266at, uint8_t enable, uint32_t ttl_ms)
+{
+    int r;
+
+    r = mutex_lock(esp8266at->cmd_mutex);
+    if (r != 0)
+    {
+        return UBI_ST_ERR;
+    }
+
+    esp8266at->dns_cache_enable = enable;
+    esp8266at->dns_cache_ttl_ms = (ttl_ms == 0) ? ESP8266AT_DNS_CACHE_TTL_MS : ttl_ms;
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return UBI_ST_OK;
+}
+
+ubi_st_t esp8266at_dns_cache_clear(esp8266at_t *esp8266at)
+{
+    int r;
+
+    r = mutex_lock(esp8266at->cmd_mutex);
+    if (r != 0)
+    {
+        return UBI_ST_ERR;
+    }
+
+    memset(esp8266at->dns_cache, 0, sizeof(esp8266at->dns_cache));
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return UBI_ST_OK;
+}
+
+#if (ESP8266AT__ENABLE_SNTP == 1)
+
+ubi_st_t esp8266at_cmd_at_cipsntpcfg(esp8266at_t *esp8266at, uint8_t enable, int8_t timezone, char * sntp_server_addr, char * sntp_server_addr2, char * sntp_server_addr3, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    esp8266at->sntp_enable = enable;
+    esp8266at->sntp_timezone = timezone;
+
+    _cmd_begin(esp8266at, "AT+CIPSNTPCFG=");
+    _cmd_int(esp8266at, enable);
+    _cmd_str(esp8266at, ",");
+    _cmd_int(esp8266at, timezone);
+    if (sntp_server_addr != NULL && strlen(sntp_server_addr) > 0)
+    {
+        _cmd_str(esp8266at, ",");
+        _cmd_quoted(esp8266at, sntp_server_addr);
+        if (esp8266at->sntp_server_addr[0] != sntp_server_addr)
+        {
+            strncpy(esp8266at->sntp_server_addr[0], sntp_server_addr, ESP8266AT_SNTP_SERVER_ADDR_LENGTH_MAX);
+        }
+
+        if (sntp_server_addr2 != NULL && strlen(sntp_server_addr2) > 0)
+        {
+            _cmd_str(esp8266at, ",");
+            _cmd_quoted(esp8266at, sntp_server_addr2);
+            if (esp8266at->sntp_server_addr[1] != sntp_server_addr2)
+            {
+                strncpy(esp8266at->sntp_server_addr[1], sntp_server_addr2, ESP8266AT_SNTP_SERVER_ADDR_LENGTH_MAX);
+            }
+
+            if (sntp_server_addr3 != NULL && strlen(sntp_server_addr3) > 0)
+            {
+                _cmd_str(esp8266at, ",");
+                _cmd_quoted(esp8266at, sntp_server_addr3);
+                if (esp8266at->sntp_server_addr[2] != sntp_server_addr3)
+                {
+                    strncpy(esp8266at->sntp_server_addr[2], sntp_server_addr3, ESP8266AT_SNTP_SERVER_ADDR_LENGTH_MAX);
+                }
+            }
+        }
+    }
+    _cmd_end(esp8266at);
+
+    if (_shadow_skip(esp8266at, ESP8266AT_SHADOW_CIPSNTPCFG, esp8266at->temp_cmd_buf))
+    {
+        st = UBI_ST_OK;
+    }
+    else
+    {
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        _shadow_update(esp8266at, ESP8266AT_SHADOW_CIPSNTPCFG, esp8266at->temp_cmd_buf, st);
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+static void _cipsntpcfg_q_line(void *arg, char *line)
+{
+    esp8266at_t *esp8266at = (esp8266at_t *) arg;
+    char *next;
+    char *field;
+
+    // +CIPSNTPCFG:<enable>,<timezone>[,"<server>"[,"<server2>"[,"<server3>"]]]
+    next = _line_value(line, "+CIPSNTPCFG:");
+    if (next == NULL)
+    {
+        return;
+    }
+
+    field = _next_field(&next);
+    if (field == NULL)
+    {
+        return;
+    }
+    esp8266at->sntp_enable = atoi(field);
+
+    field = _next_field(&next);
+    if (field == NULL)
+    {
+        return;
+    }
+    esp8266at->sntp_timezone = atoi(field);
+
+    memset(esp8266at->sntp_server_addr, 0, ESP8266AT_SNTP_SERVER_MAX * ESP8266AT_SNTP_SERVER_ADDR_LENGTH_MAX);
+    for (int i = 0; i < ESP8266AT_SNTP_SERVER_MAX; i++)
+    {
+        field = _next_field(&next);
+        if (field == NULL)
+        {
+            break;
+        }
+        _copy_field(esp8266at->sntp_server_addr[i], field, ESP8266AT_SNTP_SERVER_ADDR_LENGTH_MAX - 1);
+    }
+}
+
+ubi_st_t esp8266at_cmd_at_cipsntpcfg_q(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    st = _send_cmd_and_read_lines(esp8266at, "AT+CIPSNTPCFG?\r\n", _cipsntpcfg_q_line, esp8266at, timeoutms, &timeoutms);
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+typedef struct _cipsntptime_ctx_t
+{
+    struct tm *tm_ptr;
+    uint8_t found;
+} _cipsntptime_ctx_t;
+
+static char *_next_token(char **next, char delim)
+{
+    char *ptr;
+    char *token;
+
+    ptr = *next;
+    while (*ptr == ' ')
+    {
+        ptr++;
+    }
+    if (*ptr == 0)
+    {
+        return NULL;
+    }
+
+    token = ptr;
+    while (*ptr != 0 && *ptr != delim)
+    {
+        ptr++;
+    }
+    if (*ptr != 0)
+    {
+        *ptr = 0;
+        ptr++;
+    }
+
+    *next = ptr;
+
+    return token;
+}
+
+static void _cipsntptime_line(void *arg, char *line)
+{
+    _cipsntptime_ctx_t *ctx = (_cipsntptime_ctx_t *) arg;
+    struct tm *tm_ptr = ctx->tm_ptr;
+    char *next;
+    char *token[7];
+    const char * wday[7] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    const char * mon[12] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    const char delim[7] = {' ', ' ', ' ', ':', ':', ' ', ' '};
+
+    // +CIPSNTPTIME:<wday> <mon> <mday> <hour>:<min>:<sec> <year>, <mday> is padded with a space
+    next = _line_value(line, "+CIPSNTPTIME:");
+    if (next == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0; i < 7; i++)
+    {
+        token[i] = _next_token(&next, delim[i]);
+        if (token[i] == NULL)
+        {
+            return;
+        }
+    }
+
+    tm_ptr->tm_wday = 0;
+    for (int i = 0; i < 7; i++)
+    {
+        if (strcmp(token[0], wday[i]) == 0)
+        {
+            tm_ptr->tm_wday = i;
+            break;
+        }
+    }
+    tm_ptr->tm_mon = 0;
+    for (int i = 0; i < 12; i++)
+    {
+        if (strcmp(token[1], mon[i]) == 0)
+        {
+            tm_ptr->tm_mon = i;
+            break;
+        }
+    }
+    tm_ptr->tm_mday = atoi(token[2]);
+    tm_ptr->tm_hour = atoi(token[3]);
+    tm_ptr->tm_min = atoi(token[4]);
+    tm_ptr->tm_sec = atoi(token[5]);
+    tm_ptr->tm_year = atoi(token[6]);
+    if (tm_ptr->tm_year < 1900)
+    {
+        return;
+    }
+    tm_ptr->tm_year -= 1900;
+
+    ctx->found = 1;
+}
+
+ubi_st_t esp8266at_cmd_at_cipsntptime(esp8266at_t *esp8266at, struct tm * tm_ptr, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+    _cipsntptime_ctx_t ctx;
+
+    if (tm_ptr == NULL)
+    {
+        return UBI_ST_ERR;
+    }
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    ctx.tm_ptr = tm_ptr;
+    ctx.found = 0;
+
+    st = _send_cmd_and_read_lines(esp8266at, "AT+CIPSNTPTIME?\r\n", _cipsntptime_line, &ctx, timeoutms, &timeoutms);
+    if (st == UBI_ST_OK && !ctx.found)
+    {
+        st = UBI_ST_ERR;
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
+
+#if (ESP8266AT__ENABLE_MQTT == 1)
+
+ubi_st_t esp8266at_cmd_at_mqttusercfg(esp8266at_t *esp8266at, uint8_t mqtt_scheme, char * mqtt_client_id, char * mqtt_username, char * mqtt_passwd, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    if (mqtt_client_id == NULL || mqtt_username == NULL || mqtt_passwd == NULL)
+    {
+        return UBI_ST_ERR;
+    }
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    esp8266at->mqtt_scheme = mqtt_scheme;
+    if (esp8266at->mqtt_client_id != mqtt_client_id)
+    {
+        strncpy(esp8266at->mqtt_client_id, mqtt_client_id, ESP8266AT_MQTT_CLIENT_ID_LENGTH_MAX);
+    }
+    if (esp8266at->mqtt_username != mqtt_username)
+    {
+        strncpy(esp8266at->mqtt_username, mqtt_username, ESP8266AT_MQTT_USERNAME_LENGTH_MAX);
+    }
+    if (esp8266at->mqtt_passwd != mqtt_passwd)
+    {
+        strncpy(esp8266at->mqtt_passwd, mqtt_passwd, ESP8266AT_MQTT_PASSWD_LENGTH_MAX);
+    }
+
+    if (ESP8266AT_IS_WIZFI360(esp8266at))
+    {
+        _cmd_begin(esp8266at, "AT+MQTTSET=");
+        _cmd_quoted_mqtt(esp8266at, mqtt_username);
+        _cmd_str(esp8266at, ",");
+        _cmd_quoted_mqtt(esp8266at, mqtt_passwd);
+        _cmd_str(esp8266at, ",");
+        _cmd_quoted_mqtt(esp8266at, mqtt_client_id);
+        _cmd_str(esp8266at, ",");
+        _cmd_uint(esp8266at, esp8266at->mqtt_keepalive);
+        _cmd_end(esp8266at);
+    }
+    else
+    {
+        _cmd_begin(esp8266at, "AT+MQTTUSERCFG=0,");
+        _cmd_int(esp8266at, mqtt_scheme);
+        _cmd_str(esp8266at, ",");
+        _cmd_quoted_mqtt(esp8266at, mqtt_client_id);
+        _cmd_str(esp8266at, ",");
+        _cmd_quoted_mqtt(esp8266at, mqtt_username);
+        _cmd_str(esp8266at, ",");
+        _cmd_quoted_mqtt(esp8266at, mqtt_passwd);
+        // Certificates of the TLS schemes come from the AT+CIPSSLCCONF selection.
+        _cmd_str(esp8266at, ",");
+        _cmd_uint(esp8266at, esp8266at->ssl_pki_number);
+        _cmd_str(esp8266at, ",");
+        _cmd_uint(esp8266at, esp8266at->ssl_ca_number);
+        _cmd_str(esp8266at, ",\"\"");
+        _cmd_end(esp8266at);
+    }
+
+    if (_shadow_skip(esp8266at, ESP8266AT_SHADOW_MQTTUSERCFG, esp8266at->temp_cmd_buf))
+    {
+        st = UBI_ST_OK;
+    }
+    else
+    {
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        _shadow_update(esp8266at, ESP8266AT_SHADOW_MQTTUSERCFG, esp8266at->temp_cmd_buf, st);
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+ubi_st_t esp8266at_cmd_at_mqttconncfg(esp8266at_t *esp8266at, uint16_t keepalive, uint8_t disable_clean_session, char * lwt_topic, char * lwt_msg, uint8_t lwt_qos, uint8_t lwt_retain, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+    uint32_t shadow_id;
+
+    if (keepalive > ESP8266AT_MQTT_KEEPALIVE_MAX || lwt_qos > 2)
+    {
+        return UBI_ST_ERR;
+    }
+    if (lwt_topic == NULL)
+    {
+        lwt_topic = "";
+    }
+    if (lwt_msg == NULL)
+    {
+        lwt_msg = "";
+    }
+    if (strlen(lwt_topic) > ESP8266AT_MQTT_LWT_TOPIC_LENGTH_MAX || strlen(lwt_msg) > ESP8266AT_MQTT_LWT_MSG_LENGTH_MAX)
+    {
+        return UBI_ST_ERR;
+    }
+
+    // WizFi360 only supports keepalive (AT+MQTTSET)
+    if (ESP8266AT_IS_WIZFI360(esp8266at) && (disable_clean_session != 0 || strlen(lwt_topic) > 0))
+    {
+        return UBI_ST_ERR;
+    }
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    shadow_id = ESP8266AT_SHADOW_MQTTCONNCFG;
+    if (ESP8266AT_IS_WIZFI360(esp8266at))
+    {
+        shadow_id = ESP8266AT_SHADOW_MQTTUSERCFG;
+        // keepalive is a field of AT+MQTTSET, so resend it with the stored user config
+        _cmd_begin(esp8266at, "AT+MQTTSET=");
+        _cmd_quoted_mqtt(esp8266at, esp8266at->mqtt_username);
+        _cmd_str(esp8266at, ",");
+        _cmd_quoted_mqtt(esp8266at, esp8266at->mqtt_passwd);
+        _cmd_str(esp8266at, ",");
+        _cmd_quoted_mqtt(esp8266at, esp8266at->mqtt_client_id);
+        _cmd_str(esp8266at, ",");
+        _cmd_uint(esp8266at, keepalive);
+        _cmd_end(esp8266at);
+    }
+    else
+    {
+        _cmd_begin(esp8266at, "AT+MQTTCONNCFG=0,");
+        _cmd_uint(esp8266at, keepalive);
+        _cmd_str(esp8266at, ",");
+        _cmd_uint(esp8266at, disable_clean_session);
+        _cmd_str(esp8266at, ",");
+        _cmd_quoted_mqtt(esp8266at, lwt_topic);
+        _cmd_str(esp8266at, ",");
+        _cmd_quoted_mqtt(esp8266at, lwt_msg);
+        _cmd_str(esp8266at, ",");
+        _cmd_uint(esp8266at, lwt_qos);
+        _cmd_str(esp8266at, ",");
+        _cmd_uint(esp8266at, lwt_retain);
+        _cmd_end(esp8266at);
+    }
+
+    if (_shadow_skip(esp8266at, shadow_id, esp8266at->temp_cmd_buf))
+    {
+        st = UBI_ST_OK;
+    }
+    else
+    {
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        _shadow_update(esp8266at, shadow_id, esp8266at->temp_cmd_buf, st);
+    }
+
+    // Only an applied config is kept, because the supervisor replays it.
+    if (st == UBI_ST_OK)
+    {
+        esp8266at->mqtt_keepalive = keepalive;
+        esp8266at->mqtt_disable_clean_session = disable_clean_session;
+        if (esp8266at->mqtt_lwt_topic != lwt_topic)
+        {
+            strncpy(esp8266at->mqtt_lwt_topic, lwt_topic, ESP8266AT_MQTT_LWT_TOPIC_LENGTH_MAX);
+            esp8266at->mqtt_lwt_topic[ESP8266AT_MQTT_LWT_TOPIC_LENGTH_MAX] = 0;
+        }
+        if (esp8266at->mqtt_lwt_msg != lwt_msg)
+        {
+            strncpy(esp8266at->mqtt_lwt_msg, lwt_msg, ESP8266AT_MQTT_LWT_MSG_LENGTH_MAX);
+            esp8266at->mqtt_lwt_msg[ESP8266AT_MQTT_LWT_MSG_LENGTH_MAX] = 0;
+        }
+        esp8266at->mqtt_lwt_qos = lwt_qos;
+        esp8266at->mqtt_lwt_retain = lwt_retain;
+    }
+
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return st;
+}
+
+static void _mqtt_sub_bind(esp8266at_t *esp8266at, uint32_t id, char *topic, uint32_t qos)
+{
+    esp8266at_mqtt_sub_buf_t *sub_buf_p = &esp8266at->mqtt_sub_bufs[id];
+
+    // The rx interrupt handler matches received topics against this table.
+    ubik_entercrit();
+
+    memset(sub_buf_p->topic, 0, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX);
+    if (topic != NULL)
+    {
+        strncpy(sub_buf_p->topic, topic, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX - 1);
+    }
+    sub_buf_p->qos = qos;
+
+    ubik_exitcrit();
+}
+
+static ubi_st_t _mqtt_sub_emit(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    ubi_st_t st;
+
+    st = UBI_ST_OK;
+
+    if (ESP8266AT_IS_WIZFI360(esp8266at))
+    {
+        uint32_t count = 0;
+
+        _cmd_begin(esp8266at, "AT+MQTTTOPIC=");
+        _cmd_quoted_mqtt(esp8266at, esp8266at->mqtt_pub_topic);
+
+        for (int i = 0; i < ESP8266AT_IO_MQTT_SUB_BUF_MAX && count < ESP8266AT_WIZFI360_MQTT_SUB_TOPIC_MAX; i++)
+        {
+            if (esp8266at->mqtt_sub_bufs[i].topic[0] != 0)
+            {
+                _cmd_str(esp8266at, ",");
+                _cmd_quoted_mqtt(esp8266at, esp8266at->mqtt_sub_bufs[i].topic);
+                count++;
+            }
+        }
+
+        // Sent without sub topics too, as that is how the module drops the old ones.
+        _cmd_end(esp8266at);
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+    }
+    else
+    {
+        ubi_st_t st2;
+
+        for (int i = 0; i < ESP8266AT_IO_MQTT_SUB_BUF_MAX; i++)
+        {
+            if (esp8266at->mqtt_sub_bufs[i].topic[0] != 0)
+            {
+                _cmd_begin(esp8266at, "AT+MQTTSUB=0,");
+                _cmd_quoted_mqtt(esp8266at, esp8266at->mqtt_sub_bufs[i].topic);
+                _cmd_str(esp8266at, ",");
+                _cmd_uint(esp8266at, esp8266at->mqtt_sub_bufs[i].qos);
+                _cmd_end(esp8266at);
+                st2 = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+                if (st2 != UBI_ST_OK)
+                {
+                    logmfw("subscribe failed (id = %d, st = %d)", i, st2);
+                    st = st2;
+                }
+            }
+        }
+    }
 
     if (remain_timeoutms)
     {
         *remain_timeoutms = timeoutms;
     }
 
-    mutex_unlock(esp8266at->cmd_mutex);
-
     return st;
 }
 
-ubi_st_t esp8266at_cmd_at_gmr(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+static ubi_st_t _mqtt_unsub_send(esp8266at_t *esp8266at, char *topic, uint32_t timeoutms, uint32_t *remain_timeoutms)
 {
-    int r;
     ubi_st_t st;
-    char *ptr1 = NULL;
-    char *ptr2 = NULL;
-    int size = 0;
-    char *key = "AT version:";
 
-    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
-    timeoutms = task_getremainingtimeoutms();
-    if (r == UBIK_ERR__TIMEOUT)
+    _cmd_begin(esp8266at, "AT+MQTTUNSUB=0,");
+    _cmd_quoted_mqtt(esp8266at, topic);
+    _cmd_end(esp8266at);
+    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+
+    if (remain_timeoutms)
     {
-        return UBI_ST_TIMEOUT;
+        *remain_timeoutms = timeoutms;
     }
 
-    st = _send_cmd_and_wait_rsp(esp8266at, "AT+GMR\r\n", "OK\r\n", timeoutms, &timeoutms);
+    return st;
+}
 
-    if (st == UBI_ST_OK)
+static uint8_t _mqtt_topic_in(char *topic, char **topics, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
     {
-        do
+        if (topics[i] != NULL && strncmp(topic, topics[i], ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX - 1) == 0)
         {
-            ptr1 = strstr((char*) esp8266at->temp_resp_buf, key);
-            if (ptr1 == NULL)
-            {
-                break;
-            }
-            ptr1 = (char*) (((unsigned int) ptr1) + strlen(key));
-
-            ptr2 = strstr(ptr1, "(");
-            if (ptr2 == NULL || ptr1 >= ptr2)
-            {
-                break;
-            }
-
-            size = (unsigned int) ptr2 - (unsigned int) ptr1;
-            size = min(size, ESP8266AT_VERSION_LENGTH_MAX);
-            strncpy(esp8266at->version, ptr1, size);
-
-            break;
-        } while (1);
-    }
-
-    if (remain_timeoutms)
-    {
-        *remain_timeoutms = timeoutms;
+            return 1;
+        }
     }
 
-    mutex_unlock(esp8266at->cmd_mutex);
-
-    return st;
+    return 0;
 }
 
-ubi_st_t esp8266at_cmd_at_e(esp8266at_t *esp8266at, int is_on, uint32_t timeoutms, uint32_t *remain_timeoutms)
+ubi_st_t esp8266at_mqtt_pub_topic_swap(esp8266at_t *esp8266at, char *topic, char *old_topic, uint32_t timeoutms, uint32_t *remain_timeoutms)
 {
     int r;
-    ubi_st_t st;
+
+    if (topic == NULL || strlen(topic) >= ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX)
+    {
+        return UBI_ST_ERR;
+    }
 
     r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
     timeoutms = task_getremainingtimeoutms();
@@ -477,18 +4134,12 @@ ubi_st_t esp8266at_cmd_at_e(esp8266at_t *esp8266at, int is_on, uint32_t timeoutm
         return UBI_ST_TIMEOUT;
     }
 
-    sprintf(esp8266at->temp_cmd_buf, "ATE%d\r\n", is_on);
-    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
-
-    task_sleepms(100);
-    if (timeoutms < 100)
-    {
-        timeoutms = 0;
-    }
-    else
+    if (old_topic != NULL)
     {
-        timeoutms -= 100;
+        memcpy(old_topic, esp8266at->mqtt_pub_topic, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX);
     }
+    memset(esp8266at->mqtt_pub_topic, 0, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX);
+    strncpy(esp8266at->mqtt_pub_topic, topic, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX - 1);
 
     if (remain_timeoutms)
     {
@@ -497,13 +4148,22 @@ ubi_st_t esp8266at_cmd_at_e(esp8266at_t *esp8266at, int is_on, uint32_t timeoutm
 
     mutex_unlock(esp8266at->cmd_mutex);
 
-    return st;
+    return UBI_ST_OK;
 }
 
-ubi_st_t esp8266at_cmd_at_cwmode(esp8266at_t *esp8266at, int mode, uint32_t timeoutms, uint32_t *remain_timeoutms)
+ubi_st_t esp8266at_cmd_at_mqtttopic(esp8266at_t *esp8266at, char *pub_topic, char *sub_topic, char *sub_topic_2, char *sub_topic_3, uint32_t timeoutms, uint32_t *remain_timeoutms)
 {
     int r;
     ubi_st_t st;
+    ubi_st_t st2;
+    char *sub_topics[3] = {sub_topic, sub_topic_2, sub_topic_3};
+    char *old_topics[3];
+    uint32_t kept;
+
+    if (pub_topic == NULL || sub_topic == NULL)
+    {
+        return UBI_ST_ERR;
+    }
 
     r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
     timeoutms = task_getremainingtimeoutms();
@@ -512,17 +4172,79 @@ ubi_st_t esp8266at_cmd_at_cwmode(esp8266at_t *esp8266at, int mode, uint32_t time
         return UBI_ST_TIMEOUT;
     }
 
-    sprintf(esp8266at->temp_cmd_buf, "AT+CWMODE=%d\r\n", mode);
-    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+    memset(esp8266at->mqtt_pub_topic, 0, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX);
+    strncpy(esp8266at->mqtt_pub_topic, pub_topic, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX - 1);
 
-    task_sleepms(100);
-    if (timeoutms < 100)
+    if (ESP8266AT_IS_WIZFI360(esp8266at))
     {
-        timeoutms = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            _mqtt_sub_bind(esp8266at, i, sub_topics[i], 0);
+        }
+
+        // AT+MQTTTOPIC replaces the whole set.
+        st = _mqtt_sub_emit(esp8266at, timeoutms, &timeoutms);
+    }
+    else if (!esp8266at->mqtt_connected)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            _mqtt_sub_bind(esp8266at, i, sub_topics[i], 0);
+        }
+
+        // Subscriptions are sent by the next AT+MQTTCONN.
+        st = UBI_ST_OK;
     }
     else
     {
-        timeoutms -= 100;
+        st = UBI_ST_OK;
+
+        // Drop the topics that are replaced, and note the new ones that are subscribed already.
+        kept = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            old_topics[i] = esp8266at->mqtt_sub_bufs[i].topic[0] != 0 ? esp8266at->mqtt_sub_bufs[i].topic : NULL;
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            if (sub_topics[i] != NULL && sub_topics[i][0] != 0 && _mqtt_topic_in(sub_topics[i], old_topics, 3))
+            {
+                kept |= (1 << i);
+            }
+            if (old_topics[i] != NULL && !_mqtt_topic_in(old_topics[i], sub_topics, 3))
+            {
+                st2 = _mqtt_unsub_send(esp8266at, old_topics[i], timeoutms, &timeoutms);
+                if (st2 != UBI_ST_OK)
+                {
+                    logmfw("unsubscribe failed (id = %d, st = %d)", i, st2);
+                    st = st2;
+                }
+            }
+        }
+
+        for (int i = 0; i < 3; i++)
+        {
+            _mqtt_sub_bind(esp8266at, i, sub_topics[i], 0);
+        }
+
+        for (int i = 0; i < 3; i++)
+        {
+            if (sub_topics[i] == NULL || sub_topics[i][0] == 0 || (kept & (1 << i)) != 0)
+            {
+                continue;
+            }
+
+            _cmd_begin(esp8266at, "AT+MQTTSUB=0,");
+            _cmd_quoted_mqtt(esp8266at, sub_topics[i]);
+            _cmd_str(esp8266at, ",0");
+            _cmd_end(esp8266at);
+            st2 = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+            if (st2 != UBI_ST_OK)
+            {
+                logmfw("subscribe failed (id = %d, st = %d)", i, st2);
+                st = st2;
+            }
+        }
     }
 
     if (remain_timeoutms)
@@ -535,7 +4257,7 @@ ubi_st_t esp8266at_cmd_at_cwmode(esp8266at_t *esp8266at, int mode, uint32_t time
     return st;
 }
 
-ubi_st_t esp8266at_cmd_at_cipmux(esp8266at_t *esp8266at, int mode, uint32_t timeoutms, uint32_t *remain_timeoutms)
+ubi_st_t esp8266at_cmd_at_mqttconn(esp8266at_t *esp8266at, char *ip, uint32_t port, uint32_t reconnect, uint32_t timeoutms, uint32_t *remain_timeoutms)
 {
     int r;
     ubi_st_t st;
@@ -547,21 +4269,55 @@ ubi_st_t esp8266at_cmd_at_cipmux(esp8266at_t *esp8266at, int mode, uint32_t time
         return UBI_ST_TIMEOUT;
     }
 
-    sprintf(esp8266at->temp_cmd_buf, "AT+CIPMUX=%d\r\n", mode);
-    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
-    if (st == UBI_ST_OK)
+    if (ESP8266AT_IS_WIZFI360(esp8266at))
     {
-        esp8266at->mux_mode = mode;
+        if (esp8266at->mux_mode == 0)
+        {
+            _cmd_begin(esp8266at, "AT+MQTTCON=0,");
+            _cmd_quoted_mqtt(esp8266at, ip);
+            _cmd_str(esp8266at, ",");
+            _cmd_uint(esp8266at, port);
+            _cmd_end(esp8266at);
+            st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        }
+        else
+        {
+            _cmd_begin(esp8266at, "AT+MQTTCON=0,0,");
+            _cmd_quoted_mqtt(esp8266at, ip);
+            _cmd_str(esp8266at, ",");
+            _cmd_uint(esp8266at, port);
+            _cmd_end(esp8266at);
+            st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        }
     }
-
-    task_sleepms(100);
-    if (timeoutms < 100)
+    else
     {
-        timeoutms = 0;
+        _cmd_begin(esp8266at, "AT+MQTTCONN=0,");
+        _cmd_quoted_mqtt(esp8266at, ip);
+        _cmd_str(esp8266at, ",");
+        _cmd_uint(esp8266at, port);
+        _cmd_str(esp8266at, ",");
+        _cmd_uint(esp8266at, reconnect);
+        _cmd_end(esp8266at);
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        if (st == UBI_ST_OK)
+        {
+            _mqtt_sub_emit(esp8266at, timeoutms, &timeoutms);
+        }
     }
-    else
+
+    if (st == UBI_ST_OK)
     {
-        timeoutms -= 100;
+        if (esp8266at->mqtt_host != ip)
+        {
+            strncpy(esp8266at->mqtt_host, ip, ESP8266AT_HOST_LENGTH_MAX);
+        }
+        esp8266at->mqtt_port = port;
+        esp8266at->mqtt_reconnect = reconnect;
+        esp8266at->mqtt_requested = 1;
+        esp8266at->mqtt_connected = 1;
+        _urc_clear(esp8266at, ESP8266AT_IO_URC__MQTT_DISCONNECTED);
+        sem_give(esp8266at->io_urc_sem);
     }
 
     if (remain_timeoutms)
@@ -574,14 +4330,11 @@ ubi_st_t esp8266at_cmd_at_cipmux(esp8266at_t *esp8266at, int mode, uint32_t time
     return st;
 }
 
-ubi_st_t esp8266at_cmd_at_cwjap(esp8266at_t *esp8266at, char *ssid, char *passwd, uint32_t timeoutms, uint32_t *remain_timeoutms)
+ubi_st_t esp8266at_cmd_at_mqttclean(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
 {
     int r;
     ubi_st_t st;
 
-    assert(ssid != NULL);
-    assert(passwd != NULL);
-
     r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
     timeoutms = task_getremainingtimeoutms();
     if (r == UBIK_ERR__TIMEOUT)
@@ -589,17 +4342,16 @@ ubi_st_t esp8266at_cmd_at_cwjap(esp8266at_t *esp8266at, char *ssid, char *passwd
         return UBI_ST_TIMEOUT;
     }
 
-    if (esp8266at->ssid != ssid)
-    {
-        strncpy(esp8266at->ssid, ssid, ESP8266AT_SSID_LENGTH_MAX);
-    }
-    if (esp8266at->passwd != passwd)
-    {
-        strncpy(esp8266at->passwd, passwd, ESP8266AT_PASSWD_LENGTH_MAX);
-    }
+    // The WizFi360 AT+MQTTDIS answers "CLOSED", which must not be taken for the TCP link closing.
+    esp8266at->io_urc_ignore = esp8266at->dialect->mqtt_clean_urc;
+    st = _send_cmd_and_wait_rsp(esp8266at, (char *) esp8266at->dialect->mqtt_clean_cmd, (char *) esp8266at->dialect->mqtt_clean_rsp, timeoutms, &timeoutms);
+    esp8266at->io_urc_ignore = 0;
 
-    sprintf(esp8266at->temp_cmd_buf, "AT+"_CWJAP_STRING"=\"%s\",\"%s\"\r\n", ssid, passwd);
-    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+    // AT+MQTTCLEAN releases the MQTT configuration too.
+    esp8266at->shadow_applied &= ~((1 << ESP8266AT_SHADOW_MQTTUSERCFG) | (1 << ESP8266AT_SHADOW_MQTTCONNCFG));
+
+    esp8266at->mqtt_requested = 0;
+    esp8266at->mqtt_connected = 0;
 
     if (remain_timeoutms)
     {
@@ -611,10 +4363,11 @@ ubi_st_t esp8266at_cmd_at_cwjap(esp8266at_t *esp8266at, char *ssid, char *passwd
     return st;
 }
 
-ubi_st_t esp8266at_cmd_at_cwqap(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+ubi_st_t esp8266at_cmd_at_mqttpub(esp8266at_t *esp8266at, char *topic, char *data, uint32_t qos, uint32_t retain, uint32_t timeoutms, uint32_t *remain_timeoutms)
 {
     int r;
     ubi_st_t st;
+    uint32_t begin_tick;
 
     r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
     timeoutms = task_getremainingtimeoutms();
@@ -623,17 +4376,30 @@ ubi_st_t esp8266at_cmd_at_cwqap(esp8266at_t *esp8266at, uint32_t timeoutms, uint
         return UBI_ST_TIMEOUT;
     }
 
-    task_sleepms(500);
-    if (timeoutms < 500)
+    begin_tick = _gettick();
+
+    if (ESP8266AT_IS_WIZFI360(esp8266at))
     {
-        timeoutms = 0;
+        _cmd_begin(esp8266at, "AT+MQTTPUB=");
+        _cmd_quoted_mqtt(esp8266at, data);
+        _cmd_end(esp8266at);
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
     }
     else
     {
-        timeoutms -= 500;
+        _cmd_begin(esp8266at, "AT+MQTTPUB=0,");
+        _cmd_quoted_mqtt(esp8266at, topic);
+        _cmd_str(esp8266at, ",");
+        _cmd_quoted_mqtt(esp8266at, data);
+        _cmd_str(esp8266at, ",");
+        _cmd_uint(esp8266at, qos);
+        _cmd_str(esp8266at, ",");
+        _cmd_uint(esp8266at, retain);
+        _cmd_end(esp8266at);
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
     }
 
-    st = _send_cmd_and_wait_rsp(esp8266at, "AT+CWQAP\r\n", "OK\r\n", timeoutms, &timeoutms);
+    _mqtt_pub_stat_end(esp8266at, begin_tick, strlen(data), qos, st);
 
     if (remain_timeoutms)
     {
@@ -645,82 +4411,165 @@ ubi_st_t esp8266at_cmd_at_cwqap(esp8266at_t *esp8266at, uint32_t timeoutms, uint
     return st;
 }
 
-ubi_st_t esp8266at_cmd_at_cifsr(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+static ubi_st_t _mqtt_pub(esp8266at_t *esp8266at, char *topic, char *data, uint32_t length, uint32_t qos, uint32_t retain, uint32_t timeoutms,
+        uint32_t *remain_timeoutms)
 {
-    int r;
     ubi_st_t st;
-    char *ptr1 = NULL;
-    char *ptr2 = NULL;
-    int size = 0;
-    char *key = "STAIP,\"";
-    char *key2 = "STAMAC,\"";
+    uint32_t begin_tick;
 
-    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
-    timeoutms = task_getremainingtimeoutms();
-    if (r == UBIK_ERR__TIMEOUT)
-    {
-        return UBI_ST_TIMEOUT;
-    }
+    st = UBI_ST_ERR;
 
-    st = _send_cmd_and_wait_rsp(esp8266at, "AT+CIFSR\r\n", "OK\r\n", timeoutms, &timeoutms);
+    begin_tick = _gettick();
 
-    if (st == UBI_ST_OK)
+    do
     {
-        do
+        if (ESP8266AT_IS_WIZFI360(esp8266at))
+        {
+            _cmd_begin(esp8266at, "AT+MQTTPUB=");
+            _cmd_quoted_mqtt(esp8266at, data);
+            _cmd_end(esp8266at);
+            st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        }
+        else
         {
-            ptr1 = strstr((char*) esp8266at->temp_resp_buf, key);
-            if (ptr1 == NULL)
+            _cmd_begin(esp8266at, "AT+MQTTPUBRAW=0,");
+            _cmd_quoted_mqtt(esp8266at, topic);
+            _cmd_str(esp8266at, ",");
+            _cmd_uint(esp8266at, length);
+            _cmd_str(esp8266at, ",");
+            _cmd_uint(esp8266at, qos);
+            _cmd_str(esp8266at, ",");
+            _cmd_uint(esp8266at, retain);
+            _cmd_end(esp8266at);
+            st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, ">", timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
             {
-                st = UBI_ST_ERR;
                 break;
             }
-            ptr1 = (char*) (((unsigned int) ptr1) + strlen(key));
 
-            ptr2 = strstr(ptr1, "\"");
-            if (ptr2 == NULL || ptr1 >= ptr2)
+            st = esp8266at_io_write_timedms(esp8266at, (uint8_t *) data, length, NULL, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
             {
-                st = UBI_ST_ERR;
                 break;
             }
-
-            size = (unsigned int) ptr2 - (unsigned int) ptr1;
-            size = min(size, ESP8266AT_IP_ADDR_LENGTH_MAX);
-            strncpy(esp8266at->ip_addr, ptr1, size);
-
-            break;
-        } while (1);
-
-        do
-        {
-            ptr1 = strstr((char*) esp8266at->temp_resp_buf, key2);
-            if (ptr1 == NULL)
+            st = esp8266at_io_flush_timedms(esp8266at, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
             {
-                st = UBI_ST_ERR;
                 break;
             }
-            ptr1 = (char*) (((unsigned int) ptr1) + strlen(key2));
 
-            ptr2 = strstr(ptr1, "\"");
-            if (ptr2 == NULL || ptr1 >= ptr2)
+            st = _wait_rsp(esp8266at, "+MQTTPUB:OK\r\n", esp8266at->temp_resp_buf, ESP8266AT_TEMP_RESP_BUF_SIZE, NULL, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
             {
-                st = UBI_ST_ERR;
                 break;
             }
+        }
+
+        break;
+    } while (1);
 
-            size = (unsigned int) ptr2 - (unsigned int) ptr1;
-            size = min(size, ESP8266AT_MAC_ADDR_LENGTH_MAX);
-            strncpy(esp8266at->mac_addr, ptr1, size);
+    _mqtt_pub_stat_end(esp8266at, begin_tick, length, qos, st);
 
-            break;
-        } while (1);
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
     }
 
-    if (st != UBI_ST_OK)
+    return st;
+}
+
+static void _mqtt_pub_stat_end(esp8266at_t *esp8266at, uint32_t begin_tick, uint32_t length, uint32_t qos, ubi_st_t st)
+{
+    esp8266at_mqtt_pub_stat_t *stat = &esp8266at->mqtt_pub_stat;
+    uint32_t latency_ms;
+    uint32_t bin;
+
+    switch (st)
     {
-        memset(esp8266at->ip_addr, 0, ESP8266AT_IP_ADDR_LENGTH_MAX);
-        memset(esp8266at->mac_addr, 0, ESP8266AT_MAC_ADDR_LENGTH_MAX);
+    case UBI_ST_OK:
+        latency_ms = _elapsedms(begin_tick);
+
+        stat->msg_count++;
+        stat->msg_count_qos[min(qos, ESP8266AT_MQTT_QOS_MAX)]++;
+        stat->byte_count += length;
+
+        for (bin = 0; bin < ESP8266AT_MQTT_PUB_LATENCY_BIN_MAX - 1; bin++)
+        {
+            if (latency_ms < _mqtt_pub_latency_bin_ms[bin])
+            {
+                break;
+            }
+        }
+        stat->latency_hist[bin]++;
+        if (latency_ms < stat->latency_min_ms)
+        {
+            stat->latency_min_ms = latency_ms;
+        }
+        if (latency_ms > stat->latency_max_ms)
+        {
+            stat->latency_max_ms = latency_ms;
+        }
+        stat->latency_sum_ms += latency_ms;
+        break;
+    case UBI_ST_TIMEOUT:
+        stat->fail_count[ESP8266AT_MQTT_PUB_FAIL_TIMEOUT]++;
+        break;
+    case UBI_ST_ERR:
+        stat->fail_count[ESP8266AT_MQTT_PUB_FAIL_ERROR]++;
+        break;
+    case UBI_ST_ERR_IO:
+        stat->fail_count[ESP8266AT_MQTT_PUB_FAIL_IO]++;
+        break;
+    default:
+        stat->fail_count[ESP8266AT_MQTT_PUB_FAIL_OTHER]++;
+        break;
+    }
+}
+
+ubi_st_t esp8266at_mqtt_pub_stat_get(esp8266at_t *esp8266at, esp8266at_mqtt_pub_stat_t *stat)
+{
+    if (stat == NULL)
+    {
+        return UBI_ST_ERR;
+    }
+
+    mutex_lock(esp8266at->cmd_mutex);
+
+    memcpy(stat, &esp8266at->mqtt_pub_stat, sizeof(esp8266at_mqtt_pub_stat_t));
+    stat->elapsed_ms = _elapsedms(stat->begin_tick);
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return UBI_ST_OK;
+}
+
+ubi_st_t esp8266at_mqtt_pub_stat_reset(esp8266at_t *esp8266at)
+{
+    mutex_lock(esp8266at->cmd_mutex);
+
+    memset(&esp8266at->mqtt_pub_stat, 0, sizeof(esp8266at_mqtt_pub_stat_t));
+    esp8266at->mqtt_pub_stat.latency_min_ms = UINT32_MAX;
+    esp8266at->mqtt_pub_stat.begin_tick = _gettick();
+
+    mutex_unlock(esp8266at->cmd_mutex);
+
+    return UBI_ST_OK;
+}
+
+ubi_st_t esp8266at_cmd_at_mqttpubraw(esp8266at_t *esp8266at, char *topic, char *data, uint32_t length, uint32_t qos, uint32_t retain, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t st;
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    timeoutms = task_getremainingtimeoutms();
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
     }
 
+    st = _mqtt_pub(esp8266at, topic, data, length, qos, retain, timeoutms, &timeoutms);
+
     if (remain_timeoutms)
     {
         *remain_timeoutms = timeoutms;
@@ -731,20 +4580,44 @@ ubi_st_t esp8266at_cmd_at_cifsr(esp8266at_t *esp8266at, uint32_t timeoutms, uint
     return st;
 }
 
-ubi_st_t esp8266at_cmd_at_cipstart(esp8266at_t *esp8266at, char *type, char *ip, uint32_t port, uint32_t timeoutms, uint32_t *remain_timeoutms)
+ubi_st_t esp8266at_cmd_at_mqttsub(esp8266at_t *esp8266at, uint32_t id, char *topic, uint32_t qos, uint32_t timeoutms, uint32_t *remain_timeoutms)
 {
     int r;
     ubi_st_t st;
 
+    if (id >= ESP8266AT_IO_MQTT_SUB_BUF_MAX)
+    {
+        return UBI_ST_ERR;
+    }
+
     r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
     timeoutms = task_getremainingtimeoutms();
     if (r == UBIK_ERR__TIMEOUT)
     {
-        return UBI_ST_TIMEOUT;
+        return UBI_ST_TIMEOUT;
+    }
+
+    if (ESP8266AT_IS_WIZFI360(esp8266at))
+    {
+        _mqtt_sub_bind(esp8266at, id, topic, qos);
+        st = _mqtt_sub_emit(esp8266at, timeoutms, &timeoutms);
     }
+    else
+    {
+        // The topic that is replaced would still be delivered and then discarded as unbound.
+        if (esp8266at->mqtt_sub_bufs[id].topic[0] != 0 && strncmp(esp8266at->mqtt_sub_bufs[id].topic, topic, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX - 1) != 0)
+        {
+            _mqtt_unsub_send(esp8266at, esp8266at->mqtt_sub_bufs[id].topic, timeoutms, &timeoutms);
+        }
+        _mqtt_sub_bind(esp8266at, id, topic, qos);
 
-    sprintf(esp8266at->temp_cmd_buf, "AT+CIPSTART=\"%s\",\"%s\",%lu\r\n", type, ip, port);
-    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        _cmd_begin(esp8266at, "AT+MQTTSUB=0,");
+        _cmd_quoted_mqtt(esp8266at, topic);
+        _cmd_str(esp8266at, ",");
+        _cmd_uint(esp8266at, qos);
+        _cmd_end(esp8266at);
+        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+    }
 
     if (remain_timeoutms)
     {
@@ -756,8 +4629,7 @@ ubi_st_t esp8266at_cmd_at_cipstart(esp8266at_t *esp8266at, char *type, char *ip,
     return st;
 }
 
-ubi_st_t esp8266at_cmd_at_cipstart_multiple(esp8266at_t *esp8266at, int id, char *type, char *ip, uint32_t port, uint32_t timeoutms,
-        uint32_t *remain_timeoutms)
+ubi_st_t esp8266at_cmd_at_mqttsub_q(esp8266at_t *esp8266at, esp8266at_line_handler_t handler, void *arg, uint32_t timeoutms, uint32_t *remain_timeoutms)
 {
     int r;
     ubi_st_t st;
@@ -769,8 +4641,8 @@ ubi_st_t esp8266at_cmd_at_cipstart_multiple(esp8266at_t *esp8266at, int id, char
         return UBI_ST_TIMEOUT;
     }
 
-    sprintf(esp8266at->temp_cmd_buf, "AT+CIPSTART=%d,\"%s\",\"%s\",%lu\r\n", id, type, ip, port);
-    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+    // +MQTTSUB:<link_id>,<state>,"<topic>",<qos> per subscription
+    st = _send_cmd_and_read_lines(esp8266at, "AT+MQTTSUB?\r\n", handler, arg, timeoutms, &timeoutms);
 
     if (remain_timeoutms)
     {
@@ -782,11 +4654,16 @@ ubi_st_t esp8266at_cmd_at_cipstart_multiple(esp8266at_t *esp8266at, int id, char
     return st;
 }
 
-ubi_st_t esp8266at_cmd_at_cipclose(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+ubi_st_t esp8266at_cmd_at_mqttunsub(esp8266at_t *esp8266at, uint32_t id, uint32_t timeoutms, uint32_t *remain_timeoutms)
 {
     int r;
     ubi_st_t st;
 
+    if (id >= ESP8266AT_IO_MQTT_SUB_BUF_MAX)
+    {
+        return UBI_ST_ERR;
+    }
+
     r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
     timeoutms = task_getremainingtimeoutms();
     if (r == UBIK_ERR__TIMEOUT)
@@ -794,7 +4671,19 @@ ubi_st_t esp8266at_cmd_at_cipclose(esp8266at_t *esp8266at, uint32_t timeoutms, u
         return UBI_ST_TIMEOUT;
     }
 
-    st = _send_cmd_and_wait_rsp(esp8266at, "AT+CIPCLOSE\r\n", "OK\r\n", timeoutms, &timeoutms);
+    if (ESP8266AT_IS_WIZFI360(esp8266at))
+    {
+        _mqtt_sub_bind(esp8266at, id, NULL, 0);
+        st = _mqtt_sub_emit(esp8266at, timeoutms, &timeoutms);
+    }
+    else
+    {
+        st = _mqtt_unsub_send(esp8266at, esp8266at->mqtt_sub_bufs[id].topic, timeoutms, &timeoutms);
+        if (st == UBI_ST_OK)
+        {
+            _mqtt_sub_bind(esp8266at, id, NULL, 0);
+        }
+    }
 
     if (remain_timeoutms)
     {
@@ -806,266 +4695,302 @@ ubi_st_t esp8266at_cmd_at_cipclose(esp8266at_t *esp8266at, uint32_t timeoutms, u
     return st;
 }
 
-ubi_st_t esp8266at_cmd_at_cipsend(esp8266at_t *esp8266at, uint8_t *buffer, uint32_t length, uint32_t timeoutms, uint32_t *remain_timeoutms)
+ubi_st_t esp8266at_cmd_at_mqttsubget(esp8266at_t *esp8266at, uint32_t id, uint8_t *buffer, uint32_t max_length, uint32_t *received, uint32_t timeoutms, uint32_t *remain_timeoutms)
 {
     int r;
     ubi_st_t st;
+    uint32_t read_tmp = 0;
+    uint32_t len;
+    esp8266at_mqtt_sub_buf_t *sub_buf_p = NULL;
+    esp8266at_mqtt_sub_buf_msg_t sub_msg;
 
-    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    if (id >= ESP8266AT_IO_MQTT_SUB_BUF_MAX)
+    {
+        return UBI_ST_ERR;
+    }
+
+    sub_buf_p = &esp8266at->mqtt_sub_bufs[id];
+
+    r = mutex_lock_timedms(sub_buf_p->data_mutex, timeoutms);
     timeoutms = task_getremainingtimeoutms();
     if (r == UBIK_ERR__TIMEOUT)
     {
         return UBI_ST_TIMEOUT;
     }
 
-    st = UBI_ST_ERR;
-
     do
     {
-        sprintf(esp8266at->temp_cmd_buf, "AT+CIPSEND=%lu\r\n", length);
-        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, ">", timeoutms, &timeoutms);
-        if (st != UBI_ST_OK)
+        r = msgq_receive_timedms(sub_buf_p->msgs, (unsigned char *) &sub_msg, timeoutms);
+        timeoutms = task_getremainingtimeoutms();
+        if (r == UBIK_ERR__TIMEOUT)
         {
+            st = UBI_ST_TIMEOUT;
             break;
         }
-
-        st = esp8266at_io_write_timedms(esp8266at, buffer, length, NULL, timeoutms, &timeoutms);
-        if (st != UBI_ST_OK)
+        if (r != 0)
         {
+            st = UBI_ST_ERR;
             break;
         }
-        st = esp8266at_io_flush_timedms(esp8266at, timeoutms, &timeoutms);
-        if (st != UBI_ST_OK)
+
+        if (sub_msg > max_length)
         {
-            break;
+            len = max_length;
+            st = cbuf_read(sub_buf_p->data_buf, buffer, len, &read_tmp);
+            assert(st == UBI_ERR_OK);
+            st = cbuf_read(sub_buf_p->data_buf, NULL, sub_msg - len, NULL);
+            assert(st == UBI_ERR_OK);
+            st = UBI_ST_ERR_OVERFLOW;
         }
-
-        st = _wait_rsp(esp8266at, "SEND OK\r\n", esp8266at->temp_resp_buf, ESP8266AT_TEMP_RESP_BUF_SIZE, NULL, timeoutms, &timeoutms);
-        if (st != UBI_ST_OK)
+        else
         {
-            break;
+            len = sub_msg;
+            st = cbuf_read(sub_buf_p->data_buf, buffer, len, &read_tmp);
+            assert(st == UBI_ERR_OK);
+            st = UBI_ST_OK;
         }
 
         break;
     } while (1);
 
+    if (received)
+    {
+        *received = read_tmp;
+    }
+
     if (remain_timeoutms)
     {
         *remain_timeoutms = timeoutms;
     }
 
-    mutex_unlock(esp8266at->cmd_mutex);
+    mutex_unlock(sub_buf_p->data_mutex);
 
     return st;
 }
 
-ubi_st_t esp8266at_cmd_at_ciprecv(esp8266at_t *esp8266at, uint8_t *buffer, uint32_t length, uint32_t *received, uint32_t timeoutms, uint32_t *remain_timeoutms)
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+uint32_t esp8266at_urc_process(esp8266at_t *esp8266at)
 {
     int r;
-    ubi_st_t st;
-    uint32_t read_tmp;
-    uint32_t read_tmp2;
+    uint32_t flags;
 
-    r = mutex_lock_timedms(esp8266at->io_data_read_mutex, timeoutms);
-    timeoutms = task_getremainingtimeoutms();
-    if (r == UBIK_ERR__TIMEOUT)
+    // A restart resets the state that a running command relies on, so it is handled between commands.
+    r = mutex_lock(esp8266at->cmd_mutex);
+    if (r != 0)
     {
-        return UBI_ST_TIMEOUT;
+        return 0;
     }
 
-    st = UBI_ST_ERR;
+    flags = _urc_process(esp8266at);
 
-    read_tmp = 0;
-    read_tmp2 = 0;
+    mutex_unlock(esp8266at->cmd_mutex);
 
-    for (;;)
-    {
-        st = cbuf_read(esp8266at->io_data_buf, &buffer[read_tmp], length - read_tmp, &read_tmp2);
-        assert(st == UBI_ERR_OK || st == UBI_ERR_BUF_EMPTY);
-        read_tmp += read_tmp2;
+    return flags;
+}
 
-        if (read_tmp >= length)
-        {
-            st = UBI_ST_OK;
-            break;
-        }
-        else
-        {
-            if (timeoutms == 0)
-            {
-                st = UBI_ST_TIMEOUT;
-                break;
-            }
-            r = sem_take_timedms(esp8266at->io_data_read_sem, timeoutms);
-            timeoutms = task_getremainingtimeoutms();
-            if (r == UBIK_ERR__TIMEOUT)
-            {
-                st = UBI_ST_TIMEOUT;
-                break;
-            }
-            if (r != 0)
-            {
-                st = UBI_ST_ERR;
-                break;
-            }
-        }
-    }
+// The caller holds cmd_mutex.
+static uint32_t _urc_process(esp8266at_t *esp8266at)
+{
+    uint32_t flags;
 
-    if (received)
+    ubik_entercrit();
+    flags = esp8266at->io_urc_flags;
+    esp8266at->io_urc_flags = 0;
+    ubik_exitcrit();
+
+#if (ESP8266AT__ENABLE_MQTT == 1)
+    if ((flags & ESP8266AT_IO_URC__MQTT_DISCONNECTED) != 0)
     {
-        *received = read_tmp;
+        esp8266at->mqtt_connected = 0;
     }
-
-    if (remain_timeoutms)
+    if ((flags & ESP8266AT_IO_URC__MQTT_CONNECTED) != 0)
     {
-        *remain_timeoutms = timeoutms;
+        esp8266at->mqtt_connected = 1;
+    }
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+    if ((flags & ESP8266AT_IO_URC__WIFI_DISCONNECT) != 0)
+    {
+        esp8266at->wifi_connected = 0;
+    }
+    if ((flags & ESP8266AT_IO_URC__WIFI_GOT_IP) != 0)
+    {
+        esp8266at->wifi_connected = 1;
+    }
+    if ((flags & ESP8266AT_IO_URC__CLOSED) != 0)
+    {
+        esp8266at->tcp_connected = 0;
+    }
+    if ((flags & ESP8266AT_IO_URC__READY) != 0)
+    {
+        // The module restarted, so nothing configured before is in effect.
+        esp8266at_shadow_invalidate(esp8266at);
+        _restart_reset(esp8266at);
+        // e.g. the end of a timed deep sleep
+        _power_state_set(esp8266at, ESP8266AT_POWER_ACTIVE);
     }
 
-    mutex_unlock(esp8266at->io_data_read_mutex);
-
-    return st;
+    return flags;
 }
 
-ubi_st_t esp8266at_cmd_at_cipdns(esp8266at_t *esp8266at, uint8_t enable, char * dns_server_addr, char * dns_server_addr2, char * dns_server_addr3, uint32_t timeoutms, uint32_t *remain_timeoutms)
-{
-    int r;
-    ubi_st_t st;
-    char *ptr1;
+#if (ESP8266AT__ENABLE_MQTT == 1)
 
-    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
-    timeoutms = task_getremainingtimeoutms();
-    if (r == UBIK_ERR__TIMEOUT)
+ubi_st_t esp8266at_mqtt_pubq_config(esp8266at_t *esp8266at, uint8_t drop_policy, esp8266at_mqtt_pubq_spill_t *spill)
+{
+    if (drop_policy > ESP8266AT_MQTT_PUBQ_DROP_LOWEST_QOS)
     {
-        return UBI_ST_TIMEOUT;
+        return UBI_ST_ERR;
     }
 
-    esp8266at->dns_enable = enable;
+    mutex_lock(esp8266at->mqtt_pubq_mutex);
 
-    sprintf(esp8266at->temp_cmd_buf, "AT+"_CIPDNS_STRING"=%d", enable);
-    ptr1 = esp8266at->temp_cmd_buf + strlen(esp8266at->temp_cmd_buf);
-    if (dns_server_addr != NULL && strlen(dns_server_addr) > 0)
+    esp8266at->mqtt_pubq_drop_policy = drop_policy;
+    if (spill != NULL)
     {
-        sprintf(ptr1, ",\"%s\"", dns_server_addr);
-        ptr1 += strlen(ptr1);
-        if (esp8266at->dns_server_addr[0] != dns_server_addr)
-        {
-            strncpy(esp8266at->dns_server_addr[0], dns_server_addr, ESP8266AT_DNS_SERVER_ADDR_LENGTH_MAX);
-        }
+        memcpy(&esp8266at->mqtt_pubq_spill, spill, sizeof(esp8266at_mqtt_pubq_spill_t));
+    }
+    else
+    {
+        memset(&esp8266at->mqtt_pubq_spill, 0, sizeof(esp8266at_mqtt_pubq_spill_t));
+    }
 
-        if (dns_server_addr2 != NULL && strlen(dns_server_addr2) > 0)
-        {
-            sprintf(ptr1, ",\"%s\"", dns_server_addr2);
-            ptr1 += strlen(ptr1);
-            if (esp8266at->dns_server_addr[1] != dns_server_addr2)
-            {
-                strncpy(esp8266at->dns_server_addr[1], dns_server_addr2, ESP8266AT_DNS_SERVER_ADDR_LENGTH_MAX);
-            }
+    mutex_unlock(esp8266at->mqtt_pubq_mutex);
 
-            if (dns_server_addr3 != NULL && strlen(dns_server_addr3) > 0)
-            {
-                sprintf(ptr1, ",\"%s\"", dns_server_addr3);
-                ptr1 += strlen(ptr1);
-                if (esp8266at->dns_server_addr[2] != dns_server_addr3)
-                {
-                    strncpy(esp8266at->dns_server_addr[2], dns_server_addr3, ESP8266AT_DNS_SERVER_ADDR_LENGTH_MAX);
-                }
-            }
-        }
-    }
-    sprintf(ptr1, "\r\n");
+    return UBI_ST_OK;
+}
 
-    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+static void _mqtt_pubq_remove(esp8266at_t *esp8266at, uint32_t index)
+{
+    uint8_t slot;
 
-    if (remain_timeoutms)
+    slot = esp8266at->mqtt_pubq_order[index];
+    for (uint32_t i = index; i + 1 < esp8266at->mqtt_pubq_count; i++)
     {
-        *remain_timeoutms = timeoutms;
+        esp8266at->mqtt_pubq_order[i] = esp8266at->mqtt_pubq_order[i + 1];
     }
-
-    mutex_unlock(esp8266at->cmd_mutex);
-
-    return st;
+    esp8266at->mqtt_pubq_count--;
+    esp8266at->mqtt_pubq_order[esp8266at->mqtt_pubq_count] = slot;
 }
 
-ubi_st_t esp8266at_cmd_at_cipdns_q(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+ubi_st_t esp8266at_mqtt_pubq_put(esp8266at_t *esp8266at, char *topic, char *data, uint32_t length, uint32_t qos, uint32_t retain)
 {
-    int r;
     ubi_st_t st;
-    char *ptr1 = NULL;
-    char *ptr2 = NULL;
-    int size = 0;
-    const char *key = "+"_CIPDNS_STRING":";
+    esp8266at_mqtt_pubq_spill_t *spill;
+    esp8266at_mqtt_pubq_msg_t *msg;
+    int32_t victim;
 
-    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
-    timeoutms = task_getremainingtimeoutms();
-    if (r == UBIK_ERR__TIMEOUT)
+    if (topic == NULL || data == NULL || length > ESP8266AT_MQTT_PUBQ_DATA_LENGTH_MAX)
     {
-        return UBI_ST_TIMEOUT;
+        return UBI_ST_ERR;
     }
 
-    st = _send_cmd_and_wait_rsp(esp8266at, "AT+"_CIPDNS_STRING"?\r\n", "OK\r\n", timeoutms, &timeoutms);
+    mutex_lock(esp8266at->mqtt_pubq_mutex);
 
-    if (st == UBI_ST_OK)
+    spill = &esp8266at->mqtt_pubq_spill;
+    st = UBI_ST_OK;
+
+    do
     {
-        do
+        if (esp8266at->mqtt_pubq_count >= ESP8266AT_MQTT_PUBQ_MSG_MAX)
         {
-            ptr1 = strstr((char*) esp8266at->temp_resp_buf, key);
-            if (ptr1 == NULL)
+            // select a victim : -1 means the new message, the message being sent can not be selected
+            victim = -1;
+            switch (esp8266at->mqtt_pubq_drop_policy)
             {
+            case ESP8266AT_MQTT_PUBQ_DROP_OLDEST:
+                if (esp8266at->mqtt_pubq_inflight < esp8266at->mqtt_pubq_count)
+                {
+                    victim = esp8266at->mqtt_pubq_inflight;
+                }
                 break;
-            }
-            ptr1 = (char*) (((unsigned int) ptr1) + strlen(key));
-
-            ////
-            ptr2 = strstr(ptr1, ",");
-            if (ptr2 == NULL || ptr1 >= ptr2)
-            {
+            case ESP8266AT_MQTT_PUBQ_DROP_LOWEST_QOS:
+                for (uint32_t i = esp8266at->mqtt_pubq_inflight; i < esp8266at->mqtt_pubq_count; i++)
+                {
+                    msg = &esp8266at->mqtt_pubq_msgs[esp8266at->mqtt_pubq_order[i]];
+                    if (msg->qos <= qos && (victim < 0 || msg->qos < esp8266at->mqtt_pubq_msgs[esp8266at->mqtt_pubq_order[victim]].qos))
+                    {
+                        victim = i;
+                    }
+                }
+                break;
+            default:
                 break;
             }
-            *ptr2 = 0x0;
-            esp8266at->dns_enable = atoi(ptr1);
-            *ptr2 = ' ';
 
-            ////
-            for (int i = 0; i < ESP8266AT_DNS_SERVER_MAX; i++)
+            if (victim < 0)
             {
-                ptr1 = ptr2;
-                ptr2 = strstr(ptr1, "\"");
-                if (ptr2 == NULL || ptr1 >= ptr2)
+                if (spill->push != NULL && spill->push(spill->arg, topic, (uint8_t *) data, length, qos, retain) == UBI_ST_OK)
                 {
-                    break;
+                    esp8266at->mqtt_pubq_spill_count++;
                 }
-                *ptr2 = ' ';
-                ptr1 = ptr2;
-                ptr2 = strstr(ptr1, "\"");
-                if (ptr2 == NULL || ptr1 >= ptr2)
+                else
                 {
-                    break;
+                    esp8266at->mqtt_pubq_drop_count++;
+                    st = UBI_ST_ERR_OVERFLOW;
                 }
-                *ptr2 = ' ';
-                ptr1++;
-                size = (unsigned int) ptr2 - (unsigned int) ptr1;
-                size = min(size, ESP8266AT_DNS_SERVER_ADDR_LENGTH_MAX);
-                strncpy(esp8266at->dns_server_addr[i], ptr1, size);
+                break;
             }
-            break;
-        } while (1);
-    }
 
-    if (remain_timeoutms)
-    {
-        *remain_timeoutms = timeoutms;
-    }
+            msg = &esp8266at->mqtt_pubq_msgs[esp8266at->mqtt_pubq_order[victim]];
+            if (spill->push != NULL && spill->push(spill->arg, msg->topic, msg->data, msg->length, msg->qos, msg->retain) == UBI_ST_OK)
+            {
+                esp8266at->mqtt_pubq_spill_count++;
+            }
+            else
+            {
+                esp8266at->mqtt_pubq_drop_count++;
+            }
+            _mqtt_pubq_remove(esp8266at, victim);
+        }
 
-    mutex_unlock(esp8266at->cmd_mutex);
+        msg = &esp8266at->mqtt_pubq_msgs[esp8266at->mqtt_pubq_order[esp8266at->mqtt_pubq_count]];
+        strncpy(msg->topic, topic, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX - 1);
+        msg->topic[ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX - 1] = 0;
+        memcpy(msg->data, data, length);
+        msg->data[length] = 0;
+        msg->length = length;
+        msg->qos = qos;
+        msg->retain = retain;
+        esp8266at->mqtt_pubq_count++;
+
+        break;
+    } while (1);
+
+    mutex_unlock(esp8266at->mqtt_pubq_mutex);
 
     return st;
 }
 
-ubi_st_t esp8266at_cmd_at_cipsntpcfg(esp8266at_t *esp8266at, uint8_t enable, int8_t timezone, char * sntp_server_addr, char * sntp_server_addr2, char * sntp_server_addr3, uint32_t timeoutms, uint32_t *remain_timeoutms)
+uint32_t esp8266at_mqtt_pubq_count(esp8266at_t *esp8266at)
+{
+    uint32_t count;
+
+    mutex_lock(esp8266at->mqtt_pubq_mutex);
+    count = esp8266at->mqtt_pubq_count;
+    mutex_unlock(esp8266at->mqtt_pubq_mutex);
+
+    return count;
+}
+
+// Whether the drain task has queued messages to send now.
+static uint8_t _mqtt_pubq_pending(esp8266at_t *esp8266at, uint8_t *connected)
+{
+    uint8_t pending;
+
+    mutex_lock(esp8266at->mqtt_pubq_mutex);
+    *connected = esp8266at->mqtt_connected;
+    pending = (esp8266at->mqtt_connected && esp8266at->mqtt_pubq_count > 0);
+    mutex_unlock(esp8266at->mqtt_pubq_mutex);
+
+    return pending;
+}
+
+ubi_st_t esp8266at_mqtt_pubq_drain(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
 {
     int r;
     ubi_st_t st;
-    char *ptr1;
+    esp8266at_mqtt_pubq_spill_t *spill;
+    esp8266at_mqtt_pubq_msg_t *msg;
 
     r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
     timeoutms = task_getremainingtimeoutms();
@@ -1074,43 +4999,47 @@ ubi_st_t esp8266at_cmd_at_cipsntpcfg(esp8266at_t *esp8266at, uint8_t enable, int
         return UBI_ST_TIMEOUT;
     }
 
-    esp8266at->sntp_enable = enable;
-    esp8266at->sntp_timezone = timezone;
+    spill = &esp8266at->mqtt_pubq_spill;
+    st = UBI_ST_OK;
 
-    sprintf(esp8266at->temp_cmd_buf, "AT+CIPSNTPCFG=%d,%d", enable, timezone);
-    ptr1 = esp8266at->temp_cmd_buf + strlen(esp8266at->temp_cmd_buf);
-    if (sntp_server_addr != NULL && strlen(sntp_server_addr) > 0)
+    // Messages are sent back to back while holding the command mutex once.
+    // The module accepts one command at a time, so one publish is in flight.
+    for (;;)
     {
-        sprintf(ptr1, ",\"%s\"", sntp_server_addr);
-        ptr1 += strlen(ptr1);
-        if (esp8266at->sntp_server_addr[0] != sntp_server_addr)
-        {
-            strncpy(esp8266at->sntp_server_addr[0], sntp_server_addr, ESP8266AT_SNTP_SERVER_ADDR_LENGTH_MAX);
-        }
-
-        if (sntp_server_addr2 != NULL && strlen(sntp_server_addr2) > 0)
+        mutex_lock(esp8266at->mqtt_pubq_mutex);
+        if (esp8266at->mqtt_pubq_count == 0)
         {
-            sprintf(ptr1, ",\"%s\"", sntp_server_addr2);
-            ptr1 += strlen(ptr1);
-            if (esp8266at->sntp_server_addr[1] != sntp_server_addr2)
+            // refill from the spill storage after the RAM queue has been drained
+            msg = &esp8266at->mqtt_pubq_msgs[esp8266at->mqtt_pubq_order[0]];
+            if (spill->pop != NULL && spill->pop(spill->arg, msg) == UBI_ST_OK)
             {
-                strncpy(esp8266at->sntp_server_addr[1], sntp_server_addr2, ESP8266AT_SNTP_SERVER_ADDR_LENGTH_MAX);
+                esp8266at->mqtt_pubq_count = 1;
             }
-
-            if (sntp_server_addr3 != NULL && strlen(sntp_server_addr3) > 0)
+            else
             {
-                sprintf(ptr1, ",\"%s\"", sntp_server_addr3);
-                ptr1 += strlen(ptr1);
-                if (esp8266at->sntp_server_addr[2] != sntp_server_addr3)
-                {
-                    strncpy(esp8266at->sntp_server_addr[2], sntp_server_addr3, ESP8266AT_SNTP_SERVER_ADDR_LENGTH_MAX);
-                }
+                mutex_unlock(esp8266at->mqtt_pubq_mutex);
+                break;
             }
         }
-    }
-    sprintf(ptr1, "\r\n");
+        msg = &esp8266at->mqtt_pubq_msgs[esp8266at->mqtt_pubq_order[0]];
+        esp8266at->mqtt_pubq_inflight = 1;
+        mutex_unlock(esp8266at->mqtt_pubq_mutex);
+
+        st = _mqtt_pub(esp8266at, msg->topic, (char *) msg->data, msg->length, msg->qos, msg->retain, timeoutms, &timeoutms);
+
+        mutex_lock(esp8266at->mqtt_pubq_mutex);
+        esp8266at->mqtt_pubq_inflight = 0;
+        if (st == UBI_ST_OK)
+        {
+            _mqtt_pubq_remove(esp8266at, 0);
+        }
+        mutex_unlock(esp8266at->mqtt_pubq_mutex);
 
-    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        if (st != UBI_ST_OK)
+        {
+            break;
+        }
+    }
 
     if (remain_timeoutms)
     {
@@ -1122,668 +5051,758 @@ ubi_st_t esp8266at_cmd_at_cipsntpcfg(esp8266at_t *esp8266at, uint8_t enable, int
     return st;
 }
 
-ubi_st_t esp8266at_cmd_at_cipsntpcfg_q(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+ubi_st_t esp8266at_mqtt_pub(esp8266at_t *esp8266at, char *topic, char *data, uint32_t length, uint32_t qos, uint32_t retain, uint32_t timeoutms, uint32_t *remain_timeoutms)
 {
-    int r;
     ubi_st_t st;
-    char *ptr1 = NULL;
-    char *ptr2 = NULL;
-    int size = 0;
-    const char *key = "+CIPSNTPCFG:";
-
-    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
-    timeoutms = task_getremainingtimeoutms();
-    if (r == UBIK_ERR__TIMEOUT)
-    {
-        return UBI_ST_TIMEOUT;
-    }
+    uint8_t connected;
 
-    st = _send_cmd_and_wait_rsp(esp8266at, "AT+CIPSNTPCFG?\r\n", "OK\r\n", timeoutms, &timeoutms);
+    st = UBI_ST_ERR;
 
-    if (st == UBI_ST_OK)
+    do
     {
-        do
+        // Nothing queued, so a direct publish keeps the order.
+        if (!_mqtt_pubq_pending(esp8266at, &connected) && connected)
         {
-            ptr1 = strstr((char*) esp8266at->temp_resp_buf, key);
-            if (ptr1 == NULL)
+            st = esp8266at_cmd_at_mqttpubraw(esp8266at, topic, data, length, qos, retain, timeoutms, &timeoutms);
+            if (st == UBI_ST_OK)
             {
                 break;
             }
-            ptr1 = (char*) (((unsigned int) ptr1) + strlen(key));
+        }
 
-            ////
-            ptr2 = strstr(ptr1, ",");
-            if (ptr2 == NULL || ptr1 >= ptr2)
-            {
-                break;
-            }
-            *ptr2 = 0x0;
-            esp8266at->sntp_enable = atoi(ptr1);
-            *ptr2 = ' ';
+        st = esp8266at_mqtt_pubq_put(esp8266at, topic, data, length, qos, retain);
+        if (st == UBI_ST_OK && _mqtt_pubq_pending(esp8266at, &connected))
+        {
+            // Also after a failed direct publish, which left the message as the only one queued.
+            sem_give(esp8266at->io_urc_sem);
+        }
 
-            ////
-            ptr1 = ptr2;
-            ptr2 = strstr(ptr1, ",");
-            if (ptr2 == NULL || ptr1 >= ptr2)
-            {
-                break;
-            }
-            *ptr2 = 0x0;
-            ptr1++;
-            esp8266at->sntp_timezone = atoi(ptr1);
-            *ptr2 = ' ';
+        break;
+    } while (1);
 
-            ////
-            for (int i = 0; i < ESP8266AT_SNTP_SERVER_MAX; i++)
-            {
-                ptr1 = ptr2;
-                ptr2 = strstr(ptr1, "\"");
-                if (ptr2 == NULL || ptr1 >= ptr2)
-                {
-                    break;
-                }
-                *ptr2 = ' ';
-                ptr1 = ptr2;
-                ptr2 = strstr(ptr1, "\"");
-                if (ptr2 == NULL || ptr1 >= ptr2)
-                {
-                    break;
-                }
-                *ptr2 = ' ';
-                ptr1++;
-                size = (unsigned int) ptr2 - (unsigned int) ptr1;
-                size = min(size, ESP8266AT_SNTP_SERVER_ADDR_LENGTH_MAX);
-                strncpy(esp8266at->sntp_server_addr[i], ptr1, size);
-            }
+    if (remain_timeoutms)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    return st;
+}
+
+static void _mqtt_pubq_taskfunc(void *arg)
+{
+    esp8266at_t *esp8266at = (esp8266at_t *) arg;
+    uint8_t connected;
+
+    while (esp8266at->mqtt_pubq_cancel == 0)
+    {
+        sem_take(esp8266at->io_urc_sem);
+        if (esp8266at->mqtt_pubq_cancel != 0)
+        {
             break;
-        } while (1);
+        }
+
+        esp8266at_urc_process(esp8266at);
+
+        if (_mqtt_pubq_pending(esp8266at, &connected))
+        {
+            esp8266at_mqtt_pubq_drain(esp8266at, ESP8266AT_MQTT_PUBQ_DRAIN_TIMEOUT_MS, NULL);
+        }
     }
+}
 
-    if (remain_timeoutms)
+ubi_st_t esp8266at_mqtt_pubq_start(esp8266at_t *esp8266at)
+{
+    int r;
+
+    if (esp8266at->mqtt_pubq_task != NULL)
     {
-        *remain_timeoutms = timeoutms;
+        return UBI_ST_OK;
     }
 
-    mutex_unlock(esp8266at->cmd_mutex);
+    esp8266at->mqtt_pubq_cancel = 0;
+    r = task_create_noautodel(&esp8266at->mqtt_pubq_task, _mqtt_pubq_taskfunc, esp8266at, task_getmiddlepriority(), 0, "esp8266at_pubq");
+    if (r != 0)
+    {
+        return UBI_ST_ERR;
+    }
 
-    return st;
+    return UBI_ST_OK;
 }
 
-ubi_st_t esp8266at_cmd_at_cipsntptime(esp8266at_t *esp8266at, struct tm * tm_ptr, uint32_t timeoutms, uint32_t *remain_timeoutms)
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+static uint32_t _supervisor_check(esp8266at_t *esp8266at)
 {
     int r;
     ubi_st_t st;
-    char *ptr1 = NULL;
-    char *ptr2 = NULL;
-    const char * key = "+CIPSNTPTIME:";
-    const char * wday[7] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
-    const char * mon[12] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    uint32_t timeoutms;
 
-    if (tm_ptr == NULL)
+    // A probe would wake the module up, and the links are down on purpose in deep sleep.
+    if (esp8266at->power_state == ESP8266AT_POWER_LIGHT_SLEEP || esp8266at->power_state == ESP8266AT_POWER_DEEP_SLEEP)
     {
-        return UBI_ST_ERR;
+        return ESP8266AT_RECOVERY_NONE;
     }
 
-    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+    // Link losses are reported by URCs, so they need no AT traffic.
+    if (esp8266at->wifi_requested && !esp8266at->wifi_connected)
+    {
+        return ESP8266AT_RECOVERY_REJOIN;
+    }
+    if (esp8266at->tcp_requested && !esp8266at->tcp_connected)
+    {
+        return ESP8266AT_RECOVERY_RECONNECT;
+    }
+#if (ESP8266AT__ENABLE_MQTT == 1)
+    if (esp8266at->mqtt_requested && !esp8266at->mqtt_connected)
+    {
+        return ESP8266AT_RECOVERY_RECONNECT;
+    }
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+    // Any successful command proves the module alive, so probe only when it has been quiet.
+    if (_elapsedms(esp8266at->last_rsp_tick) < esp8266at->supervisor_probe_interval_ms)
+    {
+        return ESP8266AT_RECOVERY_NONE;
+    }
+
+    r = mutex_lock_timedms(esp8266at->cmd_mutex, ESP8266AT_SUPERVISOR_PROBE_TIMEOUT_MS);
     timeoutms = task_getremainingtimeoutms();
     if (r == UBIK_ERR__TIMEOUT)
     {
-        return UBI_ST_TIMEOUT;
+        // A long command is in progress.
+        return ESP8266AT_RECOVERY_NONE;
     }
 
-    st = _send_cmd_and_wait_rsp(esp8266at, "AT+CIPSNTPTIME?\r\n", "OK\r\n", timeoutms, &timeoutms);
+    esp8266at->supervisor_stat.probe_count++;
+    st = _send_cmd_and_wait_rsp(esp8266at, "AT\r\n", "OK\r\n", timeoutms, NULL);
+
+    mutex_unlock(esp8266at->cmd_mutex);
 
     if (st == UBI_ST_OK)
     {
-        st = UBI_ST_ERR;
-        do
+        esp8266at->supervisor_probe_fail = 0;
+        esp8266at->supervisor_probe_interval_ms = min(esp8266at->supervisor_probe_interval_ms * 2, ESP8266AT_SUPERVISOR_PROBE_INTERVAL_MAX_MS);
+        return ESP8266AT_RECOVERY_NONE;
+    }
+
+    esp8266at->supervisor_stat.probe_fail_count++;
+    esp8266at->supervisor_probe_fail++;
+    esp8266at->supervisor_probe_interval_ms = ESP8266AT_SUPERVISOR_PROBE_INTERVAL_MIN_MS;
+    logmfw("probe failed : status = %d, count = %d", st, esp8266at->supervisor_probe_fail);
+
+    if (esp8266at->supervisor_probe_fail < ESP8266AT_SUPERVISOR_PROBE_FAIL_MAX)
+    {
+        return ESP8266AT_RECOVERY_NONE;
+    }
+
+    return ESP8266AT_RECOVERY_SOFT_RESET;
+}
+
+static ubi_st_t _config_replay(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+#if (ESP8266AT__ENABLE_MQTT == 1)
+    int r;
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+    ubi_st_t st;
+
+    st = UBI_ST_OK;
+
+    do
+    {
+        if (esp8266at->wifi_mode != 0)
         {
-            ptr1 = strstr((char*) esp8266at->temp_resp_buf, key);
-            if (ptr1 == NULL)
+            st = esp8266at_cmd_at_cwmode(esp8266at, esp8266at->wifi_mode, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
             {
                 break;
             }
-            ptr1 = (char*) (((unsigned int) ptr1) + strlen(key));
+        }
 
-            ////
-            ptr2 = strstr(ptr1, " ");
-            if (ptr2 == NULL || ptr1 >= ptr2)
+        if (esp8266at->mux_mode != 0)
+        {
+            st = esp8266at_cmd_at_cipmux(esp8266at, esp8266at->mux_mode, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
             {
                 break;
             }
-            *ptr2 = 0x0;
-            tm_ptr->tm_wday = 0;
-            for (int i = 0; i < 7; i++)
+        }
+
+        if (esp8266at->cwlap_opt_sort != 0 || esp8266at->cwlap_opt_mask != ESP8266AT_CWLAP_FIELD__ALL)
+        {
+            st = esp8266at_cmd_at_cwlapopt(esp8266at, esp8266at->cwlap_opt_sort, esp8266at->cwlap_opt_mask, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
             {
-                if(strcmp(ptr1, wday[i]) == 0)
-                {
-                    tm_ptr->tm_wday = i;
-                    break;
-                }
+                break;
             }
-            *ptr2 = ',';
+        }
 
-            ////
-            ptr1 = ptr2;
-            ptr2 = strstr(ptr1, " ");
-            if (ptr2 == NULL || ptr1 >= ptr2)
+        if (esp8266at->dns_enable)
+        {
+            st = esp8266at_cmd_at_cipdns(esp8266at, esp8266at->dns_enable, esp8266at->dns_server_addr[0], esp8266at->dns_server_addr[1],
+                    esp8266at->dns_server_addr[2], timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
             {
                 break;
             }
-            ptr1++;
-            *ptr2 = 0x0;
-            tm_ptr->tm_mon = 0;
-            for (int i = 0; i < 12; i++)
+        }
+
+#if (ESP8266AT__ENABLE_SNTP == 1)
+        if (esp8266at->sntp_enable)
+        {
+            st = esp8266at_cmd_at_cipsntpcfg(esp8266at, esp8266at->sntp_enable, esp8266at->sntp_timezone, esp8266at->sntp_server_addr[0],
+                    esp8266at->sntp_server_addr[1], esp8266at->sntp_server_addr[2], timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
             {
-                if(strcmp(ptr1, mon[i]) == 0)
-                {
-                    tm_ptr->tm_mon = i;
-                    break;
-                }
+                break;
             }
-            *ptr2 = ',';
+        }
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
 
-            ////
-            ptr1 = ptr2;
-            ptr2 = strstr(ptr1, " ");
-            if (ptr2 == NULL || ptr1 >= ptr2)
+        if (esp8266at->ssl_buf_size != 0)
+        {
+            st = esp8266at_cmd_at_cipsslsize(esp8266at, esp8266at->ssl_buf_size, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
             {
                 break;
             }
-            *ptr2 = 0x0;
-            ptr1++;
-            tm_ptr->tm_mday = atoi(ptr1);
-            *ptr2 = ',';
+        }
 
-            ////
-            ptr1 = ptr2;
-            ptr2 = strstr(ptr1, ":");
-            if (ptr2 == NULL || ptr1 >= ptr2)
+        if (esp8266at->ssl_auth_mode != ESP8266AT_SSL_AUTH__NONE)
+        {
+            st = esp8266at_cmd_at_cipsslcconf(esp8266at, esp8266at->ssl_auth_mode, esp8266at->ssl_pki_number, esp8266at->ssl_ca_number,
+                    timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
             {
                 break;
             }
-            *ptr2 = 0x0;
-            ptr1++;
-            tm_ptr->tm_hour = atoi(ptr1);
-            *ptr2 = ',';
+        }
 
-            ////
-            ptr1 = ptr2;
-            ptr2 = strstr(ptr1, ":");
-            if (ptr2 == NULL || ptr1 >= ptr2)
+        if (esp8266at->ssl_sni[0] != 0 && esp8266at->dialect->ssl_sni)
+        {
+            st = esp8266at_cmd_at_cipsslcsni(esp8266at, esp8266at->ssl_sni, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
             {
                 break;
             }
-            *ptr2 = 0x0;
-            ptr1++;
-            tm_ptr->tm_min = atoi(ptr1);
-            *ptr2 = ',';
+        }
 
-            ////
-            ptr1 = ptr2;
-            ptr2 = strstr(ptr1, " ");
-            if (ptr2 == NULL || ptr1 >= ptr2)
+#if (ESP8266AT__ENABLE_MQTT == 1)
+        if (esp8266at->mqtt_requested)
+        {
+            st = esp8266at_cmd_at_mqttusercfg(esp8266at, esp8266at->mqtt_scheme, esp8266at->mqtt_client_id, esp8266at->mqtt_username,
+                    esp8266at->mqtt_passwd, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
             {
                 break;
             }
-            *ptr2 = 0x0;
-            ptr1++;
-            tm_ptr->tm_sec = atoi(ptr1);
-            *ptr2 = ' ';
 
-            ////
-            ptr1 = ptr2;
-            tm_ptr->tm_year = atoi(ptr1);
-            if (tm_ptr->tm_year < 1900)
+            st = esp8266at_cmd_at_mqttconncfg(esp8266at, esp8266at->mqtt_keepalive, esp8266at->mqtt_disable_clean_session,
+                    esp8266at->mqtt_lwt_topic, esp8266at->mqtt_lwt_msg, esp8266at->mqtt_lwt_qos, esp8266at->mqtt_lwt_retain, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
             {
                 break;
             }
-            tm_ptr->tm_year -= 1900;
 
-            ////
-            st = UBI_ST_OK;
-            break;
-        } while (1);
-    }
+            // ESP-AT subscribes again after AT+MQTTCONN, but WizFi360 needs AT+MQTTTOPIC before AT+MQTTCON.
+            if (ESP8266AT_IS_WIZFI360(esp8266at))
+            {
+                r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
+                timeoutms = task_getremainingtimeoutms();
+                if (r == UBIK_ERR__TIMEOUT)
+                {
+                    st = UBI_ST_TIMEOUT;
+                    break;
+                }
+
+                st = _mqtt_sub_emit(esp8266at, timeoutms, &timeoutms);
+
+                mutex_unlock(esp8266at->cmd_mutex);
+
+                if (st != UBI_ST_OK)
+                {
+                    break;
+                }
+            }
+        }
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+        break;
+    } while (1);
 
     if (remain_timeoutms)
     {
         *remain_timeoutms = timeoutms;
     }
 
-    mutex_unlock(esp8266at->cmd_mutex);
-
     return st;
 }
 
-ubi_st_t esp8266at_cmd_at_mqttusercfg(esp8266at_t *esp8266at, uint8_t mqtt_scheme, char * mqtt_client_id, char * mqtt_username, char * mqtt_passwd, uint32_t timeoutms, uint32_t *remain_timeoutms)
+static ubi_st_t _supervisor_recover(esp8266at_t *esp8266at, uint32_t level)
 {
-    int r;
     ubi_st_t st;
+    uint32_t timeoutms;
 
-    if (mqtt_client_id == NULL || mqtt_username == NULL || mqtt_passwd == NULL)
-    {
-        return UBI_ST_ERR;
-    }
+    timeoutms = ESP8266AT_SUPERVISOR_RECOVERY_TIMEOUT_MS;
+    st = UBI_ST_OK;
 
-    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
-    timeoutms = task_getremainingtimeoutms();
-    if (r == UBIK_ERR__TIMEOUT)
+    do
     {
-        return UBI_ST_TIMEOUT;
-    }
+        if (level == ESP8266AT_RECOVERY_HARD_RESET)
+        {
+            st = esp8266at_reset(esp8266at);
+        }
+        else if (level == ESP8266AT_RECOVERY_SOFT_RESET)
+        {
+            st = esp8266at_cmd_at_rst(esp8266at, timeoutms, &timeoutms);
+        }
+        if (st != UBI_ST_OK)
+        {
+            break;
+        }
 
-    esp8266at->mqtt_scheme = mqtt_scheme;
-    if (esp8266at->mqtt_client_id != mqtt_client_id)
-    {
-        strncpy(esp8266at->mqtt_client_id, mqtt_client_id, ESP8266AT_MQTT_CLIENT_ID_LENGTH_MAX);
-    }
-    if (esp8266at->mqtt_username != mqtt_username)
-    {
-        strncpy(esp8266at->mqtt_username, mqtt_username, ESP8266AT_MQTT_USERNAME_LENGTH_MAX);
-    }
-    if (esp8266at->mqtt_passwd != mqtt_passwd)
-    {
-        strncpy(esp8266at->mqtt_passwd, mqtt_passwd, ESP8266AT_MQTT_PASSWD_LENGTH_MAX);
-    }
+        // The configuration is also gone when the module restarted by itself (e.g. woken up from deep sleep).
+        if (level >= ESP8266AT_RECOVERY_SOFT_RESET || esp8266at->shadow_applied == 0)
+        {
+            st = _config_replay(esp8266at, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
+            {
+                break;
+            }
+        }
 
-#if (ESP8266AT__USE_WIZFI360_API == 1)
-    sprintf(esp8266at->temp_cmd_buf, "AT+MQTTSET=\"%s\",\"%s\",\"%s\",60\r\n",
-        mqtt_username, mqtt_passwd, mqtt_client_id);
-#else
-    sprintf(esp8266at->temp_cmd_buf, "AT+MQTTUSERCFG=0,%d,\"%s\",\"%s\",\"%s\",0,0,\"\"\r\n",
-        mqtt_scheme, mqtt_client_id, mqtt_username, mqtt_passwd);
-#endif /* (ESP8266AT__USE_WIZFI360_API == 1) */
+        if (level >= ESP8266AT_RECOVERY_REJOIN && esp8266at->wifi_requested)
+        {
+            st = esp8266at_fastjoin(esp8266at, esp8266at->ssid, esp8266at->passwd, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
+            {
+                break;
+            }
+        }
 
-    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+        if (esp8266at->tcp_requested && !esp8266at->tcp_connected)
+        {
+            st = esp8266at_cmd_at_cipstart(esp8266at, esp8266at->tcp_type, esp8266at->tcp_host, esp8266at->tcp_port, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
+            {
+                break;
+            }
+        }
 
-    if (remain_timeoutms)
-    {
-        *remain_timeoutms = timeoutms;
-    }
+#if (ESP8266AT__ENABLE_MQTT == 1)
+        if (esp8266at->mqtt_requested && !esp8266at->mqtt_connected)
+        {
+            st = esp8266at_cmd_at_mqttconn(esp8266at, esp8266at->mqtt_host, esp8266at->mqtt_port, esp8266at->mqtt_reconnect, timeoutms, &timeoutms);
+            if (st != UBI_ST_OK)
+            {
+                break;
+            }
+        }
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
 
-    mutex_unlock(esp8266at->cmd_mutex);
+        break;
+    } while (1);
 
     return st;
 }
 
-#if (ESP8266AT__USE_WIZFI360_API == 1)
-ubi_st_t esp8266at_cmd_at_mqtttopic(esp8266at_t *esp8266at, char *pub_topic, char *sub_topic, char *sub_topic_2, char *sub_topic_3, uint32_t timeoutms, uint32_t *remain_timeoutms)
+// Sleeps in poll intervals so that stop and deinit do not wait for a long backoff.
+static void _supervisor_sleepms(esp8266at_t *esp8266at, uint32_t ms)
 {
-    int r;
-    ubi_st_t st;
-    char *ptr1;
+    uint32_t begin_tick;
 
-    if (pub_topic == NULL || pub_topic == NULL || sub_topic == NULL)
+    begin_tick = _gettick();
+    while (esp8266at->supervisor_enable && esp8266at->supervisor_cancel == 0 && _elapsedms(begin_tick) < ms)
     {
-        return UBI_ST_ERR;
+        task_sleepms(min(ms - _elapsedms(begin_tick), ESP8266AT_SUPERVISOR_POLL_INTERVAL_MS));
     }
+}
+
+static void _supervisor_taskfunc(void *arg)
+{
+    esp8266at_t *esp8266at = (esp8266at_t *) arg;
+    esp8266at_supervisor_stat_t *stat = &esp8266at->supervisor_stat;
+    uint32_t level;
+    uint32_t recovery_time_ms;
+    ubi_st_t st;
+
+    while (esp8266at->supervisor_cancel == 0)
+    {
+        esp8266at->supervisor_busy = 0;
+        task_sleepms(ESP8266AT_SUPERVISOR_POLL_INTERVAL_MS);
+
+        // Set before the check, so that esp8266at_supervisor_stop either sees it or this pass sees the stop.
+        esp8266at->supervisor_busy = 1;
+        if (!esp8266at->supervisor_enable || esp8266at->supervisor_cancel != 0)
+        {
+            continue;
+        }
+
+        esp8266at_urc_process(esp8266at);
+
+        level = _supervisor_check(esp8266at);
+        if (level == ESP8266AT_RECOVERY_NONE)
+        {
+            _dns_cache_refresh(esp8266at);
+            continue;
+        }
+
+        if (!esp8266at->supervisor_outage)
+        {
+            esp8266at->supervisor_outage = 1;
+            esp8266at->supervisor_outage_tick = _gettick();
+            esp8266at->supervisor_backoff_ms = ESP8266AT_SUPERVISOR_BACKOFF_MIN_MS;
+            esp8266at->supervisor_level = level;
+            stat->outage_count++;
+        }
+        else
+        {
+            // Keep escalating while the outage lasts.
+            esp8266at->supervisor_level = max(esp8266at->supervisor_level, level);
+        }
+        level = esp8266at->supervisor_level;
 
-    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
-    timeoutms = task_getremainingtimeoutms();
-    if (r == UBIK_ERR__TIMEOUT)
-    {
-        return UBI_ST_TIMEOUT;
-    }
+        logmfi("recovery : level = %d", level);
+        stat->attempt_count[level]++;
+        st = _supervisor_recover(esp8266at, level);
+        if (st == UBI_ST_OK)
+        {
+            recovery_time_ms = _elapsedms(esp8266at->supervisor_outage_tick);
+            stat->recovered_count++;
+            stat->recovery_time_last_ms = recovery_time_ms;
+            stat->recovery_time_max_ms = max(stat->recovery_time_max_ms, recovery_time_ms);
+            stat->recovery_time_sum_ms += recovery_time_ms;
+
+            esp8266at->supervisor_outage = 0;
+            esp8266at->supervisor_level = ESP8266AT_RECOVERY_NONE;
+            esp8266at->supervisor_probe_fail = 0;
+            esp8266at->supervisor_probe_interval_ms = ESP8266AT_SUPERVISOR_PROBE_INTERVAL_MIN_MS;
+            logmfi("recovered : level = %d, time = %d ms", level, recovery_time_ms);
+            continue;
+        }
 
-    sprintf(esp8266at->temp_cmd_buf, "AT+MQTTTOPIC=");
-    ptr1 = esp8266at->temp_cmd_buf + strlen(esp8266at->temp_cmd_buf);
+        logmfw("recovery failed : level = %d, status = %d, retry in %d ms", level, st, esp8266at->supervisor_backoff_ms);
+        esp8266at->supervisor_level = min(level + 1, ESP8266AT_RECOVERY_HARD_RESET);
+        esp8266at->supervisor_busy = 0;
+        _supervisor_sleepms(esp8266at, esp8266at->supervisor_backoff_ms);
+        esp8266at->supervisor_backoff_ms = min(esp8266at->supervisor_backoff_ms * 2, ESP8266AT_SUPERVISOR_BACKOFF_MAX_MS);
+    }
+}
 
-    sprintf(ptr1, "\"%s\"", pub_topic);
-    ptr1 += strlen(ptr1);
+ubi_st_t esp8266at_supervisor_start(esp8266at_t *esp8266at)
+{
+    int r;
 
-    sprintf(ptr1, ",\"%s\"", sub_topic);
-    ptr1 += strlen(ptr1);
-    strncpy(esp8266at->mqtt_sub_bufs[0].topic, sub_topic, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX);
+    esp8266at->supervisor_probe_fail = 0;
+    esp8266at->supervisor_probe_interval_ms = ESP8266AT_SUPERVISOR_PROBE_INTERVAL_MIN_MS;
+    esp8266at->supervisor_enable = 1;
 
-    if (sub_topic_2 != NULL && strlen(sub_topic_2) > 0)
+    if (esp8266at->supervisor_task != NULL)
     {
-        sprintf(ptr1, ",\"%s\"", sub_topic_2);
-        ptr1 += strlen(ptr1);
-        strncpy(esp8266at->mqtt_sub_bufs[1].topic, sub_topic, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX);
+        return UBI_ST_OK;
     }
 
-    if (sub_topic_3 != NULL && strlen(sub_topic_3) > 0)
+    esp8266at->supervisor_cancel = 0;
+    r = task_create_noautodel(&esp8266at->supervisor_task, _supervisor_taskfunc, esp8266at, task_getmiddlepriority(), 0, "esp8266at_sv");
+    if (r != 0)
     {
-        sprintf(ptr1, ",\"%s\"", sub_topic_3);
-        ptr1 += strlen(ptr1);
-        strncpy(esp8266at->mqtt_sub_bufs[2].topic, sub_topic, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX);
+        esp8266at->supervisor_enable = 0;
+        return UBI_ST_ERR;
     }
 
-    sprintf(ptr1, "\r\n");
+    return UBI_ST_OK;
+}
 
-    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+ubi_st_t esp8266at_supervisor_stop(esp8266at_t *esp8266at)
+{
+    esp8266at->supervisor_enable = 0;
 
-    if (remain_timeoutms)
+    // Let a check or recovery in progress finish, so that no command of the supervisor follows.
+    while (esp8266at->supervisor_busy)
     {
-        *remain_timeoutms = timeoutms;
+        task_sleepms(ESP8266AT_SUPERVISOR_POLL_INTERVAL_MS);
     }
 
-    mutex_unlock(esp8266at->cmd_mutex);
+    esp8266at->supervisor_outage = 0;
+    esp8266at->supervisor_level = ESP8266AT_RECOVERY_NONE;
 
-    return st;
+    return UBI_ST_OK;
 }
-#else
-#endif /* (ESP8266AT__USE_WIZFI360_API == 1) */
 
-ubi_st_t esp8266at_cmd_at_mqttconn(esp8266at_t *esp8266at, char *ip, uint32_t port, uint32_t reconnect, uint32_t timeoutms, uint32_t *remain_timeoutms)
+ubi_st_t esp8266at_supervisor_stat_get(esp8266at_t *esp8266at, esp8266at_supervisor_stat_t *stat)
 {
-    int r;
-    ubi_st_t st;
-
-    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
-    timeoutms = task_getremainingtimeoutms();
-    if (r == UBIK_ERR__TIMEOUT)
-    {
-        return UBI_ST_TIMEOUT;
-    }
+    assert(stat != NULL);
 
-#if (ESP8266AT__USE_WIZFI360_API == 1)
-    if (esp8266at->mux_mode == 0)
-    {
-        sprintf(esp8266at->temp_cmd_buf, "AT+MQTTCON=0,\"%s\",%lu\r\n", ip, port);
-        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
-    }
-    else
-    {
-        sprintf(esp8266at->temp_cmd_buf, "AT+MQTTCON=0,0,\"%s\",%lu\r\n", ip, port);
-        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
-    }
-#else
-    sprintf(esp8266at->temp_cmd_buf, "AT+MQTTCONN=0,\"%s\",%lu,%lu\r\n", ip, port, reconnect);
-    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
-#endif /* (ESP8266AT__USE_WIZFI360_API == 1) */
+    ubik_entercrit();
+    memcpy(stat, &esp8266at->supervisor_stat, sizeof(esp8266at_supervisor_stat_t));
+    ubik_exitcrit();
 
-    if (remain_timeoutms)
-    {
-        *remain_timeoutms = timeoutms;
-    }
+    return UBI_ST_OK;
+}
 
-    mutex_unlock(esp8266at->cmd_mutex);
+ubi_st_t esp8266at_supervisor_stat_reset(esp8266at_t *esp8266at)
+{
+    ubik_entercrit();
+    memset(&esp8266at->supervisor_stat, 0, sizeof(esp8266at_supervisor_stat_t));
+    ubik_exitcrit();
 
-    return st;
+    return UBI_ST_OK;
 }
 
-ubi_st_t esp8266at_cmd_at_mqttclean(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+ubi_st_t esp8266at_stat_get(esp8266at_t *esp8266at, esp8266at_stat_t *stat)
 {
-    int r;
-    ubi_st_t st;
+    assert(stat != NULL);
 
-    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
-    timeoutms = task_getremainingtimeoutms();
-    if (r == UBIK_ERR__TIMEOUT)
-    {
-        return UBI_ST_TIMEOUT;
-    }
+    // The I/O counters are updated from the UART interrupt.
+    ubik_entercrit();
+    memcpy(stat, &esp8266at->stat, sizeof(esp8266at_stat_t));
+    ubik_exitcrit();
 
-#if (ESP8266AT__USE_WIZFI360_API == 1)
-    st = _send_cmd_and_wait_rsp(esp8266at, "AT+MQTTDIS\r\n", "CLOSED\r\n", timeoutms, &timeoutms);
-#else
-    st = _send_cmd_and_wait_rsp(esp8266at, "AT+MQTTCLEAN=0\r\n", "OK\r\n", timeoutms, &timeoutms);
-#endif /* (ESP8266AT__USE_WIZFI360_API == 1) */
+    stat->elapsed_ms = _elapsedms(stat->begin_tick);
+#if (ESP8266AT__ENABLE_ISR_PROFILE == 1)
+    stat->isr_cycles_per_us = esp8266at_io_profile_cycles_per_us();
+#endif /* (ESP8266AT__ENABLE_ISR_PROFILE == 1) */
 
-    if (remain_timeoutms)
+    return UBI_ST_OK;
+}
+
+ubi_st_t esp8266at_stat_reset(esp8266at_t *esp8266at)
+{
+    ubik_entercrit();
+    memset(&esp8266at->stat, 0, sizeof(esp8266at_stat_t));
+    for (int i = 0; i < ESP8266AT_IO_RX_MODE_MAX; i++)
     {
-        *remain_timeoutms = timeoutms;
+        esp8266at->stat.isr[i].cycles_min = UINT32_MAX;
     }
+    esp8266at->stat.begin_tick = _gettick();
+    ubik_exitcrit();
 
-    mutex_unlock(esp8266at->cmd_mutex);
-
-    return st;
+    return UBI_ST_OK;
 }
 
-ubi_st_t esp8266at_cmd_at_mqttpub(esp8266at_t *esp8266at, char *topic, char *data, uint32_t qos, uint32_t retain, uint32_t timeoutms, uint32_t *remain_timeoutms)
+#if (ESP8266AT__ENABLE_TRACE == 1)
+
+#if (ESP8266AT_TRACE_BUF_SIZE < (ESP8266AT_TRACE_REC_HEADER_LEN + ESP8266AT_TRACE_REC_DATA_LEN_MAX) * 2)
+    #error "ESP8266AT_TRACE_BUF_SIZE must hold at least two records of the maximum length"
+#endif
+
+static void _trace_drop_oldest(esp8266at_t *esp8266at)
 {
-    int r;
-    ubi_st_t st;
+    uint32_t rec_len;
 
-    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
-    timeoutms = task_getremainingtimeoutms();
-    if (r == UBIK_ERR__TIMEOUT)
+    rec_len = ESP8266AT_TRACE_REC_HEADER_LEN + esp8266at->trace_buf[(esp8266at->trace_begin + 1) % ESP8266AT_TRACE_BUF_SIZE];
+
+    if (esp8266at->trace_last_valid && esp8266at->trace_last == esp8266at->trace_begin)
     {
-        return UBI_ST_TIMEOUT;
+        esp8266at->trace_last_valid = 0;
     }
+    esp8266at->trace_begin = (esp8266at->trace_begin + rec_len) % ESP8266AT_TRACE_BUF_SIZE;
+    esp8266at->trace_len -= rec_len;
+    esp8266at->trace_drop_count++;
+}
 
-#if (ESP8266AT__USE_WIZFI360_API == 1)
-    sprintf(esp8266at->temp_cmd_buf, "AT+MQTTPUB=\"%s\"\r\n", data);
-    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
-#else
-    sprintf(esp8266at->temp_cmd_buf, "AT+MQTTPUB=0,\"%s\",\"%s\",%lu,%lu\r\n", topic, data, qos, retain);
-    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
-#endif /* (ESP8266AT__USE_WIZFI360_API == 1) */
+static void _trace_write(esp8266at_t *esp8266at, const uint8_t *data, uint32_t length)
+{
+    uint32_t i = (esp8266at->trace_begin + esp8266at->trace_len) % ESP8266AT_TRACE_BUF_SIZE;
 
-    if (remain_timeoutms)
+    esp8266at->trace_len += length;
+    for (uint32_t n = 0; n < length; n++)
     {
-        *remain_timeoutms = timeoutms;
+        esp8266at->trace_buf[i] = data[n];
+        i++;
+        if (i == ESP8266AT_TRACE_BUF_SIZE)
+        {
+            i = 0;
+        }
     }
-
-    mutex_unlock(esp8266at->cmd_mutex);
-
-    return st;
 }
 
-ubi_st_t esp8266at_cmd_at_mqttpubraw(esp8266at_t *esp8266at, char *topic, char *data, uint32_t length, uint32_t qos, uint32_t retain, uint32_t timeoutms, uint32_t *remain_timeoutms)
+void esp8266at_trace_put(esp8266at_t *esp8266at, uint8_t type, const uint8_t *data, uint32_t length)
 {
-    int r;
-    ubi_st_t st;
-    ubi_unused(r);
+    uint8_t header[ESP8266AT_TRACE_REC_HEADER_LEN];
+    uint32_t now;
+    uint32_t delta_ms;
+    uint32_t chunk;
+    uint32_t len_i;
 
-#if (ESP8266AT__USE_WIZFI360_API == 1)
-    st = esp8266at_cmd_at_mqttpub(esp8266at, topic, data, qos, retain, timeoutms, remain_timeoutms);
-#else
-    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
-    timeoutms = task_getremainingtimeoutms();
-    if (r == UBIK_ERR__TIMEOUT)
+    if (!esp8266at->trace_enable || length == 0)
     {
-        return UBI_ST_TIMEOUT;
+        return;
     }
 
-    st = UBI_ST_ERR;
+    ubik_entercrit();
 
-    do
+    now = _gettick();
+    delta_ms = min(ubik_ticktotimems(now - esp8266at->trace_last_tick), 0xffff);
+
+    // One record per received byte would cost four times the data, so bytes of the same ms are appended.
+    if ((type == ESP8266AT_TRACE_RX || type == ESP8266AT_TRACE_TX) && delta_ms == 0 && esp8266at->trace_last_valid
+            && esp8266at->trace_buf[esp8266at->trace_last] == type)
     {
-        sprintf(esp8266at->temp_cmd_buf, "AT+MQTTPUBRAW=0,\"%s\",%lu,%lu,%lu\r\n", topic, length, qos, retain);
-        st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, ">", timeoutms, &timeoutms);
-        if (st != UBI_ST_OK)
+        len_i = (esp8266at->trace_last + 1) % ESP8266AT_TRACE_BUF_SIZE;
+        chunk = min(length, ESP8266AT_TRACE_REC_DATA_LEN_MAX - esp8266at->trace_buf[len_i]);
+        if (chunk > 0)
         {
-            break;
+            while (ESP8266AT_TRACE_BUF_SIZE - esp8266at->trace_len < chunk)
+            {
+                _trace_drop_oldest(esp8266at);
+            }
+            // Making room may have dropped the record itself, then a new one is started below.
+            if (esp8266at->trace_last_valid)
+            {
+                esp8266at->trace_buf[len_i] += chunk;
+                _trace_write(esp8266at, data, chunk);
+                data += chunk;
+                length -= chunk;
+            }
         }
+    }
 
-        st = esp8266at_io_write_timedms(esp8266at, (uint8_t *) data, length, NULL, timeoutms, &timeoutms);
-        if (st != UBI_ST_OK)
-        {
-            break;
-        }
-        st = esp8266at_io_flush_timedms(esp8266at, timeoutms, &timeoutms);
-        if (st != UBI_ST_OK)
-        {
-            break;
-        }
+    while (length > 0)
+    {
+        chunk = min(length, ESP8266AT_TRACE_REC_DATA_LEN_MAX);
 
-        st = _wait_rsp(esp8266at, "+MQTTPUB:OK\r\n", esp8266at->temp_resp_buf, ESP8266AT_TEMP_RESP_BUF_SIZE, NULL, timeoutms, &timeoutms);
-        if (st != UBI_ST_OK)
+        header[0] = type;
+        header[1] = chunk;
+        header[2] = delta_ms & 0xff;
+        header[3] = (delta_ms >> 8) & 0xff;
+
+        while (ESP8266AT_TRACE_BUF_SIZE - esp8266at->trace_len < ESP8266AT_TRACE_REC_HEADER_LEN + chunk)
         {
-            break;
+            _trace_drop_oldest(esp8266at);
         }
-
-        break;
-    } while (1);
-
-    if (remain_timeoutms)
-    {
-        *remain_timeoutms = timeoutms;
+        esp8266at->trace_last = (esp8266at->trace_begin + esp8266at->trace_len) % ESP8266AT_TRACE_BUF_SIZE;
+        esp8266at->trace_last_valid = 1;
+        _trace_write(esp8266at, header, ESP8266AT_TRACE_REC_HEADER_LEN);
+        _trace_write(esp8266at, data, chunk);
+
+        esp8266at->trace_last_tick = now;
+        delta_ms = 0;
+        data += chunk;
+        length -= chunk;
     }
 
-    mutex_unlock(esp8266at->cmd_mutex);
-#endif /* (ESP8266AT__USE_WIZFI360_API == 1) */
-
-    return st;
+    ubik_exitcrit();
 }
 
-ubi_st_t esp8266at_cmd_at_mqttsub(esp8266at_t *esp8266at, uint32_t id, char *topic, uint32_t qos, uint32_t timeoutms, uint32_t *remain_timeoutms)
+void esp8266at_trace_rx_state(esp8266at_t *esp8266at, uint8_t rx_mode, uint32_t rx_overflow_count)
 {
-    int r;
-    ubi_st_t st;
+    uint8_t data;
 
-    if (id >= ESP8266AT_IO_MQTT_SUB_BUF_MAX)
+    if (esp8266at->rx_overflow_count != rx_overflow_count)
     {
-        return UBI_ST_ERR;
+        esp8266at_trace_put(esp8266at, ESP8266AT_TRACE_OVERFLOW, &rx_mode, 1);
     }
-
-    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
-    timeoutms = task_getremainingtimeoutms();
-    if (r == UBIK_ERR__TIMEOUT)
+    if (esp8266at->io_rx_mode != rx_mode)
     {
-        return UBI_ST_TIMEOUT;
+        data = esp8266at->io_rx_mode;
+        esp8266at_trace_put(esp8266at, ESP8266AT_TRACE_MODE, &data, 1);
     }
+}
 
-    strncpy(esp8266at->mqtt_sub_bufs[id].topic, topic, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX);
-
-    sprintf(esp8266at->temp_cmd_buf, "AT+MQTTSUB=0,\"%s\",%lu\r\n", topic, qos);
-    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
-
-    if (remain_timeoutms)
+ubi_st_t esp8266at_trace_config(esp8266at_t *esp8266at, uint8_t enable)
+{
+    ubik_entercrit();
+    if (enable && !esp8266at->trace_enable)
     {
-        *remain_timeoutms = timeoutms;
+        // The first record after a pause carries the pause as its delta.
+        esp8266at->trace_last_valid = 0;
     }
+    esp8266at->trace_enable = enable ? 1 : 0;
+    ubik_exitcrit();
 
-    mutex_unlock(esp8266at->cmd_mutex);
-
-    return st;
+    return UBI_ST_OK;
 }
 
-ubi_st_t esp8266at_cmd_at_mqttsub_q(esp8266at_t *esp8266at, uint32_t timeoutms, uint32_t *remain_timeoutms)
+ubi_st_t esp8266at_trace_clear(esp8266at_t *esp8266at)
 {
-    int r;
-    ubi_st_t st;
+    ubik_entercrit();
+    esp8266at->trace_begin = 0;
+    esp8266at->trace_len = 0;
+    esp8266at->trace_last_valid = 0;
+    esp8266at->trace_last_tick = _gettick();
+    esp8266at->trace_drop_count = 0;
+    ubik_exitcrit();
+
+    return UBI_ST_OK;
+}
 
-    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
-    timeoutms = task_getremainingtimeoutms();
-    if (r == UBIK_ERR__TIMEOUT)
+ubi_st_t esp8266at_trace_info(esp8266at_t *esp8266at, uint8_t *enable, uint32_t *length, uint32_t *drop_count)
+{
+    ubik_entercrit();
+    if (enable)
     {
-        return UBI_ST_TIMEOUT;
+        *enable = esp8266at->trace_enable;
     }
-
-    sprintf(esp8266at->temp_cmd_buf, "AT+MQTTSUB?\r\n");
-    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
-
-    if (remain_timeoutms)
+    if (length)
     {
-        *remain_timeoutms = timeoutms;
+        *length = esp8266at->trace_len;
     }
+    if (drop_count)
+    {
+        *drop_count = esp8266at->trace_drop_count;
+    }
+    ubik_exitcrit();
 
-    mutex_unlock(esp8266at->cmd_mutex);
-
-    return st;
+    return UBI_ST_OK;
 }
 
-ubi_st_t esp8266at_cmd_at_mqttunsub(esp8266at_t *esp8266at, uint32_t id, uint32_t timeoutms, uint32_t *remain_timeoutms)
+ubi_st_t esp8266at_trace_read(esp8266at_t *esp8266at, uint32_t offset, uint8_t *buffer, uint32_t length, uint32_t *read)
 {
-    int r;
-    ubi_st_t st;
-
-    if (id >= ESP8266AT_IO_MQTT_SUB_BUF_MAX)
-    {
-        return UBI_ST_ERR;
-    }
-
-    r = mutex_lock_timedms(esp8266at->cmd_mutex, timeoutms);
-    timeoutms = task_getremainingtimeoutms();
-    if (r == UBIK_ERR__TIMEOUT)
-    {
-        return UBI_ST_TIMEOUT;
-    }
+    uint32_t n = 0;
 
-    sprintf(esp8266at->temp_cmd_buf, "AT+MQTTUNSUB=0,\"%s\"\r\n", esp8266at->mqtt_sub_bufs[id].topic);
-    st = _send_cmd_and_wait_rsp(esp8266at, esp8266at->temp_cmd_buf, "OK\r\n", timeoutms, &timeoutms);
+    assert(buffer != NULL);
 
-    if (st == UBI_ST_OK)
+    ubik_entercrit();
+    while (offset + n < esp8266at->trace_len && n < length)
     {
-        memset(esp8266at->mqtt_sub_bufs[id].topic, 0, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX);
+        buffer[n] = esp8266at->trace_buf[(esp8266at->trace_begin + offset + n) % ESP8266AT_TRACE_BUF_SIZE];
+        n++;
     }
+    ubik_exitcrit();
 
-    if (remain_timeoutms)
+    if (read)
     {
-        *remain_timeoutms = timeoutms;
+        *read = n;
     }
 
-    mutex_unlock(esp8266at->cmd_mutex);
-
-    return st;
+    return UBI_ST_OK;
 }
 
-ubi_st_t esp8266at_cmd_at_mqttsubget(esp8266at_t *esp8266at, uint32_t id, uint8_t *buffer, uint32_t max_length, uint32_t *received, uint32_t timeoutms, uint32_t *remain_timeoutms)
-{
-    int r;
-    ubi_st_t st;
-    uint32_t read_tmp = 0;
-    uint32_t len;
-    esp8266at_mqtt_sub_buf_t *sub_buf_p = NULL;
-    esp8266at_mqtt_sub_buf_msg_t sub_msg;
-
-    if (id >= ESP8266AT_IO_MQTT_SUB_BUF_MAX)
-    {
-        return UBI_ST_ERR;
-    }
+#endif /* (ESP8266AT__ENABLE_TRACE == 1) */
 
-    sub_buf_p = &esp8266at->mqtt_sub_bufs[id];
+#if (ESP8266AT__ENABLE_ISR_PROFILE == 1)
 
-    r = mutex_lock_timedms(sub_buf_p->data_mutex, timeoutms);
-    timeoutms = task_getremainingtimeoutms();
-    if (r == UBIK_ERR__TIMEOUT)
+uint32_t esp8266at_io_profile_begin(esp8266at_t *esp8266at)
+{
+    if (esp8266at->io_isr_depth > 0)
     {
-        return UBI_ST_TIMEOUT;
+        esp8266at->stat.isr_reentry_count++;
     }
+    esp8266at->io_isr_depth++;
 
-    do
-    {
-        r = msgq_receive_timedms(sub_buf_p->msgs, (unsigned char *) &sub_msg, timeoutms);
-        timeoutms = task_getremainingtimeoutms();
-        if (r == UBIK_ERR__TIMEOUT)
-        {
-            st = UBI_ST_TIMEOUT;
-            break;
-        }
-        if (r != 0)
-        {
-            st = UBI_ST_ERR;
-            break;
-        }
-
-        if (sub_msg > max_length)
-        {
-            len = max_length;
-            st = cbuf_read(sub_buf_p->data_buf, buffer, len, &read_tmp);
-            assert(st == UBI_ERR_OK);
-            st = cbuf_read(sub_buf_p->data_buf, NULL, sub_msg - len, NULL);
-            assert(st == UBI_ERR_OK);
-            st = UBI_ST_ERR_OVERFLOW;
-        }
-        else
-        {
-            len = sub_msg;
-            st = cbuf_read(sub_buf_p->data_buf, buffer, len, &read_tmp);
-            assert(st == UBI_ERR_OK);
-            st = UBI_ST_OK;
-        }
+    return esp8266at_io_profile_cycles();
+}
 
-        break;
-    } while (1);
+void esp8266at_io_profile_end(esp8266at_t *esp8266at, uint32_t rx_mode, uint32_t begin_cycles)
+{
+    esp8266at_isr_stat_t *isr = &esp8266at->stat.isr[rx_mode];
+    uint32_t cycles = esp8266at_io_profile_cycles() - begin_cycles;
 
-    if (received)
+    isr->count++;
+    isr->cycles_sum += cycles;
+    if (cycles < isr->cycles_min)
     {
-        *received = read_tmp;
+        isr->cycles_min = cycles;
     }
-
-    if (remain_timeoutms)
+    if (cycles > isr->cycles_max)
     {
-        *remain_timeoutms = timeoutms;
+        isr->cycles_max = cycles;
     }
 
-    mutex_unlock(sub_buf_p->data_mutex);
-
-    return st;
+    esp8266at->io_isr_depth--;
 }
 
+#endif /* (ESP8266AT__ENABLE_ISR_PROFILE == 1) */
+
 #endif /* (INCLUDE__ESP8266AT == 1) */
 
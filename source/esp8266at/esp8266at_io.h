@@ -26,6 +26,7 @@ ubi_st_t esp8266at_io_init(esp8266at_t *esp8266at);
 ubi_st_t esp8266at_io_deinit(esp8266at_t *esp8266at);
 
 ubi_st_t esp8266at_io_module_reset(esp8266at_t *esp8266at);
+ubi_st_t esp8266at_io_module_wakeup(esp8266at_t *esp8266at);
 ubi_st_t esp8266at_io_uart_reset(esp8266at_t *esp8266at);
 
 ubi_st_t esp8266at_io_read_buf_clear(esp8266at_t *esp8266at);
@@ -44,6 +45,48 @@ ubi_st_t esp8266at_io_write(esp8266at_t *esp8266at, uint8_t *buffer, uint32_t le
 ubi_st_t esp8266at_io_write_timedms(esp8266at_t *esp8266at, uint8_t *buffer, uint32_t length, uint32_t *written, uint32_t timeoutms, uint32_t *remain_timeoutms);
 ubi_st_t esp8266at_io_write_advan(esp8266at_t *esp8266at, uint8_t *buffer, uint32_t length, uint32_t *written, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
+/*!
+ * 수신 분석기의 상태를 초기화합니다. esp8266at_io_rx_process보다 먼저 호출해야 합니다.
+ */
+void esp8266at_io_rx_init(esp8266at_t *esp8266at);
+
+/*!
+ * 수신한 byte를 분석해 응답, +IPD data, +MQTTSUBRECV message를 각 버퍼로 나누고 URC를 표시합니다.
+ *
+ * 하드웨어에 의존하지 않으며, 각 port의 수신 인터럽트나 DMA 완료 처리에서 받은 만큼 한 번에 넘깁니다.
+ */
+void esp8266at_io_rx_process(esp8266at_t *esp8266at, uint8_t *buffer, uint32_t length);
+
+void esp8266at_io_stat_high_water(esp8266at_t *esp8266at, uint32_t buf_id, cbuf_pt cbuf);
+
+#if (ESP8266AT__ENABLE_ISR_PROFILE == 1)
+/*!
+ * 인터럽트 처리 시간 측정용 카운터
+ *
+ * UART port (arch/arm/cortexm)가 DWT cycle counter로 구현합니다.
+ */
+void esp8266at_io_profile_init(void);
+uint32_t esp8266at_io_profile_cycles(void);
+uint32_t esp8266at_io_profile_cycles_per_us(void);
+
+uint32_t esp8266at_io_profile_begin(esp8266at_t *esp8266at);
+void esp8266at_io_profile_end(esp8266at_t *esp8266at, uint32_t rx_mode, uint32_t begin_cycles);
+#endif /* (ESP8266AT__ENABLE_ISR_PROFILE == 1) */
+
+#if (ESP8266AT__ENABLE_TRACE == 1)
+/*!
+ * trace ring buffer에 record를 추가합니다. (인터럽트에서 호출 가능)
+ *
+ * 같은 ms 안에 이어지는 RX, TX byte는 직전 record에 덧붙습니다.
+ */
+void esp8266at_trace_put(esp8266at_t *esp8266at, uint8_t type, const uint8_t *data, uint32_t length);
+
+/*!
+ * 수신 인터럽트 처리 전의 상태와 비교해 overflow, rx mode 변경 record를 추가합니다.
+ */
+void esp8266at_trace_rx_state(esp8266at_t *esp8266at, uint8_t rx_mode, uint32_t rx_overflow_count);
+#endif /* (ESP8266AT__ENABLE_TRACE == 1) */
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,466 @@
+/*
+ * Copyright (c) 2020 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ubinos.h>
+#include <string.h>
+
+#if (INCLUDE__ESP8266AT == 1)
+
+#include "esp8266at_io.h"
+
+// Searched for in the response stream, in ESP8266AT_IO_RX_KEY_ order.
+static const char * const _rx_keys[ESP8266AT_IO_RX_KEY_MAX] = {
+    ESP8266AT_IO_DATA_KEY,
+#if (ESP8266AT__ENABLE_MQTT == 1)
+    ESP8266AT_IO_MQTT_KEY,
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+    ESP8266AT_IO_URC_KEY_MQTT_CONNECTED,
+    ESP8266AT_IO_URC_KEY_MQTT_DISCONNECTED,
+    ESP8266AT_IO_URC_KEY_READY,
+    ESP8266AT_IO_URC_KEY_WIFI_GOT_IP,
+    ESP8266AT_IO_URC_KEY_WIFI_DISCONNECT,
+    ESP8266AT_IO_URC_KEY_CLOSED,
+};
+
+#if (ESP8266AT_IO_RX_KEY_MAX > 16)
+#error "_rx_key_first holds 16 keys"
+#endif
+
+// Keys that begin with each byte value, a bit per key.
+static uint16_t _rx_key_first[256];
+
+void esp8266at_io_stat_high_water(esp8266at_t *esp8266at, uint32_t buf_id, cbuf_pt cbuf)
+{
+    uint32_t len = cbuf_get_len(cbuf);
+
+    if (len > esp8266at->stat.high_water[buf_id])
+    {
+        esp8266at->stat.high_water[buf_id] = len;
+    }
+}
+
+static void _rx_resp_mode(esp8266at_t *esp8266at)
+{
+    esp8266at->io_rx_mode = ESP8266AT_IO_RX_MODE_RESP;
+}
+
+static void _rx_desync(esp8266at_t *esp8266at)
+{
+    esp8266at->stat.rx_desync_count++;
+    _rx_resp_mode(esp8266at);
+}
+
+static void _rx_key_clear(esp8266at_t *esp8266at)
+{
+    esp8266at->io_rx_key_active = 0;
+    memset(esp8266at->io_rx_key_i, 0, sizeof(esp8266at->io_rx_key_i));
+}
+
+static void _rx_data_begin(esp8266at_t *esp8266at)
+{
+#if (ESP8266AT__ENABLE_MQTT == 1)
+    esp8266at_mqtt_sub_buf_msg_t msg;
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+    if (esp8266at->io_is_mqtt)
+    {
+        esp8266at->stat.mqtt_frame_count++;
+        esp8266at->stat.mqtt_byte_count += esp8266at->io_data_len;
+    }
+    else
+    {
+        esp8266at->stat.ipd_frame_count++;
+        esp8266at->stat.ipd_byte_count += esp8266at->io_data_len;
+    }
+
+    esp8266at->io_data_read = 0;
+    esp8266at->io_data_written = 0;
+
+    // An empty frame has no data byte to end it.
+    if (esp8266at->io_data_len == 0)
+    {
+#if (ESP8266AT__ENABLE_MQTT == 1)
+        if (esp8266at->io_is_mqtt && esp8266at->io_mqtt_sub_buf_id >= 0)
+        {
+            msg = 0;
+            msgq_send(esp8266at->mqtt_sub_bufs[esp8266at->io_mqtt_sub_buf_id].msgs, (unsigned char *) &msg);
+        }
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+        _rx_resp_mode(esp8266at);
+        return;
+    }
+
+    esp8266at->io_rx_mode = ESP8266AT_IO_RX_MODE_DATA;
+}
+
+static uint32_t _rx_write(esp8266at_t *esp8266at, uint32_t buf_id, cbuf_pt rbuf, sem_pt rsem, uint8_t *buf, uint32_t len)
+{
+    int need_signal = 0;
+    uint32_t written = 0;
+
+    if (cbuf_get_len(rbuf) == 0)
+    {
+        need_signal = 1;
+    }
+
+    cbuf_write(rbuf, buf, len, &written);
+    if (written < len)
+    {
+        esp8266at->rx_overflow_count++;
+        esp8266at->stat.drop_count[buf_id] += len - written;
+    }
+    esp8266at_io_stat_high_water(esp8266at, buf_id, rbuf);
+
+    if (need_signal && written > 0 && rsem != NULL && _bsp_kernel_active)
+    {
+        sem_give(rsem);
+    }
+
+    return written;
+}
+
+// Advances every key by one byte and returns the key the byte completed, or ESP8266AT_IO_RX_KEY_MAX.
+static uint32_t _rx_key_match(esp8266at_t *esp8266at, uint8_t c)
+{
+    uint32_t active = esp8266at->io_rx_key_active;
+    uint32_t first = _rx_key_first[c];
+    uint32_t candidates = active | first;
+    uint32_t done = ESP8266AT_IO_RX_KEY_MAX;
+    uint32_t bit;
+    uint32_t i;
+
+    for (uint32_t k = 0; candidates != 0; k++, candidates >>= 1)
+    {
+        if ((candidates & 1) == 0)
+        {
+            continue;
+        }
+        bit = 1 << k;
+
+        if ((active & bit) != 0 && _rx_keys[k][esp8266at->io_rx_key_i[k]] == c)
+        {
+            i = esp8266at->io_rx_key_i[k] + 1;
+        }
+        else
+        {
+            // A mismatch can still begin the key again.
+            i = (first & bit) != 0 ? 1 : 0;
+        }
+
+        if (_rx_keys[k][i] == 0)
+        {
+            i = 0;
+            if (done == ESP8266AT_IO_RX_KEY_MAX)
+            {
+                done = k;
+            }
+        }
+
+        esp8266at->io_rx_key_i[k] = i;
+        if (i > 0)
+        {
+            esp8266at->io_rx_key_active |= bit;
+        }
+        else
+        {
+            esp8266at->io_rx_key_active &= ~bit;
+        }
+    }
+
+    return done;
+}
+
+// Each mode handler consumes at least one byte and returns how many it consumed.
+
+static uint32_t _rx_resp(esp8266at_t *esp8266at, uint8_t *buf, uint32_t len)
+{
+    uint32_t key = ESP8266AT_IO_RX_KEY_MAX;
+    uint32_t urc;
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        // Most bytes neither continue nor begin a key.
+        if ((esp8266at->io_rx_key_active | _rx_key_first[buf[i]]) == 0)
+        {
+            continue;
+        }
+
+        key = _rx_key_match(esp8266at, buf[i]);
+        // The frame keys come before the URC keys.
+        if (key < ESP8266AT_IO_RX_KEY_URC)
+        {
+            break;
+        }
+        if (key != ESP8266AT_IO_RX_KEY_MAX)
+        {
+            urc = (1 << (key - ESP8266AT_IO_RX_KEY_URC)) & ~esp8266at->io_urc_ignore;
+            if (urc != 0)
+            {
+                esp8266at->io_urc_flags |= urc;
+                if (_bsp_kernel_active)
+                {
+                    sem_give(esp8266at->io_urc_sem);
+                }
+            }
+        }
+    }
+
+    // The bytes before a frame key are a response, the byte ending the key is not.
+    if (i > 0)
+    {
+        _rx_write(esp8266at, ESP8266AT_STAT_BUF_READ, esp8266at->io_read_buf, esp8266at->io_read_sem, buf, i);
+    }
+    if (i == len)
+    {
+        return len;
+    }
+
+    _rx_key_clear(esp8266at);
+    esp8266at->io_data_len = 0;
+    esp8266at->io_data_len_i = 0;
+    if (key == ESP8266AT_IO_RX_KEY_DATA)
+    {
+        esp8266at->io_is_mqtt = 0;
+        esp8266at->io_rx_mode = ESP8266AT_IO_RX_MODE_DATA_LEN;
+    }
+#if (ESP8266AT__ENABLE_MQTT == 1)
+    else
+    {
+        esp8266at->io_is_mqtt = 1;
+        esp8266at->io_mqtt_topic_i = 0;
+        esp8266at->io_mqtt_sub_buf_id = -1;
+        esp8266at->io_rx_mode = ESP8266AT_IO_RX_MODE_MQTT_TOPIC;
+    }
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+    return i + 1;
+}
+
+#if (ESP8266AT__ENABLE_MQTT == 1)
+static uint32_t _rx_mqtt_topic(esp8266at_t *esp8266at, uint8_t *buf, uint32_t len)
+{
+    unsigned int msg_count;
+
+    (void) len;
+
+    if (',' == buf[0])
+    {
+        if (esp8266at->io_mqtt_topic_i > 0 && esp8266at->io_mqtt_topic_buf[esp8266at->io_mqtt_topic_i - 1] == '"')
+        {
+             // ignore last "
+            esp8266at->io_mqtt_topic_buf[esp8266at->io_mqtt_topic_i - 1] = 0;
+        }
+        else
+        {
+            esp8266at->io_mqtt_topic_buf[esp8266at->io_mqtt_topic_i] = 0;
+        }
+
+        for (int i = 0; i < ESP8266AT_IO_MQTT_SUB_BUF_MAX; i++)
+        {
+            // A free slot has an empty topic, which must not take messages with an empty topic.
+            if (esp8266at->mqtt_sub_bufs[i].topic[0] == 0)
+            {
+                continue;
+            }
+            if (strncmp((char *) esp8266at->io_mqtt_topic_buf, esp8266at->mqtt_sub_bufs[i].topic, ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX) == 0)
+            {
+                msgq_getcount(esp8266at->mqtt_sub_bufs[i].msgs, &msg_count);
+                if (msg_count < ESP8266AT_IO_MQTT_SUB_BUF_MSG_MAX)
+                {
+                    esp8266at->io_mqtt_sub_buf_id = i;
+                }
+                break;
+            }
+        }
+
+        if (esp8266at->io_mqtt_sub_buf_id < 0)
+        {
+            esp8266at->stat.mqtt_discard_count++;
+        }
+
+        esp8266at->io_rx_mode = ESP8266AT_IO_RX_MODE_DATA_LEN;
+        return 1;
+    }
+
+    if (esp8266at->io_mqtt_topic_i >= ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX - 1)
+    {
+        _rx_desync(esp8266at);
+        return 1;
+    }
+
+    if (esp8266at->io_mqtt_topic_i == 0 && buf[0] == '"')
+    {
+         // ignore first "
+    }
+    else
+    {
+        esp8266at->io_mqtt_topic_buf[esp8266at->io_mqtt_topic_i] = buf[0];
+        esp8266at->io_mqtt_topic_i++;
+    }
+
+    return 1;
+}
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+static uint32_t _rx_data_len(esp8266at_t *esp8266at, uint8_t *buf, uint32_t len)
+{
+    char len_end;
+
+    (void) len;
+
+    if (esp8266at->io_is_mqtt)
+    {
+        len_end = ',';
+    }
+    else
+    {
+        len_end = ':';
+    }
+
+    if (len_end == buf[0])
+    {
+        if (esp8266at->io_data_len_i == 0)
+        {
+            _rx_desync(esp8266at);
+            return 1;
+        }
+
+        _rx_data_begin(esp8266at);
+        return 1;
+    }
+
+    // "+IPD,<link id>,<length>:" in multiple connection mode, the length is the last field.
+    if (!esp8266at->io_is_mqtt && ',' == buf[0] && esp8266at->io_data_len_i > 0)
+    {
+        esp8266at->io_data_len = 0;
+        esp8266at->io_data_len_i = 0;
+        return 1;
+    }
+
+    // The digits are accumulated as they arrive, so a garbled length can neither overrun a buffer nor wrap.
+    if (buf[0] < '0' || buf[0] > '9')
+    {
+        _rx_desync(esp8266at);
+        return 1;
+    }
+
+    if (esp8266at->io_data_len > (ESP8266AT_IO_DATA_LEN_MAX - (uint32_t) (buf[0] - '0')) / 10)
+    {
+        _rx_desync(esp8266at);
+        return 1;
+    }
+
+    esp8266at->io_data_len = esp8266at->io_data_len * 10 + (buf[0] - '0');
+    esp8266at->io_data_len_i++;
+
+    return 1;
+}
+
+static uint32_t _rx_data(esp8266at_t *esp8266at, uint8_t *buf, uint32_t len)
+{
+#if (ESP8266AT__ENABLE_MQTT == 1)
+    esp8266at_mqtt_sub_buf_t *sub_buf;
+    esp8266at_mqtt_sub_buf_msg_t msg;
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+    // The rest of the frame, or as much of it as has arrived.
+    if (len > esp8266at->io_data_len - esp8266at->io_data_read)
+    {
+        len = esp8266at->io_data_len - esp8266at->io_data_read;
+    }
+    esp8266at->io_data_read += len;
+
+#if (ESP8266AT__ENABLE_MQTT == 1)
+    if (esp8266at->io_is_mqtt)
+    {
+        if (esp8266at->io_mqtt_sub_buf_id >= 0)
+        {
+            sub_buf = &esp8266at->mqtt_sub_bufs[esp8266at->io_mqtt_sub_buf_id];
+            esp8266at->io_data_written += _rx_write(esp8266at, ESP8266AT_STAT_BUF_MQTT, sub_buf->data_buf, NULL, buf, len);
+
+            // The message length is what was stored, or the reader would run into the next message.
+            if (esp8266at->io_data_read >= esp8266at->io_data_len)
+            {
+                msg = esp8266at->io_data_written;
+                msgq_send(sub_buf->msgs, (unsigned char *) &msg);
+            }
+        }
+    }
+    else
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+    {
+        _rx_write(esp8266at, ESP8266AT_STAT_BUF_DATA, esp8266at->io_data_buf, esp8266at->io_data_read_sem, buf, len);
+    }
+
+    if (esp8266at->io_data_read >= esp8266at->io_data_len)
+    {
+        _rx_resp_mode(esp8266at);
+    }
+
+    return len;
+}
+
+static uint32_t (* const _rx_mode_funcs[ESP8266AT_IO_RX_MODE_MAX])(esp8266at_t *esp8266at, uint8_t *buf, uint32_t len) = {
+    [ESP8266AT_IO_RX_MODE_RESP] = _rx_resp,
+    [ESP8266AT_IO_RX_MODE_DATA_LEN] = _rx_data_len,
+    [ESP8266AT_IO_RX_MODE_DATA] = _rx_data,
+#if (ESP8266AT__ENABLE_MQTT == 1)
+    [ESP8266AT_IO_RX_MODE_MQTT_TOPIC] = _rx_mqtt_topic,
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+};
+
+void esp8266at_io_rx_init(esp8266at_t *esp8266at)
+{
+    for (uint32_t k = 0; k < ESP8266AT_IO_RX_KEY_MAX; k++)
+    {
+        _rx_key_first[(uint8_t) _rx_keys[k][0]] |= (1 << k);
+    }
+
+    esp8266at->io_rx_mode = ESP8266AT_IO_RX_MODE_RESP;
+    _rx_key_clear(esp8266at);
+    esp8266at->io_data_len = 0;
+    esp8266at->io_data_len_i = 0;
+    esp8266at->io_data_read = 0;
+    esp8266at->io_data_written = 0;
+    esp8266at->io_is_mqtt = 0;
+#if (ESP8266AT__ENABLE_MQTT == 1)
+    esp8266at->io_mqtt_sub_buf_id = -1;
+    esp8266at->io_mqtt_topic_i = 0;
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+}
+
+void esp8266at_io_rx_process(esp8266at_t *esp8266at, uint8_t *buffer, uint32_t length)
+{
+    uint32_t used;
+
+#if (ESP8266AT__ENABLE_TRACE == 1)
+    uint8_t trace_rx_mode = esp8266at->io_rx_mode;
+    uint32_t trace_overflow_count = esp8266at->rx_overflow_count;
+
+    esp8266at_trace_put(esp8266at, ESP8266AT_TRACE_RX, buffer, length);
+#endif /* (ESP8266AT__ENABLE_TRACE == 1) */
+
+    esp8266at->stat.rx_byte_count += length;
+
+    while (length > 0)
+    {
+        if ((uint32_t) esp8266at->io_rx_mode >= ESP8266AT_IO_RX_MODE_MAX)
+        {
+            _rx_desync(esp8266at);
+        }
+
+        used = _rx_mode_funcs[esp8266at->io_rx_mode](esp8266at, buffer, length);
+        buffer += used;
+        length -= used;
+    }
+
+#if (ESP8266AT__ENABLE_TRACE == 1)
+    esp8266at_trace_rx_state(esp8266at, trace_rx_mode, trace_overflow_count);
+#endif /* (ESP8266AT__ENABLE_TRACE == 1) */
+}
+
+#endif /* (INCLUDE__ESP8266AT == 1) */
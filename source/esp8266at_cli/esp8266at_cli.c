@@ -15,7 +15,7 @@
 #include <esp8266at.h>
 #include <esp8266at_cli.h>
 
-#if (INCLUDE__ESP8266AT == 1)
+#if (INCLUDE__ESP8266AT == 1) && (ESP8266AT__ENABLE_CLI == 1)
 
 #include "../../source/esp8266at/esp8266at_io.h"
 
@@ -23,13 +23,40 @@
 #define LOGM_CATEGORY ESP8266AT__LOGM_CATEGORY
 
 #define ESP8266AT_RECV_BUFFER_SIZE 1500
+#if (ESP8266AT__ENABLE_MQTT == 1)
 #define ESP8266AT_MQTT_MSG_BUFFER_SIZE 512
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+#define ESP8266AT_BENCH_SAMPLE_MAX 256
+#define ESP8266AT_BENCH_WINDOW_MAX 16
+#define ESP8266AT_BENCH_SEQ_LEN 8
+#define ESP8266AT_BENCH_PATTERN_MOD 251 // prime, so that a lost or repeated chunk breaks the pattern
+
+#if (ESP8266AT__ENABLE_MQTT == 1)
+#define ESP8266AT_MQTT_BENCH_SUB_ID (ESP8266AT_IO_MQTT_SUB_BUF_MAX - 1)
+#define ESP8266AT_MQTT_BENCH_COUNT_MAX 2048
+#define ESP8266AT_MQTT_BENCH_HEADER_LEN 18 // "<seq> <tick> " in 8 hex digits each
+#define ESP8266AT_MQTT_BENCH_POLL_TIMEOUT_MS 1
+#define ESP8266AT_MQTT_BENCH_DRAIN_TIMEOUT_MS 3000
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
 
 static uint8_t _recv_buf[ESP8266AT_RECV_BUFFER_SIZE];
+#if (ESP8266AT__ENABLE_MQTT == 1)
 static uint8_t _mqtt_msg_buf[ESP8266AT_MQTT_MSG_BUFFER_SIZE];
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+static uint8_t _send_buf[ESP8266AT_RECV_BUFFER_SIZE];
+static uint32_t _bench_samples[ESP8266AT_BENCH_SAMPLE_MAX];
+static uint32_t _bench_send_ticks[ESP8266AT_BENCH_WINDOW_MAX];
+#if (ESP8266AT__ENABLE_MQTT == 1)
+static uint8_t _mqtt_bench_seen[ESP8266AT_MQTT_BENCH_COUNT_MAX / 8];
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
 
 static uint32_t _timeoutms = 10000;
 
+static void _bench_sample(uint32_t *samples, uint32_t *count, uint32_t value);
+static void _bench_print_samples(char *name, uint32_t *samples, uint32_t count);
+
 int esp8266at_cli_at(esp8266at_t *esp8266at, char *str, int len, void *arg)
 {
     int r = -1;
@@ -88,6 +115,7 @@ int esp8266at_cli_at(esp8266at_t *esp8266at, char *str, int len, void *arg)
             break;
         }
 
+#if (ESP8266AT__ENABLE_SNTP == 1)
         cmd = "sntp";
         cmdlen = strlen(cmd);
         if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
@@ -105,6 +133,36 @@ int esp8266at_cli_at(esp8266at_t *esp8266at, char *str, int len, void *arg)
             r = 0;
             break;
         }
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
+
+        cmd = "bench ";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            tmpstr = &tmpstr[cmdlen];
+            tmplen -= cmdlen;
+
+            r = esp8266at_cli_at_bench(esp8266at, tmpstr, tmplen, arg);
+            break;
+        }
+
+        cmd = "stats";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            r = esp8266at_cli_at_stats(esp8266at, &tmpstr[cmdlen], tmplen - cmdlen, arg);
+            break;
+        }
+
+#if (ESP8266AT__ENABLE_TRACE == 1)
+        cmd = "trace";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            r = esp8266at_cli_at_trace(esp8266at, &tmpstr[cmdlen], tmplen - cmdlen, arg);
+            break;
+        }
+#endif /* (ESP8266AT__ENABLE_TRACE == 1) */
 
         cmd = "c ";
         cmdlen = strlen(cmd);
@@ -139,6 +197,7 @@ int esp8266at_cli_at(esp8266at_t *esp8266at, char *str, int len, void *arg)
             break;
         }
 
+#if (ESP8266AT__ENABLE_MQTT == 1)
         cmd = "mqtt ";
         cmdlen = strlen(cmd);
         if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
@@ -149,6 +208,40 @@ int esp8266at_cli_at(esp8266at_t *esp8266at, char *str, int len, void *arg)
             r = esp8266at_cli_at_mqtt(esp8266at, tmpstr, tmplen, arg);
             break;
         }
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+        cmd = "sv ";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            tmpstr = &tmpstr[cmdlen];
+            tmplen -= cmdlen;
+
+            r = esp8266at_cli_at_sv(esp8266at, tmpstr, tmplen, arg);
+            break;
+        }
+
+        cmd = "pwr ";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            tmpstr = &tmpstr[cmdlen];
+            tmplen -= cmdlen;
+
+            r = esp8266at_cli_at_pwr(esp8266at, tmpstr, tmplen, arg);
+            break;
+        }
+
+        cmd = "ssl ";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            tmpstr = &tmpstr[cmdlen];
+            tmplen -= cmdlen;
+
+            r = esp8266at_cli_at_ssl(esp8266at, tmpstr, tmplen, arg);
+            break;
+        }
 
         break;
     } while (1);
@@ -186,7 +279,7 @@ void esp8266at_cli_at_query_version(esp8266at_t *esp8266at)
     ubi_st_t st;
 
     st = esp8266at_cmd_at_gmr(esp8266at, _timeoutms, NULL);
-    printf("result : status = %d, version = %s\n", st, esp8266at->version);
+    printf("result : status = %d, version = %s, dialect = %s\n", st, esp8266at->version, esp8266at->dialect->name);
 }
 
 void esp8266at_cli_at_query_dns(esp8266at_t *esp8266at)
@@ -205,6 +298,8 @@ void esp8266at_cli_at_query_dns(esp8266at_t *esp8266at)
     printf("\n");
 }
 
+#if (ESP8266AT__ENABLE_SNTP == 1)
+
 void esp8266at_cli_at_query_sntpcfg(esp8266at_t *esp8266at)
 {
     ubi_st_t st;
@@ -232,6 +327,8 @@ void esp8266at_cli_at_query_sntptime(esp8266at_t *esp8266at)
         tm_data.tm_year + 1900, tm_data.tm_mon + 1, tm_data.tm_mday, tm_data.tm_wday, tm_data.tm_hour, tm_data.tm_min, tm_data.tm_sec);
 }
 
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
+
 int esp8266at_cli_at_config(esp8266at_t *esp8266at, char *str, int len, void *arg)
 {
     int r = -1;
@@ -300,6 +397,18 @@ int esp8266at_cli_at_config(esp8266at_t *esp8266at, char *str, int len, void *ar
             break;
         }
 
+        cmd = "dnscache ";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            tmpstr = &tmpstr[cmdlen];
+            tmplen -= cmdlen;
+
+            r = esp8266at_cli_at_config_dnscache(esp8266at, tmpstr, tmplen, arg);
+            break;
+        }
+
+#if (ESP8266AT__ENABLE_SNTP == 1)
         cmd = "sntp ";
         cmdlen = strlen(cmd);
         if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
@@ -310,7 +419,9 @@ int esp8266at_cli_at_config(esp8266at_t *esp8266at, char *str, int len, void *ar
             r = esp8266at_cli_at_config_sntpcfg(esp8266at, tmpstr, tmplen, arg);
             break;
         }
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
 
+#if (ESP8266AT__ENABLE_MQTT == 1)
         cmd = "mqtt ";
         cmdlen = strlen(cmd);
         if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
@@ -322,6 +433,18 @@ int esp8266at_cli_at_config(esp8266at_t *esp8266at, char *str, int len, void *ar
             break;
         }
 
+        cmd = "mqttconn ";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            tmpstr = &tmpstr[cmdlen];
+            tmplen -= cmdlen;
+
+            r = esp8266at_cli_at_config_mqttconncfg(esp8266at, tmpstr, tmplen, arg);
+            break;
+        }
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
         break;
     } while (1);
 
@@ -445,6 +568,26 @@ int esp8266at_cli_at_config_dns(esp8266at_t *esp8266at, char *str, int len, void
     return r;
 }
 
+int esp8266at_cli_at_config_dnscache(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = -1;
+    int enable = 0;
+    uint32_t ttl_ms = 0;
+
+    do
+    {
+        sscanf(str, "%d %lu", &enable, &ttl_ms);
+
+        r = esp8266at_dns_cache_config(esp8266at, enable, ttl_ms);
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+#if (ESP8266AT__ENABLE_SNTP == 1)
+
 int esp8266at_cli_at_config_sntpcfg(esp8266at_t *esp8266at, char *str, int len, void *arg)
 {
     int r = -1;
@@ -468,6 +611,10 @@ int esp8266at_cli_at_config_sntpcfg(esp8266at_t *esp8266at, char *str, int len,
     return r;
 }
 
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
+
+#if (ESP8266AT__ENABLE_MQTT == 1)
+
 int esp8266at_cli_at_config_mqttusercfg(esp8266at_t *esp8266at, char *str, int len, void *arg)
 {
     int r = -1;
@@ -482,13 +629,16 @@ int esp8266at_cli_at_config_mqttusercfg(esp8266at_t *esp8266at, char *str, int l
         memset(mqtt_username, 0, ESP8266AT_MQTT_USERNAME_LENGTH_MAX);
         memset(mqtt_passwd, 0, ESP8266AT_MQTT_PASSWD_LENGTH_MAX);
 
-#if (ESP8266AT__USE_WIZFI360_API == 1)
-        sscanf(str, "%s %s %s",
-            mqtt_client_id, mqtt_username, mqtt_passwd);
-#else
-        sscanf(str, "%d %s %s %s", &mqtt_scheme,
-            mqtt_client_id, mqtt_username, mqtt_passwd);
-#endif /* (ESP8266AT__USE_WIZFI360_API == 1) */
+        if (ESP8266AT_IS_WIZFI360(esp8266at))
+        {
+            sscanf(str, "%s %s %s",
+                mqtt_client_id, mqtt_username, mqtt_passwd);
+        }
+        else
+        {
+            sscanf(str, "%d %s %s %s", &mqtt_scheme,
+                mqtt_client_id, mqtt_username, mqtt_passwd);
+        }
 
         r = esp8266at_cmd_at_mqttusercfg(esp8266at, mqtt_scheme,
             mqtt_client_id, mqtt_username, mqtt_passwd,
@@ -500,6 +650,49 @@ int esp8266at_cli_at_config_mqttusercfg(esp8266at_t *esp8266at, char *str, int l
     return r;
 }
 
+int esp8266at_cli_at_config_mqttconncfg(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = -1;
+    uint32_t keepalive = ESP8266AT_MQTT_KEEPALIVE_DEFAULT;
+    uint32_t disable_clean_session = 0;
+    char lwt_topic[ESP8266AT_MQTT_LWT_TOPIC_LENGTH_MAX + 1];
+    char lwt_msg[ESP8266AT_MQTT_LWT_MSG_LENGTH_MAX + 1];
+    uint32_t lwt_qos = 0;
+    uint32_t lwt_retain = 0;
+    int count;
+
+    do
+    {
+        memset(lwt_topic, 0, ESP8266AT_MQTT_LWT_TOPIC_LENGTH_MAX + 1);
+        memset(lwt_msg, 0, ESP8266AT_MQTT_LWT_MSG_LENGTH_MAX + 1);
+
+        // The LWT arguments are optional, but all or none of them.
+        count = sscanf(str, "%lu %lu %128s %64s %lu %lu", &keepalive, &disable_clean_session,
+            lwt_topic, lwt_msg, &lwt_qos, &lwt_retain);
+        if (count != 2 && count != 6)
+        {
+            break;
+        }
+
+        if (keepalive > ESP8266AT_MQTT_KEEPALIVE_MAX)
+        {
+            printf("keepalive must be 0 to %d\n", ESP8266AT_MQTT_KEEPALIVE_MAX);
+            r = 0;
+            break;
+        }
+
+        r = esp8266at_cmd_at_mqttconncfg(esp8266at, (uint16_t) keepalive, disable_clean_session,
+            lwt_topic, lwt_msg, lwt_qos, lwt_retain,
+            _timeoutms, NULL);
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
 int esp8266at_cli_at_ap(esp8266at_t *esp8266at, char *str, int len, void *arg)
 {
     int r = -1;
@@ -513,6 +706,17 @@ int esp8266at_cli_at_ap(esp8266at_t *esp8266at, char *str, int len, void *arg)
 
     do
     {
+        cmd = "fjoin";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            tmpstr = &tmpstr[cmdlen];
+            tmplen -= cmdlen;
+
+            r = esp8266at_cli_at_ap_fastjoin(esp8266at, tmpstr, tmplen, arg);
+            break;
+        }
+
         cmd = "join";
         cmdlen = strlen(cmd);
         if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
@@ -547,6 +751,28 @@ int esp8266at_cli_at_ap(esp8266at_t *esp8266at, char *str, int len, void *arg)
             break;
         }
 
+        cmd = "scanopt ";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            tmpstr = &tmpstr[cmdlen];
+            tmplen -= cmdlen;
+
+            r = esp8266at_cli_at_ap_scanopt(esp8266at, tmpstr, tmplen, arg);
+            break;
+        }
+
+        cmd = "scan";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            tmpstr = &tmpstr[cmdlen];
+            tmplen -= cmdlen;
+
+            r = esp8266at_cli_at_ap_scan(esp8266at, tmpstr, tmplen, arg);
+            break;
+        }
+
         break;
     } while (1);
 
@@ -571,6 +797,33 @@ int esp8266at_cli_at_ap_join(esp8266at_t *esp8266at, char *str, int len, void *a
     return r;
 }
 
+int esp8266at_cli_at_ap_fastjoin(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = -1;
+
+    ubi_st_t st;
+    esp8266at_join_cache_t *cache = &esp8266at->join_cache;
+    esp8266at_join_time_t *join_time = &esp8266at->join_time;
+
+    do
+    {
+        st = esp8266at_fastjoin(esp8266at, esp8266at->ssid, esp8266at->passwd, _timeoutms, NULL);
+        printf("result : status = %d, fast = %d\n", st, join_time->fast);
+        printf("    time (ms) : fast %lu, full %lu, cache %lu, total %lu\n", join_time->fast_ms, join_time->full_ms,
+            join_time->cache_ms, join_time->total_ms);
+        if (cache->valid)
+        {
+            printf("    cache : bssid %s, channel %d, ip %s, gateway %s, netmask %s\n", cache->bssid, cache->channel,
+                cache->ip_addr, cache->gateway, cache->netmask);
+        }
+        r = 0;
+
+        break;
+    } while (1);
+
+    return r;
+}
+
 int esp8266at_cli_at_ap_quit(esp8266at_t *esp8266at, char *str, int len, void *arg)
 {
     ubi_st_t st;
@@ -608,6 +861,68 @@ int esp8266at_cli_at_ap_query_ip(esp8266at_t *esp8266at, char *str, int len, voi
     return r;
 }
 
+static void _ap_scan_callback(void *arg, const esp8266at_ap_info_t *ap_info)
+{
+    esp8266at_ap_info_t *best = (esp8266at_ap_info_t *) arg;
+
+    printf("    %-32s %-17s ch %2d rssi %4d ecn %d\n", ap_info->ssid, ap_info->bssid, ap_info->channel, ap_info->rssi, ap_info->ecn);
+
+    // Only the numbers are kept, as the strings are gone after the callback.
+    if (ap_info->rssi > best->rssi)
+    {
+        best->rssi = ap_info->rssi;
+        best->channel = ap_info->channel;
+    }
+}
+
+int esp8266at_cli_at_ap_scan(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = -1;
+
+    ubi_st_t st;
+    uint32_t count;
+    esp8266at_ap_info_t best;
+
+    do
+    {
+        memset(&best, 0, sizeof(esp8266at_ap_info_t));
+        best.rssi = INT8_MIN;
+        st = esp8266at_cmd_at_cwlap(esp8266at, _ap_scan_callback, &best, &count, _timeoutms, NULL);
+        printf("result : status = %d, count = %lu", st, count);
+        if (count > 0)
+        {
+            printf(", strongest = ch %d rssi %d", best.channel, best.rssi);
+        }
+        printf("\n");
+        r = 0;
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+int esp8266at_cli_at_ap_scanopt(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = -1;
+
+    ubi_st_t st;
+    uint32_t sort_enable = 1;
+    uint32_t mask = ESP8266AT_CWLAP_FIELD__DEFAULT;
+
+    do
+    {
+        sscanf(str, "%lu %lx", &sort_enable, &mask);
+        st = esp8266at_cmd_at_cwlapopt(esp8266at, sort_enable, mask, _timeoutms, NULL);
+        printf("result : status = %d\n", st);
+        r = 0;
+
+        break;
+    } while (1);
+
+    return r;
+}
+
 int esp8266at_cli_at_conn(esp8266at_t *esp8266at, char *str, int len, void *arg)
 {
     int r = -1;
@@ -665,6 +980,17 @@ int esp8266at_cli_at_conn(esp8266at_t *esp8266at, char *str, int len, void *arg)
             break;
         }
 
+        cmd = "resolve ";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            tmpstr = &tmpstr[cmdlen];
+            tmplen -= cmdlen;
+
+            r = esp8266at_cli_at_conn_resolve(esp8266at, tmpstr, tmplen, arg);
+            break;
+        }
+
         break;
     } while (1);
 
@@ -693,6 +1019,30 @@ int esp8266at_cli_at_conn_open(esp8266at_t *esp8266at, char *str, int len, void
     return r;
 }
 
+int esp8266at_cli_at_conn_resolve(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = -1;
+    ubi_st_t st;
+    char host[ESP8266AT_HOST_LENGTH_MAX + 1];
+    char ip_addr[ESP8266AT_IP_ADDR_LENGTH_MAX + 1];
+    uint32_t begin_tick;
+
+    do
+    {
+        memset(host, 0, sizeof(host));
+        sscanf(str, "%128s", host);
+        ip_addr[0] = 0;
+        begin_tick = ubik_gettickcount().low;
+        st = esp8266at_resolve(esp8266at, host, ip_addr, _timeoutms, NULL);
+        printf("result : status = %d, ip = %s, time = %lu ms\n", st, ip_addr, ubik_ticktotimems(ubik_gettickcount().low - begin_tick));
+        r = 0;
+
+        break;
+    } while (1);
+
+    return r;
+}
+
 int esp8266at_cli_at_conn_close(esp8266at_t *esp8266at, char *str, int len, void *arg)
 {
     int r = -1;
@@ -755,6 +1105,8 @@ int esp8266at_cli_at_conn_recv(esp8266at_t *esp8266at, char *str, int len, void
     return r;
 }
 
+#if (ESP8266AT__ENABLE_MQTT == 1)
+
 int esp8266at_cli_at_mqtt(esp8266at_t *esp8266at, char *str, int len, void *arg)
 {
     int r = -1;
@@ -769,7 +1121,6 @@ int esp8266at_cli_at_mqtt(esp8266at_t *esp8266at, char *str, int len, void *arg)
     do
     {
 
-#if (ESP8266AT__USE_WIZFI360_API == 1)
         cmd = "topic ";
         cmdlen = strlen(cmd);
         if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
@@ -780,8 +1131,6 @@ int esp8266at_cli_at_mqtt(esp8266at_t *esp8266at, char *str, int len, void *arg)
             r = esp8266at_cli_at_mqtt_topic(esp8266at, tmpstr, tmplen, arg);
             break;
         }
-#else
-#endif /* (ESP8266AT__USE_WIZFI360_API == 1) */
 
         cmd = "open ";
         cmdlen = strlen(cmd);
@@ -861,27 +1210,92 @@ int esp8266at_cli_at_mqtt(esp8266at_t *esp8266at, char *str, int len, void *arg)
             break;
         }
 
-        break;
-    } while (1);
+        cmd = "qcfg ";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            tmpstr = &tmpstr[cmdlen];
+            tmplen -= cmdlen;
 
-    return r;
-}
+            r = esp8266at_cli_at_mqtt_qcfg(esp8266at, tmpstr, tmplen, arg);
+            break;
+        }
 
-#if (ESP8266AT__USE_WIZFI360_API == 1)
-int esp8266at_cli_at_mqtt_topic(esp8266at_t *esp8266at, char *str, int len, void *arg)
-{
-    int r = -1;
+        cmd = "qpub ";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            tmpstr = &tmpstr[cmdlen];
+            tmplen -= cmdlen;
 
-    ubi_st_t st;
-    char pub_topic[128];
-    char sub_topic[128];
-    char sub_topic_2[128];
-    char sub_topic_3[128];
+            r = esp8266at_cli_at_mqtt_qpub(esp8266at, tmpstr, tmplen, arg);
+            break;
+        }
 
-    memset(pub_topic, 0, sizeof(pub_topic));
-    memset(sub_topic, 0, sizeof(sub_topic));
-    memset(sub_topic_2, 0, sizeof(sub_topic_2));
-    memset(sub_topic_3, 0, sizeof(sub_topic_3));
+        cmd = "qdrain";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            tmpstr = &tmpstr[cmdlen];
+            tmplen -= cmdlen;
+
+            r = esp8266at_cli_at_mqtt_qdrain(esp8266at, tmpstr, tmplen, arg);
+            break;
+        }
+
+        cmd = "qinfo";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            tmpstr = &tmpstr[cmdlen];
+            tmplen -= cmdlen;
+
+            r = esp8266at_cli_at_mqtt_qinfo(esp8266at, tmpstr, tmplen, arg);
+            break;
+        }
+
+        cmd = "bench ";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            tmpstr = &tmpstr[cmdlen];
+            tmplen -= cmdlen;
+
+            r = esp8266at_cli_at_mqtt_bench(esp8266at, tmpstr, tmplen, arg);
+            break;
+        }
+
+        cmd = "stat";
+        cmdlen = strlen(cmd);
+        if (tmplen >= cmdlen && strncmp(tmpstr, cmd, cmdlen) == 0)
+        {
+            tmpstr = &tmpstr[cmdlen];
+            tmplen -= cmdlen;
+
+            r = esp8266at_cli_at_mqtt_stat(esp8266at, tmpstr, tmplen, arg);
+            break;
+        }
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+int esp8266at_cli_at_mqtt_topic(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = -1;
+
+    ubi_st_t st;
+    char pub_topic[128];
+    char sub_topic[128];
+    char sub_topic_2[128];
+    char sub_topic_3[128];
+
+    memset(pub_topic, 0, sizeof(pub_topic));
+    memset(sub_topic, 0, sizeof(sub_topic));
+    memset(sub_topic_2, 0, sizeof(sub_topic_2));
+    memset(sub_topic_3, 0, sizeof(sub_topic_3));
 
     do
     {
@@ -895,8 +1309,6 @@ int esp8266at_cli_at_mqtt_topic(esp8266at_t *esp8266at, char *str, int len, void
 
     return r;
 }
-#else
-#endif /* (ESP8266AT__USE_WIZFI360_API == 1) */
 
 int esp8266at_cli_at_mqtt_open(esp8266at_t *esp8266at, char *str, int len, void *arg)
 {
@@ -947,13 +1359,16 @@ int esp8266at_cli_at_mqtt_pub(esp8266at_t *esp8266at, char *str, int len, void *
 
     do
     {
-#if (ESP8266AT__USE_WIZFI360_API == 1)
-        sscanf(str, "%s", _mqtt_msg_buf);
-        st = esp8266at_cmd_at_mqttpub(esp8266at, topic, (char *) _mqtt_msg_buf, qos, retain, _timeoutms, NULL);
-#else
-        sscanf(str, "%s %s %lu %lu", topic, _mqtt_msg_buf, &qos, &retain);
-        st = esp8266at_cmd_at_mqttpubraw(esp8266at, topic, (char *) _mqtt_msg_buf, strlen((char *)_mqtt_msg_buf), qos, retain, _timeoutms, NULL);
-#endif /* (ESP8266AT__USE_WIZFI360_API == 1) */
+        if (ESP8266AT_IS_WIZFI360(esp8266at))
+        {
+            sscanf(str, "%s", _mqtt_msg_buf);
+            st = esp8266at_cmd_at_mqttpub(esp8266at, topic, (char *) _mqtt_msg_buf, qos, retain, _timeoutms, NULL);
+        }
+        else
+        {
+            sscanf(str, "%s %s %lu %lu", topic, _mqtt_msg_buf, &qos, &retain);
+            st = esp8266at_cmd_at_mqttpubraw(esp8266at, topic, (char *) _mqtt_msg_buf, strlen((char *)_mqtt_msg_buf), qos, retain, _timeoutms, NULL);
+        }
         printf("result : status = %d\n", st);
         r = 0;
 
@@ -1003,17 +1418,22 @@ int esp8266at_cli_at_mqtt_unsub(esp8266at_t *esp8266at, char *str, int len, void
     return r;
 }
 
+static void _mqtt_sublist_line(void *arg, char *line)
+{
+    if (strncmp(line, "+MQTTSUB:", 9) == 0)
+    {
+        printf("    %s\n", line);
+    }
+}
+
 int esp8266at_cli_at_mqtt_sublist(esp8266at_t *esp8266at, char *str, int len, void *arg)
 {
     int r = -1;
     ubi_st_t st;
-    char topic[128];
-    uint32_t qos;
 
     do
     {
-        sscanf(str, "%s %lu", topic, &qos);
-        st = esp8266at_cmd_at_mqttsub_q(esp8266at, _timeoutms, NULL);
+        st = esp8266at_cmd_at_mqttsub_q(esp8266at, _mqtt_sublist_line, NULL, _timeoutms, NULL);
         printf("result : status = %d\n", st);
         r = 0;
 
@@ -1050,42 +1470,1105 @@ int esp8266at_cli_at_mqtt_subget(esp8266at_t *esp8266at, char *str, int len, voi
     return r;
 }
 
-int esp8266at_cli_rdate(esp8266at_t *esp8266at, char *str, int len, void *arg)
+int esp8266at_cli_at_mqtt_qcfg(esp8266at_t *esp8266at, char *str, int len, void *arg)
 {
-    int r;
+    int r = -1;
     ubi_st_t st;
+    uint32_t policy = ESP8266AT_MQTT_PUBQ_DROP_OLDEST;
 
-    struct timeval tv;
-    struct tm tm_data;
+    do
+    {
+        sscanf(str, "%lu", &policy);
+        st = esp8266at_mqtt_pubq_config(esp8266at, policy, NULL);
+        if (st == UBI_ST_OK)
+        {
+            st = esp8266at_mqtt_pubq_start(esp8266at);
+        }
+        printf("result : status = %d\n", st);
+        r = 0;
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+int esp8266at_cli_at_mqtt_qpub(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = -1;
+    ubi_st_t st;
+    char topic[128];
+    uint32_t qos = 0;
+    uint32_t retain = 0;
 
-    r = -1;
     do
     {
-        st = esp8266at_cmd_at_cipsntptime(esp8266at, &tm_data, _timeoutms, NULL);
+        sscanf(str, "%s %s %lu %lu", topic, _mqtt_msg_buf, &qos, &retain);
+        st = esp8266at_mqtt_pub(esp8266at, topic, (char *) _mqtt_msg_buf, strlen((char *)_mqtt_msg_buf), qos, retain, _timeoutms, NULL);
+        printf("result : status = %d, queued = %lu\n", st, esp8266at_mqtt_pubq_count(esp8266at));
+        r = 0;
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+int esp8266at_cli_at_mqtt_qdrain(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = -1;
+    ubi_st_t st;
+
+    do
+    {
+        st = esp8266at_mqtt_pubq_drain(esp8266at, _timeoutms, NULL);
+        printf("result : status = %d, queued = %lu\n", st, esp8266at_mqtt_pubq_count(esp8266at));
+        r = 0;
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+int esp8266at_cli_at_mqtt_qinfo(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = 0;
+
+    esp8266at_urc_process(esp8266at);
+    printf("result : connected = %d, policy = %d, queued = %lu, spilled = %lu, dropped = %lu\n",
+        esp8266at->mqtt_connected, esp8266at->mqtt_pubq_drop_policy, esp8266at->mqtt_pubq_count,
+        esp8266at->mqtt_pubq_spill_count, esp8266at->mqtt_pubq_drop_count);
+
+    return r;
+}
+
+int esp8266at_cli_at_mqtt_stat(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = 0;
+    esp8266at_mqtt_pub_stat_t stat;
+    const char *bin_name[ESP8266AT_MQTT_PUB_LATENCY_BIN_MAX] = {"<10", "<20", "<50", "<100", "<200", "<500", "<1000", ">=1000"};
+    uint32_t elapsed_ms;
+
+    if (len >= 6 && strncmp(str, " reset", 6) == 0)
+    {
+        esp8266at_mqtt_pub_stat_reset(esp8266at);
+        printf("result : status = %d\n", UBI_ST_OK);
+        return r;
+    }
+
+    esp8266at_mqtt_pub_stat_get(esp8266at, &stat);
+    elapsed_ms = max(stat.elapsed_ms, 1);
+
+    printf("elapsed   : %lu ms\n", stat.elapsed_ms);
+    printf("published : %lu msgs (qos0 %lu, qos1 %lu, qos2 %lu), %lu bytes\n", stat.msg_count,
+        stat.msg_count_qos[0], stat.msg_count_qos[1], stat.msg_count_qos[2], stat.byte_count);
+    printf("rate      : %lu.%02lu msgs/s, %lu bytes/s\n",
+        (uint32_t) (((uint64_t) stat.msg_count * 1000) / elapsed_ms),
+        (uint32_t) ((((uint64_t) stat.msg_count * 100000) / elapsed_ms) % 100),
+        (uint32_t) (((uint64_t) stat.byte_count * 1000) / elapsed_ms));
+    printf("failed    : timeout %lu, error %lu, io %lu, other %lu\n",
+        stat.fail_count[ESP8266AT_MQTT_PUB_FAIL_TIMEOUT], stat.fail_count[ESP8266AT_MQTT_PUB_FAIL_ERROR],
+        stat.fail_count[ESP8266AT_MQTT_PUB_FAIL_IO], stat.fail_count[ESP8266AT_MQTT_PUB_FAIL_OTHER]);
+    if (stat.msg_count > 0)
+    {
+        printf("cmd rtt   : min %lu, avg %lu, max %lu ms\n", stat.latency_min_ms,
+            stat.latency_sum_ms / stat.msg_count, stat.latency_max_ms);
+    }
+    for (int i = 0; i < ESP8266AT_MQTT_PUB_LATENCY_BIN_MAX; i++)
+    {
+        printf("    %-6s ms : %lu\n", bin_name[i], stat.latency_hist[i]);
+    }
+
+    return r;
+}
+
+typedef struct _mqtt_bench_t
+{
+    uint32_t count;
+    uint32_t size;
+    uint32_t received;
+    uint32_t duplicate;
+    uint32_t out_of_order;
+    uint32_t corrupt;
+    uint32_t next_seq;
+    uint32_t rtt_min_ms;
+    uint32_t rtt_max_ms;
+    uint32_t rtt_sum_ms;
+    uint32_t sample_count;
+} _mqtt_bench_t;
+
+static void _mqtt_bench_fill(char *buf, uint32_t seq, uint32_t size)
+{
+    sprintf(buf, "%08lx %08lx ", seq, ubik_gettickcount().low);
+    for (uint32_t i = ESP8266AT_MQTT_BENCH_HEADER_LEN; i < size; i++)
+    {
+        buf[i] = 'a' + (char) ((seq + i) % 26);
+    }
+    buf[size] = 0;
+}
+
+static ubi_st_t _mqtt_bench_drain(esp8266at_t *esp8266at, _mqtt_bench_t *bench, uint32_t timeoutms)
+{
+    ubi_st_t st;
+    uint32_t read;
+    uint32_t seq;
+    uint32_t tick;
+    uint32_t rtt_ms;
+    uint32_t i;
+
+    for (;;)
+    {
+        st = esp8266at_cmd_at_mqttsubget(esp8266at, ESP8266AT_MQTT_BENCH_SUB_ID, _recv_buf, ESP8266AT_RECV_BUFFER_SIZE - 1, &read,
+                timeoutms, &timeoutms);
         if (st != UBI_ST_OK)
         {
             break;
         }
+        _recv_buf[read] = 0;
 
-        if (tm_data.tm_year <= 70)
+        if (read != bench->size || sscanf((char *) _recv_buf, "%8lx %8lx", &seq, &tick) != 2 || seq >= bench->count)
+        {
+            bench->corrupt++;
+            continue;
+        }
+        for (i = ESP8266AT_MQTT_BENCH_HEADER_LEN; i < read; i++)
+        {
+            if (_recv_buf[i] != 'a' + (seq + i) % 26)
+            {
+                break;
+            }
+        }
+        if (i != read)
+        {
+            bench->corrupt++;
+            continue;
+        }
+
+        if (_mqtt_bench_seen[seq / 8] & (1 << (seq % 8)))
+        {
+            bench->duplicate++;
+            continue;
+        }
+        _mqtt_bench_seen[seq / 8] |= (1 << (seq % 8));
+
+        if (seq < bench->next_seq)
+        {
+            bench->out_of_order++;
+        }
+        bench->next_seq = max(bench->next_seq, seq + 1);
+
+        // The tick was stamped by this device, so the broker clock does not matter.
+        rtt_ms = ubik_ticktotimems(ubik_gettickcount().low - tick);
+        bench->rtt_min_ms = min(bench->rtt_min_ms, rtt_ms);
+        bench->rtt_max_ms = max(bench->rtt_max_ms, rtt_ms);
+        bench->rtt_sum_ms += rtt_ms;
+        _bench_sample(_bench_samples, &bench->sample_count, rtt_ms);
+        bench->received++;
+
+        if (bench->received >= bench->count)
         {
-            st = UBI_ST_ERR;
             break;
         }
+    }
 
-        tv.tv_sec = mktime(&tm_data);
-        tv.tv_usec = 0;
-        settimeofday(&tv, NULL);
+    return st;
+}
+
+int esp8266at_cli_at_mqtt_bench(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = -1;
+    ubi_st_t st;
+    char topic[128];
+    char saved_pub_topic[ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX];
+    uint32_t qos = 0;
+    uint32_t rate = 0;
+    uint32_t sent = 0;
+    uint32_t pub_fail = 0;
+    uint32_t begin_tick;
+    uint32_t due_ms;
+    uint32_t now_ms;
+    uint32_t send_ms;
+    uint32_t elapsed_ms;
+    _mqtt_bench_t bench;
+    esp8266at_stat_t stat;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.rtt_min_ms = UINT32_MAX;
 
+    do
+    {
+        if (sscanf(str, "%127s %lu %lu %lu %lu", topic, &bench.size, &bench.count, &qos, &rate) != 5)
+        {
+            break;
+        }
         r = 0;
-        break;
-    } while(1);
 
-    printf("result : status = %d\n", st);
+        if (bench.size < ESP8266AT_MQTT_BENCH_HEADER_LEN || bench.size >= ESP8266AT_MQTT_MSG_BUFFER_SIZE || bench.count == 0 ||
+                bench.count > ESP8266AT_MQTT_BENCH_COUNT_MAX || qos > ESP8266AT_MQTT_QOS_MAX)
+        {
+            printf("size must be %d to %d bytes, count 1 to %d, qos 0 to %d\n", ESP8266AT_MQTT_BENCH_HEADER_LEN,
+                ESP8266AT_MQTT_MSG_BUFFER_SIZE - 1, ESP8266AT_MQTT_BENCH_COUNT_MAX, ESP8266AT_MQTT_QOS_MAX);
+            break;
+        }
+
+        // The bench would replace a subscription of the user and drop it at the end.
+        if (esp8266at->mqtt_sub_bufs[ESP8266AT_MQTT_BENCH_SUB_ID].topic[0] != 0)
+        {
+            printf("subscription %d is in use, unsubscribe it first\n", ESP8266AT_MQTT_BENCH_SUB_ID);
+            break;
+        }
+
+        // WizFi360 publishes to the bound topic only, so it is switched to <topic> for the run.
+        // Subscribing sends the new AT+MQTTTOPIC, and unsubscribing sends the saved one again.
+        if (ESP8266AT_IS_WIZFI360(esp8266at))
+        {
+            if (strlen(topic) >= ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX)
+            {
+                printf("topic must be shorter than %d bytes\n", ESP8266AT_IO_MQTT_TOPIC_LENGTH_MAX);
+                break;
+            }
+            st = esp8266at_mqtt_pub_topic_swap(esp8266at, topic, saved_pub_topic, _timeoutms, NULL);
+            if (st != UBI_ST_OK)
+            {
+                printf("result : status = %d\n", st);
+                break;
+            }
+        }
+
+        st = esp8266at_cmd_at_mqttsub(esp8266at, ESP8266AT_MQTT_BENCH_SUB_ID, topic, qos, _timeoutms, NULL);
+        if (st != UBI_ST_OK)
+        {
+            printf("result : status = %d\n", st);
+            if (ESP8266AT_IS_WIZFI360(esp8266at))
+            {
+                esp8266at_mqtt_pub_topic_swap(esp8266at, saved_pub_topic, NULL, _timeoutms, NULL);
+                esp8266at_cmd_at_mqttunsub(esp8266at, ESP8266AT_MQTT_BENCH_SUB_ID, _timeoutms, NULL);
+            }
+            break;
+        }
+
+        memset(_mqtt_bench_seen, 0, sizeof(_mqtt_bench_seen));
+        esp8266at_stat_reset(esp8266at);
+        esp8266at_mqtt_pub_stat_reset(esp8266at);
+        begin_tick = ubik_gettickcount().low;
+
+        for (sent = 0; sent < bench.count; sent++)
+        {
+            // Receive while waiting for the next slot, <rate> 0 : as fast as possible.
+            if (rate > 0)
+            {
+                due_ms = (uint32_t) (((uint64_t) sent * 1000) / rate);
+                now_ms = ubik_ticktotimems(ubik_gettickcount().low - begin_tick);
+                if (due_ms > now_ms)
+                {
+                    _mqtt_bench_drain(esp8266at, &bench, due_ms - now_ms);
+                }
+            }
+
+            _mqtt_bench_fill((char *) _mqtt_msg_buf, sent, bench.size);
+
+            // Alternate the string and raw publish paths (WizFi360 has the string path only).
+            if (ESP8266AT_IS_WIZFI360(esp8266at) || (sent % 2) == 0)
+            {
+                st = esp8266at_cmd_at_mqttpub(esp8266at, topic, (char *) _mqtt_msg_buf, qos, 0, _timeoutms, NULL);
+            }
+            else
+            {
+                st = esp8266at_cmd_at_mqttpubraw(esp8266at, topic, (char *) _mqtt_msg_buf, bench.size, qos, 0, _timeoutms, NULL);
+            }
+            if (st != UBI_ST_OK)
+            {
+                pub_fail++;
+            }
+
+            _mqtt_bench_drain(esp8266at, &bench, ESP8266AT_MQTT_BENCH_POLL_TIMEOUT_MS);
+        }
+
+        send_ms = max(ubik_ticktotimems(ubik_gettickcount().low - begin_tick), 1);
+
+        if (bench.received < bench.count - pub_fail)
+        {
+            _mqtt_bench_drain(esp8266at, &bench, ESP8266AT_MQTT_BENCH_DRAIN_TIMEOUT_MS);
+        }
+
+        elapsed_ms = max(ubik_ticktotimems(ubik_gettickcount().low - begin_tick), 1);
+
+        if (ESP8266AT_IS_WIZFI360(esp8266at))
+        {
+            esp8266at_mqtt_pub_topic_swap(esp8266at, saved_pub_topic, NULL, _timeoutms, NULL);
+        }
+        esp8266at_cmd_at_mqttunsub(esp8266at, ESP8266AT_MQTT_BENCH_SUB_ID, _timeoutms, NULL);
+        esp8266at_stat_get(esp8266at, &stat);
+
+        printf("bench     : mqtt, %lu msgs of %lu bytes, qos %lu, target rate %lu msgs/s, %lu ms\n", bench.count, bench.size, qos,
+            rate, elapsed_ms);
+        printf("publish   : %lu.%02lu msgs/s, failed %lu\n", (uint32_t) (((uint64_t) sent * 1000) / send_ms),
+            (uint32_t) ((((uint64_t) sent * 100000) / send_ms) % 100), pub_fail);
+        printf("received  : %lu (lost %lu, duplicate %lu, out of order %lu, corrupt %lu)\n", bench.received,
+            bench.count - bench.received, bench.duplicate, bench.out_of_order, bench.corrupt);
+        if (bench.received > 0)
+        {
+            printf("rtt       : min %lu, avg %lu, max %lu ms\n", bench.rtt_min_ms, bench.rtt_sum_ms / bench.received, bench.rtt_max_ms);
+        }
+        _bench_print_samples("rtt", _bench_samples, bench.sample_count);
+        printf("sub buf   : %lu frames discarded, %lu bytes dropped, high water %lu / %d bytes\n", stat.mqtt_discard_count,
+            stat.drop_count[ESP8266AT_STAT_BUF_MQTT], stat.high_water[ESP8266AT_STAT_BUF_MQTT], ESP8266AT_IO_MQTT_SUB_DATA_BUF_SIZE);
+
+        break;
+    } while (1);
 
     return r;
 }
 
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+
+int esp8266at_cli_at_sv(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = -1;
+    ubi_st_t st;
+    char *cmd = NULL;
+    int cmdlen = 0;
+
+    do
+    {
+        cmd = "start";
+        cmdlen = strlen(cmd);
+        if (len >= cmdlen && strncmp(str, cmd, cmdlen) == 0)
+        {
+            st = esp8266at_supervisor_start(esp8266at);
+            printf("result : status = %d\n", st);
+            r = 0;
+            break;
+        }
+
+        cmd = "stop";
+        cmdlen = strlen(cmd);
+        if (len >= cmdlen && strncmp(str, cmd, cmdlen) == 0)
+        {
+            st = esp8266at_supervisor_stop(esp8266at);
+            printf("result : status = %d\n", st);
+            r = 0;
+            break;
+        }
+
+        cmd = "stat";
+        cmdlen = strlen(cmd);
+        if (len >= cmdlen && strncmp(str, cmd, cmdlen) == 0)
+        {
+            r = esp8266at_cli_at_sv_stat(esp8266at, &str[cmdlen], len - cmdlen, arg);
+            break;
+        }
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+int esp8266at_cli_at_sv_stat(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = 0;
+    esp8266at_supervisor_stat_t stat;
+
+    if (len >= 6 && strncmp(str, " reset", 6) == 0)
+    {
+        esp8266at_supervisor_stat_reset(esp8266at);
+        printf("result : status = %d\n", UBI_ST_OK);
+        return r;
+    }
+
+    esp8266at_supervisor_stat_get(esp8266at, &stat);
+
+    printf("state     : enable %d, wifi %d/%d, tcp %d/%d", esp8266at->supervisor_enable,
+        esp8266at->wifi_connected, esp8266at->wifi_requested, esp8266at->tcp_connected, esp8266at->tcp_requested);
+#if (ESP8266AT__ENABLE_MQTT == 1)
+    printf(", mqtt %d/%d", esp8266at->mqtt_connected, esp8266at->mqtt_requested);
+#endif /* (ESP8266AT__ENABLE_MQTT == 1) */
+    printf(" (connected/requested)\n");
+    printf("probe     : %lu (failed %lu), interval %lu ms\n", stat.probe_count, stat.probe_fail_count,
+        esp8266at->supervisor_probe_interval_ms);
+    printf("attempts  : reconnect %lu, rejoin %lu, soft reset %lu, hard reset %lu\n",
+        stat.attempt_count[ESP8266AT_RECOVERY_RECONNECT], stat.attempt_count[ESP8266AT_RECOVERY_REJOIN],
+        stat.attempt_count[ESP8266AT_RECOVERY_SOFT_RESET], stat.attempt_count[ESP8266AT_RECOVERY_HARD_RESET]);
+    printf("outages   : %lu (recovered %lu)\n", stat.outage_count, stat.recovered_count);
+    if (stat.recovered_count > 0)
+    {
+        printf("recovery  : last %lu, mean %lu, max %lu ms\n", stat.recovery_time_last_ms,
+            stat.recovery_time_sum_ms / stat.recovered_count, stat.recovery_time_max_ms);
+    }
+
+    return r;
+}
+
+int esp8266at_cli_at_pwr(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = -1;
+    ubi_st_t st;
+    char *cmd = NULL;
+    int cmdlen = 0;
+    uint32_t value;
+
+    do
+    {
+        cmd = "sleep ";
+        cmdlen = strlen(cmd);
+        if (len >= cmdlen && strncmp(str, cmd, cmdlen) == 0)
+        {
+            sscanf(&str[cmdlen], "%lu", &value);
+            st = esp8266at_cmd_at_sleep(esp8266at, value, _timeoutms, NULL);
+            printf("result : status = %d\n", st);
+            r = 0;
+            break;
+        }
+
+        cmd = "gslp ";
+        cmdlen = strlen(cmd);
+        if (len >= cmdlen && strncmp(str, cmd, cmdlen) == 0)
+        {
+            sscanf(&str[cmdlen], "%lu", &value);
+            st = esp8266at_cmd_at_gslp(esp8266at, value, _timeoutms, NULL);
+            printf("result : status = %d\n", st);
+            r = 0;
+            break;
+        }
+
+        cmd = "wake";
+        cmdlen = strlen(cmd);
+        if (len >= cmdlen && strncmp(str, cmd, cmdlen) == 0)
+        {
+            st = esp8266at_power_wakeup(esp8266at, _timeoutms, NULL);
+            printf("result : status = %d\n", st);
+            r = 0;
+            break;
+        }
+
+        cmd = "stat";
+        cmdlen = strlen(cmd);
+        if (len >= cmdlen && strncmp(str, cmd, cmdlen) == 0)
+        {
+            r = esp8266at_cli_at_pwr_stat(esp8266at, &str[cmdlen], len - cmdlen, arg);
+            break;
+        }
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+int esp8266at_cli_at_pwr_stat(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = 0;
+    esp8266at_power_stat_t stat;
+    const char *state_name[ESP8266AT_POWER_STATE_MAX] = {"active", "modem sleep", "light sleep", "deep sleep"};
+    uint32_t total_ms = 0;
+
+    if (len >= 6 && strncmp(str, " reset", 6) == 0)
+    {
+        esp8266at_power_stat_reset(esp8266at);
+        printf("result : status = %d\n", UBI_ST_OK);
+        return r;
+    }
+
+    esp8266at_power_stat_get(esp8266at, &stat);
+    for (int i = 0; i < ESP8266AT_POWER_STATE_MAX; i++)
+    {
+        total_ms += stat.state_ms[i];
+    }
+    total_ms = max(total_ms, 1);
+
+    printf("state     : %s\n", state_name[esp8266at->power_state]);
+    for (int i = 0; i < ESP8266AT_POWER_STATE_MAX; i++)
+    {
+        printf("    %-11s : %lu ms (%lu%%)\n", state_name[i], stat.state_ms[i],
+            (uint32_t) (((uint64_t) stat.state_ms[i] * 100) / total_ms));
+    }
+    printf("wakeup    : %lu (failed %lu)\n", stat.wakeup_count, stat.wakeup_fail_count);
+
+    return r;
+}
+
+int esp8266at_cli_at_ssl(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = -1;
+    ubi_st_t st;
+    char *cmd = NULL;
+    int cmdlen = 0;
+    uint32_t value;
+    uint32_t pki_number;
+    uint32_t ca_number;
+    uint32_t port;
+    char host[ESP8266AT_HOST_LENGTH_MAX + 1];
+
+    do
+    {
+        cmd = "size ";
+        cmdlen = strlen(cmd);
+        if (len >= cmdlen && strncmp(str, cmd, cmdlen) == 0)
+        {
+            sscanf(&str[cmdlen], "%lu", &value);
+            st = esp8266at_cmd_at_cipsslsize(esp8266at, value, _timeoutms, NULL);
+            printf("result : status = %d\n", st);
+            r = 0;
+            break;
+        }
+
+        cmd = "conf ";
+        cmdlen = strlen(cmd);
+        if (len >= cmdlen && strncmp(str, cmd, cmdlen) == 0)
+        {
+            value = 0;
+            pki_number = 0;
+            ca_number = 0;
+            sscanf(&str[cmdlen], "%lu %lu %lu", &value, &pki_number, &ca_number);
+            st = esp8266at_cmd_at_cipsslcconf(esp8266at, value, pki_number, ca_number, _timeoutms, NULL);
+            printf("result : status = %d\n", st);
+            r = 0;
+            break;
+        }
+
+        cmd = "sni ";
+        cmdlen = strlen(cmd);
+        if (len >= cmdlen && strncmp(str, cmd, cmdlen) == 0)
+        {
+            memset(host, 0, sizeof(host));
+            sscanf(&str[cmdlen], "%128s", host);
+            st = esp8266at_cmd_at_cipsslcsni(esp8266at, host, _timeoutms, NULL);
+            printf("result : status = %d\n", st);
+            r = 0;
+            break;
+        }
+
+        cmd = "open ";
+        cmdlen = strlen(cmd);
+        if (len >= cmdlen && strncmp(str, cmd, cmdlen) == 0)
+        {
+            memset(host, 0, sizeof(host));
+            port = 443;
+            sscanf(&str[cmdlen], "%128s %lu", host, &port);
+            st = esp8266at_ssl_connect(esp8266at, host, port, _timeoutms, NULL);
+            printf("result : status = %d, time = %lu ms\n", st, esp8266at->ssl_connect_last_ms);
+            r = 0;
+            break;
+        }
+
+        cmd = "stat";
+        cmdlen = strlen(cmd);
+        if (len >= cmdlen && strncmp(str, cmd, cmdlen) == 0)
+        {
+            printf("buffer size : %d (0 : default)\n", esp8266at->ssl_buf_size);
+            printf("auth mode   : %d, pki = %d, ca = %d\n", esp8266at->ssl_auth_mode, esp8266at->ssl_pki_number, esp8266at->ssl_ca_number);
+            printf("sni         : %s\n", esp8266at->ssl_sni);
+            printf("connect     : count = %lu, last = %lu ms, max = %lu ms\n", esp8266at->ssl_connect_count,
+                    esp8266at->ssl_connect_last_ms, esp8266at->ssl_connect_max_ms);
+            r = 0;
+            break;
+        }
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+int esp8266at_cli_at_stats(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = 0;
+    esp8266at_stat_t stat;
+    esp8266at_cmd_stat_t *cmd_stat;
+    const char *buf_name[ESP8266AT_STAT_BUF_MAX] = {"read", "data", "mqtt", "write"};
+    const uint32_t buf_size[ESP8266AT_STAT_BUF_MAX] = {ESP8266AT_IO_READ_BUF_SIZE, ESP8266AT_IO_DATA_BUF_SIZE,
+        ESP8266AT_IO_MQTT_SUB_DATA_BUF_SIZE, ESP8266AT_IO_WRITE_BUF_SIZE};
+    const char *cmd_name[ESP8266AT_STAT_CMD_MAX] = {"basic", "wifi", "ip", "send", "mqtt"};
+    const char *bin_name[ESP8266AT_STAT_LATENCY_BIN_MAX] = {"<10", "<20", "<50", "<100", "<200", "<500", "<1000", "<5000", ">=5000"};
+    const char *rx_mode_name[ESP8266AT_IO_RX_MODE_MAX] = {"resp", "data len", "data", "mqtt topic"};
+    uint32_t latency_count;
+    uint32_t cycles_avg;
+
+    if (len >= 6 && strncmp(str, " reset", 6) == 0)
+    {
+        esp8266at_stat_reset(esp8266at);
+        printf("result : status = %d\n", UBI_ST_OK);
+        return r;
+    }
+
+    esp8266at_stat_get(esp8266at, &stat);
+
+    printf("elapsed   : %lu ms\n", stat.elapsed_ms);
+    printf("uart rx   : %lu bytes, %lu interrupts\n", stat.rx_byte_count, stat.rx_irq_count);
+    printf("uart tx   : %lu bytes, %lu interrupts\n", stat.tx_byte_count, stat.tx_irq_count);
+    printf("+IPD      : %lu frames, %lu bytes\n", stat.ipd_frame_count, stat.ipd_byte_count);
+    printf("mqtt sub  : %lu frames, %lu bytes, %lu discarded\n", stat.mqtt_frame_count, stat.mqtt_byte_count,
+        stat.mqtt_discard_count);
+    printf("rx overflow : %lu, desync %lu, uart errors %lu\n", esp8266at->rx_overflow_count, stat.rx_desync_count, stat.uart_error_count);
+    for (int i = 0; i < ESP8266AT_STAT_BUF_MAX; i++)
+    {
+        printf("    %-5s buf : dropped %lu bytes, high water %lu / %lu bytes\n", buf_name[i], stat.drop_count[i],
+            stat.high_water[i], buf_size[i]);
+    }
+    for (int i = 0; i < ESP8266AT_STAT_CMD_MAX; i++)
+    {
+        cmd_stat = &stat.cmd[i];
+        if (cmd_stat->count == 0)
+        {
+            continue;
+        }
+
+        printf("%-5s cmd : %lu (ok %lu, error %lu, fail %lu, timeout %lu, other %lu)\n", cmd_name[i], cmd_stat->count,
+            cmd_stat->ok_count, cmd_stat->error_count, cmd_stat->fail_count, cmd_stat->timeout_count, cmd_stat->other_count);
+
+        latency_count = cmd_stat->ok_count + cmd_stat->error_count + cmd_stat->fail_count;
+        if (latency_count == 0)
+        {
+            continue;
+        }
+
+        printf("    latency : avg %lu, max %lu ms\n", cmd_stat->latency_sum_ms / latency_count, cmd_stat->latency_max_ms);
+        printf("   ");
+        for (int j = 0; j < ESP8266AT_STAT_LATENCY_BIN_MAX; j++)
+        {
+            printf(" %s:%lu", bin_name[j], cmd_stat->latency_hist[j]);
+        }
+        printf("\n");
+    }
+    if (stat.isr_cycles_per_us > 0)
+    {
+        printf("rx isr    : re-entry %lu, %lu cycles/us\n", stat.isr_reentry_count, stat.isr_cycles_per_us);
+        for (int i = 0; i < ESP8266AT_IO_RX_MODE_MAX; i++)
+        {
+            if (stat.isr[i].count == 0)
+            {
+                continue;
+            }
+
+            cycles_avg = (uint32_t) (stat.isr[i].cycles_sum / stat.isr[i].count);
+            printf("    %-10s : %lu calls, min %lu, avg %lu, max %lu cycles (max %lu.%02lu us)\n", rx_mode_name[i], stat.isr[i].count,
+                stat.isr[i].cycles_min, cycles_avg, stat.isr[i].cycles_max, stat.isr[i].cycles_max / stat.isr_cycles_per_us,
+                ((stat.isr[i].cycles_max % stat.isr_cycles_per_us) * 100) / stat.isr_cycles_per_us);
+        }
+    }
+
+    return r;
+}
+
+#if (ESP8266AT__ENABLE_TRACE == 1)
+
+int esp8266at_cli_at_trace(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = 0;
+    uint8_t enable;
+    uint32_t length;
+    uint32_t drop_count;
+    uint8_t line[32];
+    uint32_t read;
+
+    if (len >= 3 && strncmp(str, " on", 3) == 0)
+    {
+        esp8266at_trace_config(esp8266at, 1);
+    }
+    else if (len >= 4 && strncmp(str, " off", 4) == 0)
+    {
+        esp8266at_trace_config(esp8266at, 0);
+    }
+    else if (len >= 6 && strncmp(str, " clear", 6) == 0)
+    {
+        esp8266at_trace_clear(esp8266at);
+    }
+    else if (len >= 5 && strncmp(str, " dump", 5) == 0)
+    {
+        // Paused, so the records do not move while they are printed.
+        esp8266at_trace_info(esp8266at, &enable, &length, &drop_count);
+        esp8266at_trace_config(esp8266at, 0);
+
+        // resource/esp8266at/trace_replay.py takes the lines between "trace begin" and "trace end".
+        printf("trace begin : version %d, %lu bytes, %lu dropped records\n", ESP8266AT_TRACE_VERSION, length, drop_count);
+        for (uint32_t offset = 0; offset < length; offset += read)
+        {
+            esp8266at_trace_read(esp8266at, offset, line, sizeof(line), &read);
+            if (read == 0)
+            {
+                break;
+            }
+            for (uint32_t i = 0; i < read; i++)
+            {
+                printf("%02x", line[i]);
+            }
+            printf("\n");
+        }
+        printf("trace end\n");
+
+        esp8266at_trace_config(esp8266at, enable);
+        return r;
+    }
+
+    esp8266at_trace_info(esp8266at, &enable, &length, &drop_count);
+    printf("trace : %s, %lu / %d bytes, %lu dropped records\n", enable ? "on" : "off", length, ESP8266AT_TRACE_BUF_SIZE, drop_count);
+
+    return r;
+}
+
+#endif /* (ESP8266AT__ENABLE_TRACE == 1) */
+
+static void _bench_fill(uint8_t *buf, uint32_t offset, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        buf[i] = (uint8_t) ((offset + i) % ESP8266AT_BENCH_PATTERN_MOD);
+    }
+}
+
+static uint32_t _bench_check(uint8_t *buf, uint32_t offset, uint32_t length)
+{
+    uint32_t mismatch = 0;
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        if (buf[i] != (uint8_t) ((offset + i) % ESP8266AT_BENCH_PATTERN_MOD))
+        {
+            mismatch++;
+        }
+    }
+
+    return mismatch;
+}
+
+static void _bench_sample(uint32_t *samples, uint32_t *count, uint32_t value)
+{
+    // Keep the latest samples once the table is full.
+    samples[*count % ESP8266AT_BENCH_SAMPLE_MAX] = value;
+    (*count)++;
+}
+
+static void _bench_print_samples(char *name, uint32_t *samples, uint32_t count)
+{
+    uint32_t value;
+    uint32_t j;
+
+    count = min(count, ESP8266AT_BENCH_SAMPLE_MAX);
+    if (count == 0)
+    {
+        return;
+    }
+
+    for (uint32_t i = 1; i < count; i++)
+    {
+        value = samples[i];
+        for (j = i; j > 0 && samples[j - 1] > value; j--)
+        {
+            samples[j] = samples[j - 1];
+        }
+        samples[j] = value;
+    }
+
+    printf("%-9s : %lu samples, min %lu, p50 %lu, p90 %lu, p99 %lu, max %lu ms\n", name, count, samples[0],
+        samples[(count * 50) / 100], samples[(count * 90) / 100], samples[(count * 99) / 100], samples[count - 1]);
+}
+
+static ubi_st_t _bench_open(esp8266at_t *esp8266at, char *ip, uint32_t port, char *header)
+{
+    ubi_st_t st;
+
+    do
+    {
+        st = esp8266at_cmd_at_cipstart(esp8266at, "TCP", ip, port, _timeoutms * 3, NULL);
+        if (st != UBI_ST_OK)
+        {
+            break;
+        }
+
+        // The peer (resource/esp8266at/bench_server.py) reads the header line to pick its role.
+        st = esp8266at_cmd_at_cipsend(esp8266at, (uint8_t *) header, strlen(header), _timeoutms, NULL);
+        if (st != UBI_ST_OK)
+        {
+            esp8266at_cmd_at_cipclose(esp8266at, _timeoutms, NULL);
+            break;
+        }
+
+        break;
+    } while (1);
+
+    return st;
+}
+
+int esp8266at_cli_at_bench(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = -1;
+    ubi_st_t st;
+    char *cmd = NULL;
+    int cmdlen = 0;
+    char mode[8];
+    char ip[128];
+    uint32_t port = 0;
+    uint32_t bytes = 0;
+    uint32_t chunk = 0;
+    uint32_t done = 0;
+    uint32_t length;
+    uint32_t read;
+    uint32_t mismatch = 0;
+    uint32_t sample_count = 0;
+    uint32_t begin_tick;
+    uint32_t send_tick;
+    uint32_t elapsed_ms;
+    uint32_t rx_overflow_count;
+    uint32_t kbps_x100;
+    esp8266at_stat_t stat;
+
+    do
+    {
+        cmd = "pecho ";
+        cmdlen = strlen(cmd);
+        if (len >= cmdlen && strncmp(str, cmd, cmdlen) == 0)
+        {
+            r = esp8266at_cli_at_bench_pecho(esp8266at, &str[cmdlen], len - cmdlen, arg);
+            break;
+        }
+
+        if (sscanf(str, "%7s %127s %lu %lu %lu", mode, ip, &port, &bytes, &chunk) != 5 ||
+                (strcmp(mode, "tx") != 0 && strcmp(mode, "rx") != 0 && strcmp(mode, "echo") != 0))
+        {
+            break;
+        }
+        if (bytes == 0 || chunk == 0 || chunk > ESP8266AT_RECV_BUFFER_SIZE)
+        {
+            printf("chunk must be 1 to %d bytes\n", ESP8266AT_RECV_BUFFER_SIZE);
+            r = 0;
+            break;
+        }
+        r = 0;
+        // A received chunk waits in io_data_buf until it is read.
+        if (mode[0] != 't' && chunk > ESP8266AT_IO_DATA_BUF_SIZE)
+        {
+            chunk = ESP8266AT_IO_DATA_BUF_SIZE;
+            printf("chunk     : limited to %lu by the %d byte data buffer\n", chunk, ESP8266AT_IO_DATA_BUF_SIZE);
+        }
+
+        sprintf((char *) _send_buf, "%s %lu %lu\n", mode, bytes, chunk);
+        st = _bench_open(esp8266at, ip, port, (char *) _send_buf);
+        if (st != UBI_ST_OK)
+        {
+            printf("result : status = %d\n", st);
+            break;
+        }
+
+        esp8266at_stat_reset(esp8266at);
+        rx_overflow_count = esp8266at->rx_overflow_count;
+        begin_tick = ubik_gettickcount().low;
+
+        while (done < bytes)
+        {
+            length = min(chunk, bytes - done);
+
+            if (mode[0] != 'r')
+            {
+                _bench_fill(_send_buf, done, length);
+                send_tick = ubik_gettickcount().low;
+                st = esp8266at_cmd_at_cipsend(esp8266at, _send_buf, length, _timeoutms, NULL);
+                if (st != UBI_ST_OK)
+                {
+                    break;
+                }
+                _bench_sample(_bench_samples, &sample_count, ubik_ticktotimems(ubik_gettickcount().low - send_tick));
+            }
+
+            if (mode[0] != 't')
+            {
+                st = esp8266at_cmd_at_ciprecv(esp8266at, _recv_buf, length, &read, _timeoutms, NULL);
+                if (st != UBI_ST_OK)
+                {
+                    break;
+                }
+                mismatch += _bench_check(_recv_buf, done, read);
+            }
+
+            done += length;
+        }
+
+        elapsed_ms = max(ubik_ticktotimems(ubik_gettickcount().low - begin_tick), 1);
+
+        esp8266at_cmd_at_cipclose(esp8266at, _timeoutms, NULL);
+        esp8266at_stat_get(esp8266at, &stat);
+
+        kbps_x100 = (uint32_t) (((uint64_t) done * 100000) / 1024 / elapsed_ms);
+
+        printf("result    : status = %d\n", st);
+        printf("bench     : %s, %lu / %lu bytes, chunk %lu bytes, %lu ms\n", mode, done, bytes, chunk, elapsed_ms);
+        printf("rate      : %lu.%02lu KB/s\n", kbps_x100 / 100, kbps_x100 % 100);
+        if (mode[0] != 't')
+        {
+            printf("verify    : %lu mismatched bytes\n", mismatch);
+        }
+        _bench_print_samples("cipsend", _bench_samples, sample_count);
+        printf("uart      : rx %lu bytes, tx %lu bytes\n", stat.rx_byte_count, stat.tx_byte_count);
+        printf("drops     : rx overflow %lu, read %lu, data %lu, write %lu bytes\n",
+            esp8266at->rx_overflow_count - rx_overflow_count, stat.drop_count[ESP8266AT_STAT_BUF_READ],
+            stat.drop_count[ESP8266AT_STAT_BUF_DATA], stat.drop_count[ESP8266AT_STAT_BUF_WRITE]);
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+int esp8266at_cli_at_bench_pecho(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r = -1;
+    ubi_st_t st;
+    char ip[128];
+    char seq_str[ESP8266AT_BENCH_SEQ_LEN + 1];
+    uint32_t port = 0;
+    uint32_t count = 0;
+    uint32_t size = 0;
+    uint32_t window = 0;
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    uint32_t read;
+    uint32_t mismatch = 0;
+    uint32_t sample_count = 0;
+    uint32_t rtt_ms;
+    uint32_t rtt_min_ms = UINT32_MAX;
+    uint32_t rtt_max_ms = 0;
+    uint32_t rtt_sum_ms = 0;
+    uint32_t begin_tick;
+    uint32_t elapsed_ms;
+    esp8266at_stat_t stat;
+
+    do
+    {
+        if (sscanf(str, "%127s %lu %lu %lu %lu", ip, &port, &count, &size, &window) != 5)
+        {
+            break;
+        }
+        r = 0;
+
+        if (count == 0 || size < ESP8266AT_BENCH_SEQ_LEN || size > ESP8266AT_RECV_BUFFER_SIZE || window == 0 || window > ESP8266AT_BENCH_WINDOW_MAX)
+        {
+            printf("size must be %d to %d bytes, window 1 to %d\n", ESP8266AT_BENCH_SEQ_LEN, ESP8266AT_RECV_BUFFER_SIZE, ESP8266AT_BENCH_WINDOW_MAX);
+            break;
+        }
+        // Echoes of the outstanding messages wait in io_data_buf until they are read.
+        if (window * size > ESP8266AT_IO_DATA_BUF_SIZE)
+        {
+            window = max(ESP8266AT_IO_DATA_BUF_SIZE / size, 1);
+            printf("window    : limited to %lu by the %d byte data buffer\n", window, ESP8266AT_IO_DATA_BUF_SIZE);
+        }
+
+        sprintf((char *) _send_buf, "pecho %lu %lu\n", count * size, size);
+        st = _bench_open(esp8266at, ip, port, (char *) _send_buf);
+        if (st != UBI_ST_OK)
+        {
+            printf("result : status = %d\n", st);
+            break;
+        }
+
+        esp8266at_stat_reset(esp8266at);
+        begin_tick = ubik_gettickcount().low;
+
+        while (received < count)
+        {
+            while (sent < count && sent - received < window)
+            {
+                _bench_fill(_send_buf, sent * size, size);
+                sprintf(seq_str, "%08lx", sent);
+                memcpy(_send_buf, seq_str, ESP8266AT_BENCH_SEQ_LEN);
+
+                _bench_send_ticks[sent % ESP8266AT_BENCH_WINDOW_MAX] = ubik_gettickcount().low;
+                st = esp8266at_cmd_at_cipsend(esp8266at, _send_buf, size, _timeoutms, NULL);
+                if (st != UBI_ST_OK)
+                {
+                    break;
+                }
+                sent++;
+            }
+            if (st != UBI_ST_OK)
+            {
+                break;
+            }
+
+            st = esp8266at_cmd_at_ciprecv(esp8266at, _recv_buf, size, &read, _timeoutms, NULL);
+            if (st != UBI_ST_OK)
+            {
+                break;
+            }
+            rtt_ms = ubik_ticktotimems(ubik_gettickcount().low - _bench_send_ticks[received % ESP8266AT_BENCH_WINDOW_MAX]);
+
+            sprintf(seq_str, "%08lx", received);
+            if (memcmp(_recv_buf, seq_str, ESP8266AT_BENCH_SEQ_LEN) != 0 ||
+                    _bench_check(&_recv_buf[ESP8266AT_BENCH_SEQ_LEN], received * size + ESP8266AT_BENCH_SEQ_LEN, size - ESP8266AT_BENCH_SEQ_LEN) != 0)
+            {
+                mismatch++;
+            }
+
+            rtt_min_ms = min(rtt_min_ms, rtt_ms);
+            rtt_max_ms = max(rtt_max_ms, rtt_ms);
+            rtt_sum_ms += rtt_ms;
+            _bench_sample(_bench_samples, &sample_count, rtt_ms);
+            received++;
+        }
+
+        elapsed_ms = max(ubik_ticktotimems(ubik_gettickcount().low - begin_tick), 1);
+
+        esp8266at_cmd_at_cipclose(esp8266at, _timeoutms, NULL);
+        esp8266at_stat_get(esp8266at, &stat);
+
+        printf("result    : status = %d\n", st);
+        printf("bench     : pecho, %lu / %lu msgs of %lu bytes, window %lu, %lu ms\n", received, count, size, window, elapsed_ms);
+        printf("rate      : %lu.%02lu msgs/s\n", (uint32_t) (((uint64_t) received * 1000) / elapsed_ms),
+            (uint32_t) ((((uint64_t) received * 100000) / elapsed_ms) % 100));
+        printf("verify    : %lu mismatched msgs\n", mismatch);
+        if (received > 0)
+        {
+            printf("rtt       : min %lu, avg %lu, max %lu ms\n", rtt_min_ms, rtt_sum_ms / received, rtt_max_ms);
+        }
+        _bench_print_samples("rtt", _bench_samples, sample_count);
+        printf("drops     : data %lu bytes\n", stat.drop_count[ESP8266AT_STAT_BUF_DATA]);
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+#if (ESP8266AT__ENABLE_SNTP == 1)
+
+int esp8266at_cli_rdate(esp8266at_t *esp8266at, char *str, int len, void *arg)
+{
+    int r;
+    ubi_st_t st;
+
+    struct timeval tv;
+    struct tm tm_data;
+
+    r = -1;
+    do
+    {
+        st = esp8266at_cmd_at_cipsntptime(esp8266at, &tm_data, _timeoutms, NULL);
+        if (st != UBI_ST_OK)
+        {
+            break;
+        }
+
+        if (tm_data.tm_year <= 70)
+        {
+            st = UBI_ST_ERR;
+            break;
+        }
+
+        tv.tv_sec = mktime(&tm_data);
+        tv.tv_usec = 0;
+        settimeofday(&tv, NULL);
+
+        r = 0;
+        break;
+    } while(1);
+
+    printf("result : status = %d\n", st);
+
+    return r;
+}
+
+#endif /* (ESP8266AT__ENABLE_SNTP == 1) */
+
 int esp8266at_cli_echo_client(esp8266at_t *esp8266at, char *str, int len, void *arg)
 {
     int r = -1;
@@ -1225,5 +2708,5 @@ int esp8266at_cli_echo_client(esp8266at_t *esp8266at, char *str, int len, void *
     return r;
 }
 
-#endif /* (INCLUDE__ESP8266AT == 1) */
+#endif /* (INCLUDE__ESP8266AT == 1) && (ESP8266AT__ENABLE_CLI == 1) */
 